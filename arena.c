@@ -0,0 +1,124 @@
+#include "arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_DEFAULT_CHUNK_SIZE (1024 * 1024)
+
+/*!
+ * @brief arena_init initializes an empty arena
+ * An arena hands out memory from large chunks and frees it all at once with arena_release, which removes
+ * the per-allocation malloc overhead for the many small objects of a files list.
+ * @param arena is a pointer to the arena to initialize
+ * @param chunk_size is the size of the chunks, 0 for the default (1 MiB)
+ */
+void arena_init(arena_t *arena, size_t chunk_size) {
+    if (!arena) {
+        return;
+    }
+    arena->chunks = NULL;
+    arena->chunk_size = chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK_SIZE;
+    arena->allocated = 0;
+}
+
+/*!
+ * @brief arena_alloc allocates memory from an arena
+ * @param arena is a pointer to the arena
+ * @param size is the number of bytes to allocate
+ * @param alignment is the required alignment, must be a power of 2
+ * @return a pointer to the allocated memory, NULL if out of memory. It remains valid until arena_release.
+ */
+void *arena_alloc(arena_t *arena, size_t size, size_t alignment) {
+    if (!arena) {
+        return NULL;
+    }
+
+    arena_chunk_t *chunk = arena->chunks;
+    if (chunk != NULL) {
+        size_t offset = ((uintptr_t) (chunk->data + chunk->used) + alignment - 1) & ~(uintptr_t) (alignment - 1);
+        offset -= (uintptr_t) chunk->data;
+        if (offset + size <= chunk->capacity) {
+            chunk->used = offset + size;
+            arena->allocated += size;
+            return chunk->data + offset;
+        }
+    }
+
+    // Current chunk is full: start a new one, big enough for oversized requests
+    size_t capacity = (size + alignment > arena->chunk_size) ? size + alignment : arena->chunk_size;
+    chunk = malloc(sizeof(arena_chunk_t) + capacity);
+    if (!chunk) {
+        return NULL;
+    }
+    chunk->capacity = capacity;
+    chunk->used = 0;
+    if (arena->chunks != NULL && capacity > arena->chunk_size) {
+        // Keep filling the current chunk, the oversized one is full already
+        chunk->next = arena->chunks->next;
+        arena->chunks->next = chunk;
+    } else {
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+    size_t offset = (((uintptr_t) chunk->data + alignment - 1) & ~(uintptr_t) (alignment - 1)) - (uintptr_t) chunk->data;
+    chunk->used = offset + size;
+    arena->allocated += size;
+    return chunk->data + offset;
+}
+
+/*!
+ * @brief arena_strndup copies a string into an arena
+ * @param arena is a pointer to the arena
+ * @param string is the string to copy
+ * @param length is the number of chars to copy (a '\0' is appended)
+ * @return a pointer to the copy, NULL if out of memory
+ */
+char *arena_strndup(arena_t *arena, const char *string, size_t length) {
+    char *copy = arena_alloc(arena, length + 1, 1);
+    if (copy != NULL) {
+        memcpy(copy, string, length);
+        copy[length] = '\0';
+    }
+    return copy;
+}
+
+/*!
+ * @brief arena_adopt moves all the chunks of an arena to another one, e.g. to hand the entries built by a
+ * worker over to the list that will own them. Pointers into the adopted chunks remain valid.
+ * @param arena is a pointer to the arena taking the chunks, its current chunk stays the current one
+ * @param other is a pointer to the arena giving its chunks, it is left empty and can be reused
+ */
+void arena_adopt(arena_t *arena, arena_t *other) {
+    if (!arena || !other || !other->chunks) {
+        return;
+    }
+    arena_chunk_t *last = other->chunks;
+    while (last->next != NULL) {
+        last = last->next;
+    }
+    if (arena->chunks != NULL) {
+        last->next = arena->chunks->next;
+        arena->chunks->next = other->chunks;
+    } else {
+        arena->chunks = other->chunks;
+    }
+    arena->allocated += other->allocated;
+    other->chunks = NULL;
+    other->allocated = 0;
+}
+
+/*!
+ * @brief arena_release frees all the memory of an arena at once
+ * @param arena is a pointer to the arena, it is left empty and can be reused
+ */
+void arena_release(arena_t *arena) {
+    if (!arena) {
+        return;
+    }
+    while (arena->chunks != NULL) {
+        arena_chunk_t *tmp = arena->chunks;
+        arena->chunks = tmp->next;
+        free(tmp);
+    }
+    arena->allocated = 0;
+}
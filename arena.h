@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stddef.h>
+
+typedef struct _arena_chunk {
+    struct _arena_chunk *next;
+    size_t capacity;
+    size_t used;
+    char data[];
+} arena_chunk_t;
+
+typedef struct {
+    arena_chunk_t *chunks; // Current chunk first
+    size_t chunk_size; // Default capacity of new chunks
+    size_t allocated; // Total bytes handed out, for statistics
+} arena_t;
+
+void arena_init(arena_t *arena, size_t chunk_size);
+void *arena_alloc(arena_t *arena, size_t size, size_t alignment);
+char *arena_strndup(arena_t *arena, const char *string, size_t length);
+void arena_adopt(arena_t *arena, arena_t *other);
+void arena_release(arena_t *arena);
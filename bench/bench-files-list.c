@@ -0,0 +1,187 @@
+#include "files-list.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Microbenchmark of the files list: builds lists of N synthetic paths (added in a shuffled order, as
+ * readdir gives them), sorts them and looks every path up.
+ * Usage: bench_files_list [--baseline] [N...] (default N: 100000)
+ * --baseline also times the former sorted insertion (linear search of the insertion point for each entry)
+ * on the same paths, it is quadratic so keep N under a few 10^5.
+ */
+
+#define BENCH_ROOT "/bench/root/"
+
+/*!
+ * @brief now_seconds returns a monotonic timestamp
+ * @return the current time in seconds
+ */
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*!
+ * @brief next_random is a deterministic pseudo random generator (xorshift64), so that runs are comparable
+ * @param state the generator state
+ * @return the next pseudo random value
+ */
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/*!
+ * @brief make_paths builds count paths laid out as a tree (100 entries per directory) in a shuffled order
+ * @param count the number of paths
+ * @return an array of count strings, to be freed by the caller
+ */
+static char **make_paths(size_t count) {
+    char **paths = malloc(count * sizeof(char *));
+    if (!paths) {
+        return NULL;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        char buffer[256];
+        snprintf(buffer, sizeof(buffer), BENCH_ROOT "dir_%zu/sub_%zu/file_%zu.dat", i / 10000, (i / 100) % 100, i);
+        paths[i] = strdup(buffer);
+    }
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = count - 1; i > 0; --i) {
+        size_t j = next_random(&state) % (i + 1);
+        char *tmp = paths[i];
+        paths[i] = paths[j];
+        paths[j] = tmp;
+    }
+    return paths;
+}
+
+typedef struct _baseline_entry {
+    char path_and_name[4096];
+    struct timespec mtime;
+    uint64_t size;
+    uint8_t md5sum[16];
+    file_type_t entry_type;
+    mode_t mode;
+    struct _baseline_entry *next;
+    struct _baseline_entry *prev;
+} baseline_entry_t;
+
+typedef struct {
+    baseline_entry_t *head;
+    baseline_entry_t *tail;
+} baseline_list_t;
+
+/*!
+ * @brief baseline_insert is the former add_file_entry, on the former entries (malloc'ed one by one with a
+ * fixed 4 KiB path): linear duplicate search then linear walk to the insertion point
+ * @param list the list to insert into
+ * @param path the path to insert
+ */
+static void baseline_insert(baseline_list_t *list, char *path) {
+    baseline_entry_t *current = list->head;
+    while (current != NULL && strcmp(current->path_and_name, path) < 0) {
+        current = current->next;
+    }
+    if (current != NULL && strcmp(current->path_and_name, path) == 0) {
+        return;
+    }
+    baseline_entry_t *entry = malloc(sizeof(baseline_entry_t));
+    strcpy(entry->path_and_name, path);
+    entry->next = current;
+    entry->prev = current ? current->prev : list->tail;
+    if (entry->prev) {
+        entry->prev->next = entry;
+    } else {
+        list->head = entry;
+    }
+    if (current) {
+        current->prev = entry;
+    } else {
+        list->tail = entry;
+    }
+}
+
+/*!
+ * @brief bench_size runs the benchmark for one list size and prints its timings
+ * @param count the number of entries
+ * @param with_baseline true to time the former insertion too
+ */
+static void bench_size(size_t count, int with_baseline) {
+    char **paths = make_paths(count);
+    if (!paths) {
+        fprintf(stderr, "Out of memory for %zu paths\n", count);
+        return;
+    }
+
+    files_list_t list;
+    init_files_list(&list);
+    double start = now_seconds();
+    for (size_t i = 0; i < count; ++i) {
+        add_file_entry(&list, paths[i]);
+    }
+    double added = now_seconds();
+    sort_files_list(&list);
+    double sorted = now_seconds();
+    size_t memory = list.arena.allocated + list.hash_capacity * sizeof(files_list_entry_t *)
+                    + list.index_size * sizeof(files_list_entry_t *) + list.dirs_capacity * sizeof(char *);
+    size_t found = 0;
+    for (size_t i = 0; i < count; ++i) {
+        found += find_entry_by_name(&list, paths[i], 0, 0) != NULL;
+    }
+    double hashed = now_seconds();
+    for (size_t i = 0; i < count; ++i) {
+        found += find_entry_by_name(&list, paths[i], strlen(BENCH_ROOT), strlen(BENCH_ROOT)) != NULL;
+    }
+    double searched = now_seconds();
+    clear_files_list(&list);
+
+    printf("%10zu entries: add %.3fs, sort %.3fs, hash lookups %.3fs, prefix lookups %.3fs (%zu found), %.1f bytes/entry\n",
+           count, added - start, sorted - added, hashed - sorted, searched - hashed, found, (double) memory / count);
+
+    if (with_baseline) {
+        baseline_list_t baseline = {NULL, NULL};
+        start = now_seconds();
+        for (size_t i = 0; i < count; ++i) {
+            baseline_insert(&baseline, paths[i]);
+        }
+        printf("%10zu entries: baseline sorted insertion %.3fs\n", count, now_seconds() - start);
+        while (baseline.head != NULL) {
+            baseline_entry_t *tmp = baseline.head;
+            baseline.head = tmp->next;
+            free(tmp);
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        free(paths[i]);
+    }
+    free(paths);
+}
+
+int main(int argc, char *argv[]) {
+    int with_baseline = 0;
+    int sizes_count = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--baseline") == 0) {
+            with_baseline = 1;
+        } else {
+            ++sizes_count;
+        }
+    }
+
+    if (sizes_count == 0) {
+        bench_size(100000, with_baseline);
+    }
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--baseline") != 0) {
+            bench_size(strtoull(argv[i], NULL, 10), with_baseline);
+        }
+    }
+    return 0;
+}
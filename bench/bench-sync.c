@@ -0,0 +1,377 @@
+#include "tree-generator.h"
+#include "configuration.h"
+#include "files-list.h"
+#include "file-properties.h"
+#include "copy-stage.h"
+#include "read-engine.h"
+#include "thread-pool.h"
+#include "walker.h"
+#include "sync.h"
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/*
+ * Benchmark of a synchronization, phase by phase, on a synthetic tree (@see tree-generator.h).
+ * Each mode synchronizes a freshly generated source to an empty destination ("initial"), then changes
+ * --modified percent of the source files and synchronizes again ("incremental"). The phases are timed apart:
+ *   list: walk of both trees, names and types only (@see walk_tree), and sort
+ *   stat: get_file_stats on every entry of both lists
+ *   hash: checksums of all the source files
+ *   diff: make_differences_list, including the checksums of the destination files it needs
+ *   copy: copy_entry_to_destination on every difference (the copy stage in parallel mode)
+ * The parallel mode runs the phases on a pool of --threads threads (the --threads mode of the program).
+ * Results are printed as JSON, to be compared between commits.
+ * Usage: bench_sync [--depth n] [--fanout n] [--files n] [--min-size bytes] [--max-size bytes]
+ *                   [--modified percent] [--seed n] [--threads n] [--checksum name] [--dir path]
+ *                   [--output file.json] [--label text]
+ */
+
+// Entries stat'ed or hashed by a task of the pool
+#define BENCH_SLICE_SIZE 64
+
+typedef enum { PHASE_LIST, PHASE_STAT, PHASE_HASH, PHASE_DIFF, PHASE_COPY, PHASES_COUNT } phase_t;
+
+static const char *phase_names[PHASES_COUNT] = {"list", "stat", "hash", "diff", "copy"};
+
+typedef struct {
+    const char *mode;
+    const char *scenario;
+    double seconds[PHASES_COUNT];
+    size_t source_entries;
+    size_t destination_entries;
+    size_t differences;
+    uint64_t modified_files;
+} bench_run_t;
+
+typedef struct {
+    files_list_entry_t **entries;
+    size_t count;
+    checksum_type_t checksum_type; // CHECKSUM_NONE to get the stats
+} bench_slice_t;
+
+/*!
+ * @brief now_seconds returns a monotonic timestamp
+ * @return the current time in seconds
+ */
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*!
+ * @brief slice_task gets the stats or the checksums of a slice of entries (thread pool task)
+ * @param parameters is the bench_slice_t
+ */
+static void slice_task(void *parameters) {
+    bench_slice_t *slice = parameters;
+    for (size_t i = 0; i < slice->count; ++i) {
+        if (slice->checksum_type == CHECKSUM_NONE) {
+            get_file_stats(slice->entries[i]);
+        } else {
+            get_file_checksum(slice->entries[i], slice->checksum_type, NULL);
+        }
+    }
+}
+
+/*!
+ * @brief run_slices gets the stats or the checksums of the entries of a list, on the pool if there is one
+ * @param list is the list
+ * @param checksum_type is the checksum to compute, CHECKSUM_NONE to get the stats
+ * @param pool is the pool, NULL to run in this thread
+ */
+static void run_slices(files_list_t *list, checksum_type_t checksum_type, thread_pool_t *pool) {
+    files_list_entry_t **entries = malloc((list->count + 1) * sizeof(files_list_entry_t *));
+    size_t slices_count = (list->count + BENCH_SLICE_SIZE - 1) / BENCH_SLICE_SIZE;
+    bench_slice_t *slices = malloc((slices_count + 1) * sizeof(bench_slice_t));
+    if (!entries || !slices) {
+        free(entries);
+        free(slices);
+        return;
+    }
+    size_t count = 0;
+    for (files_list_entry_t *cursor = list->head; cursor != NULL; cursor = cursor->next) {
+        entries[count++] = cursor;
+    }
+    for (size_t i = 0; i < slices_count; ++i) {
+        slices[i].entries = entries + i * BENCH_SLICE_SIZE;
+        slices[i].count = (i + 1) * BENCH_SLICE_SIZE <= count ? BENCH_SLICE_SIZE : count - i * BENCH_SLICE_SIZE;
+        slices[i].checksum_type = checksum_type;
+        if (pool == NULL) {
+            slice_task(&slices[i]);
+        } else {
+            thread_pool_submit(pool, slice_task, &slices[i]);
+        }
+    }
+    if (pool != NULL) {
+        thread_pool_wait(pool);
+    }
+    free(slices);
+    free(entries);
+}
+
+/*!
+ * @brief run_phases synchronizes the source and the destination of a configuration, timing each phase
+ * @param the_config is the configuration
+ * @param pool is the pool of the parallel mode, NULL for the sequential mode
+ * @param run receives the timings and the counts
+ * @return 0 in case of success, -1 if a tree can't be walked
+ */
+static int run_phases(configuration_t *the_config, thread_pool_t *pool, bench_run_t *run) {
+    files_list_t src_list, dst_list, diff_list;
+    init_files_list(&src_list);
+    init_files_list(&dst_list);
+    init_files_list(&diff_list);
+    int result = 0;
+
+    double start = now_seconds();
+    if (pool != NULL) {
+        parallel_walk_t walks[2];
+        parallel_walk_start(&walks[0], the_config->source, false, pool);
+        parallel_walk_start(&walks[1], the_config->destination, false, pool);
+        thread_pool_wait(pool);
+        result = (parallel_walk_finish(&walks[0], &src_list) == -1) | (parallel_walk_finish(&walks[1], &dst_list) == -1) ? -1 : 0;
+    } else if (walk_tree(&src_list, the_config->source, false) == -1 || walk_tree(&dst_list, the_config->destination, false) == -1) {
+        result = -1;
+    }
+    sort_files_list(&src_list);
+    sort_files_list(&dst_list);
+    double listed = now_seconds();
+    run->seconds[PHASE_LIST] = listed - start;
+
+    if (result == 0) {
+        run_slices(&src_list, CHECKSUM_NONE, pool);
+        run_slices(&dst_list, CHECKSUM_NONE, pool);
+        double stated = now_seconds();
+        run->seconds[PHASE_STAT] = stated - listed;
+
+        run_slices(&src_list, the_config->checksum_type, pool);
+        double hashed = now_seconds();
+        run->seconds[PHASE_HASH] = hashed - stated;
+
+        // With copy workers, make_differences_list leaves the copies to the copy phase
+        run->differences = make_differences_list(&src_list, &dst_list, &diff_list, the_config, NULL, pool);
+        double diffed = now_seconds();
+        run->seconds[PHASE_DIFF] = diffed - hashed;
+
+        if (pool != NULL) {
+            copy_stage_run(&diff_list, the_config);
+        } else {
+            for (files_list_entry_t *cursor = diff_list.head; cursor != NULL; cursor = cursor->next) {
+                copy_entry_to_destination(cursor, the_config);
+            }
+        }
+        run->seconds[PHASE_COPY] = now_seconds() - diffed;
+    }
+    run->source_entries = src_list.count;
+    run->destination_entries = dst_list.count;
+    clear_files_list(&src_list);
+    clear_files_list(&dst_list);
+    clear_files_list(&diff_list);
+    return result;
+}
+
+/*!
+ * @brief print_json_string prints a string as a JSON string
+ * @param output is the output file
+ * @param text is the string
+ */
+static void print_json_string(FILE *output, const char *text) {
+    fputc('"', output);
+    for (; *text != '\0'; ++text) {
+        if (*text == '"' || *text == '\\') {
+            fprintf(output, "\\%c", *text);
+        } else if ((unsigned char) *text < 0x20) {
+            fprintf(output, "\\u%04x", *text);
+        } else {
+            fputc(*text, output);
+        }
+    }
+    fputc('"', output);
+}
+
+/*!
+ * @brief print_results prints the results of the benchmark as JSON
+ * @param output is the output file
+ * @param label is a label of the results (e.g. a commit), NULL if none
+ * @param the_config is the configuration
+ * @param threads is the number of threads of the parallel mode
+ * @param spec is the spec of the tree
+ * @param stats are the stats of the tree
+ * @param runs are the runs
+ * @param runs_count is the number of runs
+ */
+static void print_results(FILE *output, const char *label, configuration_t *the_config, int threads, tree_spec_t *spec,
+                          tree_stats_t *stats, bench_run_t *runs, int runs_count) {
+    fprintf(output, "{\n  \"label\": ");
+    print_json_string(output, label ? label : "");
+    fprintf(output, ",\n  \"checksum\": \"%s\",\n  \"threads\": %d,\n", checksum_name(the_config->checksum_type), threads);
+    fprintf(output, "  \"tree\": {\"depth\": %d, \"fanout\": %d, \"files_per_dir\": %d, \"min_file_size\": %lu, "
+                    "\"max_file_size\": %lu, \"modified_percent\": %d, \"seed\": %lu, \"files\": %lu, \"directories\": %lu, \"bytes\": %lu},\n",
+            spec->depth, spec->fanout, spec->files_per_dir, (unsigned long) spec->min_file_size, (unsigned long) spec->max_file_size,
+            spec->modified_percent, (unsigned long) spec->seed, (unsigned long) stats->files, (unsigned long) stats->directories,
+            (unsigned long) stats->bytes);
+    fprintf(output, "  \"runs\": [\n");
+    for (int i = 0; i < runs_count; ++i) {
+        bench_run_t *run = &runs[i];
+        double total = 0;
+        fprintf(output, "    {\"mode\": \"%s\", \"scenario\": \"%s\", \"source_entries\": %zu, \"destination_entries\": %zu, "
+                        "\"differences\": %zu, \"modified_files\": %lu, \"seconds\": {",
+                run->mode, run->scenario, run->source_entries, run->destination_entries, run->differences, (unsigned long) run->modified_files);
+        for (int phase = 0; phase < PHASES_COUNT; ++phase) {
+            fprintf(output, "\"%s\": %.6f, ", phase_names[phase], run->seconds[phase]);
+            total += run->seconds[phase];
+        }
+        fprintf(output, "\"total\": %.6f}}%s\n", total, i + 1 < runs_count ? "," : "");
+    }
+    fprintf(output, "  ]\n}\n");
+}
+
+/*!
+ * @brief bench_mode runs the initial and incremental synchronizations of a mode
+ * @param the_config is the configuration, whose source and destination are created in the work directory
+ * @param spec is the spec of the tree
+ * @param stats receives the stats of the tree
+ * @param pool is the pool of the parallel mode, NULL for the sequential mode
+ * @param runs receives the two runs
+ * @return 0 in case of success, -1 else
+ */
+static int bench_mode(configuration_t *the_config, tree_spec_t *spec, tree_stats_t *stats, thread_pool_t *pool, bench_run_t *runs) {
+    remove_tree(the_config->source);
+    remove_tree(the_config->destination);
+    if (generate_tree(the_config->source, spec, stats) == -1 || mkdir(the_config->destination, 0755) == -1) {
+        return -1;
+    }
+    runs[0].mode = runs[1].mode = pool != NULL ? "parallel" : "sequential";
+    runs[0].scenario = "initial";
+    runs[1].scenario = "incremental";
+    if (run_phases(the_config, pool, &runs[0]) == -1 || modify_tree(the_config->source, spec, &runs[1].modified_files) == -1) {
+        return -1;
+    }
+    return run_phases(the_config, pool, &runs[1]);
+}
+
+int main(int argc, char *argv[]) {
+    tree_spec_t spec = {.depth = 3, .fanout = 4, .files_per_dir = 20, .min_file_size = 512, .max_file_size = 256 * 1024,
+                        .modified_percent = 10, .seed = 42};
+    configuration_t the_config;
+    init_configuration(&the_config);
+    int threads = 4;
+    const char *directory = NULL, *output_path = NULL, *label = NULL;
+
+    struct option long_options[] = {
+            {"depth", required_argument, NULL, 'd'},
+            {"fanout", required_argument, NULL, 'f'},
+            {"files", required_argument, NULL, 'n'},
+            {"min-size", required_argument, NULL, 's'},
+            {"max-size", required_argument, NULL, 'S'},
+            {"modified", required_argument, NULL, 'm'},
+            {"seed", required_argument, NULL, 'r'},
+            {"threads", required_argument, NULL, 't'},
+            {"checksum", required_argument, NULL, 'c'},
+            {"dir", required_argument, NULL, 'D'},
+            {"output", required_argument, NULL, 'o'},
+            {"label", required_argument, NULL, 'l'},
+            {0, 0, 0, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'd':
+                spec.depth = atoi(optarg);
+                break;
+            case 'f':
+                spec.fanout = atoi(optarg);
+                break;
+            case 'n':
+                spec.files_per_dir = atoi(optarg);
+                break;
+            case 's':
+                spec.min_file_size = strtoull(optarg, NULL, 10);
+                break;
+            case 'S':
+                spec.max_file_size = strtoull(optarg, NULL, 10);
+                break;
+            case 'm':
+                spec.modified_percent = atoi(optarg);
+                break;
+            case 'r':
+                spec.seed = strtoull(optarg, NULL, 10);
+                break;
+            case 't':
+                threads = atoi(optarg);
+                break;
+            case 'c':
+                if ((the_config.checksum_type = checksum_from_name(optarg)) == CHECKSUM_NONE) {
+                    fprintf(stderr, "Unknown checksum %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'D':
+                directory = optarg;
+                break;
+            case 'o':
+                output_path = optarg;
+                break;
+            case 'l':
+                label = optarg;
+                break;
+            default:
+                return EXIT_FAILURE;
+        }
+    }
+    if (spec.depth < 0 || spec.fanout < 0 || spec.files_per_dir < 0 || threads <= 0) {
+        fprintf(stderr, "Invalid tree or threads count\n");
+        return EXIT_FAILURE;
+    }
+
+    char work_directory[512];
+    if (directory != NULL) {
+        snprintf(work_directory, sizeof(work_directory), "%s", directory);
+        mkdir(work_directory, 0755);
+    } else {
+        const char *tmp = getenv("TMPDIR");
+        snprintf(work_directory, sizeof(work_directory), "%s/lp25-bench-XXXXXX", (tmp && tmp[0] != '\0') ? tmp : "/tmp");
+        if (mkdtemp(work_directory) == NULL) {
+            perror("Unable to create the work directory");
+            return EXIT_FAILURE;
+        }
+    }
+    snprintf(the_config.source, sizeof(the_config.source), "%s/source", work_directory);
+    snprintf(the_config.destination, sizeof(the_config.destination), "%s/destination", work_directory);
+    the_config.is_parallel = false;
+    read_engine_configure(the_config.read_engine, false);
+
+    bench_run_t runs[4];
+    memset(runs, 0, sizeof(runs));
+    tree_stats_t stats;
+    thread_pool_t pool;
+    int result = -1;
+    the_config.copy_workers = 1; // Copies are timed apart, in the copy phase
+    if (bench_mode(&the_config, &spec, &stats, NULL, &runs[0]) == 0 && thread_pool_init(&pool, threads) == 0) {
+        the_config.copy_workers = threads;
+        result = bench_mode(&the_config, &spec, &stats, &pool, &runs[2]);
+        thread_pool_destroy(&pool);
+    }
+    read_engine_release();
+    remove_tree(work_directory);
+    if (result == -1) {
+        fprintf(stderr, "Benchmark failed\n");
+        return EXIT_FAILURE;
+    }
+
+    FILE *output = output_path != NULL ? fopen(output_path, "w") : stdout;
+    if (!output) {
+        perror("Unable to write the results");
+        return EXIT_FAILURE;
+    }
+    print_results(output, label, &the_config, threads, &spec, &stats, runs, 4);
+    if (output != stdout) {
+        fclose(output);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,234 @@
+#define _XOPEN_SOURCE 700 // nftw
+#include "tree-generator.h"
+#include <ftw.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * Deterministic synthetic trees for the benchmarks: a directory holds files_per_dir files (f000.dat...) and,
+ * above the last level, fanout subdirectories (d00...). Everything is drawn from a xorshift generator seeded
+ * by the spec, walked in the same order every time, so that two runs (or two commits) work on the same tree.
+ * modify_tree draws again from the seed which files to change: one byte is rewritten in place, so that the
+ * size stays the same and only the mtime and the contents tell the copies apart.
+ */
+
+#define GENERATOR_BUFFER_SIZE (64 * 1024)
+#define GENERATOR_PATH_SIZE 4096
+
+/*!
+ * @brief next_random is a deterministic pseudo random generator (xorshift64)
+ * @param state the generator state, not 0
+ * @return the next pseudo random value
+ */
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/*!
+ * @brief bit_length gives the number of significant bits of a value
+ * @param value the value
+ * @return 0 for 0, else the position of its highest bit plus one
+ */
+static int bit_length(uint64_t value) {
+    int bits = 0;
+    while (value != 0) {
+        ++bits;
+        value >>= 1;
+    }
+    return bits;
+}
+
+/*!
+ * @brief draw_size draws a file size, log-uniformly: each power of 2 between the bounds is as likely
+ * @param spec the spec of the tree
+ * @param state the generator state
+ * @return the size
+ */
+static uint64_t draw_size(tree_spec_t *spec, uint64_t *state) {
+    if (spec->max_file_size <= spec->min_file_size) {
+        return spec->min_file_size;
+    }
+    int low = bit_length(spec->min_file_size), high = bit_length(spec->max_file_size);
+    int bits = low + (int) (next_random(state) % (uint64_t) (high - low + 1));
+    uint64_t size = bits == 0 ? 0 : (1ULL << (bits - 1)) + next_random(state) % (1ULL << (bits - 1));
+    if (size < spec->min_file_size) {
+        return spec->min_file_size;
+    }
+    return size > spec->max_file_size ? spec->max_file_size : size;
+}
+
+/*!
+ * @brief write_file creates a file of pseudo random contents
+ * @param path the path of the file
+ * @param size its size
+ * @param state the generator state
+ * @return 0 in case of success, -1 else
+ */
+static int write_file(const char *path, uint64_t size, uint64_t *state) {
+    uint64_t buffer[GENERATOR_BUFFER_SIZE / sizeof(uint64_t)];
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "Unable to create %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    while (size > 0) {
+        size_t chunk = size < sizeof(buffer) ? size : sizeof(buffer);
+        for (size_t i = 0; i < (chunk + sizeof(uint64_t) - 1) / sizeof(uint64_t); ++i) {
+            buffer[i] = next_random(state);
+        }
+        if (write(fd, buffer, chunk) != (ssize_t) chunk) {
+            fprintf(stderr, "Unable to write %s: %s\n", path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        size -= chunk;
+    }
+    return close(fd);
+}
+
+/*!
+ * @brief generate_directory fills a directory and creates its subdirectories, recursively
+ * @param path the path of the directory (a buffer of GENERATOR_PATH_SIZE chars, restored on return)
+ * @param level the level of the directory, 0 for the root
+ * @param spec the spec of the tree
+ * @param state the generator state
+ * @param stats the stats of the tree
+ * @return 0 in case of success, -1 else
+ */
+static int generate_directory(char *path, int level, tree_spec_t *spec, uint64_t *state, tree_stats_t *stats) {
+    size_t length = strlen(path);
+    for (int i = 0; i < spec->files_per_dir; ++i) {
+        snprintf(path + length, GENERATOR_PATH_SIZE - length, "/f%03d.dat", i);
+        uint64_t size = draw_size(spec, state);
+        if (write_file(path, size, state) == -1) {
+            return -1;
+        }
+        ++stats->files;
+        stats->bytes += size;
+    }
+    for (int i = 0; level < spec->depth && i < spec->fanout; ++i) {
+        snprintf(path + length, GENERATOR_PATH_SIZE - length, "/d%02d", i);
+        if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+            fprintf(stderr, "Unable to create %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+        ++stats->directories;
+        if (generate_directory(path, level + 1, spec, state, stats) == -1) {
+            return -1;
+        }
+    }
+    path[length] = '\0';
+    return 0;
+}
+
+/*!
+ * @brief generate_tree creates the tree of a spec in a directory
+ * @param root the directory, created if needed
+ * @param spec the spec of the tree
+ * @param stats receives the number of files and directories, and the bytes of the files
+ * @return 0 in case of success, -1 else
+ */
+int generate_tree(const char *root, tree_spec_t *spec, tree_stats_t *stats) {
+    char path[GENERATOR_PATH_SIZE];
+    uint64_t state = spec->seed ? spec->seed : 0x9E3779B97F4A7C15ULL;
+    memset(stats, 0, sizeof(tree_stats_t));
+    snprintf(path, sizeof(path), "%s", root);
+    if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+        fprintf(stderr, "Unable to create %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return generate_directory(path, 0, spec, &state, stats);
+}
+
+/*!
+ * @brief modify_directory changes the drawn files of a directory and of its subdirectories
+ * @param path the path of the directory (a buffer of GENERATOR_PATH_SIZE chars, restored on return)
+ * @param level the level of the directory, 0 for the root
+ * @param spec the spec of the tree
+ * @param state the generator state
+ * @param modified counts the changed files
+ * @return 0 in case of success, -1 else
+ */
+static int modify_directory(char *path, int level, tree_spec_t *spec, uint64_t *state, uint64_t *modified) {
+    size_t length = strlen(path);
+    for (int i = 0; i < spec->files_per_dir; ++i) {
+        if ((int) (next_random(state) % 100) >= spec->modified_percent) {
+            continue;
+        }
+        snprintf(path + length, GENERATOR_PATH_SIZE - length, "/f%03d.dat", i);
+        int fd = open(path, O_RDWR | O_CLOEXEC);
+        struct stat sb;
+        if (fd == -1 || fstat(fd, &sb) == -1) {
+            fprintf(stderr, "Unable to modify %s: %s\n", path, strerror(errno));
+            if (fd != -1) {
+                close(fd);
+            }
+            return -1;
+        }
+        // Flip a byte in the middle: same size, new contents and mtime
+        unsigned char byte = 0;
+        off_t offset = sb.st_size / 2;
+        if (sb.st_size > 0 && pread(fd, &byte, 1, offset) == 1) {
+            byte ^= 0xFF;
+            if (pwrite(fd, &byte, 1, offset) != 1) {
+                fprintf(stderr, "Unable to modify %s: %s\n", path, strerror(errno));
+            }
+        }
+        futimens(fd, NULL); // Empty files only get a new mtime
+        close(fd);
+        ++*modified;
+    }
+    for (int i = 0; level < spec->depth && i < spec->fanout; ++i) {
+        snprintf(path + length, GENERATOR_PATH_SIZE - length, "/d%02d", i);
+        if (modify_directory(path, level + 1, spec, state, modified) == -1) {
+            return -1;
+        }
+    }
+    path[length] = '\0';
+    return 0;
+}
+
+/*!
+ * @brief modify_tree changes modified_percent of the files of a tree generated with the same spec
+ * @param root the root of the tree
+ * @param spec the spec of the tree
+ * @param modified receives the number of changed files
+ * @return 0 in case of success, -1 else
+ */
+int modify_tree(const char *root, tree_spec_t *spec, uint64_t *modified) {
+    char path[GENERATOR_PATH_SIZE];
+    uint64_t state = (spec->seed ? spec->seed : 0x9E3779B97F4A7C15ULL) ^ 0xD1B54A32D192ED03ULL;
+    *modified = 0;
+    snprintf(path, sizeof(path), "%s", root);
+    return modify_directory(path, 0, spec, &state, modified);
+}
+
+/*!
+ * @brief remove_entry removes a file or an empty directory (nftw callback)
+ * @return 0 to go on
+ */
+static int remove_entry(const char *path, const struct stat *sb, int type, struct FTW *ftw) {
+    (void) sb;
+    (void) type;
+    (void) ftw;
+    if (remove(path) == -1) {
+        fprintf(stderr, "Unable to remove %s: %s\n", path, strerror(errno));
+    }
+    return 0;
+}
+
+/*!
+ * @brief remove_tree removes a directory and all its content
+ * @param root the directory
+ * @return 0 in case of success, -1 else
+ */
+int remove_tree(const char *root) {
+    return nftw(root, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+// Shape of a synthetic tree, the same spec always gives the same tree (names, sizes and contents)
+typedef struct {
+    int depth; // Levels of directories below the root
+    int fanout; // Subdirectories of each directory above the last level
+    int files_per_dir;
+    uint64_t min_file_size; // Sizes are spread log-uniformly between these bounds: many small files, a few large
+    uint64_t max_file_size;
+    int modified_percent; // Files changed by modify_tree
+    uint64_t seed;
+} tree_spec_t;
+
+typedef struct {
+    uint64_t files;
+    uint64_t directories;
+    uint64_t bytes;
+} tree_stats_t;
+
+int generate_tree(const char *root, tree_spec_t *spec, tree_stats_t *stats);
+int modify_tree(const char *root, tree_spec_t *spec, uint64_t *modified);
+int remove_tree(const char *root);
@@ -0,0 +1,308 @@
+#include "checksum-cache.h"
+#include "utility.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+/*
+ * The cache is a file holding an open addressing hash table of records, indexed by (device, inode). It is
+ * mapped in memory, so opening it costs nothing whatever its size and each lookup touches one or two pages.
+ * A record is only valid for the size and mtime (in nanoseconds) it was computed for. Records are updated in
+ * place; each one carries a hash of its content so that records torn by a crash are seen as missing. When
+ * the table gets half full, it is rebuilt twice bigger in a temporary file which then atomically replaces it.
+ */
+
+#define CHECKSUM_CACHE_MAGIC "LP25CKC"
+#define CHECKSUM_CACHE_VERSION 2
+#define CHECKSUM_CACHE_INITIAL_CAPACITY 4096
+
+/*!
+ * @brief mix64 is the splitmix64 finalizer, used to hash the records keys
+ * @param value the value to hash
+ * @return the hashed value
+ */
+static uint64_t mix64(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xBF58476D1CE4E5B9ULL;
+    value ^= value >> 27;
+    value *= 0x94D049BB133111EBULL;
+    value ^= value >> 31;
+    return value;
+}
+
+/*!
+ * @brief record_check computes the check value of a record
+ * @param record the record
+ * @return a hash of all its fields but check, never 0
+ */
+static uint32_t record_check(checksum_cache_record_t *record) {
+    uint64_t hash = mix64(record->device ^ mix64(record->inode ^ mix64(record->size ^ mix64(record->mtime_sec ^ mix64(record->mtime_nsec)))));
+    hash = (hash ^ record->checksum_type) * 1099511628211ULL;
+    for (size_t i = 0; i < sizeof(record->checksum); ++i) {
+        hash = (hash ^ record->checksum[i]) * 1099511628211ULL;
+    }
+    return (uint32_t) (hash ^ (hash >> 32)) | 1;
+}
+
+/*!
+ * @brief find_slot looks for the slot of a (device, inode) key
+ * @param records the table
+ * @param capacity the table capacity (a power of 2)
+ * @param device the device of the file
+ * @param inode the inode of the file
+ * @return the slot holding the key, or the first empty slot where it would be
+ */
+static checksum_cache_record_t *find_slot(checksum_cache_record_t *records, uint64_t capacity, uint64_t device, uint64_t inode) {
+    uint64_t mask = capacity - 1;
+    uint64_t slot = mix64(inode ^ mix64(device)) & mask;
+    while (records[slot].check != 0 && (records[slot].device != device || records[slot].inode != inode)) {
+        slot = (slot + 1) & mask;
+    }
+    return &records[slot];
+}
+
+/*!
+ * @brief map_cache_file maps the cache file after checking its header
+ * @param cache the cache, whose fd is open
+ * @return 0 if the file is a valid cache, -1 else
+ */
+static int map_cache_file(checksum_cache_t *cache) {
+    struct stat sb;
+    if (fstat(cache->fd, &sb) == -1 || (size_t) sb.st_size < sizeof(checksum_cache_header_t)) {
+        return -1;
+    }
+    void *mapping = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+    if (mapping == MAP_FAILED) {
+        return -1;
+    }
+
+    checksum_cache_header_t *header = mapping;
+    bool valid = memcmp(header->magic, CHECKSUM_CACHE_MAGIC, sizeof(header->magic)) == 0
+                 && header->version == CHECKSUM_CACHE_VERSION
+                 && header->record_size == sizeof(checksum_cache_record_t)
+                 && header->capacity > 0 && (header->capacity & (header->capacity - 1)) == 0
+                 && (uint64_t) sb.st_size == sizeof(checksum_cache_header_t) + header->capacity * sizeof(checksum_cache_record_t);
+    if (!valid) {
+        munmap(mapping, sb.st_size);
+        return -1;
+    }
+    cache->header = header;
+    cache->records = (checksum_cache_record_t *) (header + 1);
+    cache->mapped_size = sb.st_size;
+    return 0;
+}
+
+/*!
+ * @brief unmap_cache_file unmaps the cache file
+ * @param cache the cache
+ */
+static void unmap_cache_file(checksum_cache_t *cache) {
+    if (cache->header != NULL) {
+        munmap(cache->header, cache->mapped_size);
+        cache->header = NULL;
+        cache->records = NULL;
+        cache->mapped_size = 0;
+    }
+}
+
+/*!
+ * @brief create_cache_file writes an empty table, or a copy of the current one, into a new file
+ * The file is written under a temporary name, synced then renamed over the cache path, so that the cache
+ * is never seen half written.
+ * @param cache the cache, its current table (if mapped) is copied into the new one
+ * @param capacity the capacity of the new table
+ * @return the fd of the new cache file, -1 in case of error
+ */
+static int create_cache_file(checksum_cache_t *cache, uint64_t capacity) {
+    char temporary_path[sizeof(cache->path) + 8];
+    snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", cache->path);
+    int fd = open(temporary_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+
+    size_t size = sizeof(checksum_cache_header_t) + capacity * sizeof(checksum_cache_record_t);
+    void *mapping = MAP_FAILED;
+    if (ftruncate(fd, size) == 0) {
+        mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (mapping == MAP_FAILED) {
+        close(fd);
+        unlink(temporary_path);
+        return -1;
+    }
+
+    checksum_cache_header_t *header = mapping;
+    memcpy(header->magic, CHECKSUM_CACHE_MAGIC, sizeof(header->magic));
+    header->version = CHECKSUM_CACHE_VERSION;
+    header->record_size = sizeof(checksum_cache_record_t);
+    header->capacity = capacity;
+    header->count = 0;
+    checksum_cache_record_t *records = (checksum_cache_record_t *) (header + 1);
+    if (cache->header != NULL) {
+        for (uint64_t i = 0; i < cache->header->capacity; ++i) {
+            checksum_cache_record_t *record = &cache->records[i];
+            if (record->check != 0 && record->check == record_check(record)) {
+                *find_slot(records, capacity, record->device, record->inode) = *record;
+                ++header->count;
+            }
+        }
+    }
+
+    int result = msync(mapping, size, MS_SYNC);
+    munmap(mapping, size);
+    if (result == -1 || fsync(fd) == -1 || rename(temporary_path, cache->path) == -1) {
+        close(fd);
+        unlink(temporary_path);
+        return -1;
+    }
+    return fd;
+}
+
+/*!
+ * @brief replace_cache_file replaces the cache file by a new table and maps it
+ * @param cache the cache
+ * @param capacity the capacity of the new table
+ * @return 0 in case of success, -1 else (the cache is then disabled)
+ */
+static int replace_cache_file(checksum_cache_t *cache, uint64_t capacity) {
+    int fd = create_cache_file(cache, capacity);
+    unmap_cache_file(cache);
+    if (cache->fd != -1) {
+        close(cache->fd);
+    }
+    cache->fd = fd;
+    if (fd == -1 || flock(fd, LOCK_EX | LOCK_NB) == -1 || map_cache_file(cache) == -1) {
+        fprintf(stderr, "Checksum cache %s cannot be written, it is disabled\n", cache->path);
+        checksum_cache_close(cache);
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief checksum_cache_open opens (or creates) the checksum cache of a directory
+ * An invalid cache file (other version, truncated, etc.) is replaced by an empty one. If another run
+ * holds the cache, or if it cannot be created, the cache is disabled and checksums are always computed.
+ * @param cache is a pointer to the cache to open
+ * @param cache_dir is the directory holding the cache, NULL or "" to disable the cache
+ * @param rebuild is true to drop all the cached checksums
+ * @return 0 if the cache is usable, -1 if it is disabled
+ */
+int checksum_cache_open(checksum_cache_t *cache, char *cache_dir, bool rebuild) {
+    if (!cache) {
+        return -1;
+    }
+    memset(cache, 0, sizeof(checksum_cache_t));
+    cache->fd = -1;
+    pthread_rwlock_init(&cache->lock, NULL);
+    if (!cache_dir || cache_dir[0] == '\0') {
+        return -1;
+    }
+    if (!concat_path(cache->path, cache_dir, CHECKSUM_CACHE_FILE_NAME)) {
+        return -1;
+    }
+
+    cache->fd = open(cache->path, O_RDWR);
+    if (cache->fd != -1 && flock(cache->fd, LOCK_EX | LOCK_NB) == -1) {
+        fprintf(stderr, "Checksum cache %s is used by another run, it is disabled\n", cache->path);
+        checksum_cache_close(cache);
+        return -1;
+    }
+    if (cache->fd != -1 && !rebuild && map_cache_file(cache) == 0) {
+        return 0;
+    }
+    return replace_cache_file(cache, CHECKSUM_CACHE_INITIAL_CAPACITY);
+}
+
+/*!
+ * @brief checksum_cache_lookup looks for the cached checksum of a file
+ * @param cache is a pointer to the cache
+ * @param entry is the file entry, with its device, inode, size and mtime set
+ * @param type is the wanted checksum
+ * @return true if the sum was found (it is then copied into entry->checksum), false else
+ */
+bool checksum_cache_lookup(checksum_cache_t *cache, files_list_entry_t *entry, checksum_type_t type) {
+    if (!cache || !entry || cache->fd == -1) {
+        return false;
+    }
+
+    bool found = false;
+    pthread_rwlock_rdlock(&cache->lock);
+    if (cache->header != NULL) {
+        checksum_cache_record_t *record = find_slot(cache->records, cache->header->capacity, entry->device, entry->inode);
+        if (record->check != 0 && record->check == record_check(record) && record->size == entry->size
+            && record->mtime_sec == entry->mtime.tv_sec && record->mtime_nsec == (uint32_t) entry->mtime.tv_nsec
+            && record->checksum_type == type) {
+            memcpy(entry->checksum, record->checksum, sizeof(entry->checksum));
+            entry->checksum_type = type;
+            found = true;
+        }
+    }
+    pthread_rwlock_unlock(&cache->lock);
+    __sync_fetch_and_add(found ? &cache->hits : &cache->misses, 1);
+    return found;
+}
+
+/*!
+ * @brief checksum_cache_store records the checksum of a file, replacing the previous one for its inode
+ * @param cache is a pointer to the cache
+ * @param entry is the file entry, with its device, inode, size, mtime and checksum set
+ * @return 0 in case of success, -1 else
+ */
+int checksum_cache_store(checksum_cache_t *cache, files_list_entry_t *entry) {
+    if (!cache || !entry || cache->fd == -1 || entry->checksum_type == CHECKSUM_NONE) {
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&cache->lock);
+    if (cache->header == NULL) {
+        pthread_rwlock_unlock(&cache->lock);
+        return -1;
+    }
+    checksum_cache_record_t *record = find_slot(cache->records, cache->header->capacity, entry->device, entry->inode);
+    if (record->check == 0) {
+        // New key: keep the table at most half full so that probing sequences stay short
+        if ((cache->header->count + 1) * 2 > cache->header->capacity) {
+            if (replace_cache_file(cache, cache->header->capacity * 2) == -1) {
+                pthread_rwlock_unlock(&cache->lock);
+                return -1;
+            }
+            record = find_slot(cache->records, cache->header->capacity, entry->device, entry->inode);
+        }
+        ++cache->header->count;
+    }
+
+    record->check = 0;
+    record->device = entry->device;
+    record->inode = entry->inode;
+    record->size = entry->size;
+    record->mtime_sec = entry->mtime.tv_sec;
+    record->mtime_nsec = entry->mtime.tv_nsec;
+    memcpy(record->checksum, entry->checksum, sizeof(record->checksum));
+    record->checksum_type = entry->checksum_type;
+    memset(record->padding, 0, sizeof(record->padding));
+    record->check = record_check(record);
+    pthread_rwlock_unlock(&cache->lock);
+    return 0;
+}
+
+/*!
+ * @brief checksum_cache_close unmaps and closes the cache (its content is already in the file)
+ * @param cache is a pointer to the cache
+ */
+void checksum_cache_close(checksum_cache_t *cache) {
+    if (!cache) {
+        return;
+    }
+    unmap_cache_file(cache);
+    if (cache->fd != -1) {
+        close(cache->fd);
+        cache->fd = -1;
+    }
+}
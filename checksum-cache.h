@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "files-list.h"
+
+#define CHECKSUM_CACHE_FILE_NAME "lp25-checksums.cache"
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t capacity; // Number of records, always a power of 2
+    uint64_t count; // Number of used records
+} checksum_cache_header_t;
+
+typedef struct {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t check; // Hash of all the other fields, 0 for an empty slot
+    uint8_t checksum[CHECKSUM_SIZE_MAX];
+    uint8_t checksum_type; // A record only holds one checksum type, the last one computed
+    uint8_t padding[7];
+} checksum_cache_record_t;
+
+typedef struct {
+    char path[4096];
+    int fd; // -1 when the cache is disabled
+    checksum_cache_header_t *header; // Mapping of the whole file
+    checksum_cache_record_t *records;
+    size_t mapped_size;
+    pthread_rwlock_t lock; // Lookups may run in several threads, stores may remap the table
+    uint64_t hits;
+    uint64_t misses;
+} checksum_cache_t;
+
+int checksum_cache_open(checksum_cache_t *cache, char *cache_dir, bool rebuild);
+bool checksum_cache_lookup(checksum_cache_t *cache, files_list_entry_t *entry, checksum_type_t type);
+int checksum_cache_store(checksum_cache_t *cache, files_list_entry_t *entry);
+void checksum_cache_close(checksum_cache_t *cache);
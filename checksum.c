@@ -0,0 +1,443 @@
+#include "checksum.h"
+#include <openssl/evp.h>
+#include <pthread.h>
+#include <string.h>
+#include <strings.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+/*
+ * Checksum backends, behind a common init/update/final interface:
+ * - md5 and blake2s (256 bits) come from OpenSSL,
+ * - xxh64 is a fast non cryptographic hash, good enough to compare files,
+ * - crc32c uses the SSE4.2 crc32 instruction when the CPU has it (checked at runtime), a table else.
+ * Digests are stored big endian, so that they read as the usual hexadecimal values.
+ */
+
+typedef struct {
+    const char *name;
+    size_t digest_size;
+    int (*init)(checksum_context_t *context);
+    int (*update)(checksum_context_t *context, const uint8_t *data, size_t size);
+    int (*final)(checksum_context_t *context, uint8_t *digest);
+} checksum_backend_t;
+
+/*!
+ * @brief evp_init starts an OpenSSL digest
+ * @param context the context of the computation
+ * @param md the digest
+ * @return 0 in case of success, -1 else
+ */
+static int evp_init(checksum_context_t *context, const EVP_MD *md) {
+    EVP_MD_CTX *evp = EVP_MD_CTX_new();
+    if (!evp || !md || !EVP_DigestInit_ex(evp, md, NULL)) {
+        EVP_MD_CTX_free(evp);
+        return -1;
+    }
+    context->state.evp = evp;
+    return 0;
+}
+
+/*!
+ * @brief md5_init starts a MD5 checksum
+ * @param context the context of the computation
+ * @return 0 in case of success, -1 else
+ */
+static int md5_init(checksum_context_t *context) {
+    return evp_init(context, EVP_md5());
+}
+
+/*!
+ * @brief blake2s_init starts a BLAKE2s (256 bits) checksum
+ * @param context the context of the computation
+ * @return 0 in case of success, -1 else
+ */
+static int blake2s_init(checksum_context_t *context) {
+    return evp_init(context, EVP_blake2s256());
+}
+
+/*!
+ * @brief evp_update adds data to an OpenSSL digest
+ * @param context the context of the computation
+ * @param data the data
+ * @param size the size of data
+ * @return 0 in case of success, -1 else
+ */
+static int evp_update(checksum_context_t *context, const uint8_t *data, size_t size) {
+    return EVP_DigestUpdate(context->state.evp, data, size) ? 0 : -1;
+}
+
+/*!
+ * @brief evp_final ends an OpenSSL digest and frees its context
+ * @param context the context of the computation
+ * @param digest receives the digest
+ * @return 0 in case of success, -1 else
+ */
+static int evp_final(checksum_context_t *context, uint8_t *digest) {
+    unsigned int digest_size;
+    int result = EVP_DigestFinal_ex(context->state.evp, digest, &digest_size) ? 0 : -1;
+    EVP_MD_CTX_free(context->state.evp);
+    context->state.evp = NULL;
+    return result;
+}
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+/*!
+ * @brief rotate_left rotates a 64 bits value
+ * @param value the value
+ * @param bits the number of bits, from 1 to 63
+ * @return the rotated value
+ */
+static inline uint64_t rotate_left(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+/*!
+ * @brief read_le64 reads a little endian 64 bits value, at any alignment
+ * @param data the bytes of the value
+ * @return the value
+ */
+static inline uint64_t read_le64(const uint8_t *data) {
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value; // Hosts are little endian (x86_64, aarch64)
+}
+
+/*!
+ * @brief read_le32 reads a little endian 32 bits value, at any alignment
+ * @param data the bytes of the value
+ * @return the value
+ */
+static inline uint32_t read_le32(const uint8_t *data) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+/*!
+ * @brief xxh64_round mixes 8 bytes of input into an accumulator
+ * @param accumulator the accumulator
+ * @param input the input
+ * @return the new accumulator
+ */
+static inline uint64_t xxh64_round(uint64_t accumulator, uint64_t input) {
+    accumulator += input * XXH_PRIME64_2;
+    return rotate_left(accumulator, 31) * XXH_PRIME64_1;
+}
+
+/*!
+ * @brief xxh64_merge_round merges an accumulator into the hash, once the stripes are consumed
+ * @param accumulator the hash
+ * @param value the accumulator to merge
+ * @return the new hash
+ */
+static inline uint64_t xxh64_merge_round(uint64_t accumulator, uint64_t value) {
+    accumulator ^= xxh64_round(0, value);
+    return accumulator * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+/*!
+ * @brief xxh64_init starts a XXH64 checksum, with a seed of 0
+ * @param context the context of the computation
+ * @return 0
+ */
+static int xxh64_init(checksum_context_t *context) {
+    memset(&context->state.xxh64, 0, sizeof(context->state.xxh64));
+    context->state.xxh64.accumulators[0] = XXH_PRIME64_1 + XXH_PRIME64_2;
+    context->state.xxh64.accumulators[1] = XXH_PRIME64_2;
+    context->state.xxh64.accumulators[2] = 0;
+    context->state.xxh64.accumulators[3] = -XXH_PRIME64_1;
+    return 0;
+}
+
+/*!
+ * @brief xxh64_stripes consumes 32 bytes stripes with the 4 accumulators (independent, so they run in parallel
+ * in the CPU pipelines)
+ * @param accumulators the accumulators
+ * @param data the data, a multiple of 32 bytes
+ * @param size the size of data
+ */
+static void xxh64_stripes(uint64_t *accumulators, const uint8_t *data, size_t size) {
+    uint64_t v1 = accumulators[0], v2 = accumulators[1], v3 = accumulators[2], v4 = accumulators[3];
+    for (const uint8_t *end = data + size; data < end; data += 32) {
+        v1 = xxh64_round(v1, read_le64(data));
+        v2 = xxh64_round(v2, read_le64(data + 8));
+        v3 = xxh64_round(v3, read_le64(data + 16));
+        v4 = xxh64_round(v4, read_le64(data + 24));
+    }
+    accumulators[0] = v1;
+    accumulators[1] = v2;
+    accumulators[2] = v3;
+    accumulators[3] = v4;
+}
+
+/*!
+ * @brief xxh64_update adds data to a XXH64 checksum, keeping the end of data that doesn't fill a stripe
+ * @param context the context of the computation
+ * @param data the data
+ * @param size the size of data
+ * @return 0
+ */
+static int xxh64_update(checksum_context_t *context, const uint8_t *data, size_t size) {
+    typeof(context->state.xxh64) *state = &context->state.xxh64;
+    state->total_size += size;
+    if (state->buffered > 0) {
+        size_t missing = sizeof(state->buffer) - state->buffered;
+        size_t copied = size < missing ? size : missing;
+        memcpy(state->buffer + state->buffered, data, copied);
+        state->buffered += copied;
+        data += copied;
+        size -= copied;
+        if (state->buffered < sizeof(state->buffer)) {
+            return 0;
+        }
+        xxh64_stripes(state->accumulators, state->buffer, sizeof(state->buffer));
+        state->buffered = 0;
+    }
+    size_t stripes_size = size & ~(size_t) 31;
+    xxh64_stripes(state->accumulators, data, stripes_size);
+    memcpy(state->buffer, data + stripes_size, size - stripes_size);
+    state->buffered = size - stripes_size;
+    return 0;
+}
+
+/*!
+ * @brief xxh64_final ends a XXH64 checksum with the buffered bytes and the avalanche
+ * @param context the context of the computation
+ * @param digest receives the 8 bytes of the digest
+ * @return 0
+ */
+static int xxh64_final(checksum_context_t *context, uint8_t *digest) {
+    typeof(context->state.xxh64) *state = &context->state.xxh64;
+    uint64_t *v = state->accumulators;
+    uint64_t hash;
+    if (state->total_size >= 32) {
+        hash = rotate_left(v[0], 1) + rotate_left(v[1], 7) + rotate_left(v[2], 12) + rotate_left(v[3], 18);
+        for (int i = 0; i < 4; ++i) {
+            hash = xxh64_merge_round(hash, v[i]);
+        }
+    } else {
+        hash = v[2] + XXH_PRIME64_5; // v[2] is still the seed (0)
+    }
+    hash += state->total_size;
+
+    const uint8_t *cursor = state->buffer;
+    const uint8_t *end = state->buffer + state->buffered;
+    for (; cursor + 8 <= end; cursor += 8) {
+        hash ^= xxh64_round(0, read_le64(cursor));
+        hash = rotate_left(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+    if (cursor + 4 <= end) {
+        hash ^= (uint64_t) read_le32(cursor) * XXH_PRIME64_1;
+        hash = rotate_left(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        cursor += 4;
+    }
+    for (; cursor < end; ++cursor) {
+        hash ^= *cursor * XXH_PRIME64_5;
+        hash = rotate_left(hash, 11) * XXH_PRIME64_1;
+    }
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME64_3;
+    hash ^= hash >> 32;
+
+    for (int i = 0; i < 8; ++i) {
+        digest[i] = (uint8_t) (hash >> (56 - 8 * i));
+    }
+    return 0;
+}
+
+#define CRC32C_POLYNOMIAL 0x82F63B78 // Castagnoli, reflected
+
+static uint32_t crc32c_table[8][256];
+
+/*!
+ * @brief crc32c_software computes a CRC32C 8 bytes at a time with slicing tables
+ * @param crc the current (inverted) CRC
+ * @param data the data
+ * @param size the size of data
+ * @return the updated CRC
+ */
+static uint32_t crc32c_software(uint32_t crc, const uint8_t *data, size_t size) {
+    for (; size >= 8; data += 8, size -= 8) {
+        uint64_t word = read_le64(data) ^ crc;
+        crc = crc32c_table[7][word & 0xFF] ^ crc32c_table[6][(word >> 8) & 0xFF] ^ crc32c_table[5][(word >> 16) & 0xFF]
+              ^ crc32c_table[4][(word >> 24) & 0xFF] ^ crc32c_table[3][(word >> 32) & 0xFF] ^ crc32c_table[2][(word >> 40) & 0xFF]
+              ^ crc32c_table[1][(word >> 48) & 0xFF] ^ crc32c_table[0][word >> 56];
+    }
+    for (; size > 0; ++data, --size) {
+        crc = crc32c_table[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+/*!
+ * @brief crc32c_sse42 computes a CRC32C with the SSE4.2 crc32 instruction
+ * @param crc the current (inverted) CRC
+ * @param data the data
+ * @param size the size of data
+ * @return the updated CRC
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *data, size_t size) {
+    uint64_t crc64 = crc;
+    for (; size >= 8; data += 8, size -= 8) {
+        crc64 = _mm_crc32_u64(crc64, read_le64(data));
+    }
+    crc = (uint32_t) crc64;
+    for (; size > 0; ++data, --size) {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+    return crc;
+}
+#endif
+
+// Implementation picked once, by the first thread computing a CRC32C
+static uint32_t (*crc32c_implementation)(uint32_t crc, const uint8_t *data, size_t size) = NULL;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/*!
+ * @brief crc32c_select picks the implementation of the CPU, and fills the table of the software one
+ * pthread_once makes the table and the pointer visible to all the threads once it returns.
+ */
+static void crc32c_select(void) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc32c_implementation = crc32c_sse42;
+        return;
+    }
+#endif
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLYNOMIAL : 0);
+        }
+        crc32c_table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (int slice = 1; slice < 8; ++slice) {
+            crc32c_table[slice][i] = (crc32c_table[slice - 1][i] >> 8) ^ crc32c_table[0][crc32c_table[slice - 1][i] & 0xFF];
+        }
+    }
+    crc32c_implementation = crc32c_software;
+}
+
+/*!
+ * @brief crc32c_init starts a CRC32C, picking its implementation the first time
+ * @param context the context of the computation
+ * @return 0
+ */
+static int crc32c_init(checksum_context_t *context) {
+    pthread_once(&crc32c_once, crc32c_select);
+    context->state.crc32c = 0xFFFFFFFF;
+    return 0;
+}
+
+/*!
+ * @brief crc32c_update adds data to a CRC32C
+ * @param context the context of the computation
+ * @param data the data
+ * @param size the size of data
+ * @return 0
+ */
+static int crc32c_update(checksum_context_t *context, const uint8_t *data, size_t size) {
+    context->state.crc32c = crc32c_implementation(context->state.crc32c, data, size);
+    return 0;
+}
+
+/*!
+ * @brief crc32c_final ends a CRC32C
+ * @param context the context of the computation
+ * @param digest receives the 4 bytes of the digest
+ * @return 0
+ */
+static int crc32c_final(checksum_context_t *context, uint8_t *digest) {
+    uint32_t crc = ~context->state.crc32c;
+    for (int i = 0; i < 4; ++i) {
+        digest[i] = (uint8_t) (crc >> (24 - 8 * i));
+    }
+    return 0;
+}
+
+static const checksum_backend_t backends[CHECKSUM_TYPES_COUNT] = {
+        [CHECKSUM_MD5] = {"md5", 16, md5_init, evp_update, evp_final},
+        [CHECKSUM_XXH64] = {"xxh64", 8, xxh64_init, xxh64_update, xxh64_final},
+        [CHECKSUM_BLAKE2S] = {"blake2s", 32, blake2s_init, evp_update, evp_final},
+        [CHECKSUM_CRC32C] = {"crc32c", 4, crc32c_init, crc32c_update, crc32c_final},
+};
+
+/*!
+ * @brief checksum_init starts the computation of a checksum
+ * @param context is the context of the computation
+ * @param type is the checksum to compute
+ * @return 0 in case of success, -1 else
+ */
+int checksum_init(checksum_context_t *context, checksum_type_t type) {
+    if (!context || type <= CHECKSUM_NONE || type >= CHECKSUM_TYPES_COUNT) {
+        return -1;
+    }
+    context->type = type;
+    return backends[type].init(context);
+}
+
+/*!
+ * @brief checksum_update adds data to a checksum
+ * @param context is the context of the computation
+ * @param data is the data
+ * @param size is the size of data
+ * @return 0 in case of success, -1 else
+ */
+int checksum_update(checksum_context_t *context, const void *data, size_t size) {
+    return backends[context->type].update(context, data, size);
+}
+
+/*!
+ * @brief checksum_final ends the computation of a checksum and frees its context
+ * @param context is the context of the computation
+ * @param digest receives the checksum (@see checksum_size)
+ * @return 0 in case of success, -1 else
+ */
+int checksum_final(checksum_context_t *context, uint8_t *digest) {
+    return backends[context->type].final(context, digest);
+}
+
+/*!
+ * @brief checksum_size gives the size of the digests of a checksum
+ * @param type is the checksum
+ * @return the size in bytes, 0 for CHECKSUM_NONE or an invalid type
+ */
+size_t checksum_size(checksum_type_t type) {
+    return (type > CHECKSUM_NONE && type < CHECKSUM_TYPES_COUNT) ? backends[type].digest_size : 0;
+}
+
+/*!
+ * @brief checksum_name gives the name of a checksum, as used by the --checksum option
+ * @param type is the checksum
+ * @return its name
+ */
+const char *checksum_name(checksum_type_t type) {
+    return (type > CHECKSUM_NONE && type < CHECKSUM_TYPES_COUNT) ? backends[type].name : "none";
+}
+
+/*!
+ * @brief checksum_from_name finds a checksum by its name
+ * @param name is the name
+ * @return the checksum, CHECKSUM_NONE if unknown
+ */
+checksum_type_t checksum_from_name(const char *name) {
+    for (int type = CHECKSUM_NONE + 1; type < CHECKSUM_TYPES_COUNT; ++type) {
+        if (strcasecmp(name, backends[type].name) == 0) {
+            return type;
+        }
+    }
+    return CHECKSUM_NONE;
+}
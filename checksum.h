@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Largest digest of all the backends
+#define CHECKSUM_SIZE_MAX 32
+
+typedef enum {
+    CHECKSUM_NONE, // No checksum computed
+    CHECKSUM_MD5,
+    CHECKSUM_XXH64,
+    CHECKSUM_BLAKE2S,
+    CHECKSUM_CRC32C,
+    CHECKSUM_TYPES_COUNT
+} checksum_type_t;
+
+typedef struct {
+    checksum_type_t type;
+    union {
+        void *evp; // EVP_MD_CTX of the OpenSSL backends
+        struct {
+            uint64_t accumulators[4];
+            uint8_t buffer[32];
+            size_t buffered;
+            uint64_t total_size;
+        } xxh64;
+        uint32_t crc32c;
+    } state;
+} checksum_context_t;
+
+int checksum_init(checksum_context_t *context, checksum_type_t type);
+int checksum_update(checksum_context_t *context, const void *data, size_t size);
+int checksum_final(checksum_context_t *context, uint8_t *digest);
+size_t checksum_size(checksum_type_t type);
+const char *checksum_name(checksum_type_t type);
+checksum_type_t checksum_from_name(const char *name);
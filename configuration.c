@@ -5,7 +5,7 @@
 #include <stdio.h>
 #include <string.h>
 
-typedef enum { DATE_SIZE_ONLY, NO_PARALLEL, DRY_RUN, VERBOSE } long_opt_values;
+typedef enum { DATE_SIZE_ONLY, NO_PARALLEL, DRY_RUN, VERBOSE, CACHE_DIR, REBUILD_CACHE, THREADS, TRANSPORT, CHECKSUM, READ_ENGINE, DELTA, COPY_WORKERS, COPY_BUDGET, PIPELINE, MAX_MEMORY, WATCH, STATS, TRACE, DEDUP, TREE, STAT_ENGINE, STAT_QUEUE_DEPTH } long_opt_values;
 
 /*!
  * @brief function display_help displays a brief manual for the program usage
@@ -16,10 +16,56 @@ void display_help(char *my_name) {
     printf("%s [options] source_dir destination_dir\n", my_name);
     printf("Options: \t-n <processes count>\tnumber of processes for file calculations\n");
     printf("         \t-h display help (this text)\n");
-    printf("         \t--date_size_only disables MD5 calculation for files\n");
+    printf("         \t--date_size_only disables checksum calculation for files\n");
+    printf("         \t--checksum=md5|xxh64|blake2s|crc32c selects the checksum of the files contents (md5 by default; xxh64 and blake2s stand in for xxh3 and blake3, with no AVX2/AVX-512 code paths)\n");
     printf("         \t--no-parallel disables parallel computing (cancels values of option -n)\n");
+    printf("         \t--threads <threads count> runs the parallel mode in threads of this process instead of processes\n");
     printf("         \t--dry-run perform a trial run with no changes made\n");
     printf("         \t-v enable verbose mode\n");
+    printf("         \t--cache-dir <dir> keeps the checksums of unchanged files in a cache in <dir>\n");
+    printf("         \t--rebuild-cache drops the cached checksums and computes them again\n");
+    printf("         \t--transport=mq|shm exchanges data between processes through a message queue (default) or shared memory rings\n");
+    printf("         \t--read-engine=read|io_uring reads the files to hash with read() (default) or several io_uring reads in flight\n");
+    printf("         \t--delta <MiB> only writes the changed blocks of existing files of at least <MiB> MiB\n");
+    printf("         \t--copy-workers <n> copies the differences with <n> threads once the comparison is done\n");
+    printf("         \t--copy-budget <MiB> limits the bytes of large files copied at once by the copy workers (256 by default)\n");
+    printf("         \t--pipeline walks both directories at once and copies the differences while they are walked (no processes, -n threads hash the files)\n");
+    printf("         \t--max-memory <size> sorts the lists on disk to keep them under <size> MiB (or K, M, G suffixed)\n");
+    printf("         \t--watch keeps copying the changes of the source once it is synchronized, until interrupted\n");
+    printf("         \t--stats[=<file>] writes the counters and timings of each phase as JSON, to <file> or the standard output\n");
+    printf("         \t--trace=<file> writes the timeline of every process and thread to <file>, for chrome://tracing or Perfetto\n");
+    printf("         \t--tree compares the directories one by one, in parallel with --threads, copying the entries of missing directories without comparison\n");
+    printf("         \t--dedup[=reflink|link] clones (default) or hard links (same mode and mtime only) the files whose content was already copied\n");
+    printf("         \t--stat-engine=lstat|threads|io_uring makes the analyzer processes read the stats one by one (default), from threads or as io_uring statx\n");
+    printf("         \t--stat-queue-depth <n> reads up to <n> stats at once with --stat-engine (32 by default)\n");
+}
+
+/*!
+ * @brief parse_size reads a size in MiB, or in KiB, MiB or GiB with a K, M or G suffix
+ * @param text is the size
+ * @return the size in bytes, 0 if it is invalid
+ */
+static uint64_t parse_size(const char *text) {
+    char *end;
+    uint64_t size = strtoull(text, &end, 10);
+    if (end == text) {
+        return 0;
+    }
+    switch (*end) {
+        case 'K':
+        case 'k':
+            return end[1] == '\0' ? size * 1024 : 0;
+        case 'G':
+        case 'g':
+            return end[1] == '\0' ? size * 1024 * 1024 * 1024 : 0;
+        case 'M':
+        case 'm':
+            return end[1] == '\0' ? size * 1024 * 1024 : 0;
+        case '\0':
+            return size * 1024 * 1024;
+        default:
+            return 0;
+    }
 }
 
 /*!
@@ -33,7 +79,8 @@ void init_configuration(configuration_t *the_config) {
         the_config->processes_count = 1; // Default to a single process
         the_config->is_parallel = true; // Default to parallel computing
         the_config->uses_md5 = true; // Default to calculating MD5 for files
-        the_config->uses_dry_run = false; // Default to not performing a dry run
+        the_config->checksum_type = CHECKSUM_MD5;
+        the_config->dry_run = false; // Default to not performing a dry run
         the_config->verbose = false; // Default to non-verbose mode
     }
 }
@@ -57,6 +104,24 @@ int set_configuration(configuration_t *the_config, int argc, char *argv[]) {
             {"no-parallel", no_argument, NULL, NO_PARALLEL},
             {"dry-run", no_argument, NULL, DRY_RUN},
             {"verbose", no_argument, NULL, VERBOSE},
+            {"cache-dir", required_argument, NULL, CACHE_DIR},
+            {"rebuild-cache", no_argument, NULL, REBUILD_CACHE},
+            {"threads", required_argument, NULL, THREADS},
+            {"transport", required_argument, NULL, TRANSPORT},
+            {"checksum", required_argument, NULL, CHECKSUM},
+            {"read-engine", required_argument, NULL, READ_ENGINE},
+            {"delta", required_argument, NULL, DELTA},
+            {"copy-workers", required_argument, NULL, COPY_WORKERS},
+            {"copy-budget", required_argument, NULL, COPY_BUDGET},
+            {"pipeline", no_argument, NULL, PIPELINE},
+            {"max-memory", required_argument, NULL, MAX_MEMORY},
+            {"watch", no_argument, NULL, WATCH},
+            {"stats", optional_argument, NULL, STATS},
+            {"trace", required_argument, NULL, TRACE},
+            {"dedup", optional_argument, NULL, DEDUP},
+            {"tree", no_argument, NULL, TREE},
+            {"stat-engine", required_argument, NULL, STAT_ENGINE},
+            {"stat-queue-depth", required_argument, NULL, STAT_QUEUE_DEPTH},
             {NULL, 0, NULL, 0}
     };
 
@@ -83,16 +148,151 @@ int set_configuration(configuration_t *the_config, int argc, char *argv[]) {
                 the_config->processes_count = 1; // Reset process count if parallel is disabled
                 break;
             case DRY_RUN:
-                the_config->uses_dry_run = true;
+                the_config->dry_run = true;
                 break;
             case VERBOSE:
                 the_config->verbose = true;
                 break;
+            case CACHE_DIR:
+                strncpy(the_config->cache_dir, optarg, sizeof(the_config->cache_dir) - 1);
+                the_config->cache_dir[sizeof(the_config->cache_dir) - 1] = '\0';
+                break;
+            case REBUILD_CACHE:
+                the_config->rebuild_cache = true;
+                break;
+            case THREADS:
+                if (atoi(optarg) <= 0 || atoi(optarg) > UINT8_MAX) {
+                    fprintf(stderr, "Error: Invalid number of threads.\n");
+                    return -1;
+                }
+                the_config->threads_count = atoi(optarg);
+                break;
+            case TRANSPORT:
+                if (strcmp(optarg, transport_name(TRANSPORT_MQ)) == 0) {
+                    the_config->transport = TRANSPORT_MQ;
+                } else if (strcmp(optarg, transport_name(TRANSPORT_SHM)) == 0) {
+                    the_config->transport = TRANSPORT_SHM;
+                } else {
+                    fprintf(stderr, "Error: Unknown transport %s.\n", optarg);
+                    return -1;
+                }
+                break;
+            case CHECKSUM:
+                the_config->checksum_type = checksum_from_name(optarg);
+                if (the_config->checksum_type == CHECKSUM_NONE) {
+                    fprintf(stderr, "Error: Unknown checksum %s.\n", optarg);
+                    return -1;
+                }
+                break;
+            case READ_ENGINE:
+                if (strcmp(optarg, read_engine_name(READ_ENGINE_SYNC)) == 0) {
+                    the_config->read_engine = READ_ENGINE_SYNC;
+                } else if (strcmp(optarg, read_engine_name(READ_ENGINE_IO_URING)) == 0) {
+                    the_config->read_engine = READ_ENGINE_IO_URING;
+                } else {
+                    fprintf(stderr, "Error: Unknown read engine %s.\n", optarg);
+                    return -1;
+                }
+                break;
+            case DELTA:
+                if (atoi(optarg) <= 0) {
+                    fprintf(stderr, "Error: Invalid delta threshold.\n");
+                    return -1;
+                }
+                the_config->delta_threshold = (uint64_t) atoi(optarg) * 1024 * 1024;
+                break;
+            case COPY_WORKERS:
+                if (atoi(optarg) <= 0 || atoi(optarg) > UINT8_MAX) {
+                    fprintf(stderr, "Error: Invalid number of copy workers.\n");
+                    return -1;
+                }
+                the_config->copy_workers = atoi(optarg);
+                break;
+            case COPY_BUDGET:
+                if (atoi(optarg) <= 0) {
+                    fprintf(stderr, "Error: Invalid copy budget.\n");
+                    return -1;
+                }
+                the_config->copy_budget = (uint64_t) atoi(optarg) * 1024 * 1024;
+                break;
+            case PIPELINE:
+                the_config->pipelined = true;
+                break;
+            case MAX_MEMORY:
+                if ((the_config->max_memory = parse_size(optarg)) == 0) {
+                    fprintf(stderr, "Error: Invalid memory limit.\n");
+                    return -1;
+                }
+                break;
+            case WATCH:
+                the_config->watch = true;
+                break;
+            case STATS:
+                the_config->stats = true;
+                if (optarg != NULL) {
+                    strncpy(the_config->stats_file, optarg, sizeof(the_config->stats_file) - 1);
+                    the_config->stats_file[sizeof(the_config->stats_file) - 1] = '\0';
+                }
+                break;
+            case TRACE:
+                strncpy(the_config->trace_file, optarg, sizeof(the_config->trace_file) - 1);
+                the_config->trace_file[sizeof(the_config->trace_file) - 1] = '\0';
+                break;
+            case TREE:
+                the_config->tree_diff = true;
+                break;
+            case STAT_ENGINE:
+                if (strcmp(optarg, stat_engine_name(STAT_ENGINE_LSTAT)) == 0) {
+                    the_config->stat_engine = STAT_ENGINE_LSTAT;
+                } else if (strcmp(optarg, stat_engine_name(STAT_ENGINE_THREADS)) == 0) {
+                    the_config->stat_engine = STAT_ENGINE_THREADS;
+                } else if (strcmp(optarg, stat_engine_name(STAT_ENGINE_IO_URING)) == 0) {
+                    the_config->stat_engine = STAT_ENGINE_IO_URING;
+                } else {
+                    fprintf(stderr, "Error: Unknown stat engine %s.\n", optarg);
+                    return -1;
+                }
+                break;
+            case STAT_QUEUE_DEPTH:
+                if (atoi(optarg) <= 0 || atoi(optarg) > STAT_ENGINE_MAX_QUEUE_DEPTH) {
+                    fprintf(stderr, "Error: Invalid stat queue depth.\n");
+                    return -1;
+                }
+                the_config->stat_queue_depth = atoi(optarg);
+                break;
+            case DEDUP:
+                the_config->dedup = optarg != NULL ? dedup_mode_from_name(optarg) : DEDUP_REFLINK;
+                if (the_config->dedup == DEDUP_NONE) {
+                    fprintf(stderr, "Error: Unknown deduplication %s.\n", optarg);
+                    return -1;
+                }
+                break;
             default:
                 return -1;
         }
     }
 
+    if (!the_config->is_parallel) {
+        the_config->threads_count = 0; // --no-parallel cancels --threads too
+    }
+    if (the_config->tree_diff) {
+        // Directories are compared by this process, on the pool with --threads
+        the_config->is_parallel = the_config->threads_count > 0;
+        the_config->pipelined = false;
+    }
+    if (the_config->pipelined) {
+        // The pipeline runs its own threads, it needs neither processes nor the pool
+        the_config->is_parallel = false;
+        the_config->threads_count = 0;
+    }
+    if (the_config->max_memory > 0) {
+        // Sorted runs are built by this process only, while the trees are walked
+        the_config->is_parallel = false;
+        the_config->threads_count = 0;
+        the_config->pipelined = false;
+        the_config->tree_diff = false;
+    }
+
     // Check for the remaining non-option arguments (source_dir and destination_dir)
     if (optind + 2 != argc) {
         fprintf(stderr, "Error: Incorrect number of arguments.\n");
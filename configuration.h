@@ -2,16 +2,40 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "transport.h"
+#include "checksum.h"
+#include "read-engine.h"
+#include "stat-engine.h"
+#include "dedup.h"
 
 typedef struct {
     char source[1024];
     char destination[1024];
     uint8_t processes_count;
+    uint8_t threads_count; // When not 0, parallel mode runs on a pool of threads instead of processes
     bool is_parallel;
-    bool uses_md5;
+    bool uses_md5; // Compare the contents (with checksum_type) when size and mtime can't decide
+    checksum_type_t checksum_type;
     bool date_size_only;
     bool verbose;
     bool dry_run;
+    char cache_dir[1024]; // Directory of the checksum cache, empty when disabled
+    bool rebuild_cache;
+    transport_kind_t transport; // Channel between the processes of the parallel mode
+    read_engine_kind_t read_engine; // How the contents of the files are read to compute their checksums
+    uint64_t delta_threshold; // Size from which existing files are updated by delta transfer, 0 when disabled
+    uint8_t copy_workers; // Threads applying the differences once they are all known, 0 to copy them while comparing
+    uint64_t copy_budget; // Bytes of large files copied at once by the copy workers, 0 for the default
+    bool pipelined; // Walk both trees in their own threads while they are compared
+    uint64_t max_memory; // Memory of the lists above which they are sorted on disk, 0 to keep them in memory
+    bool watch; // Keep synchronizing the changes of the source after the first synchronization
+    bool stats; // Report the counters and timings of the run
+    char stats_file[1024]; // File receiving the statistics, empty for the standard output
+    char trace_file[1024]; // File receiving the timeline of the run (Chrome trace format), empty when disabled
+    bool tree_diff; // Compare the trees directory by directory instead of as two sorted lists
+    dedup_mode_t dedup; // How a content already written to the destination is reused by the other files with it
+    stat_engine_kind_t stat_engine; // How the analyzers read the stats of the entries
+    uint16_t stat_queue_depth; // Stats read at once by the stat engine, 0 for the default
 
 } configuration_t;
 
@@ -0,0 +1,174 @@
+#define _GNU_SOURCE // copy_file_range
+#include "copy-engine.h"
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*
+ * The copy engine moves the content of a file without bringing it to user space. It first asks the
+ * filesystem for a clone (FICLONE), which shares the blocks and costs nothing. Otherwise the data ranges of
+ * the source (found with SEEK_DATA/SEEK_HOLE) are copied one by one with copy_file_range, or sendfile when
+ * copy_file_range is not supported between the two files: holes are not written, the destination stays sparse.
+ */
+
+/*!
+ * @brief clone_file_contents makes a file share all the blocks of another one (FICLONE), without copying them
+ * @param source_fd is the source file, opened for reading
+ * @param destination_fd is the destination file, opened for writing
+ * @return 0 in case of success, -1 else (errno is set, EXDEV or EOPNOTSUPP when the filesystem can't)
+ */
+int clone_file_contents(int source_fd, int destination_fd) {
+    return ioctl(destination_fd, FICLONE, source_fd) == 0 ? 0 : -1;
+}
+
+/*!
+ * @brief is_unsupported tells if an error means that a strategy can't be used for these files
+ * @param error is the errno of the failed call
+ * @return true if another strategy must be tried
+ */
+static bool is_unsupported(int error) {
+    return error == EXDEV || error == ENOSYS || error == EOPNOTSUPP || error == EINVAL;
+}
+
+/*!
+ * @brief copy_range copies a range of the source at the same offset in the destination
+ * @param source_fd is the source file
+ * @param destination_fd is the destination file
+ * @param offset is the start of the range
+ * @param length is the length of the range
+ * @param report is updated with the strategy used and the bytes copied
+ * @return 0 in case of success, -1 else (errno is set)
+ */
+static int copy_range(int source_fd, int destination_fd, off_t offset, uint64_t length, copy_report_t *report) {
+    if (report->strategy != COPY_STRATEGY_SENDFILE) {
+        loff_t source_offset = offset, destination_offset = offset;
+        while (length > 0) {
+            ++report->syscalls;
+            ssize_t copied = copy_file_range(source_fd, &source_offset, destination_fd, &destination_offset, length, 0);
+            if (copied == -1 && errno == EINTR) {
+                continue;
+            }
+            if (copied == -1 && is_unsupported(errno) && report->strategy != COPY_STRATEGY_COPY_FILE_RANGE) {
+                break; // First call: use sendfile for this file
+            }
+            if (copied == -1) {
+                return -1;
+            }
+            if (copied == 0) {
+                return 0; // The source was truncated while being copied
+            }
+            report->strategy = COPY_STRATEGY_COPY_FILE_RANGE;
+            report->bytes_copied += copied;
+            length -= copied;
+        }
+        if (length == 0) {
+            return 0;
+        }
+        offset = source_offset;
+    }
+
+    // sendfile writes at the position of the destination
+    report->strategy = COPY_STRATEGY_SENDFILE;
+    ++report->syscalls;
+    if (lseek(destination_fd, offset, SEEK_SET) == -1) {
+        return -1;
+    }
+    while (length > 0) {
+        size_t chunk = length < COPY_ENGINE_SENDFILE_CHUNK ? length : COPY_ENGINE_SENDFILE_CHUNK;
+        ++report->syscalls;
+        ssize_t copied = sendfile(destination_fd, source_fd, &offset, chunk);
+        if (copied == -1 && errno == EINTR) {
+            continue;
+        }
+        if (copied == -1) {
+            return -1;
+        }
+        if (copied == 0) {
+            return 0;
+        }
+        report->bytes_copied += copied;
+        length -= copied;
+    }
+    return 0;
+}
+
+/*!
+ * @brief copy_file_contents copies the content of a file into an empty destination, keeping its holes
+ * The mode and times of the destination are left to the caller.
+ * @param source_fd is the source file, opened for reading
+ * @param destination_fd is the destination file, opened for writing and empty
+ * @param size is the size of the source
+ * @param report receives the strategy used and the bytes copied
+ * @return 0 in case of success, -1 else (errno is set)
+ */
+int copy_file_contents(int source_fd, int destination_fd, uint64_t size, copy_report_t *report) {
+    report->strategy = COPY_STRATEGY_NONE;
+    report->bytes_copied = 0;
+    report->has_holes = false;
+    report->syscalls = 0;
+    if (size == 0) {
+        return 0;
+    }
+
+    ++report->syscalls;
+    if (clone_file_contents(source_fd, destination_fd) == 0) {
+        report->strategy = COPY_STRATEGY_CLONE;
+        report->bytes_copied = size;
+        return 0;
+    }
+
+    off_t offset = 0;
+    while ((uint64_t) offset < size) {
+        report->syscalls += 2; // SEEK_DATA and SEEK_HOLE
+        off_t data = lseek(source_fd, offset, SEEK_DATA);
+        if (data == -1 && errno == ENXIO) {
+            break; // Only a hole up to the end
+        }
+        off_t hole = data == -1 ? -1 : lseek(source_fd, data, SEEK_HOLE);
+        if (data == -1 || hole == -1) {
+            // SEEK_DATA/SEEK_HOLE unsupported: everything is data
+            data = offset;
+            hole = size;
+        }
+        if ((uint64_t) hole > size) {
+            hole = size;
+        }
+        if (data > offset) {
+            report->has_holes = true;
+        }
+        if (data >= hole) {
+            break;
+        }
+        if (copy_range(source_fd, destination_fd, data, hole - data, report) == -1) {
+            return -1;
+        }
+        offset = hole;
+    }
+    if ((uint64_t) offset < size) {
+        report->has_holes = true;
+    }
+
+    // Trailing holes are not written: give the destination its size
+    ++report->syscalls;
+    return ftruncate(destination_fd, size);
+}
+
+/*!
+ * @brief copy_strategy_name gives the name of a strategy, to report it
+ * @param strategy is the strategy
+ * @return its name
+ */
+const char *copy_strategy_name(copy_strategy_t strategy) {
+    switch (strategy) {
+        case COPY_STRATEGY_CLONE:
+            return "clone";
+        case COPY_STRATEGY_COPY_FILE_RANGE:
+            return "copy_file_range";
+        case COPY_STRATEGY_SENDFILE:
+            return "sendfile";
+        default:
+            return "empty";
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Largest block given to sendfile, which moves less than 2 GiB per call
+#define COPY_ENGINE_SENDFILE_CHUNK (64 * 1024 * 1024)
+
+typedef enum {
+    COPY_STRATEGY_NONE, // Nothing to copy (empty file or only holes)
+    COPY_STRATEGY_CLONE, // FICLONE: the destination shares the blocks of the source (btrfs, XFS...)
+    COPY_STRATEGY_COPY_FILE_RANGE, // Copy in the kernel, offloaded to the filesystem when it can
+    COPY_STRATEGY_SENDFILE, // Copy through the page cache
+} copy_strategy_t;
+
+typedef struct {
+    copy_strategy_t strategy; // Last strategy used for the data
+    uint64_t bytes_copied; // Bytes of data copied (holes excluded)
+    bool has_holes; // True when holes of the source were kept as holes
+    uint64_t syscalls; // System calls made for the copy
+} copy_report_t;
+
+int clone_file_contents(int source_fd, int destination_fd);
+int copy_file_contents(int source_fd, int destination_fd, uint64_t size, copy_report_t *report);
+const char *copy_strategy_name(copy_strategy_t strategy);
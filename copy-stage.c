@@ -0,0 +1,275 @@
+#include "copy-stage.h"
+#include "sync.h"
+#include "stats.h"
+#include "trace.h"
+#include "read-engine.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * The copy stage applies the differences with several threads, since copying many small files is bound
+ * by the latency of each open/copy/close, not by the bandwidth.
+ * Entries are submitted in the order of the list, while the workers already copy: directories are created
+ * at once by the submitting thread, so parents always exist before their children are handed out. Files go
+ * to two queues: small files, which are always handed out, and large files, which are only handed out while
+ * the bytes of the large files being copied fit in the budget. A few huge files can't hold all the workers
+ * (and the disk) while thousands of small files wait.
+ * Each worker keeps the errors of its copies, they are printed once all the copies are done.
+ */
+
+typedef struct {
+    files_list_entry_t **entries;
+    size_t count;
+    size_t next;
+    size_t capacity;
+} copy_queue_t;
+
+typedef struct {
+    copy_stage_t *stage;
+    pthread_t thread;
+    copy_error_t *errors;
+    size_t errors_count;
+    size_t errors_capacity;
+    size_t files_copied;
+    uint64_t bytes_copied;
+} copy_worker_t;
+
+struct _copy_stage {
+    configuration_t *the_config;
+    copy_queue_t small_files;
+    copy_queue_t large_files;
+    uint64_t budget;
+    uint64_t small_file_limit;
+    uint64_t large_in_flight; // Bytes of the large files being copied
+    bool closed; // No more entries will be submitted
+    pthread_mutex_t lock;
+    pthread_cond_t changed; // New files, budget released or stage closed
+    copy_worker_t submitter; // Errors of the directories, created by the submitting thread
+    copy_worker_t *workers;
+    int workers_count;
+};
+
+/*!
+ * @brief print_copy_error prints why the copy of an entry failed
+ * @param error is the error
+ */
+void print_copy_error(copy_error_t *error) {
+    fprintf(stderr, "Error %s %s: %s\n", error->operation, error->path, strerror(error->error_number));
+}
+
+/*!
+ * @brief add_worker_error keeps an error in the list of a worker
+ * @param worker is the worker
+ * @param error is the error
+ */
+static void add_worker_error(copy_worker_t *worker, copy_error_t *error) {
+    if (worker->errors_count == worker->errors_capacity) {
+        size_t new_capacity = worker->errors_capacity ? 2 * worker->errors_capacity : 16;
+        copy_error_t *new_errors = realloc(worker->errors, new_capacity * sizeof(copy_error_t));
+        if (!new_errors) {
+            print_copy_error(error); // Not kept, but not lost
+            return;
+        }
+        worker->errors = new_errors;
+        worker->errors_capacity = new_capacity;
+    }
+    worker->errors[worker->errors_count++] = *error;
+}
+
+/*!
+ * @brief take_next_file gives a worker its next file, waiting for files or for the budget
+ * @param stage is the copy stage
+ * @param is_large is set to true when the file is charged to the budget
+ * @return the entry to copy, NULL when the stage is closed and all the files are handed out
+ */
+static files_list_entry_t *take_next_file(copy_stage_t *stage, bool *is_large) {
+    files_list_entry_t *entry = NULL;
+    pthread_mutex_lock(&stage->lock);
+    while (entry == NULL) {
+        copy_queue_t *large = &stage->large_files, *small = &stage->small_files;
+        if (large->next < large->count) {
+            files_list_entry_t *candidate = large->entries[large->next];
+            // A file larger than the whole budget is copied alone
+            if (stage->large_in_flight == 0 || stage->large_in_flight + candidate->size <= stage->budget) {
+                entry = candidate;
+                ++large->next;
+                stage->large_in_flight += candidate->size;
+                *is_large = true;
+                break;
+            }
+        }
+        if (small->next < small->count) {
+            entry = small->entries[small->next++];
+            *is_large = false;
+        } else if (stage->closed && large->next == large->count) {
+            break;
+        } else {
+            pthread_cond_wait(&stage->changed, &stage->lock);
+        }
+    }
+    pthread_mutex_unlock(&stage->lock);
+    return entry;
+}
+
+/*!
+ * @brief copy_worker copies files until the stage is closed and all of them are handed out
+ * @param parameters is the copy_worker_t of the thread
+ * @return NULL
+ */
+static void *copy_worker(void *parameters) {
+    copy_worker_t *worker = (copy_worker_t *) parameters;
+    copy_stage_t *stage = worker->stage;
+    stats_set_role("copy worker", (int) (worker - stage->workers));
+    trace_set_role("copy worker", (int) (worker - stage->workers));
+    bool is_large = false;
+    files_list_entry_t *entry;
+    while ((entry = take_next_file(stage, &is_large)) != NULL) {
+        copy_error_t error;
+        if (copy_entry(entry, stage->the_config, &error) == -1) {
+            add_worker_error(worker, &error);
+        } else {
+            ++worker->files_copied;
+            worker->bytes_copied += entry->size;
+        }
+        if (is_large) {
+            pthread_mutex_lock(&stage->lock);
+            stage->large_in_flight -= entry->size;
+            pthread_cond_broadcast(&stage->changed);
+            pthread_mutex_unlock(&stage->lock);
+        }
+    }
+    read_engine_release(); // Buffers of the files hashed for the deduplication
+    return NULL;
+}
+
+/*!
+ * @brief copy_stage_start starts the_config->copy_workers copy threads
+ * @param the_config is a pointer to the configuration (copy_workers and copy_budget)
+ * @return the stage, NULL if no thread could be started
+ */
+copy_stage_t *copy_stage_start(configuration_t *the_config) {
+    copy_stage_t *stage = calloc(1, sizeof(copy_stage_t));
+    int workers_count = the_config->copy_workers > 0 ? the_config->copy_workers : 1;
+    if (!stage || !(stage->workers = calloc(workers_count, sizeof(copy_worker_t)))) {
+        free(stage);
+        return NULL;
+    }
+    stage->the_config = the_config;
+    stage->budget = the_config->copy_budget > 0 ? the_config->copy_budget : COPY_STAGE_DEFAULT_BUDGET;
+    stage->small_file_limit = stage->budget / workers_count;
+    stage->submitter.stage = stage;
+    pthread_mutex_init(&stage->lock, NULL);
+    pthread_cond_init(&stage->changed, NULL);
+    for (; stage->workers_count < workers_count; ++stage->workers_count) {
+        copy_worker_t *worker = &stage->workers[stage->workers_count];
+        worker->stage = stage;
+        if (pthread_create(&worker->thread, NULL, copy_worker, worker) != 0) {
+            break;
+        }
+    }
+    if (stage->workers_count == 0) {
+        pthread_cond_destroy(&stage->changed);
+        pthread_mutex_destroy(&stage->lock);
+        free(stage->workers);
+        free(stage);
+        return NULL;
+    }
+    return stage;
+}
+
+/*!
+ * @brief copy_stage_submit hands an entry over to the copy stage
+ * Directories are created at once, in the calling thread. Entries must be submitted parents first.
+ * @param stage is the stage
+ * @param entry is the entry to copy, it must remain valid until copy_stage_finish
+ */
+void copy_stage_submit(copy_stage_t *stage, files_list_entry_t *entry) {
+    if (entry->entry_type == DOSSIER) {
+        copy_error_t error;
+        if (copy_entry(entry, stage->the_config, &error) == -1) {
+            add_worker_error(&stage->submitter, &error);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&stage->lock);
+    copy_queue_t *queue = entry->size <= stage->small_file_limit ? &stage->small_files : &stage->large_files;
+    if (queue->count == queue->capacity) {
+        size_t new_capacity = queue->capacity ? 2 * queue->capacity : 1024;
+        files_list_entry_t **new_entries = realloc(queue->entries, new_capacity * sizeof(files_list_entry_t *));
+        if (!new_entries) {
+            pthread_mutex_unlock(&stage->lock);
+            copy_entry_to_destination(entry, stage->the_config); // Copied here instead
+            return;
+        }
+        queue->entries = new_entries;
+        queue->capacity = new_capacity;
+    }
+    queue->entries[queue->count++] = entry;
+    stats_queue_depth(STATS_QUEUE_COPY_STAGE, stage->small_files.count - stage->small_files.next + stage->large_files.count - stage->large_files.next);
+    pthread_cond_signal(&stage->changed);
+    pthread_mutex_unlock(&stage->lock);
+}
+
+/*!
+ * @brief copy_stage_finish waits for the copies of all the submitted entries, prints the errors and frees
+ * the stage
+ * @param stage is the stage
+ * @return the number of entries that could not be copied
+ */
+size_t copy_stage_finish(copy_stage_t *stage) {
+    pthread_mutex_lock(&stage->lock);
+    stage->closed = true;
+    pthread_cond_broadcast(&stage->changed);
+    pthread_mutex_unlock(&stage->lock);
+    for (int i = 0; i < stage->workers_count; ++i) {
+        pthread_join(stage->workers[i].thread, NULL);
+    }
+
+    size_t errors_count = 0;
+    for (int i = -1; i < stage->workers_count; ++i) {
+        copy_worker_t *worker = i < 0 ? &stage->submitter : &stage->workers[i];
+        for (size_t j = 0; j < worker->errors_count; ++j) {
+            print_copy_error(&worker->errors[j]);
+        }
+        errors_count += worker->errors_count;
+        if (i >= 0 && stage->the_config->verbose) {
+            printf("Copy worker %d: %zu files, %lu bytes\n", i, worker->files_copied, (unsigned long) worker->bytes_copied);
+        }
+        free(worker->errors);
+    }
+    if (errors_count > 0) {
+        fprintf(stderr, "%zu entries could not be copied\n", errors_count);
+    }
+
+    pthread_cond_destroy(&stage->changed);
+    pthread_mutex_destroy(&stage->lock);
+    free(stage->small_files.entries);
+    free(stage->large_files.entries);
+    free(stage->workers);
+    free(stage);
+    return errors_count;
+}
+
+/*!
+ * @brief copy_stage_run applies a list of differences to the destination with the_config->copy_workers threads
+ * @param diff_list is the list of the entries to copy, parents before their children
+ * @param the_config is a pointer to the configuration (copy_workers and copy_budget)
+ * @return the number of entries that could not be copied
+ */
+size_t copy_stage_run(files_list_t *diff_list, configuration_t *the_config) {
+    copy_stage_t *stage = copy_stage_start(the_config);
+    if (!stage) {
+        fprintf(stderr, "Unable to start the copy workers, copying sequentially\n");
+        for (files_list_entry_t *cursor = diff_list->head; cursor != NULL; cursor = cursor->next) {
+            copy_entry_to_destination(cursor, the_config);
+        }
+        return 0;
+    }
+    for (files_list_entry_t *cursor = diff_list->head; cursor != NULL; cursor = cursor->next) {
+        copy_stage_submit(stage, cursor);
+    }
+    return copy_stage_finish(stage);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "defines.h"
+#include "files-list.h"
+#include "configuration.h"
+
+// Default in-flight byte budget of the large files being copied
+#define COPY_STAGE_DEFAULT_BUDGET (256 * 1024 * 1024)
+
+// Why the copy of an entry failed
+typedef struct {
+    char path[PATH_SIZE];
+    const char *operation; // Operation that failed, e.g. "opening source file"
+    int error_number;
+} copy_error_t;
+
+typedef struct _copy_stage copy_stage_t;
+
+void print_copy_error(copy_error_t *error);
+copy_stage_t *copy_stage_start(configuration_t *the_config);
+void copy_stage_submit(copy_stage_t *stage, files_list_entry_t *entry);
+size_t copy_stage_finish(copy_stage_t *stage);
+size_t copy_stage_run(files_list_t *diff_list, configuration_t *the_config);
@@ -0,0 +1,237 @@
+#include "dedup.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The deduplication index maps the contents written to the destination during a synchronization, by size
+ * and checksum, to the first destination file holding them. Another file with the same content is then
+ * cloned from it (FICLONE, the files share their blocks until one of them is written) or, when the user
+ * opts in, hard linked to it, instead of being copied. As with the hard links (@see hard-links.h), a file
+ * whose content is being copied by another copy worker waits for the end of that copy.
+ * Contents are identified by their size and BLAKE2s checksum, whatever the checksum of the comparison: files
+ * are cloned or linked on a match without comparing their bytes, so the checksum must resist crafted
+ * collisions, which MD5 doesn't.
+ * Hard links share mode and mtime, so in DEDUP_LINK mode they are part of the key too: each set of files with
+ * the same content and attributes has its own first file.
+ * The index is emptied before each comparison of the trees, with the counts of saved files and bytes.
+ */
+
+static pthread_mutex_t contents_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t contents_changed = PTHREAD_COND_INITIALIZER; // A copy of a first file ended
+static dedup_content_t *contents = NULL; // Open addressing table
+static size_t contents_capacity = 0; // Always a power of 2
+static size_t contents_count = 0;
+static uint64_t saved_files = 0;
+static uint64_t saved_bytes = 0;
+static bool key_attributes = false; // Mode and mtime are part of the key (DEDUP_LINK)
+
+static const char *mode_names[] = {"none", "reflink", "link"};
+
+/*!
+ * @brief dedup_mode_from_name gives the mode of a --dedup option
+ * @param name is the name of the mode
+ * @return the mode, DEDUP_NONE if the name is unknown
+ */
+dedup_mode_t dedup_mode_from_name(const char *name) {
+    for (dedup_mode_t mode = DEDUP_REFLINK; mode <= DEDUP_LINK; ++mode) {
+        if (strcmp(name, mode_names[mode]) == 0) {
+            return mode;
+        }
+    }
+    return DEDUP_NONE;
+}
+
+/*!
+ * @brief dedup_mode_name gives the name of a mode, as used by the --dedup option
+ * @param mode is the mode
+ * @return its name
+ */
+const char *dedup_mode_name(dedup_mode_t mode) {
+    return mode <= DEDUP_LINK ? mode_names[mode] : "unknown";
+}
+
+/*!
+ * @brief dedup_checksum_type gives the checksum identifying the contents
+ * @return the checksum
+ */
+checksum_type_t dedup_checksum_type(void) {
+    return CHECKSUM_BLAKE2S;
+}
+
+/*!
+ * @brief content_hash hashes the key of a content
+ * @param size is the size of the content
+ * @param checksum is its checksum (its first 8 bytes are enough)
+ * @return the hash
+ */
+static uint64_t content_hash(uint64_t size, const uint8_t *checksum) {
+    uint64_t value;
+    memcpy(&value, checksum, sizeof(value));
+    value ^= size * 0x9E3779B97F4A7C15ULL;
+    value ^= value >> 31;
+    value *= 0xBF58476D1CE4E5B9ULL;
+    return value ^ (value >> 29);
+}
+
+/*!
+ * @brief is_same_key tells if a record is the one of a content
+ * @param content is the record
+ * @param key is a record with the key of the content
+ * @return true if the keys are the same
+ */
+static bool is_same_key(dedup_content_t *content, dedup_content_t *key) {
+    if (content->size != key->size || content->checksum_type != key->checksum_type
+        || memcmp(content->checksum, key->checksum, checksum_size(key->checksum_type)) != 0) {
+        return false;
+    }
+    return !key_attributes
+           || (content->mode == key->mode && content->mtime.tv_sec == key->mtime.tv_sec && content->mtime.tv_nsec == key->mtime.tv_nsec);
+}
+
+/*!
+ * @brief find_slot looks for the slot of a content
+ * @param table is the table
+ * @param capacity is its capacity (a power of 2)
+ * @param key is a record with the key of the content
+ * @return the slot of the content, or the empty slot where it would be
+ */
+static dedup_content_t *find_slot(dedup_content_t *table, size_t capacity, dedup_content_t *key) {
+    size_t mask = capacity - 1;
+    size_t slot = content_hash(key->size, key->checksum) & mask;
+    while (table[slot].size != 0 && !is_same_key(&table[slot], key)) {
+        slot = (slot + 1) & mask;
+    }
+    return &table[slot];
+}
+
+/*!
+ * @brief grow_table doubles the capacity of the table, contents_lock held
+ * @return 0 in case of success, -1 if out of memory
+ */
+static int grow_table(void) {
+    size_t capacity = contents_capacity ? contents_capacity * 2 : DEDUP_INITIAL_CAPACITY;
+    dedup_content_t *table = calloc(capacity, sizeof(dedup_content_t));
+    if (table == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < contents_capacity; ++i) {
+        if (contents[i].size != 0) {
+            *find_slot(table, capacity, &contents[i]) = contents[i];
+        }
+    }
+    free(contents);
+    contents = table;
+    contents_capacity = capacity;
+    return 0;
+}
+
+/*!
+ * @brief find_content gives the record of the content of an entry, contents_lock held
+ * @param entry is the entry, with its checksum
+ * @param create is true to add the content when it is missing
+ * @return the record, NULL if it is missing (or out of memory)
+ */
+static dedup_content_t *find_content(files_list_entry_t *entry, bool create) {
+    dedup_content_t key = {.size = entry->size, .checksum_type = entry->checksum_type, .state = DEDUP_UNKNOWN,
+                           .mode = entry->mode, .mtime = entry->mtime};
+    memcpy(key.checksum, entry->checksum, sizeof(key.checksum));
+    if (contents_capacity > 0) {
+        dedup_content_t *content = find_slot(contents, contents_capacity, &key);
+        if (content->size != 0) {
+            return content;
+        }
+    }
+    if (!create || ((contents_count + 1) * 2 > contents_capacity && grow_table() == -1)) {
+        return NULL;
+    }
+    dedup_content_t *content = find_slot(contents, contents_capacity, &key);
+    *content = key;
+    ++contents_count;
+    return content;
+}
+
+/*!
+ * @brief dedup_claim tells if the content of a source file is already in the destination
+ * The first file with a content must be copied, then reported with dedup_copied; the others are to be made
+ * from its copy. If the first file is being copied, the call waits for the end of its copy.
+ * @param entry is the source file entry, with its checksum (@see dedup_checksum_type)
+ * @param destination_path is the path of its destination
+ * @param match receives the destination file holding the content
+ * @return true if the file can be made from match, false if it must be copied (and dedup_copied called)
+ */
+bool dedup_claim(files_list_entry_t *entry, const char *destination_path, dedup_match_t *match) {
+    if (entry->entry_type != FICHIER || entry->size == 0 || entry->checksum_type == CHECKSUM_NONE) {
+        return false;
+    }
+    pthread_mutex_lock(&contents_lock);
+    dedup_content_t *content = find_content(entry, true);
+    while (content != NULL && content->state == DEDUP_COPYING) {
+        pthread_cond_wait(&contents_changed, &contents_lock);
+        content = find_content(entry, true); // The table may have grown
+    }
+    bool found = content != NULL && content->state == DEDUP_COPIED;
+    if (found) {
+        strncpy(match->path, content->destination_path, sizeof(match->path) - 1);
+        match->path[sizeof(match->path) - 1] = '\0';
+    } else if (content != NULL) {
+        free(content->destination_path);
+        content->destination_path = strdup(destination_path);
+        content->state = content->destination_path != NULL ? DEDUP_COPYING : DEDUP_UNKNOWN;
+    }
+    pthread_mutex_unlock(&contents_lock);
+    return found;
+}
+
+/*!
+ * @brief dedup_copied ends the copy of the first file with a content, and wakes up the other files with it
+ * @param entry is the source file entry
+ * @param success is true if the copy succeeded; else the next file with the content will be copied
+ */
+void dedup_copied(files_list_entry_t *entry, bool success) {
+    pthread_mutex_lock(&contents_lock);
+    dedup_content_t *content = find_content(entry, false);
+    if (content != NULL && content->state == DEDUP_COPYING) {
+        content->state = success ? DEDUP_COPIED : DEDUP_UNKNOWN;
+        pthread_cond_broadcast(&contents_changed);
+    }
+    pthread_mutex_unlock(&contents_lock);
+}
+
+/*!
+ * @brief dedup_saved counts a file made from another one instead of being copied
+ * @param bytes is the size of the file, not written
+ */
+void dedup_saved(uint64_t bytes) {
+    __atomic_fetch_add(&saved_files, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&saved_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+/*!
+ * @brief dedup_totals gives the files and bytes saved since the last dedup_reset
+ * @param files receives the number of files not copied
+ * @param bytes receives the number of bytes not written
+ */
+void dedup_totals(uint64_t *files, uint64_t *bytes) {
+    *files = __atomic_load_n(&saved_files, __ATOMIC_RELAXED);
+    *bytes = __atomic_load_n(&saved_bytes, __ATOMIC_RELAXED);
+}
+
+/*!
+ * @brief dedup_reset forgets all the contents and the totals, when no copy is running
+ * @param mode is the deduplication of the next comparison
+ */
+void dedup_reset(dedup_mode_t mode) {
+    pthread_mutex_lock(&contents_lock);
+    key_attributes = mode == DEDUP_LINK;
+    for (size_t i = 0; i < contents_capacity; ++i) {
+        free(contents[i].destination_path);
+    }
+    free(contents);
+    contents = NULL;
+    contents_capacity = 0;
+    contents_count = 0;
+    saved_files = 0;
+    saved_bytes = 0;
+    pthread_mutex_unlock(&contents_lock);
+}
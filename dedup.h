@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+#include "defines.h"
+#include "files-list.h"
+#include "checksum.h"
+
+#define DEDUP_INITIAL_CAPACITY 1024
+
+typedef enum {
+    DEDUP_NONE, // Every file is copied
+    DEDUP_REFLINK, // A content already written is cloned (FICLONE), or copied when the filesystem can't
+    DEDUP_LINK, // A file with the content, mode and mtime of a file already written is hard linked to it, or cloned
+} dedup_mode_t;
+
+typedef enum {
+    DEDUP_UNKNOWN, // Content whose copy failed, the next file with it will be copied
+    DEDUP_COPYING, // Its first file is being copied, the others wait for it
+    DEDUP_COPIED, // Its first file is in the destination, at destination_path
+} dedup_state_t;
+
+// A content written to the destination during the synchronization
+typedef struct {
+    uint64_t size; // 0 for an empty slot (empty files are not deduplicated)
+    uint8_t checksum[CHECKSUM_SIZE_MAX];
+    uint8_t checksum_type;
+    uint8_t state;
+    mode_t mode; // Attributes of the first file, part of the key with DEDUP_LINK (a hard link shares them)
+    struct timespec mtime;
+    char *destination_path;
+} dedup_content_t;
+
+// The destination file holding a content, for the copies of the other files with it
+typedef struct {
+    char path[PATH_SIZE];
+} dedup_match_t;
+
+dedup_mode_t dedup_mode_from_name(const char *name);
+const char *dedup_mode_name(dedup_mode_t mode);
+checksum_type_t dedup_checksum_type(void);
+bool dedup_claim(files_list_entry_t *entry, const char *destination_path, dedup_match_t *match);
+void dedup_copied(files_list_entry_t *entry, bool success);
+void dedup_saved(uint64_t bytes);
+void dedup_totals(uint64_t *files, uint64_t *bytes);
+void dedup_reset(dedup_mode_t mode);
@@ -0,0 +1,427 @@
+#include "delta.h"
+#include "checksum.h"
+#include "defines.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * Delta transfer updates an existing destination file by writing only the parts of the source it doesn't
+ * already hold, like rsync does between two hosts:
+ * - the destination is cut in blocks, each with a weak rolling checksum and a strong hash (xxh64);
+ * - a window slides over the source one byte at a time, its weak checksum being updated in O(1): when it
+ *   matches a block and the strong hashes agree, the window is a copy of this block and jumps past it;
+ * - the bytes between the matches are literals, taken from the source.
+ * When every matched block is at the same offset in both files (blocks changed in place, the common case
+ * of VM images and databases), only the literals are written to the destination. Otherwise the new content
+ * is assembled in a temporary file next to the destination, which then replaces it.
+ */
+
+typedef struct {
+    uint32_t weak;
+    uint64_t strong;
+} block_signature_t;
+
+typedef struct {
+    block_signature_t *blocks;
+    uint64_t blocks_count;
+    uint64_t block_size;
+    uint32_t *buckets; // Index + 1 of the first block of each bucket, 0 when empty
+    uint32_t *next; // Index + 1 of the next block in the same bucket
+    uint32_t buckets_mask;
+} signature_t;
+
+typedef struct {
+    uint64_t source_offset;
+    uint64_t destination_offset;
+    uint64_t length;
+} match_t;
+
+typedef struct {
+    match_t *items;
+    size_t count;
+    size_t capacity;
+} matches_t;
+
+/*!
+ * @brief weak_checksum computes the rolling checksum of a block (the Adler-32 like sum of rsync)
+ * @param data is the block
+ * @param length is its size
+ * @return the checksum
+ */
+static uint32_t weak_checksum(const uint8_t *data, uint64_t length) {
+    uint32_t a = 0, b = 0;
+    for (uint64_t i = 0; i < length; ++i) {
+        a += data[i];
+        b += (uint32_t) (length - i) * data[i];
+    }
+    return (a & 0xffff) | (b << 16);
+}
+
+/*!
+ * @brief strong_hash computes the hash that confirms a match of the weak checksums
+ * @param data is the block
+ * @param length is its size
+ * @return the hash
+ */
+static uint64_t strong_hash(const uint8_t *data, uint64_t length) {
+    checksum_context_t context;
+    uint8_t digest[CHECKSUM_SIZE_MAX];
+    uint64_t hash = 0;
+    checksum_init(&context, CHECKSUM_XXH64);
+    checksum_update(&context, data, length);
+    checksum_final(&context, digest);
+    memcpy(&hash, digest, sizeof(hash));
+    return hash;
+}
+
+/*!
+ * @brief get_block_size chooses the block size for a file
+ * @param size is the size of the destination
+ * @return the smallest power of 2 whose square reaches the size, within the bounds of delta.h
+ */
+static uint64_t get_block_size(uint64_t size) {
+    uint64_t block_size = DELTA_BLOCK_SIZE_MIN;
+    while (block_size < DELTA_BLOCK_SIZE_MAX && block_size * block_size < size) {
+        block_size <<= 1;
+    }
+    return block_size;
+}
+
+/*!
+ * @brief make_signature computes the checksums of the full blocks of the destination
+ * @param signature is the signature to fill
+ * @param data is the content of the destination
+ * @param size is the size of the destination
+ * @param block_size is the size of the blocks
+ * @return 0 in case of success, -1 else
+ */
+static int make_signature(signature_t *signature, const uint8_t *data, uint64_t size, uint64_t block_size) {
+    memset(signature, 0, sizeof(signature_t));
+    signature->block_size = block_size;
+    signature->blocks_count = size / block_size;
+    if (signature->blocks_count >= UINT32_MAX) {
+        errno = EFBIG;
+        return -1;
+    }
+    uint64_t buckets_count = 1;
+    while (buckets_count < 2 * signature->blocks_count) {
+        buckets_count <<= 1;
+    }
+    signature->buckets_mask = buckets_count - 1;
+    signature->blocks = malloc(signature->blocks_count * sizeof(block_signature_t) + 1);
+    signature->next = malloc(signature->blocks_count * sizeof(uint32_t) + 1);
+    signature->buckets = calloc(buckets_count, sizeof(uint32_t));
+    if (!signature->blocks || !signature->next || !signature->buckets) {
+        return -1;
+    }
+
+    for (uint64_t i = 0; i < signature->blocks_count; ++i) {
+        const uint8_t *block = data + i * block_size;
+        signature->blocks[i].weak = weak_checksum(block, block_size);
+        signature->blocks[i].strong = strong_hash(block, block_size);
+        uint32_t bucket = signature->blocks[i].weak & signature->buckets_mask;
+        signature->next[i] = signature->buckets[bucket];
+        signature->buckets[bucket] = i + 1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief free_signature frees the tables of a signature
+ * @param signature is the signature
+ */
+static void free_signature(signature_t *signature) {
+    free(signature->blocks);
+    free(signature->next);
+    free(signature->buckets);
+}
+
+/*!
+ * @brief add_match records that a range of the source is found in the destination, merging it with the
+ * previous range when both are contiguous
+ * @param matches is the list of matches
+ * @param source_offset is the offset of the range in the source
+ * @param destination_offset is the offset of the range in the destination
+ * @param length is the length of the range
+ * @return 0 in case of success, -1 else
+ */
+static int add_match(matches_t *matches, uint64_t source_offset, uint64_t destination_offset, uint64_t length) {
+    if (matches->count > 0) {
+        match_t *last = &matches->items[matches->count - 1];
+        if (last->source_offset + last->length == source_offset && last->destination_offset + last->length == destination_offset) {
+            last->length += length;
+            return 0;
+        }
+    }
+    if (matches->count == matches->capacity) {
+        size_t new_capacity = matches->capacity ? 2 * matches->capacity : 64;
+        match_t *new_items = realloc(matches->items, new_capacity * sizeof(match_t));
+        if (!new_items) {
+            return -1;
+        }
+        matches->items = new_items;
+        matches->capacity = new_capacity;
+    }
+    matches->items[matches->count++] = (match_t) {source_offset, destination_offset, length};
+    return 0;
+}
+
+/*!
+ * @brief find_block looks for a block of the destination with the content of a window of the source
+ * The block at the same offset is preferred, so that unchanged blocks stay in place.
+ * @param signature is the signature of the destination
+ * @param weak is the weak checksum of the window
+ * @param window is the window
+ * @param offset is the offset of the window in the source
+ * @return the index of the block, -1 if there is none
+ */
+static int64_t find_block(signature_t *signature, uint32_t weak, const uint8_t *window, uint64_t offset) {
+    uint32_t candidate = signature->buckets[weak & signature->buckets_mask];
+    bool has_strong = false;
+    uint64_t strong = 0;
+    int64_t found = -1;
+    for (; candidate != 0; candidate = signature->next[candidate - 1]) {
+        block_signature_t *block = &signature->blocks[candidate - 1];
+        if (block->weak != weak) {
+            continue;
+        }
+        if (!has_strong) {
+            strong = strong_hash(window, signature->block_size);
+            has_strong = true;
+        }
+        if (block->strong == strong) {
+            found = candidate - 1;
+            if ((uint64_t) found * signature->block_size == offset) {
+                break;
+            }
+        }
+    }
+    return found;
+}
+
+/*!
+ * @brief find_matches slides a window over the source and records the ranges found in the destination
+ * @param signature is the signature of the destination
+ * @param source is the content of the source
+ * @param size is the size of the source
+ * @param matches receives the matching ranges, in the order of the source
+ * @return 0 in case of success, -1 else
+ */
+static int find_matches(signature_t *signature, const uint8_t *source, uint64_t size, matches_t *matches) {
+    uint64_t block_size = signature->block_size;
+    if (signature->blocks_count == 0 || size < block_size) {
+        return 0;
+    }
+    uint64_t offset = 0;
+    uint32_t weak = weak_checksum(source, block_size);
+    uint32_t a = weak & 0xffff, b = weak >> 16;
+    while (offset + block_size <= size) {
+        int64_t block = find_block(signature, (a & 0xffff) | (b << 16), source + offset, offset);
+        if (block != -1) {
+            if (add_match(matches, offset, block * block_size, block_size) == -1) {
+                return -1;
+            }
+            offset += block_size;
+            if (offset + block_size <= size) {
+                weak = weak_checksum(source + offset, block_size);
+                a = weak & 0xffff;
+                b = weak >> 16;
+            }
+            continue;
+        }
+        if (offset + block_size == size) {
+            break;
+        }
+        // Roll the window by one byte
+        uint8_t out = source[offset], in = source[offset + block_size];
+        a = (a - out + in) & 0xffff;
+        b = (b - (uint32_t) block_size * out + a) & 0xffff;
+        ++offset;
+    }
+    return 0;
+}
+
+/*!
+ * @brief write_all writes a buffer at an offset of a file
+ * @param fd is the file
+ * @param data is the buffer
+ * @param length is its size
+ * @param offset is the offset in the file
+ * @param syscalls counts the writes
+ * @return 0 in case of success, -1 else
+ */
+static int write_all(int fd, const uint8_t *data, uint64_t length, uint64_t offset, uint64_t *syscalls) {
+    while (length > 0) {
+        ++*syscalls;
+        ssize_t written = pwrite(fd, data, length, offset);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written == -1) {
+            return -1;
+        }
+        data += written;
+        offset += written;
+        length -= written;
+    }
+    return 0;
+}
+
+/*!
+ * @brief write_literals writes the ranges of the source found in no block of the destination
+ * @param fd is the file to write
+ * @param source is the content of the source
+ * @param size is the size of the source
+ * @param matches are the matching ranges
+ * @param report receives the bytes written
+ * @return 0 in case of success, -1 else
+ */
+static int write_literals(int fd, const uint8_t *source, uint64_t size, matches_t *matches, delta_report_t *report) {
+    uint64_t offset = 0;
+    for (size_t i = 0; i <= matches->count; ++i) {
+        uint64_t end = i < matches->count ? matches->items[i].source_offset : size;
+        if (end > offset) {
+            if (write_all(fd, source + offset, end - offset, offset, &report->syscalls) == -1) {
+                return -1;
+            }
+            report->bytes_written += end - offset;
+        }
+        if (i < matches->count) {
+            offset = end + matches->items[i].length;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief rebuild_in_temporary assembles the new content in a temporary file that replaces the destination
+ * @param destination_path is the path of the destination
+ * @param destination is the content of the destination
+ * @param source is the content of the source
+ * @param size is the size of the source
+ * @param matches are the matching ranges
+ * @param report receives the bytes written
+ * @return the descriptor of the new destination, -1 in case of error
+ */
+static int rebuild_in_temporary(const char *destination_path, const uint8_t *destination, const uint8_t *source, uint64_t size,
+                                matches_t *matches, delta_report_t *report) {
+    char temporary_path[PATH_SIZE];
+    const char *name = strrchr(destination_path, '/');
+    int directory_length = name ? (int) (name - destination_path + 1) : 0;
+    name = name ? name + 1 : destination_path;
+    if (snprintf(temporary_path, sizeof(temporary_path), "%.*s.%s.delta-XXXXXX", directory_length, destination_path, name) >= PATH_SIZE) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = mkstemp(temporary_path);
+    report->syscalls += 3; // mkstemp, ftruncate and rename
+    if (fd == -1) {
+        return -1;
+    }
+
+    int result = ftruncate(fd, size);
+    for (size_t i = 0; result == 0 && i < matches->count; ++i) {
+        match_t *match = &matches->items[i];
+        result = write_all(fd, destination + match->destination_offset, match->length, match->source_offset, &report->syscalls);
+    }
+    if (result == 0) {
+        result = write_literals(fd, source, size, matches, report);
+    }
+    if (result == 0) {
+        result = rename(temporary_path, destination_path);
+    }
+    if (result == -1) {
+        int saved_errno = errno;
+        unlink(temporary_path);
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    return fd;
+}
+
+/*!
+ * @brief delta_transfer updates an existing destination file with the content of the source, writing only
+ * the ranges that are not already in the destination
+ * @param source_fd is the source file, opened for reading
+ * @param source_size is the size of the source
+ * @param destination_path is the path of the existing destination
+ * @param report receives the block size, the bytes matched and written and how the destination was updated
+ * @return the descriptor of the updated destination (for its mode and times), -1 if the destination can't
+ * be updated (errno is set, 0 when it has no block in common with the source: a plain copy is better)
+ */
+int delta_transfer(int source_fd, uint64_t source_size, const char *destination_path, delta_report_t *report) {
+    memset(report, 0, sizeof(delta_report_t));
+    report->syscalls = 7; // open, fstat, both mmap and munmap, madvise
+    int destination_fd = open(destination_path, O_RDWR);
+    if (destination_fd == -1) {
+        return -1;
+    }
+    struct stat sb;
+    if (fstat(destination_fd, &sb) == -1 || !S_ISREG(sb.st_mode) || sb.st_size == 0 || source_size == 0) {
+        close(destination_fd);
+        errno = 0;
+        return -1;
+    }
+    uint64_t destination_size = sb.st_size;
+
+    uint8_t *source = mmap(NULL, source_size, PROT_READ, MAP_PRIVATE, source_fd, 0);
+    uint8_t *destination = mmap(NULL, destination_size, PROT_READ, MAP_SHARED, destination_fd, 0);
+    signature_t signature = {0};
+    matches_t matches = {0};
+    int result = -1;
+    int saved_errno = 0;
+    if (source == MAP_FAILED || destination == MAP_FAILED) {
+        saved_errno = errno;
+        goto cleanup;
+    }
+    madvise(source, source_size, MADV_SEQUENTIAL);
+
+    report->block_size = get_block_size(destination_size);
+    if (make_signature(&signature, destination, destination_size, report->block_size) == -1
+        || find_matches(&signature, source, source_size, &matches) == -1) {
+        saved_errno = errno;
+        goto cleanup;
+    }
+    report->in_place = true;
+    for (size_t i = 0; i < matches.count; ++i) {
+        report->bytes_matched += matches.items[i].length;
+        report->in_place = report->in_place && matches.items[i].source_offset == matches.items[i].destination_offset;
+    }
+    if (report->bytes_matched == 0) {
+        goto cleanup;
+    }
+
+    if (report->in_place) {
+        // Matched blocks are already at their place: the literals never overwrite them
+        ++report->syscalls; // ftruncate
+        if (write_literals(destination_fd, source, source_size, &matches, report) == 0
+            && ftruncate(destination_fd, source_size) == 0) {
+            result = destination_fd;
+        }
+    } else {
+        result = rebuild_in_temporary(destination_path, destination, source, source_size, &matches, report);
+    }
+    saved_errno = errno;
+
+cleanup:
+    if (source != MAP_FAILED) {
+        munmap(source, source_size);
+    }
+    if (destination != MAP_FAILED) {
+        munmap(destination, destination_size);
+    }
+    free_signature(&signature);
+    free(matches.items);
+    if (result != destination_fd) {
+        close(destination_fd);
+    }
+    errno = saved_errno;
+    return result;
+}
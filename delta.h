@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Bounds of the block size, which grows with the square root of the file size (as rsync does)
+#define DELTA_BLOCK_SIZE_MIN 4096
+#define DELTA_BLOCK_SIZE_MAX (1024 * 1024)
+
+typedef struct {
+    uint64_t block_size;
+    uint64_t bytes_matched; // Bytes of the source found in the destination
+    uint64_t bytes_written; // Bytes of the source written to the destination
+    uint64_t syscalls; // System calls made for the transfer
+    bool in_place; // True when the destination was updated in place, false when it was rebuilt in a temporary file
+} delta_report_t;
+
+int delta_transfer(int source_fd, uint64_t source_size, const char *destination_path, delta_report_t *report);
@@ -0,0 +1,181 @@
+#include "dir-tree.h"
+#include "walker.h"
+#include "stats.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * The directory tree holds a tree as nodes: each directory keeps its children sorted by name, with the node
+ * of each child directory and a pointer to its parent. Unlike a files list, nodes are read one at a time
+ * (@see dir_tree_read), so a directory can be handled (e.g. compared with the same directory of another
+ * tree) as soon as it is read, and independent subtrees can be read by the tasks of a pool at once.
+ * Each thread allocates the entries and nodes it reads in its own list (no lock, @see new_file_entry); they
+ * all stay valid until dir_tree_release.
+ */
+
+/*!
+ * @brief current_worker gives the memory of the calling thread
+ * @param tree is the tree
+ * @return the worker of the thread
+ */
+static dir_tree_worker_t *current_worker(dir_tree_t *tree) {
+    int index = thread_pool_worker_index();
+    return &tree->workers[index >= 0 && index < tree->workers_count ? index : tree->workers_count];
+}
+
+/*!
+ * @brief new_node allocates the node of a directory, not read yet
+ * @param worker is the worker allocating it
+ * @param parent is the node of the parent directory, NULL for a root
+ * @param entry is the entry of the directory in its parent, NULL for a root
+ * @param path is the path of the directory, with its trailing '/'
+ * @param length is the length of path
+ * @return the node, NULL if out of memory
+ */
+static dir_node_t *new_node(dir_tree_worker_t *worker, dir_node_t *parent, files_list_entry_t *entry, const char *path, size_t length) {
+    dir_node_t *node = arena_alloc(&worker->list.arena, sizeof(dir_node_t), sizeof(void *));
+    if (node != NULL) {
+        memset(node, 0, sizeof(dir_node_t));
+        node->parent = parent;
+        node->entry = entry;
+        node->path = arena_strndup(&worker->list.arena, path, length);
+    }
+    return node && node->path ? node : NULL;
+}
+
+/*!
+ * @brief dir_tree_init prepares the memory of the threads reading the trees
+ * @param tree is the tree
+ * @param pool is the pool running the tasks, NULL to run them in the calling thread
+ * @return 0 in case of success, -1 else
+ */
+int dir_tree_init(dir_tree_t *tree, thread_pool_t *pool) {
+    tree->pool = pool;
+    tree->workers_count = pool != NULL ? pool->workers_count : 0;
+    tree->workers = calloc(tree->workers_count + 1, sizeof(dir_tree_worker_t));
+    if (!tree->workers) {
+        return -1;
+    }
+    for (int i = 0; i <= tree->workers_count; ++i) {
+        init_files_list(&tree->workers[i].list);
+    }
+    return 0;
+}
+
+/*!
+ * @brief dir_tree_root makes the node of the root of a tree, not read yet
+ * @param tree is the tree
+ * @param path is the path of the root, followed or not by a '/' (as concat_path, the node path has one)
+ * @return the node, NULL if out of memory or the path is too long
+ */
+dir_node_t *dir_tree_root(dir_tree_t *tree, const char *path) {
+    char root[PATH_SIZE];
+    size_t length = strlen(path);
+    int root_length = snprintf(root, PATH_SIZE, (length > 0 && path[length - 1] == '/') ? "%s" : "%s/", path);
+    return root_length < PATH_SIZE ? new_node(current_worker(tree), NULL, NULL, root, root_length) : NULL;
+}
+
+/*!
+ * @brief dir_tree_read reads the children of a directory, with their stats, and makes the nodes of its
+ * subdirectories (not read yet)
+ * @param tree is the tree
+ * @param node is the node of the directory
+ * @return 0 in case of success, -1 if the directory couldn't be fully read (the children read are kept)
+ */
+int dir_tree_read(dir_tree_t *tree, dir_node_t *node) {
+    dir_tree_worker_t *worker = current_worker(tree);
+    if (worker->buffer == NULL && (worker->buffer = malloc(WALKER_BUFFER_SIZE)) == NULL) {
+        node->read_failed = true;
+        return -1;
+    }
+    // A root may be a symbolic link, given by the user
+    int dir_fd = open(node->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC | (node->parent != NULL ? O_NOFOLLOW : 0));
+    if (dir_fd == -1) {
+        fprintf(stderr, "Error opening directory %s: %s\n", node->path, strerror(errno));
+        node->read_failed = true;
+        return -1;
+    }
+
+    stats_phase_t previous_phase = stats_enter(STATS_PHASE_SCAN);
+    files_list_entry_t **children = NULL;
+    size_t count = 0;
+    node->read_failed = read_sorted_children(dir_fd, node->path, &worker->list, true, worker->buffer, &children, &count) == -1;
+    close(dir_fd);
+
+    char path[PATH_SIZE];
+    node->children = arena_alloc(&worker->list.arena, (count + 1) * sizeof(files_list_entry_t *), sizeof(void *));
+    node->subtrees = arena_alloc(&worker->list.arena, (count + 1) * sizeof(dir_node_t *), sizeof(void *));
+    if (node->children && node->subtrees) {
+        for (size_t i = 0; i < count; ++i) {
+            files_list_entry_t *child = children[i];
+            node->children[i] = child;
+            node->subtrees[i] = NULL;
+            if (child->entry_type == DOSSIER) {
+                int length = snprintf(path, PATH_SIZE, "%s%s/", node->path, child->name);
+                node->subtrees[i] = length < PATH_SIZE ? new_node(worker, node, child, path, length) : NULL;
+                node->read_failed |= node->subtrees[i] == NULL;
+            }
+        }
+        node->count = count;
+    } else {
+        node->read_failed = true;
+    }
+    free(children);
+    stats_leave(previous_phase);
+    return node->read_failed ? -1 : 0;
+}
+
+/*!
+ * @brief dir_tree_submit runs a task on the pool of the tree, or at once without a pool
+ * @param tree is the tree
+ * @param function is the task
+ * @param argument is given to the task
+ */
+void dir_tree_submit(dir_tree_t *tree, task_function_t function, void *argument) {
+    if (tree->pool == NULL) {
+        function(argument);
+    } else {
+        thread_pool_submit(tree->pool, function, argument); // Run at once when it can't be queued
+    }
+}
+
+/*!
+ * @brief dir_tree_alloc allocates memory of the calling thread, valid until dir_tree_release (e.g. for the
+ * arguments of the tasks)
+ * @param tree is the tree
+ * @param size is the size to allocate
+ * @return the memory, NULL if out of memory
+ */
+void *dir_tree_alloc(dir_tree_t *tree, size_t size) {
+    return arena_alloc(&current_worker(tree)->list.arena, size, sizeof(void *));
+}
+
+/*!
+ * @brief dir_tree_wait waits for the end of all the tasks submitted, and of the tasks they submitted
+ * @param tree is the tree
+ */
+void dir_tree_wait(dir_tree_t *tree) {
+    if (tree->pool != NULL) {
+        thread_pool_wait(tree->pool);
+    }
+}
+
+/*!
+ * @brief dir_tree_release frees all the nodes and entries, once the tasks are done
+ * @param tree is the tree
+ */
+void dir_tree_release(dir_tree_t *tree) {
+    if (!tree->workers) {
+        return;
+    }
+    for (int i = 0; i <= tree->workers_count; ++i) {
+        clear_files_list(&tree->workers[i].list);
+        free(tree->workers[i].buffer);
+    }
+    free(tree->workers);
+    tree->workers = NULL;
+}
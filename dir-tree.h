@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "files-list.h"
+#include "thread-pool.h"
+
+typedef struct _dir_node {
+    struct _dir_node *parent; // NULL for a root
+    files_list_entry_t *entry; // Entry of the directory among the children of its parent, NULL for a root
+    const char *path; // Path of the directory, with its trailing '/'
+    files_list_entry_t **children; // Regular files and directories, sorted by name, once the node is read
+    struct _dir_node **subtrees; // Node of each child directory (not read yet), NULL for the files
+    size_t count;
+    bool read_failed; // The directory couldn't be (fully) read
+} dir_node_t;
+
+// Memory of a thread reading directories, entries and nodes are never linked to its list
+typedef struct {
+    files_list_t list;
+    char *buffer; // getdents64 buffer
+} dir_tree_worker_t;
+
+// Nodes of one or several trees, read directory by directory by the tasks of a pool or by the calling thread
+typedef struct {
+    thread_pool_t *pool; // NULL to run the tasks at once in the calling thread
+    dir_tree_worker_t *workers; // One per worker of the pool, plus one for the other threads
+    int workers_count;
+} dir_tree_t;
+
+int dir_tree_init(dir_tree_t *tree, thread_pool_t *pool);
+dir_node_t *dir_tree_root(dir_tree_t *tree, const char *path);
+int dir_tree_read(dir_tree_t *tree, dir_node_t *node);
+void dir_tree_submit(dir_tree_t *tree, task_function_t function, void *argument);
+void *dir_tree_alloc(dir_tree_t *tree, size_t size);
+void dir_tree_wait(dir_tree_t *tree);
+void dir_tree_release(dir_tree_t *tree);
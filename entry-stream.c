@@ -0,0 +1,126 @@
+#include "entry-stream.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * An entry stream walks a tree in a thread with a sorted walker (@see sorted_walker_next) and hands its
+ * entries over to a consumer through a bounded ring, by batches. Two streams let the two trees be walked at
+ * once, on different disks, while a comparator consumes them in order.
+ * The walker thread appends the entries to the list of the stream; the consumer must not walk the list
+ * before entry_stream_finish.
+ */
+
+/*!
+ * @brief push_batch moves a batch of entries to the ring, waiting for room
+ * @param stream is the stream
+ * @param batch is the batch
+ * @param count is the number of entries of the batch
+ */
+static void push_batch(entry_stream_t *stream, files_list_entry_t **batch, size_t count) {
+    pthread_mutex_lock(&stream->lock);
+    for (size_t i = 0; i < count; ++i) {
+        while (stream->produced - stream->consumed == ENTRY_STREAM_CAPACITY) {
+            pthread_cond_signal(&stream->not_empty);
+            pthread_cond_wait(&stream->not_full, &stream->lock);
+        }
+        stream->ring[stream->produced++ % ENTRY_STREAM_CAPACITY] = batch[i];
+    }
+    stats_queue_depth(STATS_QUEUE_ENTRY_STREAM, stream->produced - stream->consumed);
+    pthread_cond_signal(&stream->not_empty);
+    pthread_mutex_unlock(&stream->lock);
+}
+
+/*!
+ * @brief stream_walker_thread walks the tree of a stream
+ * @param parameters is the entry_stream_t
+ * @return NULL
+ */
+static void *stream_walker_thread(void *parameters) {
+    entry_stream_t *stream = parameters;
+    stats_phase_t previous_phase = stats_enter(STATS_PHASE_SCAN);
+    files_list_entry_t *batch[ENTRY_STREAM_BATCH];
+    size_t count = 0;
+    files_list_entry_t *entry;
+    while ((entry = sorted_walker_next(&stream->walker)) != NULL) {
+        add_entry_to_tail(stream->list, entry);
+        batch[count++] = entry;
+        if (count == ENTRY_STREAM_BATCH) {
+            push_batch(stream, batch, count);
+            count = 0;
+        }
+    }
+    push_batch(stream, batch, count);
+
+    int result = sorted_walker_close(&stream->walker);
+    stats_leave(previous_phase);
+    pthread_mutex_lock(&stream->lock);
+    stream->result = result;
+    stream->finished = true;
+    pthread_cond_signal(&stream->not_empty);
+    pthread_mutex_unlock(&stream->lock);
+    return NULL;
+}
+
+/*!
+ * @brief entry_stream_start starts walking a tree in a thread
+ * @param stream is the stream to start
+ * @param list is the list receiving the entries (with their stats), in sorted order
+ * @param root is the directory to walk
+ * @return 0 in case of success, -1 else
+ */
+int entry_stream_start(entry_stream_t *stream, files_list_t *list, const char *root) {
+    memset(stream, 0, sizeof(entry_stream_t));
+    stream->list = list;
+    if (sorted_walker_open(&stream->walker, list, root, true) == -1) {
+        sorted_walker_close(&stream->walker);
+        return -1;
+    }
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->not_empty, NULL);
+    pthread_cond_init(&stream->not_full, NULL);
+    if (pthread_create(&stream->thread, NULL, stream_walker_thread, stream) != 0) {
+        sorted_walker_close(&stream->walker);
+        pthread_cond_destroy(&stream->not_full);
+        pthread_cond_destroy(&stream->not_empty);
+        pthread_mutex_destroy(&stream->lock);
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief entry_stream_next gives the next entry of the tree, waiting for the walker
+ * @param stream is the stream
+ * @return the next entry in sorted order, NULL at the end of the tree
+ */
+files_list_entry_t *entry_stream_next(entry_stream_t *stream) {
+    if (stream->batch_next < stream->batch_count) {
+        return stream->batch[stream->batch_next++];
+    }
+    pthread_mutex_lock(&stream->lock);
+    while (stream->produced == stream->consumed && !stream->finished) {
+        pthread_cond_wait(&stream->not_empty, &stream->lock);
+    }
+    stream->batch_count = 0;
+    stream->batch_next = 0;
+    while (stream->consumed < stream->produced && stream->batch_count < ENTRY_STREAM_BATCH) {
+        stream->batch[stream->batch_count++] = stream->ring[stream->consumed++ % ENTRY_STREAM_CAPACITY];
+    }
+    pthread_cond_signal(&stream->not_full);
+    pthread_mutex_unlock(&stream->lock);
+    return stream->batch_count > 0 ? stream->batch[stream->batch_next++] : NULL;
+}
+
+/*!
+ * @brief entry_stream_finish waits for the end of the walk, the list of the stream is then complete
+ * @param stream is the stream, whose entries must all have been consumed
+ * @return 0 if the whole tree was walked, -1 if a directory couldn't be read
+ */
+int entry_stream_finish(entry_stream_t *stream) {
+    pthread_join(stream->thread, NULL);
+    pthread_cond_destroy(&stream->not_full);
+    pthread_cond_destroy(&stream->not_empty);
+    pthread_mutex_destroy(&stream->lock);
+    return stream->result;
+}
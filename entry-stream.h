@@ -0,0 +1,33 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include "files-list.h"
+#include "walker.h"
+
+// Entries kept between the walker thread and the consumer
+#define ENTRY_STREAM_CAPACITY 8192
+// Entries moved at once, to take the lock once per batch
+#define ENTRY_STREAM_BATCH 128
+
+// Entries of a tree walked in sorted order by a thread, consumed while the walk goes on
+typedef struct {
+    sorted_walker_t walker;
+    files_list_t *list; // Receives the entries, in sorted order
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    files_list_entry_t *ring[ENTRY_STREAM_CAPACITY];
+    size_t produced;
+    size_t consumed;
+    bool finished;
+    int result;
+    files_list_entry_t *batch[ENTRY_STREAM_BATCH]; // Consumer side
+    size_t batch_count;
+    size_t batch_next;
+} entry_stream_t;
+
+int entry_stream_start(entry_stream_t *stream, files_list_t *list, const char *root);
+files_list_entry_t *entry_stream_next(entry_stream_t *stream);
+int entry_stream_finish(entry_stream_t *stream);
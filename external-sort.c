@@ -0,0 +1,424 @@
+#include "external-sort.h"
+#include "checksum.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * The external sorter orders the entries of trees that don't fit in memory. Entries are copied to a batch
+ * (a files list, so that they are sorted like any other list); once the batch holds memory_limit bytes, it
+ * is sorted and written to a run file, then emptied. Once the tree is walked, the runs and the last batch
+ * are merged with a heap: entries come out one at a time in the order of sort_files_list, so two sorters
+ * can be compared like two sorted lists while only one entry per run is in memory.
+ * Run files are unlinked at once: they are removed when closed, even if the program is killed.
+ */
+
+// Header of an entry in a run file, followed by its checksum, its directory and its name
+typedef struct {
+    uint64_t size;
+    uint64_t device;
+    uint64_t inode;
+    uint64_t nlink;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t mode;
+    uint16_t dir_path_length;
+    uint16_t name_length;
+    uint8_t entry_type;
+    uint8_t checksum_type;
+} run_record_t;
+
+/*!
+ * @brief batch_chunk_size gives the size of the arena chunks of the batch, so that small limits are kept
+ * @param memory_limit is the memory limit of the sorter
+ * @return the chunk size, between 64 KiB and 1 MiB
+ */
+static size_t batch_chunk_size(size_t memory_limit) {
+    size_t chunk_size = memory_limit / 16;
+    if (chunk_size < 64 * 1024) {
+        return 64 * 1024;
+    }
+    return chunk_size > 1024 * 1024 ? 1024 * 1024 : chunk_size;
+}
+
+/*!
+ * @brief batch_memory estimates the memory used by the batch: its entries, names and tables
+ * @param list is the batch
+ * @return the number of bytes
+ */
+static size_t batch_memory(files_list_t *list) {
+    return list->arena.allocated + (list->hash_capacity + list->dirs_capacity + list->count) * sizeof(void *);
+}
+
+/*!
+ * @brief new_run_file creates an unlinked temporary file in $TMPDIR (/tmp by default)
+ * @return the file open for writing and reading, NULL in case of error
+ */
+static FILE *new_run_file(void) {
+    const char *directory = getenv("TMPDIR");
+    char path[PATH_SIZE];
+    snprintf(path, PATH_SIZE, "%s/lp25-run-XXXXXX", (directory && directory[0] != '\0') ? directory : "/tmp");
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("Unable to create a run file");
+        return NULL;
+    }
+    unlink(path);
+    FILE *file = fdopen(fd, "w+");
+    if (!file) {
+        close(fd);
+        return NULL;
+    }
+    setvbuf(file, NULL, _IOFBF, EXTERNAL_SORT_RUN_BUFFER);
+    return file;
+}
+
+/*!
+ * @brief write_record appends an entry to a run file
+ * @param file is the run file
+ * @param entry is the entry
+ * @return 0 in case of success, -1 else
+ */
+static int write_record(FILE *file, files_list_entry_t *entry) {
+    run_record_t record = {
+            .size = entry->size,
+            .device = entry->device,
+            .inode = entry->inode,
+            .nlink = entry->nlink,
+            .mtime_sec = entry->mtime.tv_sec,
+            .mtime_nsec = entry->mtime.tv_nsec,
+            .mode = entry->mode,
+            .dir_path_length = entry->dir_path_length,
+            .name_length = strlen(entry->name),
+            .entry_type = entry->entry_type,
+            .checksum_type = entry->checksum_type,
+    };
+    size_t checksum_length = checksum_size(entry->checksum_type);
+    if (fwrite(&record, sizeof(record), 1, file) != 1
+        || fwrite(entry->checksum, 1, checksum_length, file) != checksum_length
+        || fwrite(entry->dir_path, 1, record.dir_path_length, file) != record.dir_path_length
+        || fwrite(entry->name, 1, record.name_length, file) != record.name_length) {
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief read_run moves a run to its next entry
+ * @param merger is the merger, marked as failed if the run file can't be read
+ * @param run is the run
+ * @return true if the run has a current entry, false at its end
+ */
+static bool read_run(run_merger_t *merger, sort_run_t *run) {
+    if (run->file == NULL) {
+        run->current = run->next_in_memory;
+        if (run->current != NULL) {
+            run->next_in_memory = run->current->next;
+        }
+        return run->current != NULL;
+    }
+
+    run_record_t record;
+    if (fread(&record, sizeof(record), 1, run->file) != 1) {
+        merger->failed |= ferror(run->file) != 0;
+        return false;
+    }
+    size_t checksum_length = record.checksum_type < CHECKSUM_TYPES_COUNT ? checksum_size(record.checksum_type) : CHECKSUM_SIZE_MAX + 1;
+    if (checksum_length > CHECKSUM_SIZE_MAX || (size_t) record.dir_path_length + record.name_length + 2 > sizeof(run->path)) {
+        merger->failed = true;
+        return false;
+    }
+    files_list_entry_t *entry = &run->entry;
+    memset(entry, 0, sizeof(files_list_entry_t));
+    char *name = run->path + record.dir_path_length + 1;
+    if (fread(entry->checksum, 1, checksum_length, run->file) != checksum_length
+        || fread(run->path, 1, record.dir_path_length, run->file) != record.dir_path_length
+        || fread(name, 1, record.name_length, run->file) != record.name_length) {
+        merger->failed = true;
+        return false;
+    }
+    run->path[record.dir_path_length] = '\0';
+    name[record.name_length] = '\0';
+    entry->dir_path = run->path;
+    entry->dir_path_length = record.dir_path_length;
+    entry->name = name;
+    entry->size = record.size;
+    entry->device = record.device;
+    entry->inode = record.inode;
+    entry->nlink = record.nlink;
+    entry->mtime.tv_sec = record.mtime_sec;
+    entry->mtime.tv_nsec = record.mtime_nsec;
+    entry->mode = record.mode;
+    entry->entry_type = record.entry_type;
+    entry->checksum_type = record.checksum_type;
+    run->current = entry;
+    return true;
+}
+
+/*!
+ * @brief run_is_before orders two runs by their current entries
+ * @param merger is the merger
+ * @param left is the index of the first run
+ * @param right is the index of the second run
+ * @return true if the entry of left comes first
+ */
+static bool run_is_before(run_merger_t *merger, size_t left, size_t right) {
+    return compare_entries(merger->runs[left].current, merger->runs[right].current, 0, 0) < 0;
+}
+
+/*!
+ * @brief sift_down moves the top of the heap down to its place
+ * @param merger is the merger
+ */
+static void sift_down(run_merger_t *merger) {
+    size_t *heap = merger->heap;
+    size_t position = 0;
+    for (;;) {
+        size_t smallest = position;
+        size_t left = 2 * position + 1, right = left + 1;
+        if (left < merger->heap_count && run_is_before(merger, heap[left], heap[smallest])) {
+            smallest = left;
+        }
+        if (right < merger->heap_count && run_is_before(merger, heap[right], heap[smallest])) {
+            smallest = right;
+        }
+        if (smallest == position) {
+            return;
+        }
+        size_t tmp = heap[position];
+        heap[position] = heap[smallest];
+        heap[smallest] = tmp;
+        position = smallest;
+    }
+}
+
+/*!
+ * @brief merger_open starts the merge of sorted runs
+ * @param merger is the merger to initialize
+ * @param files are the run files, read from their beginning
+ * @param count is the number of run files
+ * @param memory_run is a sorted list merged with the files, NULL if none
+ * @return 0 in case of success, -1 else
+ */
+static int merger_open(run_merger_t *merger, FILE **files, size_t count, files_list_t *memory_run) {
+    memset(merger, 0, sizeof(run_merger_t));
+    size_t runs_count = count + (memory_run != NULL ? 1 : 0);
+    merger->runs = calloc(runs_count + 1, sizeof(sort_run_t));
+    merger->heap = calloc(runs_count + 1, sizeof(size_t));
+    if (!merger->runs || !merger->heap) {
+        merger->failed = true;
+        return -1;
+    }
+    for (size_t i = 0; i < runs_count; ++i) {
+        sort_run_t *run = &merger->runs[i];
+        if (i < count) {
+            run->file = files[i];
+            if (fflush(run->file) != 0 || fseek(run->file, 0, SEEK_SET) != 0) {
+                merger->failed = true;
+                return -1;
+            }
+        } else {
+            run->next_in_memory = memory_run->head;
+        }
+        if (read_run(merger, run)) {
+            // Sift up
+            size_t position = merger->heap_count++;
+            merger->heap[position] = i;
+            while (position > 0 && run_is_before(merger, merger->heap[position], merger->heap[(position - 1) / 2])) {
+                size_t parent = (position - 1) / 2;
+                size_t tmp = merger->heap[parent];
+                merger->heap[parent] = merger->heap[position];
+                merger->heap[position] = tmp;
+                position = parent;
+            }
+        }
+    }
+    return merger->failed ? -1 : 0;
+}
+
+/*!
+ * @brief merger_next gives the next entry of the merged runs
+ * @param merger is the merger
+ * @return the entry, valid until the next call, NULL at the end of the runs (or if merger->failed)
+ */
+static files_list_entry_t *merger_next(run_merger_t *merger) {
+    if (merger->advance_top) {
+        merger->advance_top = false;
+        if (!read_run(merger, &merger->runs[merger->heap[0]])) {
+            merger->heap[0] = merger->heap[--merger->heap_count];
+        }
+        sift_down(merger);
+    }
+    if (merger->heap_count == 0 || merger->failed) {
+        return NULL;
+    }
+    merger->advance_top = true;
+    return merger->runs[merger->heap[0]].current;
+}
+
+/*!
+ * @brief merger_close frees a merger, its files are left open
+ * @param merger is the merger
+ */
+static void merger_close(run_merger_t *merger) {
+    free(merger->runs);
+    free(merger->heap);
+    merger->runs = NULL;
+    merger->heap = NULL;
+    merger->heap_count = 0;
+}
+
+/*!
+ * @brief add_run keeps a run file
+ * @param sorter is the sorter
+ * @param file is the run file
+ * @return 0 in case of success, -1 else
+ */
+static int add_run(external_sorter_t *sorter, FILE *file) {
+    if (sorter->runs_count == sorter->runs_capacity) {
+        size_t new_capacity = sorter->runs_capacity ? 2 * sorter->runs_capacity : 16;
+        FILE **new_runs = realloc(sorter->runs, new_capacity * sizeof(FILE *));
+        if (!new_runs) {
+            return -1;
+        }
+        sorter->runs = new_runs;
+        sorter->runs_capacity = new_capacity;
+    }
+    sorter->runs[sorter->runs_count++] = file;
+    return 0;
+}
+
+/*!
+ * @brief spill_batch sorts the batch, writes it to a new run file and empties it
+ * @param sorter is the sorter
+ * @return 0 in case of success, -1 else
+ */
+static int spill_batch(external_sorter_t *sorter) {
+    sort_files_list(&sorter->batch);
+    FILE *file = new_run_file();
+    if (!file) {
+        return -1;
+    }
+    for (files_list_entry_t *cursor = sorter->batch.head; cursor != NULL; cursor = cursor->next) {
+        if (write_record(file, cursor) == -1) {
+            perror("Unable to write a run file");
+            fclose(file);
+            return -1;
+        }
+    }
+    if (add_run(sorter, file) == -1) {
+        fclose(file);
+        return -1;
+    }
+    clear_files_list(&sorter->batch);
+    arena_init(&sorter->batch.arena, batch_chunk_size(sorter->memory_limit));
+    return 0;
+}
+
+/*!
+ * @brief external_sorter_init initializes an empty sorter
+ * @param sorter is the sorter to initialize
+ * @param memory_limit is the memory the batch may use before it is written to a run file
+ */
+void external_sorter_init(external_sorter_t *sorter, size_t memory_limit) {
+    memset(sorter, 0, sizeof(external_sorter_t));
+    sorter->memory_limit = memory_limit;
+    init_files_list(&sorter->batch);
+    arena_init(&sorter->batch.arena, batch_chunk_size(memory_limit));
+}
+
+/*!
+ * @brief external_sorter_add adds a copy of an entry to a sorter, spilling the batch to a run if it is full
+ * @param sorter is the sorter
+ * @param entry is the entry, only read during the call
+ * @return 0 in case of success, -1 else
+ */
+int external_sorter_add(external_sorter_t *sorter, files_list_entry_t *entry) {
+    if (sorter->failed || duplicate_file_entry(&sorter->batch, entry) == NULL) {
+        sorter->failed = true;
+        return -1;
+    }
+    ++sorter->entries_count;
+    if (batch_memory(&sorter->batch) >= sorter->memory_limit && spill_batch(sorter) == -1) {
+        sorter->failed = true;
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief external_sorter_sort ends the gathering of the entries and starts their merge
+ * When there are more runs than EXTERNAL_SORT_MAX_FANIN, the oldest ones are first merged into larger runs,
+ * so that the number of open runs stays bounded.
+ * @param sorter is the sorter
+ * @return 0 in case of success, -1 else
+ */
+int external_sorter_sort(external_sorter_t *sorter) {
+    if (sorter->failed) {
+        return -1;
+    }
+    sort_files_list(&sorter->batch);
+    while (sorter->runs_count > EXTERNAL_SORT_MAX_FANIN) {
+        run_merger_t merger;
+        FILE *file = new_run_file();
+        if (!file || merger_open(&merger, sorter->runs, EXTERNAL_SORT_MAX_FANIN, NULL) == -1) {
+            if (file != NULL) {
+                fclose(file);
+                merger_close(&merger);
+            }
+            sorter->failed = true;
+            return -1;
+        }
+        files_list_entry_t *entry;
+        while ((entry = merger_next(&merger)) != NULL && write_record(file, entry) == 0) {
+        }
+        bool failed = merger.failed || entry != NULL;
+        merger_close(&merger);
+        if (failed) {
+            fclose(file);
+            sorter->failed = true;
+            return -1;
+        }
+        for (size_t i = 0; i < EXTERNAL_SORT_MAX_FANIN; ++i) {
+            fclose(sorter->runs[i]);
+        }
+        sorter->runs_count -= EXTERNAL_SORT_MAX_FANIN;
+        memmove(sorter->runs, sorter->runs + EXTERNAL_SORT_MAX_FANIN, sorter->runs_count * sizeof(FILE *));
+        sorter->runs[sorter->runs_count++] = file; // Room is left by the merged runs
+    }
+    if (merger_open(&sorter->merger, sorter->runs, sorter->runs_count, &sorter->batch) == -1) {
+        sorter->failed = true;
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief external_sorter_next gives the entries of a sorter in the order of sort_files_list
+ * @param sorter is the sorter, sorted by external_sorter_sort
+ * @return the next entry, valid until the next call, NULL at the end (or if sorter->failed)
+ */
+files_list_entry_t *external_sorter_next(external_sorter_t *sorter) {
+    if (sorter->failed) {
+        return NULL;
+    }
+    files_list_entry_t *entry = merger_next(&sorter->merger);
+    sorter->failed = sorter->merger.failed;
+    return entry;
+}
+
+/*!
+ * @brief external_sorter_release frees a sorter and removes its run files
+ * @param sorter is the sorter
+ */
+void external_sorter_release(external_sorter_t *sorter) {
+    merger_close(&sorter->merger);
+    for (size_t i = 0; i < sorter->runs_count; ++i) {
+        fclose(sorter->runs[i]);
+    }
+    free(sorter->runs);
+    sorter->runs = NULL;
+    sorter->runs_count = 0;
+    sorter->runs_capacity = 0;
+    clear_files_list(&sorter->batch);
+}
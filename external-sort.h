@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "defines.h"
+#include "files-list.h"
+
+// Size of the stdio buffer of each run file
+#define EXTERNAL_SORT_RUN_BUFFER (64 * 1024)
+// Runs merged at once, more runs are first merged into larger ones
+#define EXTERNAL_SORT_MAX_FANIN 128
+
+// Cursor on a sorted run, on disk or in memory
+typedef struct {
+    FILE *file; // NULL for the run kept in memory
+    files_list_entry_t *next_in_memory;
+    files_list_entry_t *current; // Current entry of the run, NULL at its end
+    files_list_entry_t entry; // Entry read from the file
+    char path[PATH_SIZE + 1]; // Directory and name of the current entry, '\0' separated
+} sort_run_t;
+
+// K-way merge of sorted runs, with a heap of the cursors
+typedef struct {
+    sort_run_t *runs;
+    size_t *heap; // Index of the runs that have an entry, smallest first
+    size_t heap_count;
+    bool advance_top; // The entry of the top run was given, it moves on at the next call
+    bool failed;
+} run_merger_t;
+
+// Entries of a tree sorted under a memory limit: the entries are gathered in a batch, which is sorted and
+// written to a run file each time it reaches the limit (@see external_sorter_add)
+typedef struct {
+    size_t memory_limit;
+    files_list_t batch; // Entries of the run being gathered
+    FILE **runs;
+    size_t runs_count;
+    size_t runs_capacity;
+    uint64_t entries_count;
+    run_merger_t merger;
+    bool failed;
+} external_sorter_t;
+
+void external_sorter_init(external_sorter_t *sorter, size_t memory_limit);
+int external_sorter_add(external_sorter_t *sorter, files_list_entry_t *entry);
+int external_sorter_sort(external_sorter_t *sorter);
+files_list_entry_t *external_sorter_next(external_sorter_t *sorter);
+void external_sorter_release(external_sorter_t *sorter);
@@ -1,13 +1,15 @@
 #include "file-properties.h"
 #include <sys/stat.h>
 #include <dirent.h>
-#include <openssl/evp.h>
 #include <unistd.h>
-#include <assert.h>
 #include "defines.h"
 #include <fcntl.h>
 #include <stdio.h>
 #include "utility.h"
+#include "read-engine.h"
+#include "stats.h"
+#include "trace.h"
+#include "hard-links.h"
 #include <errno.h>
 #include <string.h>
 
@@ -15,7 +17,8 @@
  * @brief Gets all of the required information for a file (including directories).
  *
  * This function retrieves information such as mode (permissions), mtime (in nanoseconds),
- * size, entry type (FICHIER), and MD5 sum.
+ * size, entry type (FICHIER), device, inode and number of links. It doesn't read the content of the file: the checksum is only
+ * computed when the comparison needs it (@see get_file_checksum).
  *
  * For directories, it obtains mode and entry type (DOSSIER).
  *
@@ -24,24 +27,41 @@
  */
 int get_file_stats(files_list_entry_t *entry) {
     struct stat sb;
-    const char *path = entry->path_and_name;
+    char path[PATH_SIZE];
+    get_entry_path(entry, path);
 
+    stats_add(STATS_ENTRIES_ANALYZED, 1);
+    stats_syscalls(STATS_PHASE_SCAN, 1);
+    uint64_t span = trace_begin();
     int result = lstat(path, &sb);
+    trace_end(TRACE_STAT, span, 0, path);
     if (result == -1) {
-        printf("%s\n", strerror(errno));
-        // Handle the error...
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
     }
+    return set_entry_stats(entry, &sb);
+}
 
-    entry->mtime.tv_sec = sb.st_mtim.tv_sec;  // Copy seconds
-    entry->mtime.tv_nsec = sb.st_mtim.tv_nsec;
-    entry->size = sb.st_size;
-    entry->mode = sb.st_mode;
-
-    if (S_ISDIR(sb.st_mode)) {
+/*!
+ * @brief Copies the stats of a file (from stat, lstat, fstatat...) to its entry.
+ *
+ * @param entry The files list entry.
+ * @param sb The stats of the file.
+ * @return -1 if the file is neither a regular file nor a directory, 0 otherwise.
+ */
+int set_entry_stats(files_list_entry_t *entry, struct stat *sb) {
+    entry->mtime.tv_sec = sb->st_mtim.tv_sec;  // Copy seconds
+    entry->mtime.tv_nsec = sb->st_mtim.tv_nsec;
+    entry->size = sb->st_size;
+    entry->mode = sb->st_mode;
+    entry->device = sb->st_dev;
+    entry->inode = sb->st_ino;
+    entry->nlink = sb->st_nlink;
+
+    if (S_ISDIR(sb->st_mode)) {
         entry->entry_type = DOSSIER;
-    } else if (S_ISREG(sb.st_mode)) {
+    } else if (S_ISREG(sb->st_mode)) {
         entry->entry_type = FICHIER;
-        assert(compute_file_md5(entry) == 0 && "Error computing MD5");
     } else {
         return -1; // Type de fichier inconnu
     }
@@ -49,37 +69,92 @@ int get_file_stats(files_list_entry_t *entry) {
 }
 
 /*!
- * @brief Computes a file's MD5 sum using libcrypto functions from openssl/evp.h.
+ * @brief Gets the checksum of a file, whose stats are already known (@see get_file_stats).
  *
- * @param entry The pointer to the files list entry.
- * @return -1 in case of error, 0 otherwise.
+ * The checksum is taken from another link of the same inode when it was already hashed (@see hard-links.h),
+ * or from the checksum cache when the file has not changed since it was cached, otherwise it is computed
+ * and stored in the cache.
+ *
+ * @param entry The files list entry.
+ * @param type The checksum to get.
+ * @param cache The checksum cache, NULL to always compute the checksum.
+ * @return -1 in case of error, 0 otherwise (directories have no checksum).
  */
-int compute_file_md5(files_list_entry_t *entry) {
-    // Open and check if the file has been opened correctly.
-    int file = open(entry->path_and_name, O_RDONLY);
-    assert(file != -1 && "Unable to open the file");
+int get_file_checksum(files_list_entry_t *entry, checksum_type_t type, checksum_cache_t *cache) {
+    if (entry->entry_type != FICHIER || entry->checksum_type == type || hard_links_get_checksum(entry, type)) {
+        return 0;
+    }
+    if (!checksum_cache_lookup(cache, entry, type)) {
+        if (compute_file_checksum(entry, type) == -1) {
+            return -1;
+        }
+        checksum_cache_store(cache, entry);
+    }
+    hard_links_set_checksum(entry);
+    return 0;
+}
 
-    EVP_MD_CTX *mdctx = EVP_MD_CTX_new();
-    const EVP_MD *md = EVP_md5();
+/*!
+ * @brief checksum_consumer feeds the blocks of a file given by the read engine to a checksum
+ * @param context is the checksum context
+ * @param data is the next block of the file
+ * @param size is the size of the block
+ * @return 0 to go on, -1 on error
+ */
+static int checksum_consumer(void *context, const uint8_t *data, size_t size) {
+    stats_add(STATS_BYTES_HASHED, size);
+    return checksum_update((checksum_context_t *) context, data, size);
+}
 
-    assert(mdctx && md && EVP_DigestInit_ex(mdctx, md, NULL) && "Error in MD5 sum initialization");
+/*!
+ * @brief Computes a file's checksum (@see checksum.h for the available backends).
+ *
+ * The file is streamed by the read engine (@see read-engine.h), which uses large buffers and, when selected,
+ * keeps several reads in flight with io_uring.
+ *
+ * @param entry The pointer to the files list entry.
+ * @param type The checksum to compute.
+ * @return -1 in case of error, 0 otherwise.
+ */
+int compute_file_checksum(files_list_entry_t *entry, checksum_type_t type) {
+    char path[PATH_SIZE];
+    get_entry_path(entry, path);
 
-    unsigned char buffer[1024];
-    ssize_t bytes;
-    while ((bytes = read(file, buffer, sizeof(buffer))) > 0) {
-        assert(EVP_DigestUpdate(mdctx, buffer, bytes) && "Error in MD5 sum update");
+    checksum_context_t context;
+    if (checksum_init(&context, type) == -1) {
+        return -1;
     }
 
-    close(file);
-
-    unsigned int md_len;
-    assert(EVP_DigestFinal_ex(mdctx, entry->md5sum, &md_len) && "Error in MD5 sum finalization");
+    stats_phase_t previous_phase = stats_enter(STATS_PHASE_HASH);
+    uint64_t span = trace_begin();
+    int result = read_engine_read_file(path, checksum_consumer, &context);
+    if (result == -1) {
+        fprintf(stderr, "Unable to read %s: %s\n", path, strerror(errno));
+    }
 
-    EVP_MD_CTX_free(mdctx);
+    // Always called, it frees the context
+    result = checksum_final(&context, entry->checksum) == -1 ? -1 : result;
+    trace_end(TRACE_HASH, span, entry->size, path);
+    stats_leave(previous_phase);
+    if (result == -1) {
+        return -1;
+    }
+    entry->checksum_type = type;
+    stats_add(STATS_FILES_HASHED, 1);
 
     return 0;
 }
 
+/*!
+ * @brief Computes a file's MD5 sum.
+ *
+ * @param entry The pointer to the files list entry.
+ * @return -1 in case of error, 0 otherwise.
+ */
+int compute_file_md5(files_list_entry_t *entry) {
+    return compute_file_checksum(entry, CHECKSUM_MD5);
+}
+
 /*!
  * @brief Tests the existence of a directory.
  *
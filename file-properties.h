@@ -3,8 +3,13 @@
 #include "files-list.h"
 #include <stdbool.h>
 #include "configuration.h"
+#include "checksum-cache.h"
+#include <sys/stat.h>
 
 int get_file_stats(files_list_entry_t *entry);
+int set_entry_stats(files_list_entry_t *entry, struct stat *sb);
+int get_file_checksum(files_list_entry_t *entry, checksum_type_t type, checksum_cache_t *cache);
+int compute_file_checksum(files_list_entry_t *entry, checksum_type_t type);
 int compute_file_md5(files_list_entry_t *entry);
 bool directory_exists(char *path_to_dir);
 bool is_directory_writable(char *path_to_dir);
@@ -1,82 +1,362 @@
 #include "files-list.h"
+#include "defines.h"
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <sys/stat.h>
 
+#define HASH_TABLE_INITIAL_CAPACITY 1024
+#define DIRS_TABLE_INITIAL_CAPACITY 64
+
+/*
+ * A path is stored in two parts: the interned path of its parent directory and its own name. Comparisons
+ * and hashes run over a view of both parts as if they were a single string, without rebuilding it.
+ */
+typedef struct {
+    const char *first;
+    const char *second;
+} path_view_t;
+
+/*!
+ * @brief make_entry_view builds the view of an entry path, without its first offset chars
+ * @param entry the entry
+ * @param offset the number of chars to skip (e.g. the length of the root of the tree)
+ * @return the view on the path
+ */
+static path_view_t make_entry_view(files_list_entry_t *entry, size_t offset) {
+    path_view_t view;
+    if (offset <= entry->dir_path_length) {
+        view.first = entry->dir_path + offset;
+        view.second = entry->name;
+    } else {
+        size_t name_length = strlen(entry->name);
+        offset -= entry->dir_path_length;
+        view.first = entry->name + (offset < name_length ? offset : name_length);
+        view.second = "";
+    }
+    return view;
+}
+
+/*!
+ * @brief compare_views compares two paths views like strcmp would compare the full paths
+ * @param left the first view
+ * @param right the second view
+ * @return an integer less than, equal to, or greater than zero like strcmp
+ */
+static int compare_views(path_view_t left, path_view_t right) {
+    for (;;) {
+        if (*left.first == '\0' && *left.second != '\0') {
+            left.first = left.second;
+            left.second = "";
+        }
+        if (*right.first == '\0' && *right.second != '\0') {
+            right.first = right.second;
+            right.second = "";
+        }
+        unsigned char l = *left.first;
+        unsigned char r = *right.first;
+        if (l != r || l == '\0') {
+            return (l > r) - (l < r);
+        }
+        ++left.first;
+        ++right.first;
+    }
+}
+
+/*!
+ * @brief hash_view computes the FNV-1a hash of a path view
+ * @param view the path to hash
+ * @return the hash value, the same as the one of the full path string
+ */
+static uint64_t hash_view(path_view_t view) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *) view.first; *p != '\0'; ++p) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    for (const unsigned char *p = (const unsigned char *) view.second; *p != '\0'; ++p) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*!
+ * @brief hash_table_lookup finds the slot of a path in the list hash table
+ * The table uses open addressing with linear probing, its capacity is always a power of 2.
+ * @param list the list whose table to search
+ * @param path the view of the path to look for
+ * @return a pointer to the slot holding the entry, or to the empty slot where it would be inserted
+ */
+static files_list_entry_t **hash_table_lookup(files_list_t *list, path_view_t path) {
+    size_t mask = list->hash_capacity - 1;
+    size_t slot = hash_view(path) & mask;
+    while (list->hash_table[slot] != NULL && compare_views(make_entry_view(list->hash_table[slot], 0), path) != 0) {
+        slot = (slot + 1) & mask;
+    }
+    return &list->hash_table[slot];
+}
+
+/*!
+ * @brief hash_table_grow doubles the capacity of the list hash table (or creates it)
+ * @param list the list whose table must grow
+ * @return 0 in case of success, -1 else (out of memory)
+ */
+static int hash_table_grow(files_list_t *list) {
+    size_t new_capacity = list->hash_capacity ? list->hash_capacity * 2 : HASH_TABLE_INITIAL_CAPACITY;
+    files_list_entry_t **new_table = calloc(new_capacity, sizeof(files_list_entry_t *));
+    if (!new_table) {
+        return -1;
+    }
+
+    files_list_entry_t **old_table = list->hash_table;
+    size_t old_capacity = list->hash_capacity;
+    list->hash_table = new_table;
+    list->hash_capacity = new_capacity;
+    for (size_t i = 0; i < old_capacity; ++i) {
+        if (old_table[i] != NULL) {
+            *hash_table_lookup(list, make_entry_view(old_table[i], 0)) = old_table[i];
+        }
+    }
+    free(old_table);
+    return 0;
+}
+
+/*!
+ * @brief intern_dir returns the single copy of a directory path owned by the list
+ * All the entries of a directory share the same copy of its path, so it is stored once.
+ * @param list the list owning the directories
+ * @param dir_path the directory path (not necessarily '\0' terminated)
+ * @param length the length of dir_path
+ * @return the interned copy, NULL if out of memory
+ */
+static const char *intern_dir(files_list_t *list, const char *dir_path, size_t length) {
+    if (list->last_dir != NULL && list->last_dir_length == length && memcmp(list->last_dir, dir_path, length) == 0) {
+        return list->last_dir;
+    }
+
+    if ((list->dirs_count + 1) * 2 > list->dirs_capacity) {
+        size_t new_capacity = list->dirs_capacity ? list->dirs_capacity * 2 : DIRS_TABLE_INITIAL_CAPACITY;
+        const char **new_table = calloc(new_capacity, sizeof(const char *));
+        if (!new_table) {
+            return NULL;
+        }
+        for (size_t i = 0; i < list->dirs_capacity; ++i) {
+            if (list->dirs_table[i] != NULL) {
+                path_view_t view = {list->dirs_table[i], ""};
+                size_t slot = hash_view(view) & (new_capacity - 1);
+                while (new_table[slot] != NULL) {
+                    slot = (slot + 1) & (new_capacity - 1);
+                }
+                new_table[slot] = list->dirs_table[i];
+            }
+        }
+        free(list->dirs_table);
+        list->dirs_table = new_table;
+        list->dirs_capacity = new_capacity;
+    }
+
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (unsigned char) dir_path[i];
+        hash *= 1099511628211ULL;
+    }
+    size_t mask = list->dirs_capacity - 1;
+    size_t slot = hash & mask;
+    while (list->dirs_table[slot] != NULL) {
+        const char *candidate = list->dirs_table[slot];
+        if (memcmp(candidate, dir_path, length) == 0 && candidate[length] == '\0') {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    if (list->dirs_table[slot] == NULL) {
+        char *copy = arena_strndup(&list->arena, dir_path, length);
+        if (!copy) {
+            return NULL;
+        }
+        list->dirs_table[slot] = copy;
+        ++list->dirs_count;
+    }
+
+    list->last_dir = list->dirs_table[slot];
+    list->last_dir_length = length;
+    return list->last_dir;
+}
+
+/*!
+ * @brief link_entry_to_tail appends an entry to the list and updates its bookkeeping (count, order, hash)
+ * @param list the list to append to
+ * @param entry the entry to append
+ * @param slot the hash table slot for the entry, NULL to look it up
+ * @return 0 in case of success, -1 else (out of memory)
+ */
+static int link_entry_to_tail(files_list_t *list, files_list_entry_t *entry, files_list_entry_t **slot) {
+    // Keep the load factor under 1/2 so that probing sequences stay short
+    if ((list->count + 1) * 2 > list->hash_capacity) {
+        if (hash_table_grow(list) == -1) {
+            return -1;
+        }
+        slot = NULL;
+    }
+    if (slot == NULL) {
+        slot = hash_table_lookup(list, make_entry_view(entry, 0));
+    }
+    *slot = entry;
+
+    if (list->tail != NULL && compare_entries(list->tail, entry, 0, 0) > 0) {
+        list->sorted = false;
+    }
+
+    entry->prev = list->tail;
+    entry->next = NULL;
+    if (list->tail != NULL) {
+        list->tail->next = entry;
+    }
+    list->tail = entry;
+    if (list->head == NULL) {
+        list->head = entry;
+    }
+    ++list->count;
+    return 0;
+}
+
+/*!
+ * @brief init_files_list initializes an empty files list
+ * @param list is a pointer to the list to initialize
+ */
+void init_files_list(files_list_t *list) {
+    if (!list) {
+        return;
+    }
+    memset(list, 0, sizeof(files_list_t));
+    list->sorted = true;
+    arena_init(&list->arena, 0);
+}
+
 /*!
  * @brief clear_files_list clears a files list
  * @param list is a pointer to the list to be cleared
- * This function is provided, you don't need to implement nor modify it
+ * All the entries live in the list arena, which is released at once. The list is left empty and can be reused.
  */
 void clear_files_list(files_list_t *list) {
-    while (list->head) {
-        files_list_entry_t *tmp = list->head;
-        list->head = tmp->next;
-        free(tmp);
+    arena_release(&list->arena);
+    free(list->index);
+    free(list->hash_table);
+    free(list->dirs_table);
+    init_files_list(list);
+}
+
+/*!
+ * @brief new_file_entry allocates an entry in the list arena, without adding it to the list
+ * Properties are zeroed. The directory part of the path is interned, so that it is stored once for all
+ * its entries. Use it to build entries that are then given to add_entry_to_tail.
+ * @param list the list that will own the entry
+ * @param file_path the full path of the file
+ * @return a pointer to the new entry, NULL if out of memory or the path is too long
+ */
+files_list_entry_t *new_file_entry(files_list_t *list, const char *file_path) {
+    if (!list || !file_path) {
+        return NULL;
     }
+
+    size_t length = strlen(file_path);
+    if (length >= PATH_SIZE) {
+        return NULL;
+    }
+    const char *last_slash = strrchr(file_path, '/');
+    size_t dir_length = last_slash ? (size_t) (last_slash - file_path) + 1 : 0;
+
+    files_list_entry_t *entry = arena_alloc(&list->arena, sizeof(files_list_entry_t), sizeof(uint64_t));
+    if (!entry) {
+        return NULL;
+    }
+    memset(entry, 0, sizeof(files_list_entry_t));
+    entry->dir_path = intern_dir(list, file_path, dir_length);
+    entry->name = arena_strndup(&list->arena, file_path + dir_length, length - dir_length);
+    if (!entry->dir_path || !entry->name) {
+        return NULL;
+    }
+    entry->dir_path_length = dir_length;
+    return entry;
 }
 
 /*!
  *  @brief add_file_entry adds a new file to the files list.
- *  It adds the file in an ordered manner (strcmp) without filling its properties.
+ *  The entry is appended in O(1) without filling its properties: the list is only ordered (strcmp)
+ *  once, by sort_files_list, after all the entries have been added. Duplicates are detected through
+ *  a hash index on the path.
  *  If the file already exists, it does nothing and returns NULL
  *  @param list the list to add the file entry into
  *  @param file_path the full path (from the root of the considered tree) of the file
  *  @return a pointer to the added element if success, NULL else (out of memory or duplicate entry)
  */
 files_list_entry_t *add_file_entry(files_list_t *list, char *file_path) {
+    if (!list || !file_path) {
+        return NULL;
+    }
+
     // Check if the file entry already exists
-    if (find_entry_by_name(list, file_path, 0, 0) != NULL) {
-        return NULL; // Entry already exists
+    files_list_entry_t **slot = NULL;
+    if (list->hash_capacity > 0) {
+        path_view_t view = {file_path, ""};
+        slot = hash_table_lookup(list, view);
+        if (*slot != NULL) {
+            return NULL; // Entry already exists
+        }
     }
 
     // Create a new file entry
-    files_list_entry_t *new_entry = malloc(sizeof(files_list_entry_t));
+    files_list_entry_t *new_entry = new_file_entry(list, file_path);
     if (!new_entry) {
         return NULL; // Memory allocation failed
     }
 
-    // Initialize the new entry's properties
-    strncpy(new_entry->path_and_name, file_path, sizeof(new_entry->path_and_name));
-    new_entry->next = NULL;
-    new_entry->prev = NULL;
-
-    // Add the new entry to the list in an ordered manner
-    files_list_entry_t *current = list->head;
-    files_list_entry_t *prev = NULL;
-    while (current != NULL && strcmp(file_path, current->path_and_name) > 0) {
-        prev = current;
-        current = current->next;
+    if (link_entry_to_tail(list, new_entry, slot) == -1) {
+        return NULL;
     }
 
-    if (prev == NULL) {
-        // Insert at the beginning of the list
-        new_entry->next = list->head;
-        if (list->head != NULL) {
-            list->head->prev = new_entry;
-        }
-        list->head = new_entry;
-    } else {
-        // Insert in the middle or at the end of the list
-        new_entry->next = current;
-        new_entry->prev = prev;
-        prev->next = new_entry;
-        if (current != NULL) {
-            current->prev = new_entry;
-        }
+    return new_entry;
+}
+
+/*!
+ * @brief duplicate_file_entry copies an entry with its properties and adds it to the tail of another list
+ * @param list the list receiving the copy
+ * @param entry the entry to copy
+ * @return a pointer to the copy, NULL if out of memory
+ */
+files_list_entry_t *duplicate_file_entry(files_list_t *list, files_list_entry_t *entry) {
+    if (!list || !entry) {
+        return NULL;
     }
 
-    return new_entry;
+    char path[PATH_SIZE];
+    files_list_entry_t *copy = new_file_entry(list, get_entry_path(entry, path));
+    if (!copy) {
+        return NULL;
+    }
+    copy->mtime = entry->mtime;
+    copy->size = entry->size;
+    copy->device = entry->device;
+    copy->inode = entry->inode;
+    copy->nlink = entry->nlink;
+    memcpy(copy->checksum, entry->checksum, sizeof(copy->checksum));
+    copy->checksum_type = entry->checksum_type;
+    copy->entry_type = entry->entry_type;
+    copy->mode = entry->mode;
+    if (link_entry_to_tail(list, copy, NULL) == -1) {
+        return NULL;
+    }
+    return copy;
 }
 
 /*!
  * @brief add_entry_to_tail adds an entry directly to the tail of the list
  * It supposes that the entries are provided already ordered, e.g. when a lister process sends its list's
- * elements to the main process.
+ * elements to the main process. If they are not, the list will be sorted again by sort_files_list.
  * @param list is a pointer to the list to which to add the element
- * @param entry is a pointer to the entry to add. The list becomes owner of the entry.
+ * @param entry is a pointer to the entry to add, allocated with new_file_entry on the same list.
  * @return 0 in case of success, -1 else
  */
 int add_entry_to_tail(files_list_t *list, files_list_entry_t *entry) {
@@ -84,28 +364,99 @@ int add_entry_to_tail(files_list_t *list, files_list_entry_t *entry) {
         return -1; // Invalid input parameters
     }
 
-    // Update the entry's pointers
-    entry->prev = list->tail;
-    entry->next = NULL;
+    return link_entry_to_tail(list, entry, NULL);
+}
 
-    // Update the list's pointers
-    if (list->tail != NULL) {
-        list->tail->next = entry;
+/*!
+ * @brief merge_sorted_runs merges two NULL terminated runs of entries linked by their next pointer
+ * @param left the first run
+ * @param right the second run
+ * @return the head of the merged run. Entries with equal paths keep their relative order.
+ */
+static files_list_entry_t *merge_sorted_runs(files_list_entry_t *left, files_list_entry_t *right) {
+    files_list_entry_t head;
+    files_list_entry_t *tail = &head;
+    head.next = NULL;
+    while (left != NULL && right != NULL) {
+        if (compare_entries(left, right, 0, 0) <= 0) {
+            tail->next = left;
+            left = left->next;
+        } else {
+            tail->next = right;
+            right = right->next;
+        }
+        tail = tail->next;
     }
+    tail->next = (left != NULL) ? left : right;
+    return head.next;
+}
 
-    list->tail = entry;
+/*!
+ * @brief sort_files_list orders the list (strcmp) and builds its sorted index
+ * Lists built with add_file_entry are collected unordered, this function must be called once they are
+ * complete. It runs a bottom-up merge sort in O(n log n), and does nothing but rebuilding the index if
+ * the entries were already appended in order.
+ * @param list is a pointer to the list to sort
+ * @return 0 in case of success, -1 else (out of memory for the index, the list is sorted anyway)
+ */
+int sort_files_list(files_list_t *list) {
+    if (!list) {
+        return -1;
+    }
 
-    // If the list was empty, update the head pointer
-    if (list->head == NULL) {
-        list->head = entry;
+    if (!list->sorted) {
+        // Bottom-up merge sort: runs[i] holds a sorted run of 2^i entries (or is empty)
+        files_list_entry_t *runs[64] = {NULL};
+        files_list_entry_t *cursor = list->head;
+        while (cursor != NULL) {
+            files_list_entry_t *run = cursor;
+            cursor = cursor->next;
+            run->next = NULL;
+            int level = 0;
+            while (runs[level] != NULL) {
+                run = merge_sorted_runs(runs[level], run);
+                runs[level++] = NULL;
+            }
+            runs[level] = run;
+        }
+        files_list_entry_t *sorted = NULL;
+        for (int level = 0; level < 64; ++level) {
+            if (runs[level] != NULL) {
+                sorted = merge_sorted_runs(runs[level], sorted);
+            }
+        }
+
+        // Restore the prev pointers and the tail
+        list->head = sorted;
+        list->tail = NULL;
+        for (cursor = sorted; cursor != NULL; cursor = cursor->next) {
+            cursor->prev = list->tail;
+            list->tail = cursor;
+        }
+        list->sorted = true;
+        list->index_size = 0;
     }
 
-    return 0; // Success
+    if (list->index_size != list->count) {
+        files_list_entry_t **new_index = realloc(list->index, (list->count + 1) * sizeof(files_list_entry_t *));
+        if (!new_index) {
+            list->index_size = 0;
+            return -1;
+        }
+        list->index = new_index;
+        size_t i = 0;
+        for (files_list_entry_t *cursor = list->head; cursor != NULL; cursor = cursor->next) {
+            list->index[i++] = cursor;
+        }
+        list->index_size = i;
+    }
+    return 0;
 }
 
 /*!
  *  @brief find_entry_by_name looks up for a file in a list
- *  The function uses the ordering of the entries to interrupt its search
+ *  When no prefix is skipped, the lookup goes through the hash index in O(1). Otherwise, the function
+ *  runs a binary search on the sorted index (O(log n)), sorting the list first if required.
  *  @param list the list to look into
  *  @param file_path the full path of the file to look for
  *  @param start_of_src the position of the name of the file in the source directory (removing the source path)
@@ -113,55 +464,110 @@ int add_entry_to_tail(files_list_t *list, files_list_entry_t *entry) {
  *  @return a pointer to the element found, NULL if none were found.
  */
 files_list_entry_t *find_entry_by_name(files_list_t *list, char *file_path, size_t start_of_src, size_t start_of_dest) {
-    if (!list || !file_path) {
+    if (!list || !file_path || list->count == 0) {
         return NULL; // Invalid input parameters
     }
 
-    files_list_entry_t *current = list->head;
+    if (start_of_src == 0 && start_of_dest == 0) {
+        path_view_t view = {file_path, ""};
+        return *hash_table_lookup(list, view);
+    }
 
-    // Iterate through the list
-    while (current != NULL) {
-        // Implement the logic to compare file paths based on your requirements
-        // You may want to use start_of_src and start_of_dest
-        if (strcmp(current->path_and_name, file_path) == 0) {
-            return current; // Entry found
-        } else if (strcmp(current->path_and_name, file_path) > 0) {
-            // Entry not found because we passed the point where it could be
-            break;
-        }
+    if (strlen(file_path) < start_of_src) {
+        return NULL;
+    }
+    if (sort_files_list(list) == -1) {
+        return NULL;
+    }
 
-        current = current->next;
+    // All the entries of a list share their root, so ordering full paths also orders their suffixes
+    path_view_t name = {file_path + start_of_src, ""};
+    size_t low = 0;
+    size_t high = list->index_size;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        files_list_entry_t *candidate = list->index[middle];
+        int comparison = (get_entry_path_length(candidate) < start_of_dest) ? -1 : compare_views(make_entry_view(candidate, start_of_dest), name);
+        if (comparison == 0) {
+            return list->index[middle]; // Entry found
+        } else if (comparison < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
     }
 
     return NULL; // Entry not found
 }
 
+/*!
+ * @brief get_entry_path builds the full path of an entry
+ * @param entry the entry
+ * @param buffer the buffer receiving the path, at least PATH_SIZE long
+ * @return buffer, or NULL if a parameter is NULL
+ */
+char *get_entry_path(files_list_entry_t *entry, char *buffer) {
+    if (!entry || !buffer) {
+        return NULL;
+    }
+    memcpy(buffer, entry->dir_path, entry->dir_path_length);
+    strcpy(buffer + entry->dir_path_length, entry->name);
+    return buffer;
+}
+
+/*!
+ * @brief get_entry_path_length computes the length of the full path of an entry
+ * @param entry the entry
+ * @return the length of its full path
+ */
+size_t get_entry_path_length(files_list_entry_t *entry) {
+    return entry->dir_path_length + strlen(entry->name);
+}
+
+/*!
+ * @brief compare_entries compares the paths of two entries like strcmp, without building them
+ * @param left the first entry
+ * @param right the second entry
+ * @param start_of_left the number of chars to skip in the left path (e.g. the source root)
+ * @param start_of_right the number of chars to skip in the right path (e.g. the destination root)
+ * @return an integer less than, equal to, or greater than zero like strcmp
+ */
+int compare_entries(files_list_entry_t *left, files_list_entry_t *right, size_t start_of_left, size_t start_of_right) {
+    // Siblings share their interned directory, only their names must be compared
+    if (left->dir_path == right->dir_path && start_of_left == start_of_right && start_of_left <= left->dir_path_length) {
+        return strcmp(left->name, right->name);
+    }
+    return compare_views(make_entry_view(left, start_of_left), make_entry_view(right, start_of_right));
+}
+
 /*!
  * @brief display_files_list displays a files list
  * @param list is the pointer to the list to be displayed
- * This function is already provided complete.
+ * The list is sorted first if entries were added out of order.
  */
 void display_files_list(files_list_t *list) {
     if (!list) {
         return;
     }
 
+    sort_files_list(list);
     for (files_list_entry_t *cursor = list->head; cursor != NULL; cursor = cursor->next) {
-        printf("%s\n", cursor->path_and_name);
+        printf("%s%s\n", cursor->dir_path, cursor->name);
     }
 }
 
 /*!
  * @brief display_files_list_reversed displays a files list from the end to the beginning
  * @param list is the pointer to the list to be displayed
- * This function is already provided complete.
+ * The list is sorted first if entries were added out of order.
  */
 void display_files_list_reversed(files_list_t *list) {
     if (!list) {
         return;
     }
 
+    sort_files_list(list);
     for (files_list_entry_t *cursor = list->tail; cursor != NULL; cursor = cursor->prev) {
-        printf("%s\n", cursor->path_and_name);
+        printf("%s%s\n", cursor->dir_path, cursor->name);
     }
 }
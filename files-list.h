@@ -1,18 +1,28 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <time.h>
 #include <sys/types.h>
+#include "arena.h"
+#include "checksum.h"
 
 typedef enum { FICHIER, DOSSIER } file_type_t;
 
 typedef struct _files_list_entry {
-    char path_and_name[4096];
+    const char *dir_path; // Interned path of the parent directory (with its trailing '/'), shared by siblings
+    const char *name; // Name of the entry in its parent directory
     struct timespec mtime;
     uint64_t size;
-    uint8_t md5sum[16];
+    uint64_t device; // Device and inode identify the file content, e.g. in the checksum cache
+    uint64_t inode;
+    uint64_t nlink; // Number of hard links to the inode, the content is only hashed and copied once for all of them
+    uint8_t checksum[CHECKSUM_SIZE_MAX]; // Only its first checksum_size(checksum_type) bytes are used
     file_type_t entry_type;
     mode_t mode;
+    uint16_t dir_path_length;
+    uint8_t checksum_type; // checksum_type_t of checksum, CHECKSUM_NONE until it is computed
     struct _files_list_entry *next;
     struct _files_list_entry *prev;
 } files_list_entry_t;
@@ -20,11 +30,30 @@ typedef struct _files_list_entry {
 typedef struct {
     struct _files_list_entry *head;
     struct _files_list_entry *tail;
+    size_t count; // Number of entries in the list
+    bool sorted; // false as long as entries were appended out of order
+    files_list_entry_t **index; // Entries in sorted order, valid when index_size == count
+    size_t index_size;
+    files_list_entry_t **hash_table; // Open addressing table on the full path, for duplicates detection
+    size_t hash_capacity;
+    arena_t arena; // Owns the entries, their names and the interned directories
+    const char **dirs_table; // Open addressing table of the interned directories
+    size_t dirs_capacity;
+    size_t dirs_count;
+    const char *last_dir; // Last interned directory, siblings are usually added in a row
+    size_t last_dir_length;
 } files_list_t;
 
+void init_files_list(files_list_t *list);
 void clear_files_list(files_list_t *list);
+files_list_entry_t *new_file_entry(files_list_t *list, const char *file_path);
 files_list_entry_t *add_file_entry(files_list_t *list, char *file_path);
+files_list_entry_t *duplicate_file_entry(files_list_t *list, files_list_entry_t *entry);
 int add_entry_to_tail(files_list_t *list, files_list_entry_t *entry);
+int sort_files_list(files_list_t *list);
 files_list_entry_t *find_entry_by_name(files_list_t *list, char *file_path, size_t start_of_src, size_t start_of_dest);
+char *get_entry_path(files_list_entry_t *entry, char *buffer);
+size_t get_entry_path_length(files_list_entry_t *entry);
+int compare_entries(files_list_entry_t *left, files_list_entry_t *right, size_t start_of_left, size_t start_of_right);
 void display_files_list(files_list_t *list);
-void display_files_list_reversed(files_list_t *list);
\ No newline at end of file
+void display_files_list_reversed(files_list_t *list);
@@ -0,0 +1,237 @@
+#include "hard-links.h"
+#include "defines.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The hard links table follows the files with several links (st_nlink > 1) during a synchronization, by
+ * (device, inode), so that their content is hashed and copied once for all their links:
+ * - the checksum of the first link hashed is given to the others, as long as size and mtime are the same;
+ * - the first link to be copied is copied, the others become hard links to its copy (@see linkat). A link
+ *   whose inode is being copied by another copy worker waits for the end of that copy.
+ * Only the main process uses it (the comparison and the copy workers), behind a mutex. It is emptied
+ * before each comparison of the trees, since inodes may change between them.
+ */
+
+static pthread_mutex_t links_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t links_changed = PTHREAD_COND_INITIALIZER; // A copy of a first link ended
+static hard_link_t *links = NULL; // Open addressing table
+static size_t links_capacity = 0; // Always a power of 2
+static size_t links_count = 0;
+
+/*!
+ * @brief is_tracked tells if an entry shares its content with other links
+ * @param entry is the entry
+ * @return true for files with several links
+ */
+static bool is_tracked(files_list_entry_t *entry) {
+    return entry->entry_type == FICHIER && entry->nlink > 1 && entry->inode != 0;
+}
+
+/*!
+ * @brief mix64 is the splitmix64 finalizer, used to hash the inodes
+ * @param value the value to hash
+ * @return the hashed value
+ */
+static uint64_t mix64(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xBF58476D1CE4E5B9ULL;
+    value ^= value >> 27;
+    value *= 0x94D049BB133111EBULL;
+    value ^= value >> 31;
+    return value;
+}
+
+/*!
+ * @brief find_slot looks for the slot of an inode
+ * @param table is the table
+ * @param capacity is its capacity (a power of 2)
+ * @param device is the device of the inode
+ * @param inode is the inode
+ * @return the slot of the inode, or the empty slot where it would be
+ */
+static hard_link_t *find_slot(hard_link_t *table, size_t capacity, uint64_t device, uint64_t inode) {
+    size_t mask = capacity - 1;
+    size_t slot = mix64(inode ^ mix64(device)) & mask;
+    while (table[slot].inode != 0 && (table[slot].inode != inode || table[slot].device != device)) {
+        slot = (slot + 1) & mask;
+    }
+    return &table[slot];
+}
+
+/*!
+ * @brief grow_table doubles the capacity of the table, links_lock held
+ * @return 0 in case of success, -1 if out of memory
+ */
+static int grow_table(void) {
+    size_t capacity = links_capacity ? links_capacity * 2 : HARD_LINKS_INITIAL_CAPACITY;
+    hard_link_t *table = calloc(capacity, sizeof(hard_link_t));
+    if (table == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < links_capacity; ++i) {
+        if (links[i].inode != 0) {
+            *find_slot(table, capacity, links[i].device, links[i].inode) = links[i];
+        }
+    }
+    free(links);
+    links = table;
+    links_capacity = capacity;
+    return 0;
+}
+
+/*!
+ * @brief find_link gives the record of the inode of an entry, links_lock held
+ * A record whose size or mtime are not those of the entry loses its checksum: the inode changed.
+ * @param entry is the entry
+ * @param create is true to add the inode when it is missing
+ * @return the record, NULL if it is missing (or out of memory)
+ */
+static hard_link_t *find_link(files_list_entry_t *entry, bool create) {
+    if (links_capacity > 0) {
+        hard_link_t *link = find_slot(links, links_capacity, entry->device, entry->inode);
+        if (link->inode != 0) {
+            if (link->size != entry->size || link->mtime.tv_sec != entry->mtime.tv_sec || link->mtime.tv_nsec != entry->mtime.tv_nsec) {
+                link->size = entry->size;
+                link->mtime = entry->mtime;
+                link->checksum_type = CHECKSUM_NONE;
+            }
+            return link;
+        }
+    }
+    if (!create || ((links_count + 1) * 2 > links_capacity && grow_table() == -1)) {
+        return NULL;
+    }
+    hard_link_t *link = find_slot(links, links_capacity, entry->device, entry->inode);
+    memset(link, 0, sizeof(hard_link_t));
+    link->device = entry->device;
+    link->inode = entry->inode;
+    link->size = entry->size;
+    link->mtime = entry->mtime;
+    link->checksum_type = CHECKSUM_NONE;
+    ++links_count;
+    return link;
+}
+
+/*!
+ * @brief hard_links_get_checksum gives a file the checksum already computed for another link of its inode
+ * @param entry is the file entry, with its stats
+ * @param type is the checksum needed
+ * @return true if the checksum was found (it is then set in the entry), false else
+ */
+bool hard_links_get_checksum(files_list_entry_t *entry, checksum_type_t type) {
+    if (!is_tracked(entry)) {
+        return false;
+    }
+    pthread_mutex_lock(&links_lock);
+    hard_link_t *link = find_link(entry, false);
+    bool found = link != NULL && link->checksum_type == type;
+    if (found) {
+        memcpy(entry->checksum, link->checksum, sizeof(entry->checksum));
+        entry->checksum_type = type;
+    }
+    pthread_mutex_unlock(&links_lock);
+    return found;
+}
+
+/*!
+ * @brief hard_links_set_checksum records the checksum of a file for the other links of its inode
+ * @param entry is the file entry, with its checksum
+ */
+void hard_links_set_checksum(files_list_entry_t *entry) {
+    if (!is_tracked(entry) || entry->checksum_type == CHECKSUM_NONE) {
+        return;
+    }
+    pthread_mutex_lock(&links_lock);
+    hard_link_t *link = find_link(entry, true);
+    if (link != NULL) {
+        memcpy(link->checksum, entry->checksum, sizeof(link->checksum));
+        link->checksum_type = entry->checksum_type;
+    }
+    pthread_mutex_unlock(&links_lock);
+}
+
+/*!
+ * @brief hard_links_set_destination records a destination file found up to date, so that the other links of
+ * its source inode are linked to it rather than copied
+ * @param entry is the source file entry
+ * @param destination_path is the path of its destination
+ */
+void hard_links_set_destination(files_list_entry_t *entry, const char *destination_path) {
+    if (!is_tracked(entry)) {
+        return;
+    }
+    pthread_mutex_lock(&links_lock);
+    hard_link_t *link = find_link(entry, true);
+    if (link != NULL && link->state == HARD_LINK_UNKNOWN) {
+        link->destination_path = strdup(destination_path);
+        link->state = link->destination_path != NULL ? HARD_LINK_COPIED : HARD_LINK_UNKNOWN;
+    }
+    pthread_mutex_unlock(&links_lock);
+}
+
+/*!
+ * @brief hard_links_claim tells how a source file is to be written to the destination
+ * The first link of an inode must be copied, then reported with hard_links_copied; the others are to be
+ * linked to its copy. If the first link is being copied, the call waits for the end of its copy.
+ * @param entry is the source file entry
+ * @param destination_path is the path of its destination
+ * @param target receives the destination to link to (PATH_SIZE bytes)
+ * @return true if the file must be linked to target, false if it must be copied (and hard_links_copied called)
+ */
+bool hard_links_claim(files_list_entry_t *entry, const char *destination_path, char *target) {
+    if (!is_tracked(entry)) {
+        return false;
+    }
+    pthread_mutex_lock(&links_lock);
+    hard_link_t *link = find_link(entry, true);
+    while (link != NULL && link->state == HARD_LINK_COPYING) {
+        pthread_cond_wait(&links_changed, &links_lock);
+        link = find_link(entry, true); // The table may have grown
+    }
+    bool linked = link != NULL && link->state == HARD_LINK_COPIED;
+    if (linked) {
+        strncpy(target, link->destination_path, PATH_SIZE - 1);
+        target[PATH_SIZE - 1] = '\0';
+    } else if (link != NULL) {
+        free(link->destination_path);
+        link->destination_path = strdup(destination_path);
+        link->state = link->destination_path != NULL ? HARD_LINK_COPYING : HARD_LINK_UNKNOWN;
+    }
+    pthread_mutex_unlock(&links_lock);
+    return linked;
+}
+
+/*!
+ * @brief hard_links_copied ends the copy of the first link of an inode, and wakes up its other links
+ * @param entry is the source file entry
+ * @param success is true if the copy succeeded; else the next link will be copied
+ */
+void hard_links_copied(files_list_entry_t *entry, bool success) {
+    if (!is_tracked(entry)) {
+        return;
+    }
+    pthread_mutex_lock(&links_lock);
+    hard_link_t *link = find_link(entry, false);
+    if (link != NULL && link->state == HARD_LINK_COPYING) {
+        link->state = success ? HARD_LINK_COPIED : HARD_LINK_UNKNOWN;
+        pthread_cond_broadcast(&links_changed);
+    }
+    pthread_mutex_unlock(&links_lock);
+}
+
+/*!
+ * @brief hard_links_clear forgets all the inodes, when no copy is running
+ */
+void hard_links_clear(void) {
+    pthread_mutex_lock(&links_lock);
+    for (size_t i = 0; i < links_capacity; ++i) {
+        free(links[i].destination_path);
+    }
+    free(links);
+    links = NULL;
+    links_capacity = 0;
+    links_count = 0;
+    pthread_mutex_unlock(&links_lock);
+}
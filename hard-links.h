@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "files-list.h"
+#include "checksum.h"
+
+#define HARD_LINKS_INITIAL_CAPACITY 1024
+
+typedef enum {
+    HARD_LINK_UNKNOWN, // Inode seen (e.g. hashed), no destination yet
+    HARD_LINK_COPYING, // Its first link is being copied, the others wait for it
+    HARD_LINK_COPIED, // Its content is in the destination, at destination_path
+} hard_link_state_t;
+
+// An inode with several links, seen during the synchronization
+typedef struct {
+    uint64_t device;
+    uint64_t inode; // 0 for an empty slot
+    uint64_t size;
+    struct timespec mtime;
+    char *destination_path; // First link in the destination, NULL until its copy starts
+    uint8_t checksum[CHECKSUM_SIZE_MAX];
+    uint8_t checksum_type; // CHECKSUM_NONE until a link is hashed
+    uint8_t state;
+} hard_link_t;
+
+bool hard_links_get_checksum(files_list_entry_t *entry, checksum_type_t type);
+void hard_links_set_checksum(files_list_entry_t *entry);
+void hard_links_set_destination(files_list_entry_t *entry, const char *destination_path);
+bool hard_links_claim(files_list_entry_t *entry, const char *destination_path, char *target);
+void hard_links_copied(files_list_entry_t *entry, bool success);
+void hard_links_clear(void);
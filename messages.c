@@ -1,7 +1,305 @@
 #include "messages.h"
+#include "transport.h"
 #include <sys/msg.h>
 #include <string.h>
+#include <stdio.h>
 
+/*!
+ * @brief put_varint encodes an unsigned integer as a LEB128 varint
+ * @param cursor where to write
+ * @param value the value to encode
+ * @return the position after the encoded value
+ */
+static uint8_t *put_varint(uint8_t *cursor, uint64_t value) {
+    while (value >= 0x80) {
+        *cursor++ = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    *cursor++ = (uint8_t) value;
+    return cursor;
+}
+
+/*!
+ * @brief get_varint decodes a LEB128 varint
+ * @param reader the reader, moved after the value
+ * @param value receives the decoded value
+ * @return true in case of success, false if the data is truncated
+ */
+static bool get_varint(entries_batch_reader_t *reader, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64 && reader->cursor < reader->end; shift += 7) {
+        uint8_t byte = *reader->cursor++;
+        *value |= (uint64_t) (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief get_batch_capacity gives the size of the batches that can be sent on a queue
+ * A batch never exceeds msgmax, nor a quarter of the queue capacity so that several messages can be in
+ * flight at the same time.
+ * @param msg_queue the id of the queue
+ * @return the max number of data bytes in a batch
+ */
+size_t get_batch_capacity(int msg_queue) {
+    size_t message_max = transport_message_max(msg_queue);
+    if (transport_queue_bytes(msg_queue) / 4 < message_max) {
+        message_max = transport_queue_bytes(msg_queue) / 4;
+    }
+
+    size_t header_size = offsetof(entries_batch_message_t, data) - sizeof(long);
+    size_t capacity = message_max > header_size ? message_max - header_size : 0;
+    if (capacity > MSG_BATCH_DATA_SIZE) {
+        capacity = MSG_BATCH_DATA_SIZE;
+    }
+    // A batch must at least hold one entry with the longest path
+    if (capacity < MSG_RECORD_SIZE_MAX) {
+        capacity = MSG_RECORD_SIZE_MAX;
+    }
+    return capacity;
+}
+
+/*!
+ * @brief init_entries_batch prepares an empty batch
+ * @param batch is a pointer to the batch
+ * @param msg_queue is the id of the queue it will be sent on
+ * @param recipient is the mtype of the recipient
+ * @param cmd_code is the command of the batch, it determines the encoded fields (@see add_entry_to_batch)
+ * @param reply_to is the topic of the sender
+ */
+void init_entries_batch(entries_batch_t *batch, int msg_queue, int recipient, int cmd_code, int reply_to) {
+    batch->msg_queue = msg_queue;
+    batch->capacity = get_batch_capacity(msg_queue);
+    batch->length = 0;
+    batch->message.mtype = recipient;
+    batch->message.op_code = cmd_code;
+    batch->message.reply_to = reply_to;
+    batch->message.count = 0;
+}
+
+/*!
+ * @brief add_entry_to_batch encodes an entry into a batch
+ * Only the fields required by the command are encoded:
+ * - COMMAND_CODE_ANALYZE_FILE: id and path
+ * - COMMAND_CODE_FILE_ANALYZED: id, stats and checksum (files only, when computed)
+ * - COMMAND_CODE_FILE_ENTRY: path, stats and checksum (files only, when computed)
+ * An empty batch always accepts an entry, so the capacity may be lowered to send smaller batches.
+ * @param batch is a pointer to the batch
+ * @param entry is the entry to encode
+ * @param id is the index of the entry in the lister list
+ * @return 0 in case of success, 1 if the batch is full (send it, then add the entry again), -1 else
+ */
+int add_entry_to_batch(entries_batch_t *batch, files_list_entry_t *entry, uint32_t id) {
+    if (!batch || !entry) {
+        return -1;
+    }
+
+    uint8_t flags = 0;
+    switch (batch->message.op_code) {
+        case COMMAND_CODE_ANALYZE_FILE:
+            flags = RECORD_HAS_ID | RECORD_HAS_PATH;
+            break;
+        case COMMAND_CODE_FILE_ANALYZED:
+            flags = RECORD_HAS_ID | RECORD_HAS_STATS;
+            break;
+        case COMMAND_CODE_FILE_ENTRY:
+            flags = RECORD_HAS_PATH | RECORD_HAS_STATS;
+            break;
+        default:
+            return -1;
+    }
+    if (entry->entry_type == DOSSIER) {
+        flags |= RECORD_IS_DIR;
+    } else if (flags & RECORD_HAS_STATS) {
+        if (checksum_size(entry->checksum_type) > 0) {
+            flags |= RECORD_HAS_CHECKSUM;
+        }
+    }
+
+    uint8_t record[MSG_RECORD_SIZE_MAX];
+    uint8_t *cursor = record;
+    *cursor++ = flags;
+    if (flags & RECORD_HAS_ID) {
+        cursor = put_varint(cursor, id);
+    }
+    if (flags & RECORD_HAS_PATH) {
+        size_t dir_length = entry->dir_path_length;
+        size_t name_length = strlen(entry->name);
+        if (dir_length + name_length >= PATH_SIZE) {
+            return -1;
+        }
+        cursor = put_varint(cursor, dir_length + name_length);
+        memcpy(cursor, entry->dir_path, dir_length);
+        memcpy(cursor + dir_length, entry->name, name_length);
+        cursor += dir_length + name_length;
+    }
+    if (flags & RECORD_HAS_STATS) {
+        cursor = put_varint(cursor, entry->mode);
+        cursor = put_varint(cursor, entry->size);
+        cursor = put_varint(cursor, (uint64_t) entry->mtime.tv_sec);
+        cursor = put_varint(cursor, (uint64_t) entry->mtime.tv_nsec);
+        cursor = put_varint(cursor, entry->device);
+        cursor = put_varint(cursor, entry->inode);
+        cursor = put_varint(cursor, entry->nlink);
+    }
+    if (flags & RECORD_HAS_CHECKSUM) {
+        *cursor++ = entry->checksum_type;
+        memcpy(cursor, entry->checksum, checksum_size(entry->checksum_type));
+        cursor += checksum_size(entry->checksum_type);
+    }
+
+    size_t record_size = cursor - record;
+    if (batch->message.count > 0 && (batch->length + record_size > batch->capacity || batch->message.count == UINT16_MAX)) {
+        return 1;
+    }
+    memcpy(batch->message.data + batch->length, record, record_size);
+    batch->length += record_size;
+    ++batch->message.count;
+    return 0;
+}
+
+/*!
+ * @brief send_entries_batch sends a batch, then empties it
+ * Empty batches are not sent.
+ * @param batch is a pointer to the batch
+ * @param flags are the msgsnd flags (IPC_NOWAIT to fail with EAGAIN instead of blocking on a full queue)
+ * @return 0 in case of success, -1 else (the batch is kept)
+ */
+int send_entries_batch(entries_batch_t *batch, int flags) {
+    if (batch->message.count == 0) {
+        return 0;
+    }
+    size_t size = offsetof(entries_batch_message_t, data) - sizeof(long) + batch->length;
+    if (transport_send(batch->msg_queue, &batch->message, size, flags) == -1) {
+        return -1;
+    }
+    batch->length = 0;
+    batch->message.count = 0;
+    return 0;
+}
+
+/*!
+ * @brief init_batch_reader prepares the decoding of a received batch
+ * @param reader is a pointer to the reader
+ * @param message is the received message
+ * @param message_size is the size returned by msgrcv
+ */
+void init_batch_reader(entries_batch_reader_t *reader, entries_batch_message_t *message, ssize_t message_size) {
+    ssize_t data_size = message_size - (ssize_t) (offsetof(entries_batch_message_t, data) - sizeof(long));
+    reader->cursor = message->data;
+    reader->end = message->data + (data_size > 0 ? data_size : 0);
+}
+
+/*!
+ * @brief read_batch_record decodes the next entry of a batch
+ * @param reader is a pointer to the reader
+ * @param record receives the decoded fields (its path points into the message)
+ * @return true if an entry was decoded, false at the end of the batch (or on malformed data)
+ */
+bool read_batch_record(entries_batch_reader_t *reader, batch_record_t *record) {
+    if (reader->cursor >= reader->end) {
+        return false;
+    }
+    memset(record, 0, sizeof(batch_record_t));
+    record->flags = *reader->cursor++;
+
+    uint64_t value;
+    if (record->flags & RECORD_HAS_ID) {
+        if (!get_varint(reader, &value)) {
+            return false;
+        }
+        record->id = (uint32_t) value;
+    }
+    if (record->flags & RECORD_HAS_PATH) {
+        if (!get_varint(reader, &value) || value >= PATH_SIZE || value > (uint64_t) (reader->end - reader->cursor)) {
+            return false;
+        }
+        record->path = (const char *) reader->cursor;
+        record->path_length = value;
+        reader->cursor += value;
+    }
+    if (record->flags & RECORD_HAS_STATS) {
+        uint64_t fields[7];
+        for (int i = 0; i < 7; ++i) {
+            if (!get_varint(reader, &fields[i])) {
+                return false;
+            }
+        }
+        record->mode = (mode_t) fields[0];
+        record->size = fields[1];
+        record->mtime.tv_sec = (time_t) fields[2];
+        record->mtime.tv_nsec = (long) fields[3];
+        record->device = fields[4];
+        record->inode = fields[5];
+        record->nlink = fields[6];
+    }
+    if (record->flags & RECORD_HAS_CHECKSUM) {
+        if (reader->cursor >= reader->end) {
+            return false;
+        }
+        record->checksum_type = *reader->cursor++;
+        size_t size = checksum_size(record->checksum_type);
+        if (size == 0 || reader->end - reader->cursor < (ssize_t) size) {
+            return false;
+        }
+        memcpy(record->checksum, reader->cursor, size);
+        reader->cursor += size;
+    }
+    return true;
+}
+
+/*!
+ * @brief apply_batch_record copies the properties of a decoded entry into an entry
+ * @param entry the entry to update
+ * @param record the decoded entry
+ */
+void apply_batch_record(files_list_entry_t *entry, batch_record_t *record) {
+    entry->entry_type = (record->flags & RECORD_IS_DIR) ? DOSSIER : FICHIER;
+    if (record->flags & RECORD_HAS_STATS) {
+        entry->mode = record->mode;
+        entry->size = record->size;
+        entry->mtime = record->mtime;
+        entry->device = record->device;
+        entry->inode = record->inode;
+        entry->nlink = record->nlink;
+    }
+    if (record->flags & RECORD_HAS_CHECKSUM) {
+        memcpy(entry->checksum, record->checksum, sizeof(entry->checksum));
+        entry->checksum_type = record->checksum_type;
+    }
+}
+
+/*!
+ * @brief batch_record_to_entry rebuilds an entry from a decoded one
+ * @param list the list whose arena will own the entry (it is not added to the list, @see add_entry_to_tail)
+ * @param record the decoded entry, with a path
+ * @return the new entry, NULL if out of memory or the record has no path
+ */
+files_list_entry_t *batch_record_to_entry(files_list_t *list, batch_record_t *record) {
+    if (!(record->flags & RECORD_HAS_PATH)) {
+        return NULL;
+    }
+    char path[PATH_SIZE];
+    memcpy(path, record->path, record->path_length);
+    path[record->path_length] = '\0';
+    files_list_entry_t *entry = new_file_entry(list, path);
+    if (entry != NULL) {
+        apply_batch_record(entry, record);
+    }
+    return entry;
+}
+
+/*!
+ * @brief send_file_entry sends a single entry, as a batch of one
+ * @param msg_queue the id of the queue
+ * @param recipient the mtype of the recipient
+ * @param file_entry the entry to send (with id 0)
+ * @param cmd_code the command
+ * @return 0 in case of success, -1 else
+ */
 int send_file_entry(int msg_queue, int recipient, files_list_entry_t *file_entry, int cmd_code) {
     // Vérifier les paramètres d'entrée
     if (file_entry == NULL || recipient < 0) {
@@ -9,15 +307,12 @@ int send_file_entry(int msg_queue, int recipient, files_list_entry_t *file_entry
         return -1;
     }
 
-    files_list_entry_transmit_t message;
-    message.mtype = recipient;
-    message.op_code = cmd_code;
-
-    // Utiliser memcpy pour copier la structure complète
-    memcpy(&message.payload, file_entry, sizeof(files_list_entry_t));
-
-    // Envoyer le message
-    return msgsnd(msg_queue, &message, sizeof(files_list_entry_transmit_t) - sizeof(long), 0);
+    entries_batch_t batch;
+    init_entries_batch(&batch, msg_queue, recipient, cmd_code, recipient);
+    if (add_entry_to_batch(&batch, file_entry, 0) != 0) {
+        return -1;
+    }
+    return send_entries_batch(&batch, 0);
 }
 
 int send_analyze_dir_command(int msg_queue, int recipient, char *target_dir) {
@@ -35,8 +330,9 @@ int send_analyze_dir_command(int msg_queue, int recipient, char *target_dir) {
     strncpy(message.target, target_dir, PATH_SIZE);
     message.target[PATH_SIZE - 1] = '\0';
 
-    // Envoyer le message
-    return msgsnd(msg_queue, &message, sizeof(analyze_dir_command_t) - sizeof(long), 0);
+    // Envoyer le message, sans les octets inutilisés du chemin
+    size_t size = offsetof(analyze_dir_command_t, target) - sizeof(long) + strlen(message.target) + 1;
+    return transport_send(msg_queue, &message, size, 0);
 }
 
 
@@ -57,7 +353,7 @@ int send_list_end(int msg_queue, int recipient) {
     message.mtype = recipient;
     message.message = COMMAND_CODE_LIST_COMPLETE;
 
-    return msgsnd(msg_queue, &message, sizeof(simple_command_t) - sizeof(long), 0);
+    return transport_send(msg_queue, &message, sizeof(simple_command_t) - sizeof(long), 0);
 }
 
 int send_terminate_command(int msg_queue, int recipient) {
@@ -65,7 +361,7 @@ int send_terminate_command(int msg_queue, int recipient) {
     message.mtype = recipient;
     message.message = COMMAND_CODE_TERMINATE;
 
-    return msgsnd(msg_queue, &message, sizeof(simple_command_t) - sizeof(long), 0);
+    return transport_send(msg_queue, &message, sizeof(simple_command_t) - sizeof(long), 0);
 }
 
 int send_terminate_confirm(int msg_queue, int recipient) {
@@ -73,5 +369,5 @@ int send_terminate_confirm(int msg_queue, int recipient) {
     message.mtype = recipient;
     message.message = COMMAND_CODE_TERMINATE_OK;
 
-    return msgsnd(msg_queue, &message, sizeof(simple_command_t) - sizeof(long), 0);
+    return transport_send(msg_queue, &message, sizeof(simple_command_t) - sizeof(long), 0);
 }
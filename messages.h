@@ -2,6 +2,8 @@
 
 #include "files-list.h"
 #include "defines.h"
+#include <stdbool.h>
+#include <stddef.h>
 
 #define COMMAND_CODE_TERMINATE 0x0
 #define COMMAND_CODE_TERMINATE_OK 0x10
@@ -17,6 +19,18 @@
 #define MSG_TYPE_TO_SOURCE_ANALYZERS 4
 #define MSG_TYPE_TO_DESTINATION_ANALYZERS 5
 
+// Room for the data of a batch: messages never exceed the queue msgmax, this is only the buffer size
+#define MSG_BATCH_DATA_SIZE 32768
+// Largest encoded entry: flags, id, path length and path, 7 stats, checksum type and checksum
+#define MSG_RECORD_SIZE_MAX (1 + 5 + 2 + PATH_SIZE + 7 * 10 + 1 + CHECKSUM_SIZE_MAX)
+
+// Flags of an encoded entry, telling which fields follow
+#define RECORD_HAS_ID 0x01
+#define RECORD_HAS_PATH 0x02
+#define RECORD_HAS_STATS 0x04
+#define RECORD_HAS_CHECKSUM 0x08
+#define RECORD_IS_DIR 0x10
+
 typedef struct {
     long mtype;
     char message;
@@ -24,30 +38,66 @@ typedef struct {
 
 typedef struct {
     long mtype;
-    char op_code; // Contains the analyze file opcode
-    files_list_entry_t payload;
-} analyze_file_command_t;
+    char op_code; // Contains the analyze dir opcode
+    char target[PATH_SIZE]; // Only the string and its '\0' are sent
+} analyze_dir_command_t;
 
+/*
+ * A batch packs many entries into one message. Each entry is encoded as its flags followed by the fields
+ * they announce: id (index of the entry in the lister list), path (length prefixed), stats and checksum (its
+ * type, then its checksum_size bytes).
+ * Integers are LEB128 varints, so small values take a single byte.
+ */
 typedef struct {
     long mtype;
-    char op_code; // Contains the analyze file opcode
-    files_list_entry_t payload;
+    char op_code; // COMMAND_CODE_ANALYZE_FILE, COMMAND_CODE_FILE_ANALYZED or COMMAND_CODE_FILE_ENTRY
     int reply_to; // MQ id of the sender, to build either source or destination list
-} files_list_entry_transmit_t;
-
-typedef struct {
-    long mtype;
-    char op_code; // Contains the analyze dir opcode
-    char target[PATH_SIZE];
-} analyze_dir_command_t;
+    uint16_t count; // Number of entries in data
+    uint8_t data[MSG_BATCH_DATA_SIZE];
+} entries_batch_message_t;
 
 typedef union {
     simple_command_t simple_command;
-    analyze_file_command_t analyze_file_command;
     analyze_dir_command_t analyze_dir_command;
-    files_list_entry_transmit_t list_entry;
+    entries_batch_message_t entries_batch;
 } any_message_t;
 
+typedef struct {
+    int msg_queue;
+    size_t capacity; // Max data bytes in one message, depends on the queue limits
+    size_t length; // Used data bytes
+    entries_batch_message_t message;
+} entries_batch_t;
+
+typedef struct {
+    const uint8_t *cursor;
+    const uint8_t *end;
+} entries_batch_reader_t;
+
+typedef struct {
+    uint8_t flags;
+    uint32_t id;
+    const char *path; // Not '\0' terminated
+    size_t path_length;
+    mode_t mode;
+    uint64_t size;
+    struct timespec mtime;
+    uint64_t device;
+    uint64_t inode;
+    uint64_t nlink;
+    uint8_t checksum_type;
+    uint8_t checksum[CHECKSUM_SIZE_MAX];
+} batch_record_t;
+
+size_t get_batch_capacity(int msg_queue);
+void init_entries_batch(entries_batch_t *batch, int msg_queue, int recipient, int cmd_code, int reply_to);
+int add_entry_to_batch(entries_batch_t *batch, files_list_entry_t *entry, uint32_t id);
+int send_entries_batch(entries_batch_t *batch, int flags);
+void init_batch_reader(entries_batch_reader_t *reader, entries_batch_message_t *message, ssize_t message_size);
+bool read_batch_record(entries_batch_reader_t *reader, batch_record_t *record);
+void apply_batch_record(files_list_entry_t *entry, batch_record_t *record);
+files_list_entry_t *batch_record_to_entry(files_list_t *list, batch_record_t *record);
+
 int send_analyze_dir_command(int msg_queue, int recipient, char *target_dir);
 int send_file_entry(int msg_queue, int recipient, files_list_entry_t *file_entry, int cmd_code);
 int send_analyze_file_command(int msg_queue, int recipient, files_list_entry_t *file_entry);
@@ -4,43 +4,159 @@
 #include "sys/msg.h"
 #include <stdio.h>
 #include "messages.h"
+#include "transport.h"
+#include "read-engine.h"
+#include "stat-engine.h"
+#include "hard-links.h"
 #include "file-properties.h"
 #include "sync.h"
+#include "walker.h"
+#include "stats.h"
+#include "trace.h"
 #include <string.h>
 #include <errno.h>
 #include <sys/wait.h>
 #include <signal.h>
 
+// Estimated size of an encoded ANALYZE_FILE entry, on top of its path
+#define ANALYZE_FILE_RECORD_OVERHEAD 8
+
+/*!
+ * @brief create_message_queue creates a new MQ with a key not used by any other queue
+ * @param p_context is a pointer to the processes context, receiving the key and id of the queue
+ * @param transport is the kind of queue (@see transport.h)
+ * @return 0 in case of success, -1 else
+ */
+static int create_message_queue(process_context_t *p_context, transport_kind_t transport) {
+    key_t key = (key_t) getpid();
+    for (int attempts = 0; attempts < 1024; ++attempts, ++key) {
+        int msg_queue = transport_create(transport, key);
+        if (msg_queue != -1) {
+            p_context->shared_key = key;
+            p_context->message_queue_id = msg_queue;
+            return 0;
+        }
+        if (errno != EEXIST) {
+            break;
+        }
+    }
+    perror("Erreur lors de la création de la file de messages");
+    return -1;
+}
+
 /*!
- * @brief prepare prepares (only when parallel is enabled) the processes used for the synchronization.
+ * @brief abort_processes kills the processes already started and removes the MQ, when prepare fails
+ * @param p_context is a pointer to the processes context
+ */
+static void abort_processes(process_context_t *p_context) {
+    pid_t *all_pids[] = {&p_context->source_lister_pid, &p_context->destination_lister_pid};
+    for (size_t i = 0; i < sizeof(all_pids) / sizeof(all_pids[0]); ++i) {
+        if (*all_pids[i] > 0) {
+            kill(*all_pids[i], SIGTERM);
+        }
+    }
+    for (int i = 0; i < p_context->processes_count; ++i) {
+        if (p_context->source_analyzers_pids && p_context->source_analyzers_pids[i] > 0) {
+            kill(p_context->source_analyzers_pids[i], SIGTERM);
+        }
+        if (p_context->destination_analyzers_pids && p_context->destination_analyzers_pids[i] > 0) {
+            kill(p_context->destination_analyzers_pids[i], SIGTERM);
+        }
+    }
+    while (wait(NULL) > 0);
+    if (p_context->message_queue_id != -1) {
+        transport_destroy(p_context->message_queue_id);
+        p_context->message_queue_id = -1;
+    }
+    free(p_context->source_analyzers_pids);
+    free(p_context->destination_analyzers_pids);
+    p_context->source_analyzers_pids = NULL;
+    p_context->destination_analyzers_pids = NULL;
+}
+
+/*!
+ * @brief prepare opens the checksum cache and prepares (only when parallel is enabled) the processes used
+ * for the synchronization: the MQ, a lister and processes_count analyzers for each of the source and the
+ * destination.
+ * If the processes cannot be created, the program falls back to the non parallel mode.
  * @param the_config is a pointer to the program configuration
  * @param p_context is a pointer to the program processes context
  * @return 0 if all went good, -1 else
  */
 int prepare(configuration_t *the_config, process_context_t *p_context) {
-    // Vérifier si le traitement parallèle est activé
-    if (the_config->is_parallel) {
-        // Allouer de la mémoire pour les PID des analyseurs
-        p_context->source_analyzers_pids = malloc(sizeof(pid_t) * the_config->processes_count);
-        p_context->destination_analyzers_pids = malloc(sizeof(pid_t) * the_config->processes_count);
-
-        if (p_context->source_analyzers_pids == NULL || p_context->destination_analyzers_pids == NULL) {
-            // Échec de l'allocation mémoire
-            perror("Erreur d'allocation mémoire");
+    memset(p_context, 0, sizeof(process_context_t));
+    p_context->message_queue_id = -1;
+    p_context->main_process_pid = getpid();
+
+    // Only the main process uses the cache, when it compares the lists
+    checksum_cache_open(&p_context->cache, the_config->cache_dir, the_config->rebuild_cache);
+    read_engine_configure(the_config->read_engine, the_config->verbose);
+    stat_engine_configure(the_config->stat_engine, the_config->stat_queue_depth, the_config->verbose);
+    // Mapped before the forks, the statistics are shared by all the processes
+    if (the_config->stats && stats_open() == -1) {
+        perror("Unable to gather the statistics");
+    }
+    if (the_config->trace_file[0] != '\0' && trace_open() == -1) {
+        perror("Unable to trace the run");
+    }
+
+    // Mode parallèle par threads : pas de processus ni de MQ, seulement le pool
+    if (the_config->is_parallel && the_config->threads_count > 0) {
+        if (thread_pool_init(&p_context->thread_pool, the_config->threads_count) == -1) {
+            fprintf(stderr, "Erreur lors de la création du pool de threads\n");
+            the_config->is_parallel = false;
             return -1;
         }
+        p_context->uses_threads = true;
+        return 0;
+    }
 
-        // Initialiser d'autres variables liées aux processus
-        p_context->main_process_pid = getpid();
-        p_context->source_lister_pid = 0;
-        p_context->destination_lister_pid = 0;
+    // Le traitement parallèle n'est pas activé
+    if (!the_config->is_parallel) {
+        return 0;
+    }
 
+    // Allouer de la mémoire pour les PID des analyseurs
+    p_context->processes_count = the_config->processes_count;
+    p_context->source_analyzers_pids = calloc(the_config->processes_count, sizeof(pid_t));
+    p_context->destination_analyzers_pids = calloc(the_config->processes_count, sizeof(pid_t));
+    if (p_context->source_analyzers_pids == NULL || p_context->destination_analyzers_pids == NULL) {
+        // Échec de l'allocation mémoire
+        perror("Erreur d'allocation mémoire");
+        abort_processes(p_context);
+        the_config->is_parallel = false;
+        return -1;
+    }
+    if (create_message_queue(p_context, the_config->transport) == -1) {
+        abort_processes(p_context);
+        the_config->is_parallel = false;
+        return -1;
+    }
 
-        return 0;  // Renvoyer 0 pour indiquer le succès
-    } else {
-        // Le traitement parallèle n'est pas activé
-        return 0;  // Renvoyer 0 pour indiquer le succès
+    // Les configurations sont copiées dans les processus fils par fork
+    lister_configuration_t source_lister = {MSG_TYPE_TO_SOURCE_ANALYZERS, MSG_TYPE_TO_SOURCE_LISTER, the_config->processes_count, p_context->shared_key};
+    lister_configuration_t destination_lister = {MSG_TYPE_TO_DESTINATION_ANALYZERS, MSG_TYPE_TO_DESTINATION_LISTER, the_config->processes_count, p_context->shared_key};
+    analyzer_configuration_t source_analyzer = {MSG_TYPE_TO_SOURCE_LISTER, MSG_TYPE_TO_SOURCE_ANALYZERS, p_context->shared_key, the_config->uses_md5, 0};
+    analyzer_configuration_t destination_analyzer = {MSG_TYPE_TO_DESTINATION_LISTER, MSG_TYPE_TO_DESTINATION_ANALYZERS, p_context->shared_key, the_config->uses_md5, 0};
+
+    p_context->source_lister_pid = make_process(p_context, lister_process_loop, &source_lister);
+    p_context->destination_lister_pid = make_process(p_context, lister_process_loop, &destination_lister);
+    bool failed = p_context->source_lister_pid == -1 || p_context->destination_lister_pid == -1;
+    for (int i = 0; i < the_config->processes_count && !failed; ++i) {
+        source_analyzer.index = i;
+        destination_analyzer.index = i;
+        p_context->source_analyzers_pids[i] = make_process(p_context, analyzer_process_loop, &source_analyzer);
+        p_context->destination_analyzers_pids[i] = make_process(p_context, analyzer_process_loop, &destination_analyzer);
+        failed = p_context->source_analyzers_pids[i] == -1 || p_context->destination_analyzers_pids[i] == -1;
+    }
+    if (failed) {
+        fprintf(stderr, "Les processus n'ont pas pu être créés, synchronisation sans parallélisme\n");
+        abort_processes(p_context);
+        the_config->is_parallel = false;
+        return -1;
     }
+
+    return 0;  // Renvoyer 0 pour indiquer le succès
 }
 
 /*!
@@ -51,6 +167,9 @@ int prepare(configuration_t *the_config, process_context_t *p_context) {
  * @return the PID of the child process (it never returns in the child process)
  */
 int make_process(process_context_t *p_context, process_loop_t func, void *parameters) {
+    // Vider les tampons pour que le fils ne les écrive pas une seconde fois
+    fflush(stdout);
+    fflush(stderr);
     pid_t child_pid = fork();
 
     if (child_pid < 0) {
@@ -66,6 +185,170 @@ int make_process(process_context_t *p_context, process_loop_t func, void *parame
     }
 }
 
+/*!
+ * @brief receive_analyzed_entries receives a batch of analyzed entries and applies them to the list
+ * @param msg_queue is the id of the MQ
+ * @param list is the list being analyzed, entries ids are their positions in its index
+ * @param cfg is the lister configuration
+ * @param pending is the number of entries waiting for their analysis, updated
+ * @param in_flight_bytes is the estimated size of the requests not answered yet, updated
+ * @return 0 in case of success, -1 else
+ */
+static int receive_analyzed_entries(int msg_queue, files_list_t *list, lister_configuration_t *cfg, size_t *pending, size_t *in_flight_bytes) {
+    static entries_batch_message_t message;
+    ssize_t size;
+    do {
+        size = transport_receive(msg_queue, &message, sizeof(message) - sizeof(long), cfg->my_receiver_id, 0);
+    } while (size == -1 && errno == EINTR);
+    if (size == -1) {
+        perror("Erreur lors de la réception des analyses");
+        return -1;
+    }
+    if (message.op_code != COMMAND_CODE_FILE_ANALYZED) {
+        return 0;
+    }
+
+    entries_batch_reader_t reader;
+    batch_record_t record;
+    init_batch_reader(&reader, &message, size);
+    while (read_batch_record(&reader, &record)) {
+        if (record.id >= list->index_size) {
+            continue;
+        }
+        files_list_entry_t *entry = list->index[record.id];
+        apply_batch_record(entry, &record);
+        *in_flight_bytes -= get_entry_path_length(entry) + ANALYZE_FILE_RECORD_OVERHEAD;
+        --*pending;
+    }
+    return 0;
+}
+
+/*!
+ * @brief send_analyze_batch sends a batch of entries to analyze without ever blocking while analyses are
+ * pending: when the MQ is full, the answers are received first, which makes room in the queue.
+ * @param batch is the batch to send
+ * @param list is the list being analyzed
+ * @param cfg is the lister configuration
+ * @param pending is the number of entries waiting for their analysis
+ * @param in_flight_bytes is the estimated size of the requests not answered yet
+ * @return 0 in case of success, -1 else
+ */
+static int send_analyze_batch(entries_batch_t *batch, files_list_t *list, lister_configuration_t *cfg, size_t *pending, size_t *in_flight_bytes) {
+    while (send_entries_batch(batch, IPC_NOWAIT) == -1) {
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN) {
+            perror("Erreur lors de l'envoi des fichiers à analyser");
+            return -1;
+        }
+        if (*pending == batch->message.count) {
+            // Nothing in flight: the queue is full of the other side's messages, which are being received
+            if (send_entries_batch(batch, 0) == -1 && errno != EINTR) {
+                perror("Erreur lors de l'envoi des fichiers à analyser");
+                return -1;
+            }
+            continue;
+        }
+        if (receive_analyzed_entries(batch->msg_queue, list, cfg, pending, in_flight_bytes) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief request_element_details gets the properties of all the entries of a list from the analyzers
+ * Entries are sent by batches, identified by their position in the list index. The requests not answered
+ * yet are kept under a quarter of the queue capacity (both listers share it with the answers), and batches
+ * are sized so that all the analyzers get some work.
+ * @param msg_queue is the id of the MQ
+ * @param list is the sorted list to analyze
+ * @param cfg is the lister configuration
+ */
+void request_element_details(int msg_queue, files_list_t *list, lister_configuration_t *cfg) {
+    size_t budget = transport_queue_bytes(msg_queue) / 4;
+
+    static entries_batch_t batch;
+    init_entries_batch(&batch, msg_queue, cfg->my_recipient_id, COMMAND_CODE_ANALYZE_FILE, cfg->my_receiver_id);
+    if (cfg->analyzers_count > 0 && budget / cfg->analyzers_count < batch.capacity) {
+        batch.capacity = budget / cfg->analyzers_count;
+    }
+
+    size_t pending = 0;
+    size_t in_flight_bytes = 0;
+    for (size_t i = 0; i < list->index_size; ++i) {
+        files_list_entry_t *entry = list->index[i];
+        int result = add_entry_to_batch(&batch, entry, i);
+        if (result == 1) {
+            while (in_flight_bytes > budget && pending > batch.message.count) {
+                if (receive_analyzed_entries(msg_queue, list, cfg, &pending, &in_flight_bytes) == -1) {
+                    return;
+                }
+            }
+            if (send_analyze_batch(&batch, list, cfg, &pending, &in_flight_bytes) == -1) {
+                return;
+            }
+            stats_queue_depth(STATS_QUEUE_ANALYZE_REQUESTS, pending);
+            result = add_entry_to_batch(&batch, entry, i);
+        }
+        if (result == 0) {
+            ++pending;
+            in_flight_bytes += get_entry_path_length(entry) + ANALYZE_FILE_RECORD_OVERHEAD;
+        }
+    }
+    if (send_analyze_batch(&batch, list, cfg, &pending, &in_flight_bytes) == -1) {
+        return;
+    }
+    while (pending > 0) {
+        if (receive_analyzed_entries(msg_queue, list, cfg, &pending, &in_flight_bytes) == -1) {
+            return;
+        }
+    }
+}
+
+/*!
+ * @brief list_and_send_directory lists a directory, gets its entries analyzed and sends them to the main
+ * process, followed by a list end
+ * @param msg_queue is the id of the MQ
+ * @param cfg is the lister configuration
+ * @param target is the directory to list
+ */
+static void list_and_send_directory(int msg_queue, lister_configuration_t *cfg, char *target) {
+    files_list_t list;
+    init_files_list(&list);
+    // Types only, the analyzers get the stats. Directories are read by as many threads as analyzers
+    stats_phase_t previous_phase = stats_enter(STATS_PHASE_SCAN);
+    thread_pool_t pool;
+    if (cfg->analyzers_count > 1 && thread_pool_init(&pool, cfg->analyzers_count) == 0) {
+        walk_tree_parallel(&list, target, false, &pool);
+        thread_pool_destroy(&pool);
+    } else {
+        walk_tree(&list, target, false);
+    }
+    stats_leave(previous_phase);
+    if (sort_files_list(&list) == 0) {
+        request_element_details(msg_queue, &list, cfg);
+    } else {
+        // No index to identify the entries: analyze them here
+        for (files_list_entry_t *cursor = list.head; cursor != NULL; cursor = cursor->next) {
+            get_file_stats(cursor);
+        }
+    }
+
+    static entries_batch_t batch;
+    init_entries_batch(&batch, msg_queue, MSG_TYPE_TO_MAIN, COMMAND_CODE_FILE_ENTRY, cfg->my_receiver_id);
+    for (files_list_entry_t *cursor = list.head; cursor != NULL; cursor = cursor->next) {
+        if (add_entry_to_batch(&batch, cursor, 0) == 1) {
+            send_entries_batch(&batch, 0);
+            add_entry_to_batch(&batch, cursor, 0);
+        }
+    }
+    send_entries_batch(&batch, 0);
+    send_list_end(msg_queue, MSG_TYPE_TO_MAIN);
+    clear_files_list(&list);
+}
+
 /*!
  * @brief lister_process_loop is the lister process function (@see make_process)
  * @param parameters is a pointer to its parameters, to be cast to a lister_configuration_t
@@ -73,49 +356,190 @@ int make_process(process_context_t *p_context, process_loop_t func, void *parame
 void lister_process_loop(void *parameters) {
     // Conversion du pointeur vers le type
     lister_configuration_t *lister_config = (lister_configuration_t *)parameters;
+    const char *role = lister_config->my_receiver_id == MSG_TYPE_TO_SOURCE_LISTER ? "source lister" : "destination lister";
+    stats_set_role(role, -1);
+    trace_set_role(role, -1);
+    int msg_queue = transport_open(lister_config->mq_key);
+    if (msg_queue == -1) {
+        perror("Erreur lors de l'ouverture de la file de messages");
+        return;
+    }
+
+    static any_message_t message;
+    for (;;) {
+        ssize_t size = transport_receive(msg_queue, &message, sizeof(message) - sizeof(long), lister_config->my_receiver_id, 0);
+        if (size == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Erreur lors de la réception d'une commande");
+            return;
+        }
+
+        if (message.analyze_dir_command.op_code == COMMAND_CODE_ANALYZE_DIR) {
+            list_and_send_directory(msg_queue, lister_config, message.analyze_dir_command.target);
+        } else if (message.simple_command.message == COMMAND_CODE_TERMINATE) {
+            // Arrêter les analyseurs, puis confirmer au processus principal
+            for (int i = 0; i < lister_config->analyzers_count; ++i) {
+                send_terminate_command(msg_queue, lister_config->my_recipient_id);
+            }
+            for (int confirmed = 0; confirmed < lister_config->analyzers_count;) {
+                size = transport_receive(msg_queue, &message, sizeof(message) - sizeof(long), lister_config->my_receiver_id, 0);
+                if (size == -1 && errno != EINTR) {
+                    break;
+                }
+                if (size != -1 && message.simple_command.message == COMMAND_CODE_TERMINATE_OK) {
+                    ++confirmed;
+                }
+            }
+            send_terminate_confirm(msg_queue, MSG_TYPE_TO_MAIN);
+            return;
+        }
+    }
 }
 
 /*!
  * @brief analyzer_process_loop is the analyzer process function
+ * Each received batch is answered with batches holding the properties of its entries.
  * @param parameters is a pointer to its parameters, to be cast to an analyzer_configuration_t
  */
 void analyzer_process_loop(void *parameters) {
     // Conversion du pointeur vers le type
     analyzer_configuration_t *analyzer_config = (analyzer_configuration_t *)parameters;
-}
-
-/*!
- * @brief clean_processes cleans the processes by sending them a terminate command and waiting to the confirmation
- * @param the_config is a pointer to the program configuration
- * @param p_context is a pointer to the processes context
- */
-void clean_processes(configuration_t *the_config, process_context_t *p_context) {
-    // Ne rien faire si le traitement n'est pas parallèle
-    if (!the_config->is_parallel) {
+    const char *role = analyzer_config->my_receiver_id == MSG_TYPE_TO_SOURCE_ANALYZERS ? "source analyzer" : "destination analyzer";
+    stats_set_role(role, analyzer_config->index);
+    trace_set_role(role, analyzer_config->index);
+    int msg_queue = transport_open(analyzer_config->mq_key);
+    if (msg_queue == -1) {
+        perror("Erreur lors de l'ouverture de la file de messages");
         return;
     }
 
-    // Envoyer une commande de terminaison à tous les processus
-    kill(p_context->main_process_pid, SIGTERM);
-    kill(p_context->source_lister_pid, SIGTERM);
-    kill(p_context->destination_lister_pid, SIGTERM);
+    static any_message_t message;
+    static entries_batch_t response;
+    // Entries of a batch with their ids (NULL when unknown), and the ones whose stats are read (@see stat-engine.h).
+    // A record takes at least its flags byte
+    static files_list_entry_t *entries[MSG_BATCH_DATA_SIZE];
+    static files_list_entry_t *known_entries[MSG_BATCH_DATA_SIZE];
+    static uint32_t ids[MSG_BATCH_DATA_SIZE];
+    for (;;) {
+        ssize_t size = transport_receive(msg_queue, &message, sizeof(message) - sizeof(long), analyzer_config->my_receiver_id, 0);
+        if (size == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Erreur lors de la réception d'une commande");
+            break;
+        }
 
-    for (int i = 0; i < the_config->processes_count; ++i) {
-        kill(p_context->source_analyzers_pids[i], SIGTERM);
-        kill(p_context->destination_analyzers_pids[i], SIGTERM);
+        if (message.simple_command.message == COMMAND_CODE_TERMINATE) {
+            send_terminate_confirm(msg_queue, analyzer_config->my_recipient_id);
+            break;
+        }
+        if (message.entries_batch.op_code != COMMAND_CODE_ANALYZE_FILE) {
+            continue;
+        }
+
+        stats_phase_t previous_phase = stats_enter(STATS_PHASE_SCAN);
+        files_list_t scratch;
+        init_files_list(&scratch);
+        init_entries_batch(&response, msg_queue, analyzer_config->my_recipient_id, COMMAND_CODE_FILE_ANALYZED, analyzer_config->my_receiver_id);
+        entries_batch_reader_t reader;
+        batch_record_t record;
+        init_batch_reader(&reader, &message.entries_batch, size);
+        size_t count = 0;
+        size_t known_count = 0;
+        while (count < MSG_BATCH_DATA_SIZE && read_batch_record(&reader, &record)) {
+            entries[count] = batch_record_to_entry(&scratch, &record);
+            ids[count] = record.id;
+            if (entries[count] != NULL) {
+                known_entries[known_count++] = entries[count];
+            }
+            ++count;
+        }
+        // The stats of the whole batch are read at once
+        stat_engine_fill(known_entries, known_count);
+        for (size_t i = 0; i < count; ++i) {
+            // The lister waits for an answer for every entry
+            files_list_entry_t unknown_entry = {0};
+            files_list_entry_t *entry = entries[i] != NULL ? entries[i] : &unknown_entry;
+            if (add_entry_to_batch(&response, entry, ids[i]) == 1) {
+                send_entries_batch(&response, 0);
+                add_entry_to_batch(&response, entry, ids[i]);
+            }
+        }
+        send_entries_batch(&response, 0);
+        clear_files_list(&scratch);
+        stats_leave(previous_phase);
     }
+    stat_engine_release();
+}
 
-    // Attendre les réponses de tous les processus fils
-    int status;
-    pid_t terminated_pid;
+/*!
+ * @brief stop_processes sends a terminate command to the listers, which stop their analyzers, waits for all
+ * of them and removes the MQ
+ * @param p_context is a pointer to the processes context
+ */
+static void stop_processes(process_context_t *p_context) {
+    // Envoyer une commande de terminaison aux listers, qui arrêtent leurs analyseurs
+    int msg_queue = p_context->message_queue_id;
+    send_terminate_command(msg_queue, MSG_TYPE_TO_SOURCE_LISTER);
+    send_terminate_command(msg_queue, MSG_TYPE_TO_DESTINATION_LISTER);
+    simple_command_t message;
+    for (int confirmed = 0; confirmed < 2;) {
+        ssize_t size = transport_receive(msg_queue, &message, sizeof(message) - sizeof(long), MSG_TYPE_TO_MAIN, 0);
+        if (size == -1 && errno != EINTR) {
+            perror("Erreur lors de l'attente des confirmations");
+            break;
+        }
+        if (size != -1 && message.message == COMMAND_CODE_TERMINATE_OK) {
+            ++confirmed;
+        }
+    }
 
-    while ((terminated_pid = wait(&status)) > 0) {
-        printf("Processus avec PID %d terminé avec le statut %d\n", terminated_pid, WEXITSTATUS(status));
+    // Attendre la fin de tous les processus fils
+    waitpid(p_context->source_lister_pid, NULL, 0);
+    waitpid(p_context->destination_lister_pid, NULL, 0);
+    for (int i = 0; i < p_context->processes_count; ++i) {
+        waitpid(p_context->source_analyzers_pids[i], NULL, 0);
+        waitpid(p_context->destination_analyzers_pids[i], NULL, 0);
     }
 
-    // Libérer la mémoire allouée
+    // Libérer la file de messages et la mémoire allouée
+    transport_destroy(msg_queue);
+    p_context->message_queue_id = -1;
     free(p_context->source_analyzers_pids);
     free(p_context->destination_analyzers_pids);
+    p_context->source_analyzers_pids = NULL;
+    p_context->destination_analyzers_pids = NULL;
+}
 
-    // Libérer la file de messages (MQ) ou d'autres ressources si nécessaire
+/*!
+ * @brief clean_processes cleans the processes by sending them a terminate command and waiting to the confirmation
+ * It also closes the checksum cache, frees the buffers of the read engine and the hard links table. Once every process is done,
+ * the statistics of the run are reported (@see stats_report) and its trace is written (@see trace_write).
+ * @param the_config is a pointer to the program configuration
+ * @param p_context is a pointer to the processes context
+ */
+void clean_processes(configuration_t *the_config, process_context_t *p_context) {
+    checksum_cache_close(&p_context->cache);
+    read_engine_release();
+    hard_links_clear();
+
+    if (the_config->is_parallel && p_context->uses_threads) {
+        // Mode threads : arrêter les workers du pool
+        thread_pool_destroy(&p_context->thread_pool);
+        p_context->uses_threads = false;
+    } else if (the_config->is_parallel) {
+        stop_processes(p_context);
+    }
+
+    if (the_config->stats) {
+        stats_report(the_config);
+    }
+    stats_close();
+    if (the_config->trace_file[0] != '\0') {
+        trace_write(the_config->trace_file);
+    }
+    trace_close();
 }
@@ -5,6 +5,8 @@
 #include <sys/types.h>
 #include "files-list.h"
 #include <stdbool.h>
+#include "thread-pool.h"
+#include "checksum-cache.h"
 
 typedef struct {
     uint8_t processes_count;
@@ -15,6 +17,9 @@ typedef struct {
     pid_t *destination_analyzers_pids;
     key_t shared_key;
     int message_queue_id;
+    bool uses_threads; // true when the parallel mode runs on thread_pool instead of processes
+    thread_pool_t thread_pool;
+    checksum_cache_t cache;
 } process_context_t;
 
 typedef struct {
@@ -29,6 +34,7 @@ typedef struct {
     int my_receiver_id; // Id I must listen to
     key_t mq_key;
     bool use_md5; // Set to true when computing MD5sum for files
+    int index; // Position among the analyzers of its lister, for the statistics
 } analyzer_configuration_t;
 
 typedef void (*process_loop_t)(void *);
@@ -38,4 +44,4 @@ int make_process(process_context_t *p_context, process_loop_t func, void *parame
 void lister_process_loop(void *parameters);
 void analyzer_process_loop(void *parameters);
 void clean_processes(configuration_t *the_config, process_context_t *p_context);
-void request_element_details(int msg_queue, files_list_entry_t *entry, lister_configuration_t *cfg, int *current_analyzers);
+void request_element_details(int msg_queue, files_list_t *list, lister_configuration_t *cfg);
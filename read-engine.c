@@ -0,0 +1,268 @@
+#include "read-engine.h"
+#include "stats.h"
+#include "uring.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+/*
+ * The read engine streams files to a consumer (e.g. a checksum) in large page aligned buffers, after telling
+ * the kernel the file is read sequentially. With io_uring, READ_ENGINE_QUEUE_DEPTH reads are in flight: the
+ * consumer works on a buffer while the next ones are being filled, so that one thread keeps a disk busy.
+ * io_uring is used through its system calls (@see uring.h); when it is not available (old kernel,
+ * seccomp, io_uring_disabled), the engine silently uses read().
+ * Buffers and rings are per thread, allocated on first use and kept for the next files.
+ */
+
+typedef struct {
+    uint8_t *buffers[READ_ENGINE_QUEUE_DEPTH];
+    uring_t uring;
+    bool uring_ready;
+    bool uring_failed;
+    uint64_t syscalls; // System calls made for the current file
+} read_engine_state_t;
+
+static read_engine_kind_t engine_kind = READ_ENGINE_SYNC;
+static bool engine_verbose = false;
+static __thread read_engine_state_t engine_state;
+
+/*!
+ * @brief read_engine_configure selects the backend for all the threads
+ * @param kind is the backend
+ * @param verbose is true to print the throughput of each file
+ */
+void read_engine_configure(read_engine_kind_t kind, bool verbose) {
+    engine_kind = kind;
+    engine_verbose = verbose;
+}
+
+/*!
+ * @brief get_buffers allocates the buffers of the current thread
+ * @param count is the number of buffers needed
+ * @return 0 in case of success, -1 else
+ */
+static int get_buffers(int count) {
+    for (int i = 0; i < count; ++i) {
+        if (engine_state.buffers[i] == NULL && posix_memalign((void **) &engine_state.buffers[i], 4096, READ_ENGINE_BUFFER_SIZE) != 0) {
+            engine_state.buffers[i] = NULL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief uring_queue_read queues a read (it is submitted by the next uring_submit_and_wait)
+ * @param uring the ring
+ * @param fd the file to read
+ * @param buffer receives the data
+ * @param size the size to read
+ * @param offset the position of the data in the file
+ * @param slot identifies the read in its completion
+ */
+static void uring_queue_read(uring_t *uring, int fd, uint8_t *buffer, size_t size, uint64_t offset, int slot) {
+    struct io_uring_sqe *sqe = uring_get_sqe(uring);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buffer;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = slot;
+    uring_queue(uring);
+}
+
+/*!
+ * @brief read_with_syscalls feeds the consumer with read() from the current position to the end of the file
+ * @param fd the file
+ * @param consumer the consumer
+ * @param context the context of the consumer
+ * @param bytes is increased by the size read
+ * @return 0 in case of success, -1 else
+ */
+static int read_with_syscalls(int fd, read_consumer_t consumer, void *context, uint64_t *bytes) {
+    if (get_buffers(1) == -1) {
+        return -1;
+    }
+    ssize_t size;
+    while ((size = read(fd, engine_state.buffers[0], READ_ENGINE_BUFFER_SIZE)) != 0) {
+        ++engine_state.syscalls;
+        if (size == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        *bytes += size;
+        if (consumer(context, engine_state.buffers[0], size) == -1) {
+            return -1;
+        }
+    }
+    ++engine_state.syscalls; // The read of the end of the file
+    return 0;
+}
+
+/*!
+ * @brief read_with_uring feeds the consumer in order while READ_ENGINE_QUEUE_DEPTH reads are in flight
+ * Each buffer is read again at the next offset as soon as the consumer is done with it.
+ * @param fd the file
+ * @param file_size the size of the file when it was opened
+ * @param consumer the consumer
+ * @param context the context of the consumer
+ * @param bytes is increased by the size read
+ * @return 0 in case of success, -1 else
+ */
+static int read_with_uring(int fd, uint64_t file_size, read_consumer_t consumer, void *context, uint64_t *bytes) {
+    uring_t *uring = &engine_state.uring;
+    int results[READ_ENGINE_QUEUE_DEPTH];
+    bool done[READ_ENGINE_QUEUE_DEPTH] = {false};
+    uint64_t offsets[READ_ENGINE_QUEUE_DEPTH];
+    int in_flight = 0;
+    uint64_t next_offset = 0;
+
+    for (int slot = 0; slot < READ_ENGINE_QUEUE_DEPTH && next_offset < file_size; ++slot) {
+        offsets[slot] = next_offset;
+        uring_queue_read(uring, fd, engine_state.buffers[slot], READ_ENGINE_BUFFER_SIZE, next_offset, slot);
+        next_offset += READ_ENGINE_BUFFER_SIZE;
+        ++in_flight;
+    }
+
+    int result = 0;
+    uint64_t position = 0; // End of the data given to the consumer
+    for (int slot = 0; in_flight > 0; slot = (slot + 1) % READ_ENGINE_QUEUE_DEPTH) {
+        while (!done[slot]) {
+            if (uring_submit_and_wait(uring, &engine_state.syscalls) == -1) {
+                // Reads may still be in flight: the ring is dropped with them, the next file opens another one
+                int saved_errno = errno;
+                uring_close(uring);
+                engine_state.uring_ready = false;
+                errno = saved_errno;
+                return -1;
+            }
+            uring_reap(uring, results, done);
+        }
+        done[slot] = false;
+        --in_flight;
+        if (result != 0) {
+            continue; // Draining the reads in flight after an error or a short read
+        }
+        if (results[slot] < 0) {
+            errno = -results[slot];
+            result = -1;
+            continue;
+        }
+        if (consumer(context, engine_state.buffers[slot], results[slot]) == -1) {
+            errno = 0;
+            result = -1;
+            continue;
+        }
+        position = offsets[slot] + results[slot];
+        *bytes += results[slot];
+        if ((size_t) results[slot] < READ_ENGINE_BUFFER_SIZE && position < file_size) {
+            // Short read before the end: finish with read() once the ring is drained
+            result = 1;
+            continue;
+        }
+        if (result == 0 && next_offset < file_size) {
+            offsets[slot] = next_offset;
+            uring_queue_read(uring, fd, engine_state.buffers[slot], READ_ENGINE_BUFFER_SIZE, next_offset, slot);
+            next_offset += READ_ENGINE_BUFFER_SIZE;
+            ++in_flight;
+        }
+    }
+    if (result != -1) {
+        // Data after a short read, or past the size known at open (growing file)
+        if (lseek(fd, position, SEEK_SET) == -1) {
+            return -1;
+        }
+        return read_with_syscalls(fd, consumer, context, bytes);
+    }
+    return result;
+}
+
+/*!
+ * @brief read_engine_read_file reads a whole file and gives its content, in order, to a consumer
+ * @param path is the path of the file
+ * @param consumer is called with each block of the file
+ * @param context is passed to the consumer
+ * @return 0 in case of success, -1 else (errno is set for read errors)
+ */
+int read_engine_read_file(const char *path, read_consumer_t consumer, void *context) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) == -1) {
+        close(fd);
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    engine_state.syscalls = 4; // open, fstat, posix_fadvise and close
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t bytes = 0;
+    int result;
+    bool uses_uring = false;
+    if (engine_kind == READ_ENGINE_IO_URING && !engine_state.uring_failed && (size_t) sb.st_size > READ_ENGINE_BUFFER_SIZE) {
+        if (!engine_state.uring_ready) {
+            engine_state.uring_ready = uring_open(&engine_state.uring, READ_ENGINE_QUEUE_DEPTH) == 0;
+            engine_state.uring_failed = !engine_state.uring_ready;
+        }
+        uses_uring = engine_state.uring_ready && get_buffers(READ_ENGINE_QUEUE_DEPTH) == 0;
+    }
+    if (uses_uring) {
+        result = read_with_uring(fd, sb.st_size, consumer, context, &bytes);
+        if (result == -1 && bytes == 0 && (errno == EINVAL || errno == EOPNOTSUPP || errno == ENOSYS)) {
+            // The ring doesn't work (it may already be closed) (e.g. IORING_OP_READ unsupported): use read() from now on
+            uring_close(&engine_state.uring);
+            engine_state.uring_ready = false;
+            engine_state.uring_failed = true;
+            uses_uring = false;
+            result = lseek(fd, 0, SEEK_SET) == -1 ? -1 : read_with_syscalls(fd, consumer, context, &bytes);
+        }
+    } else {
+        result = read_with_syscalls(fd, consumer, context, &bytes);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    int saved_errno = errno;
+    close(fd);
+    stats_syscalls(STATS_PHASE_HASH, engine_state.syscalls);
+
+    if (engine_verbose && result == 0) {
+        double seconds = (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+        double megabytes = (double) bytes / (1024.0 * 1024.0);
+        printf("%s: %.1f MiB read in %.3f s (%.1f MiB/s, %s)\n", path, megabytes, seconds,
+               seconds > 0 ? megabytes / seconds : 0.0, uses_uring ? "io_uring" : "read");
+    }
+    errno = saved_errno;
+    return result;
+}
+
+/*!
+ * @brief read_engine_release frees the buffers and the ring of the calling thread
+ */
+void read_engine_release(void) {
+    for (int i = 0; i < READ_ENGINE_QUEUE_DEPTH; ++i) {
+        free(engine_state.buffers[i]);
+        engine_state.buffers[i] = NULL;
+    }
+    if (engine_state.uring_ready) {
+        uring_close(&engine_state.uring);
+    }
+    engine_state.uring_ready = false;
+}
+
+/*!
+ * @brief read_engine_name gives the name of a backend, as used by the --read-engine option
+ * @param kind is the backend
+ * @return its name
+ */
+const char *read_engine_name(read_engine_kind_t kind) {
+    return kind == READ_ENGINE_IO_URING ? "io_uring" : "read";
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Size of each read, buffers are aligned on pages
+#define READ_ENGINE_BUFFER_SIZE (1024 * 1024)
+// Number of reads kept in flight by the io_uring backend
+#define READ_ENGINE_QUEUE_DEPTH 4
+
+typedef enum {
+    READ_ENGINE_SYNC, // read() in large buffers, with the kernel readahead
+    READ_ENGINE_IO_URING, // Several reads in flight while the data is consumed, falls back to READ_ENGINE_SYNC
+} read_engine_kind_t;
+
+/*!
+ * @brief read_consumer_t is called with the content of a file, in order
+ * @param context is the context given to read_engine_read_file
+ * @param data is the next block of the file
+ * @param size is the size of the block
+ * @return 0 to go on, -1 to stop reading
+ */
+typedef int (*read_consumer_t)(void *context, const uint8_t *data, size_t size);
+
+void read_engine_configure(read_engine_kind_t kind, bool verbose);
+int read_engine_read_file(const char *path, read_consumer_t consumer, void *context);
+void read_engine_release(void);
+const char *read_engine_name(read_engine_kind_t kind);
@@ -0,0 +1,320 @@
+#define _GNU_SOURCE // struct statx
+#include "stat-engine.h"
+#include "file-properties.h"
+#include "thread-pool.h"
+#include "uring.h"
+#include "stats.h"
+#include "trace.h"
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * The stat engine fills the stats of a batch of entries (@see get_file_stats) with several metadata requests
+ * in flight, so that the round trips of a network or FUSE filesystem, or the seeks of a cold disk, overlap:
+ * - io_uring: queue depth statx requests (only the fields of the entries) are kept in flight in a ring;
+ * - threads: queue depth threads of a pool call lstat on the next entries of the batch.
+ * When io_uring is not available (old kernel without IORING_OP_STATX, seccomp, io_uring_disabled), or when a
+ * filesystem doesn't give all the fields, the engine silently uses the threads for the entries left.
+ * Entries are filled as with get_file_stats: callers see the same entries, errors and statistics.
+ * Rings, buffers and pools are per thread, created on first use (after the forks of the analyzers).
+ */
+
+// Fields of an entry, @see set_entry_stats (the links are needed by the hard links, @see hard-links.h)
+#define STAT_ENGINE_MASK (STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME | STATX_INO | STATX_NLINK)
+
+typedef struct {
+    uring_t uring;
+    bool uring_ready;
+    bool uring_failed;
+    struct statx *buffers; // One per slot of the ring
+    char (*paths)[PATH_SIZE];
+    size_t *indexes; // Entry of each slot
+    int *results;
+    bool *done;
+    int *free_slots;
+    thread_pool_t pool;
+    bool pool_ready;
+    bool pool_failed;
+} stat_engine_state_t;
+
+// Entries shared by the tasks of the pool, each task takes the next one
+typedef struct {
+    files_list_entry_t **entries;
+    size_t count;
+    size_t next;
+    size_t failures;
+} stat_batch_t;
+
+static stat_engine_kind_t engine_kind = STAT_ENGINE_LSTAT;
+static int engine_queue_depth = STAT_ENGINE_DEFAULT_QUEUE_DEPTH;
+static bool engine_verbose = false;
+static __thread stat_engine_state_t engine_state;
+
+static const char *kind_names[] = {"lstat", "threads", "io_uring"};
+
+/*!
+ * @brief stat_engine_configure selects the backend for all the threads
+ * @param kind is the backend
+ * @param queue_depth is the number of requests in flight, or of threads
+ * @param verbose is true to tell when io_uring can't be used
+ */
+void stat_engine_configure(stat_engine_kind_t kind, int queue_depth, bool verbose) {
+    engine_kind = kind;
+    engine_queue_depth = queue_depth > 0 ? queue_depth : STAT_ENGINE_DEFAULT_QUEUE_DEPTH;
+    engine_verbose = verbose;
+}
+
+/*!
+ * @brief stat_task fills the stats of the next entries of a batch, until there are none left
+ * @param argument is the batch, to be cast to a stat_batch_t
+ */
+static void stat_task(void *argument) {
+    stat_batch_t *batch = argument;
+    size_t index;
+    while ((index = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->count) {
+        if (get_file_stats(batch->entries[index]) == -1) {
+            __atomic_fetch_add(&batch->failures, 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/*!
+ * @brief fill_with_threads fills the stats of entries with lstat, from the threads of the pool and the
+ * calling thread, or from the calling thread only without a pool
+ * @param entries are the entries
+ * @param count is the number of entries
+ * @return the number of entries whose stats couldn't be read
+ */
+static size_t fill_with_threads(files_list_entry_t **entries, size_t count) {
+    stat_batch_t batch = {.entries = entries, .count = count, .next = 0, .failures = 0};
+    if (!engine_state.pool_ready && !engine_state.pool_failed && count > 1) {
+        engine_state.pool_ready = thread_pool_init(&engine_state.pool, engine_queue_depth) == 0;
+        engine_state.pool_failed = !engine_state.pool_ready;
+    }
+    if (engine_state.pool_ready && count > 1) {
+        size_t tasks = count - 1 < (size_t) engine_queue_depth ? count - 1 : (size_t) engine_queue_depth;
+        for (size_t i = 0; i < tasks; ++i) {
+            if (thread_pool_submit(&engine_state.pool, stat_task, &batch) == -1) {
+                break;
+            }
+        }
+        stat_task(&batch);
+        thread_pool_wait(&engine_state.pool);
+    } else {
+        stat_task(&batch);
+    }
+    return batch.failures;
+}
+
+/*!
+ * @brief open_ring creates the ring and the slots of the calling thread
+ * @return 0 in case of success, -1 else
+ */
+static int open_ring(void) {
+    size_t depth = engine_queue_depth;
+    engine_state.buffers = calloc(depth, sizeof(struct statx));
+    engine_state.paths = malloc(depth * PATH_SIZE);
+    engine_state.indexes = calloc(depth, sizeof(size_t));
+    engine_state.results = calloc(depth, sizeof(int));
+    engine_state.done = calloc(depth, sizeof(bool));
+    engine_state.free_slots = calloc(depth, sizeof(int));
+    if (!engine_state.buffers || !engine_state.paths || !engine_state.indexes || !engine_state.results
+        || !engine_state.done || !engine_state.free_slots) {
+        return -1;
+    }
+    engine_state.uring_ready = uring_open(&engine_state.uring, depth) == 0;
+    return engine_state.uring_ready ? 0 : -1;
+}
+
+/*!
+ * @brief drop_ring closes the ring of the calling thread, its next entries are filled by the threads
+ */
+static void drop_ring(void) {
+    if (engine_state.uring_ready) {
+        uring_close(&engine_state.uring);
+    }
+    engine_state.uring_ready = false;
+    engine_state.uring_failed = true;
+    if (engine_verbose) {
+        fprintf(stderr, "io_uring can't read the stats, using %s\n", kind_names[STAT_ENGINE_THREADS]);
+    }
+}
+
+/*!
+ * @brief apply_statx copies the result of a statx to its entry, as get_file_stats
+ * @param entry is the entry
+ * @param path is the path of the entry
+ * @param result is the result of the request, a negated errno in case of error
+ * @param stx is the statx of the entry
+ * @return -1 in case of error, 0 otherwise
+ */
+static int apply_statx(files_list_entry_t *entry, const char *path, int result, struct statx *stx) {
+    stats_add(STATS_ENTRIES_ANALYZED, 1);
+    if (result < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(-result));
+        return -1;
+    }
+    // The device is in the key of the checksum cache: it must be the st_dev of lstat
+    struct stat sb;
+    memset(&sb, 0, sizeof(sb));
+    sb.st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+    sb.st_ino = stx->stx_ino;
+    sb.st_mode = stx->stx_mode;
+    sb.st_nlink = stx->stx_nlink;
+    sb.st_size = (off_t) stx->stx_size;
+    sb.st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+    sb.st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+    return set_entry_stats(entry, &sb);
+}
+
+/*!
+ * @brief fill_with_uring fills the stats of entries with statx requests, queue depth of them in flight
+ * Entries are marked as filled once their request is done, the others are left to fill_with_threads.
+ * @param entries are the entries
+ * @param count is the number of entries
+ * @param filled is set for each entry filled (or whose stats couldn't be read)
+ * @param failures is increased by the number of entries whose stats couldn't be read
+ * @return 0 in case of success, -1 if the ring doesn't work (requests may still be in flight: drop the ring)
+ */
+static int fill_with_uring(files_list_entry_t **entries, size_t count, bool *filled, size_t *failures) {
+    uring_t *uring = &engine_state.uring;
+    int depth = engine_queue_depth;
+    int free_count = depth;
+    for (int slot = 0; slot < depth; ++slot) {
+        engine_state.free_slots[slot] = depth - 1 - slot;
+    }
+    uint64_t syscalls = 0;
+    int result = 0;
+    size_t next = 0;
+    int in_flight = 0;
+    while (next < count || in_flight > 0) {
+        for (; next < count && free_count > 0 && result == 0; ++next) {
+            int slot = engine_state.free_slots[--free_count];
+            get_entry_path(entries[next], engine_state.paths[slot]);
+            struct io_uring_sqe *sqe = uring_get_sqe(uring);
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uint64_t) (uintptr_t) engine_state.paths[slot];
+            sqe->len = STAT_ENGINE_MASK;
+            sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+            sqe->addr2 = (uint64_t) (uintptr_t) &engine_state.buffers[slot];
+            sqe->user_data = slot;
+            uring_queue(uring);
+            engine_state.indexes[slot] = next;
+            ++in_flight;
+        }
+        if (in_flight == 0) {
+            break; // The ring doesn't work, the entries left are not queued
+        }
+        if (uring_submit_and_wait(uring, &syscalls) == -1) {
+            result = -1;
+            break;
+        }
+        uring_reap(uring, engine_state.results, engine_state.done);
+        for (int slot = 0; slot < depth; ++slot) {
+            if (!engine_state.done[slot]) {
+                continue;
+            }
+            engine_state.done[slot] = false;
+            engine_state.free_slots[free_count++] = slot;
+            --in_flight;
+            size_t index = engine_state.indexes[slot];
+            int slot_result = engine_state.results[slot];
+            if (slot_result == -EINVAL || slot_result == -EOPNOTSUPP || slot_result == -ENOSYS) {
+                result = -1; // IORING_OP_STATX unsupported
+                continue;
+            }
+            if (slot_result == 0 && (engine_state.buffers[slot].stx_mask & STAT_ENGINE_MASK) != STAT_ENGINE_MASK) {
+                continue; // Fields missing, lstat will tell
+            }
+            filled[index] = true;
+            if (apply_statx(entries[index], engine_state.paths[slot], slot_result, &engine_state.buffers[slot]) == -1) {
+                ++*failures;
+            }
+        }
+    }
+    stats_syscalls(STATS_PHASE_SCAN, syscalls);
+    return result;
+}
+
+/*!
+ * @brief stat_engine_fill fills the stats of entries, as get_file_stats does for each of them
+ * @param entries are the entries, with their paths
+ * @param count is the number of entries
+ * @return 0 if all the stats were read, -1 if some of them couldn't be (their paths are printed)
+ */
+int stat_engine_fill(files_list_entry_t **entries, size_t count) {
+    if (count == 0) {
+        return 0;
+    }
+    if (engine_kind == STAT_ENGINE_LSTAT) {
+        int result = 0;
+        for (size_t i = 0; i < count; ++i) {
+            result |= get_file_stats(entries[i]);
+        }
+        return result;
+    }
+
+    size_t failures = 0;
+    if (engine_kind == STAT_ENGINE_IO_URING && !engine_state.uring_failed) {
+        if (!engine_state.uring_ready && open_ring() == -1) {
+            drop_ring();
+        }
+        bool *filled = engine_state.uring_ready ? calloc(count, sizeof(bool)) : NULL;
+        files_list_entry_t **left_entries = filled != NULL ? malloc(count * sizeof(files_list_entry_t *)) : NULL;
+        if (left_entries != NULL) {
+            uint64_t span = trace_begin();
+            if (fill_with_uring(entries, count, filled, &failures) == -1) {
+                drop_ring();
+            }
+            trace_end(TRACE_STAT, span, 0, entries[0]->dir_path);
+            // Entries left (requests not done, fields missing) are given to the threads
+            size_t left = 0;
+            for (size_t i = 0; i < count; ++i) {
+                if (!filled[i]) {
+                    left_entries[left++] = entries[i];
+                }
+            }
+            failures += fill_with_threads(left_entries, left);
+            free(left_entries);
+            free(filled);
+            return failures > 0 ? -1 : 0;
+        }
+        free(filled);
+    }
+    failures += fill_with_threads(entries, count);
+    return failures > 0 ? -1 : 0;
+}
+
+/*!
+ * @brief stat_engine_release frees the ring, its buffers and the pool of the calling thread
+ */
+void stat_engine_release(void) {
+    if (engine_state.uring_ready) {
+        uring_close(&engine_state.uring);
+    }
+    if (engine_state.pool_ready) {
+        thread_pool_destroy(&engine_state.pool);
+    }
+    free(engine_state.buffers);
+    free(engine_state.paths);
+    free(engine_state.indexes);
+    free(engine_state.results);
+    free(engine_state.done);
+    free(engine_state.free_slots);
+    memset(&engine_state, 0, sizeof(engine_state));
+}
+
+/*!
+ * @brief stat_engine_name gives the name of a backend, as used by the --stat-engine option
+ * @param kind is the backend
+ * @return its name
+ */
+const char *stat_engine_name(stat_engine_kind_t kind) {
+    return kind <= STAT_ENGINE_IO_URING ? kind_names[kind] : "unknown";
+}
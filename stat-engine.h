@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "files-list.h"
+
+// Metadata requests in flight (io_uring) or threads calling lstat (threads) by default
+#define STAT_ENGINE_DEFAULT_QUEUE_DEPTH 32
+#define STAT_ENGINE_MAX_QUEUE_DEPTH 4096
+
+typedef enum {
+    STAT_ENGINE_LSTAT, // One lstat after the other
+    STAT_ENGINE_THREADS, // lstat from queue depth threads at once
+    STAT_ENGINE_IO_URING, // queue depth statx in flight in a ring, falls back to STAT_ENGINE_THREADS
+} stat_engine_kind_t;
+
+void stat_engine_configure(stat_engine_kind_t kind, int queue_depth, bool verbose);
+int stat_engine_fill(files_list_entry_t **entries, size_t count);
+void stat_engine_release(void);
+const char *stat_engine_name(stat_engine_kind_t kind);
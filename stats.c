@@ -0,0 +1,411 @@
+#include "stats.h"
+#include "thread-pool.h"
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Run statistics are gathered in a run_stats_t mapped (shared, anonymous) by the main process before the
+ * listers and analyzers are forked: every process writes into the same memory, nothing has to be sent back.
+ * Each thread gets a slot on its first use, found by its name so that the threads of the pools started again
+ * (a lister walks each tree with a new pool) keep adding to the same slot. Counters are only updated with
+ * relaxed atomic adds in the slot of the thread, and only when --stats is given: otherwise every call is a
+ * test of a NULL pointer.
+ * Phases are charged on changes only (@see stats_enter): the time of a thread between two changes goes to
+ * the phase it was in. The main thread also charges the wall time and the CPU time of the whole main process
+ * to the phases of the run; the other threads and processes report their busy time in their slots.
+ */
+
+typedef struct {
+    stats_slot_t *slot;
+    stats_phase_t phase;
+    uint64_t wall_ns; // Times of the last change of phase
+    uint64_t cpu_ns;
+    uint64_t process_cpu_ns;
+} thread_stats_t;
+
+static run_stats_t *shared_stats = NULL;
+static __thread thread_stats_t thread_stats;
+static char process_role[32] = "main"; // Prefix of the names of the threads of this process
+static pid_t role_pid = 0;
+static int threads_named = 0; // Threads of this process named after process_role
+
+static const char *phase_names[STATS_PHASES_COUNT] = {"scan", "hash", "diff", "copy"};
+static const char *counter_names[STATS_COUNTERS_COUNT] = {"entries_scanned", "entries_analyzed", "files_hashed",
+                                                           "bytes_hashed", "files_copied", "bytes_copied", "files_linked",
+                                                           "files_deduplicated", "bytes_deduplicated"};
+static const char *queue_names[STATS_QUEUES_COUNT] = {"analyze_requests", "thread_pool", "entry_stream", "copy_stage"};
+
+/*!
+ * @brief now_ns reads a clock
+ * @param clock is the clock
+ * @return its time in nanoseconds
+ */
+static uint64_t now_ns(clockid_t clock) {
+    struct timespec time;
+    clock_gettime(clock, &time);
+    return (uint64_t) time.tv_sec * 1000000000ULL + (uint64_t) time.tv_nsec;
+}
+
+/*!
+ * @brief claim_slot gives the slot of a name, taken from the free slots the first time the name is used
+ * @param group is the name without the index
+ * @param index is the index of the thread in its group, -1 for none
+ * @return the slot (the last one when they are all used)
+ */
+static stats_slot_t *claim_slot(const char *group, int index) {
+    char name[STATS_NAME_SIZE];
+    if (index >= 0) {
+        snprintf(name, sizeof(name), "%s %d", group, index);
+    } else {
+        snprintf(name, sizeof(name), "%s", group);
+    }
+
+    // Claims are rare (once per thread): a spin lock shared by the processes is enough
+    while (__atomic_exchange_n(&shared_stats->slots_lock, 1, __ATOMIC_ACQUIRE) != 0) {
+        sched_yield();
+    }
+    stats_slot_t *slot = NULL;
+    for (int i = 0; i < shared_stats->slots_used && slot == NULL; ++i) {
+        if (strcmp(shared_stats->slots[i].name, name) == 0) {
+            slot = &shared_stats->slots[i];
+        }
+    }
+    if (slot == NULL && shared_stats->slots_used < STATS_MAX_SLOTS) {
+        slot = &shared_stats->slots[shared_stats->slots_used++];
+        strcpy(slot->name, name);
+        snprintf(slot->group, sizeof(slot->group), "%s", group);
+    } else if (slot == NULL) {
+        slot = &shared_stats->slots[STATS_MAX_SLOTS - 1];
+    }
+    __atomic_store_n(&shared_stats->slots_lock, 0, __ATOMIC_RELEASE);
+    return slot;
+}
+
+/*!
+ * @brief current_thread_stats gives the state of the calling thread, naming it after its process when it
+ * has no slot yet: "<role> pool worker <n>" in a thread pool, "<role> thread <n>" otherwise
+ * @return the state of the thread
+ */
+static thread_stats_t *current_thread_stats(void) {
+    if (thread_stats.slot == NULL) {
+        char group[STATS_NAME_SIZE];
+        int index = thread_pool_worker_index();
+        if (index >= 0) {
+            snprintf(group, sizeof(group), "%s pool worker", process_role);
+        } else {
+            snprintf(group, sizeof(group), "%s thread", process_role);
+            index = __atomic_add_fetch(&threads_named, 1, __ATOMIC_RELAXED);
+        }
+        thread_stats.slot = claim_slot(group, index);
+        thread_stats.phase = STATS_PHASE_IDLE;
+    }
+    return &thread_stats;
+}
+
+/*!
+ * @brief stats_open maps the statistics of the run, to be called by the main process before any fork
+ * The calling thread becomes the main thread of the run.
+ * @return 0 in case of success, -1 else (statistics are then not gathered)
+ */
+int stats_open(void) {
+    void *mapping = mmap(NULL, sizeof(run_stats_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        return -1;
+    }
+    shared_stats = mapping;
+    shared_stats->start_ns = now_ns(CLOCK_MONOTONIC);
+    role_pid = getpid();
+    memset(&thread_stats, 0, sizeof(thread_stats));
+    thread_stats.slot = claim_slot("main", -1);
+    thread_stats.phase = STATS_PHASE_IDLE;
+    return 0;
+}
+
+/*!
+ * @brief stats_set_role gives the calling thread its own slot, under the name of its role
+ * The first call in a forked process also names the process: its other threads are named after it.
+ * @param group is the role, e.g. "source analyzer"
+ * @param index is the index of the thread in its role, -1 for none
+ */
+void stats_set_role(const char *group, int index) {
+    if (shared_stats == NULL) {
+        return;
+    }
+    pid_t pid = getpid();
+    if (pid != role_pid) {
+        role_pid = pid;
+        threads_named = 0;
+        if (index >= 0) {
+            snprintf(process_role, sizeof(process_role), "%s %d", group, index);
+        } else {
+            snprintf(process_role, sizeof(process_role), "%s", group);
+        }
+    }
+    thread_stats.slot = claim_slot(group, index);
+    thread_stats.phase = STATS_PHASE_IDLE;
+}
+
+/*!
+ * @brief stats_add adds to a counter of the calling thread
+ * @param counter is the counter
+ * @param value is added to it
+ */
+void stats_add(stats_counter_t counter, uint64_t value) {
+    if (shared_stats != NULL) {
+        __atomic_fetch_add(&current_thread_stats()->slot->counters[counter], value, __ATOMIC_RELAXED);
+    }
+}
+
+/*!
+ * @brief stats_syscalls counts the system calls made by the calling thread for a phase
+ * @param phase is the phase
+ * @param count is the number of calls
+ */
+void stats_syscalls(stats_phase_t phase, uint64_t count) {
+    if (shared_stats != NULL) {
+        __atomic_fetch_add(&current_thread_stats()->slot->syscalls[phase], count, __ATOMIC_RELAXED);
+    }
+}
+
+/*!
+ * @brief stats_queue_depth samples the depth of a queue
+ * @param queue is the queue
+ * @param depth is its number of elements
+ */
+void stats_queue_depth(stats_queue_t queue, uint64_t depth) {
+    if (shared_stats == NULL) {
+        return;
+    }
+    stats_gauge_t *gauge = &shared_stats->queues[queue];
+    uint64_t max = __atomic_load_n(&gauge->max, __ATOMIC_RELAXED);
+    while (depth > max && !__atomic_compare_exchange_n(&gauge->max, &max, depth, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    __atomic_fetch_add(&gauge->total, depth, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&gauge->samples, 1, __ATOMIC_RELAXED);
+}
+
+/*!
+ * @brief charge_phase charges the time since the last change of phase to the current phase of a thread
+ * @param state is the state of the thread
+ */
+static void charge_phase(thread_stats_t *state) {
+    bool is_main = state->slot == &shared_stats->slots[0]; // Forked processes take another slot first
+    uint64_t wall = now_ns(CLOCK_MONOTONIC);
+    uint64_t cpu = now_ns(CLOCK_THREAD_CPUTIME_ID);
+    uint64_t process_cpu = is_main ? now_ns(CLOCK_PROCESS_CPUTIME_ID) : 0;
+    stats_phase_t phase = state->phase;
+    if (phase != STATS_PHASE_IDLE) {
+        __atomic_fetch_add(&state->slot->busy_ns[phase], wall - state->wall_ns, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&state->slot->cpu_ns[phase], cpu - state->cpu_ns, __ATOMIC_RELAXED);
+        if (is_main) {
+            shared_stats->phase_wall_ns[phase] += wall - state->wall_ns;
+            shared_stats->phase_cpu_ns[phase] += process_cpu - state->process_cpu_ns;
+        }
+    }
+    state->wall_ns = wall;
+    state->cpu_ns = cpu;
+    state->process_cpu_ns = process_cpu;
+}
+
+/*!
+ * @brief stats_enter makes the calling thread enter a phase, until stats_leave (phases may be nested, the
+ * time of the inner phase is not charged to the outer one)
+ * @param phase is the phase
+ * @return the phase the thread was in, to be given to stats_leave
+ */
+stats_phase_t stats_enter(stats_phase_t phase) {
+    if (shared_stats == NULL) {
+        return STATS_PHASE_IDLE;
+    }
+    thread_stats_t *state = current_thread_stats();
+    stats_phase_t previous = state->phase;
+    charge_phase(state);
+    state->phase = phase;
+    return previous;
+}
+
+/*!
+ * @brief stats_leave makes the calling thread leave its phase (@see stats_enter)
+ * @param previous is the phase it goes back to
+ */
+void stats_leave(stats_phase_t previous) {
+    if (shared_stats == NULL) {
+        return;
+    }
+    thread_stats_t *state = current_thread_stats();
+    charge_phase(state);
+    state->phase = previous;
+}
+
+/*!
+ * @brief write_phases writes a JSON object with a value of each phase
+ * @param output is the output
+ * @param values are the values, in nanoseconds when seconds is true
+ * @param seconds is true to write the values in seconds
+ */
+static void write_phases(FILE *output, uint64_t values[STATS_PHASES_COUNT], bool seconds) {
+    fprintf(output, "{");
+    for (int phase = 0; phase < STATS_PHASES_COUNT; ++phase) {
+        if (seconds) {
+            fprintf(output, "%s\"%s\": %.6f", phase ? ", " : "", phase_names[phase], (double) values[phase] / 1e9);
+        } else {
+            fprintf(output, "%s\"%s\": %lu", phase ? ", " : "", phase_names[phase], (unsigned long) values[phase]);
+        }
+    }
+    fprintf(output, "}");
+}
+
+/*!
+ * @brief slot_busy_ns gives the busy time of a slot in all the phases
+ * @param slot is the slot
+ * @return the time in nanoseconds
+ */
+static uint64_t slot_busy_ns(stats_slot_t *slot) {
+    uint64_t busy = 0;
+    for (int phase = 0; phase < STATS_PHASES_COUNT; ++phase) {
+        busy += slot->busy_ns[phase];
+    }
+    return busy;
+}
+
+/*!
+ * @brief write_imbalance writes, for each group of several busy threads (e.g. the source analyzers), the
+ * busy time of the busiest one over their mean busy time: 1 when the work is evenly spread
+ * @param output is the output
+ * @param slots are the slots
+ * @param count is the number of slots
+ */
+static void write_imbalance(FILE *output, stats_slot_t *slots, int count) {
+    fprintf(output, "  \"imbalance\": {");
+    bool first = true;
+    for (int i = 0; i < count; ++i) {
+        bool seen = false;
+        for (int j = 0; j < i && !seen; ++j) {
+            seen = strcmp(slots[i].group, slots[j].group) == 0;
+        }
+        uint64_t max = 0, total = 0;
+        int members = 0;
+        for (int j = i; j < count && !seen; ++j) {
+            if (strcmp(slots[i].group, slots[j].group) == 0) {
+                uint64_t busy = slot_busy_ns(&slots[j]);
+                max = busy > max ? busy : max;
+                total += busy;
+                ++members;
+            }
+        }
+        if (!seen && members > 1 && total > 0) {
+            fprintf(output, "%s\"%s\": %.3f", first ? "" : ", ", slots[i].group, (double) max * members / (double) total);
+            first = false;
+        }
+    }
+    fprintf(output, "},\n");
+}
+
+/*!
+ * @brief stats_report writes the statistics of the run as JSON, once all the processes are done
+ * Rates of bytes are given per second of busy time (summed over the threads): they tell how fast a thread
+ * hashes or copies, whatever the number of threads.
+ * @param the_config is a pointer to the configuration (mode of the run and stats_file)
+ * @return 0 in case of success, -1 else
+ */
+int stats_report(configuration_t *the_config) {
+    if (shared_stats == NULL) {
+        return -1;
+    }
+    stats_leave(STATS_PHASE_IDLE);
+    FILE *output = the_config->stats_file[0] != '\0' ? fopen(the_config->stats_file, "w") : stdout;
+    if (output == NULL) {
+        perror(the_config->stats_file);
+        return -1;
+    }
+
+    const char *mode = the_config->max_memory > 0 ? "external" : the_config->tree_diff ? "tree" : the_config->pipelined ? "pipeline"
+                     : !the_config->is_parallel ? "sequential" : the_config->threads_count > 0 ? "threads" : "processes";
+    double wall = (double) (now_ns(CLOCK_MONOTONIC) - shared_stats->start_ns) / 1e9;
+    struct rusage children;
+    getrusage(RUSAGE_CHILDREN, &children);
+    double children_cpu = (double) (children.ru_utime.tv_sec + children.ru_stime.tv_sec)
+                          + (double) (children.ru_utime.tv_usec + children.ru_stime.tv_usec) / 1e6;
+
+    int count = shared_stats->slots_used;
+    stats_slot_t *slots = shared_stats->slots;
+    uint64_t totals[STATS_COUNTERS_COUNT] = {0}, syscalls[STATS_PHASES_COUNT] = {0};
+    uint64_t busy[STATS_PHASES_COUNT] = {0}, cpu[STATS_PHASES_COUNT] = {0};
+    for (int i = 0; i < count; ++i) {
+        for (int counter = 0; counter < STATS_COUNTERS_COUNT; ++counter) {
+            totals[counter] += slots[i].counters[counter];
+        }
+        for (int phase = 0; phase < STATS_PHASES_COUNT; ++phase) {
+            syscalls[phase] += slots[i].syscalls[phase];
+            busy[phase] += slots[i].busy_ns[phase];
+            cpu[phase] += slots[i].cpu_ns[phase];
+        }
+    }
+
+    fprintf(output, "{\n  \"mode\": \"%s\",\n  \"wall_s\": %.6f,\n  \"children_cpu_s\": %.6f,\n", mode, wall, children_cpu);
+    fprintf(output, "  \"phases\": {\n");
+    for (int phase = 0; phase < STATS_PHASES_COUNT; ++phase) {
+        fprintf(output, "    \"%s\": {\"wall_s\": %.6f, \"cpu_s\": %.6f, \"busy_s\": %.6f, \"threads_cpu_s\": %.6f, \"syscalls\": %lu}%s\n",
+                phase_names[phase], (double) shared_stats->phase_wall_ns[phase] / 1e9, (double) shared_stats->phase_cpu_ns[phase] / 1e9,
+                (double) busy[phase] / 1e9, (double) cpu[phase] / 1e9, (unsigned long) syscalls[phase],
+                phase + 1 < STATS_PHASES_COUNT ? "," : "");
+    }
+    fprintf(output, "  },\n  \"totals\": {");
+    for (int counter = 0; counter < STATS_COUNTERS_COUNT; ++counter) {
+        fprintf(output, "%s\"%s\": %lu", counter ? ", " : "", counter_names[counter], (unsigned long) totals[counter]);
+    }
+    double hash_busy = (double) busy[STATS_PHASE_HASH] / 1e9, copy_busy = (double) busy[STATS_PHASE_COPY] / 1e9;
+    fprintf(output, "},\n  \"throughput\": {\"entries_per_s\": %.1f, \"hash_mib_per_busy_s\": %.1f, \"copy_mib_per_busy_s\": %.1f},\n",
+            wall > 0 ? (double) (totals[STATS_ENTRIES_SCANNED] + totals[STATS_ENTRIES_ANALYZED]) / wall : 0.0,
+            hash_busy > 0 ? (double) totals[STATS_BYTES_HASHED] / (1024.0 * 1024.0) / hash_busy : 0.0,
+            copy_busy > 0 ? (double) totals[STATS_BYTES_COPIED] / (1024.0 * 1024.0) / copy_busy : 0.0);
+    fprintf(output, "  \"queues\": {");
+    for (int queue = 0; queue < STATS_QUEUES_COUNT; ++queue) {
+        stats_gauge_t *gauge = &shared_stats->queues[queue];
+        fprintf(output, "%s\"%s\": {\"max\": %lu, \"mean\": %.1f}", queue ? ", " : "", queue_names[queue], (unsigned long) gauge->max,
+                gauge->samples > 0 ? (double) gauge->total / (double) gauge->samples : 0.0);
+    }
+    fprintf(output, "},\n");
+    write_imbalance(output, slots, count);
+
+    fprintf(output, "  \"threads\": [\n");
+    for (int i = 0; i < count; ++i) {
+        fprintf(output, "    {\"name\": \"%s\"", slots[i].name);
+        for (int counter = 0; counter < STATS_COUNTERS_COUNT; ++counter) {
+            fprintf(output, ", \"%s\": %lu", counter_names[counter], (unsigned long) slots[i].counters[counter]);
+        }
+        fprintf(output, ",\n     \"syscalls\": ");
+        write_phases(output, slots[i].syscalls, false);
+        fprintf(output, ", \"busy_s\": ");
+        write_phases(output, slots[i].busy_ns, true);
+        fprintf(output, ", \"cpu_s\": ");
+        write_phases(output, slots[i].cpu_ns, true);
+        fprintf(output, "}%s\n", i + 1 < count ? "," : "");
+    }
+    fprintf(output, "  ]\n}\n");
+
+    int result = ferror(output) ? -1 : 0;
+    if (output != stdout && fclose(output) != 0) {
+        result = -1;
+    }
+    if (result == -1) {
+        fprintf(stderr, "Unable to write the statistics\n");
+    }
+    return result;
+}
+
+/*!
+ * @brief stats_close unmaps the statistics of the run
+ */
+void stats_close(void) {
+    if (shared_stats != NULL) {
+        munmap(shared_stats, sizeof(run_stats_t));
+        shared_stats = NULL;
+    }
+    thread_stats.slot = NULL;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "configuration.h"
+
+// Threads (of all the processes) with their own counters, the next ones share the last slot
+#define STATS_MAX_SLOTS 256
+#define STATS_NAME_SIZE 48
+
+typedef enum {
+    STATS_PHASE_SCAN, // Walking the trees and getting the stats of the entries
+    STATS_PHASE_HASH, // Reading the contents to compute their checksums
+    STATS_PHASE_DIFF, // Comparing the lists
+    STATS_PHASE_COPY, // Applying the differences
+    STATS_PHASES_COUNT,
+    STATS_PHASE_IDLE = STATS_PHASES_COUNT, // Time not charged to any phase
+} stats_phase_t;
+
+typedef enum {
+    STATS_ENTRIES_SCANNED, // Entries found by the walkers
+    STATS_ENTRIES_ANALYZED, // Entries whose stats were asked to an analyzer
+    STATS_FILES_HASHED,
+    STATS_BYTES_HASHED,
+    STATS_FILES_COPIED,
+    STATS_BYTES_COPIED,
+    STATS_FILES_LINKED, // Files made a hard link to the copy of another link of their inode
+    STATS_FILES_DEDUPLICATED, // Files cloned or linked from another destination file with the same content
+    STATS_BYTES_DEDUPLICATED, // Bytes of the deduplicated files, not written
+    STATS_COUNTERS_COUNT,
+} stats_counter_t;
+
+typedef enum {
+    STATS_QUEUE_ANALYZE_REQUESTS, // Entries sent to the analyzers and not answered yet
+    STATS_QUEUE_THREAD_POOL, // Tasks waiting in the deques of a thread pool
+    STATS_QUEUE_ENTRY_STREAM, // Entries walked and not compared yet (pipeline)
+    STATS_QUEUE_COPY_STAGE, // Files waiting for a copy worker
+    STATS_QUEUES_COUNT,
+} stats_queue_t;
+
+// Counters of a thread, only written by it (or by the threads sharing its name), 64 bytes aligned
+typedef struct {
+    char name[STATS_NAME_SIZE];
+    char group[STATS_NAME_SIZE]; // Name without the index of the thread, compared for the imbalance
+    uint64_t counters[STATS_COUNTERS_COUNT];
+    uint64_t syscalls[STATS_PHASES_COUNT];
+    uint64_t busy_ns[STATS_PHASES_COUNT]; // Wall time spent in each phase
+    uint64_t cpu_ns[STATS_PHASES_COUNT]; // CPU time of the thread in each phase
+} __attribute__((aligned(64))) stats_slot_t;
+
+typedef struct {
+    uint64_t max;
+    uint64_t total; // Sum of the samples, for the mean
+    uint64_t samples;
+} stats_gauge_t;
+
+// Statistics of a run, in memory shared by all the processes (mapped before the fork)
+typedef struct {
+    uint64_t start_ns;
+    uint64_t phase_wall_ns[STATS_PHASES_COUNT]; // Time of the main thread in each phase
+    uint64_t phase_cpu_ns[STATS_PHASES_COUNT]; // CPU time of the main process (all its threads) in each phase
+    stats_gauge_t queues[STATS_QUEUES_COUNT];
+    int slots_lock;
+    int slots_used;
+    stats_slot_t slots[STATS_MAX_SLOTS];
+} run_stats_t;
+
+int stats_open(void);
+void stats_set_role(const char *group, int index);
+void stats_add(stats_counter_t counter, uint64_t value);
+void stats_syscalls(stats_phase_t phase, uint64_t count);
+void stats_queue_depth(stats_queue_t queue, uint64_t depth);
+stats_phase_t stats_enter(stats_phase_t phase);
+void stats_leave(stats_phase_t previous);
+int stats_report(configuration_t *the_config);
+void stats_close(void);
@@ -4,14 +4,26 @@
 #include "processes.h"
 #include "utility.h"
 #include "messages.h"
+#include "transport.h"
 #include "file-properties.h"
+#include "copy-engine.h"
+#include "delta.h"
+#include "walker.h"
+#include "entry-stream.h"
+#include "external-sort.h"
+#include "dir-tree.h"
+#include "watch.h"
+#include "stats.h"
+#include "trace.h"
+#include "hard-links.h"
+#include "dedup.h"
 #include <sys/stat.h>
 #include <fcntl.h>
-#include <sys/sendfile.h>
 #include <unistd.h>
 #include <sys/msg.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
 
 /*!
  * @brief make_files_list buils a files list in no parallel mode
@@ -24,155 +36,1214 @@ void make_files_list(files_list_t *list, char *target_path) {
     }
 
     make_list(list, target_path);
+    sort_files_list(list);
+}
 
-    files_list_entry_t *p_entry = list->head;
-    while (p_entry != NULL) {
-        get_file_stats(p_entry);
-        p_entry = p_entry->next;
+/*!
+ * @brief make_files_lists_threaded builds both (src and dest) files lists on a pool of threads
+ * Both trees are walked at once, each directory being a task of the pool (@see parallel_walk_start), and
+ * the walks get the stats of their entries. The lists come out sorted.
+ * @param src_list is a pointer to the source list to build
+ * @param dst_list is a pointer to the destination list to build
+ * @param the_config is a pointer to the program configuration
+ * @param pool is a pointer to the thread pool
+ */
+void make_files_lists_threaded(files_list_t *src_list, files_list_t *dst_list, configuration_t *the_config, thread_pool_t *pool) {
+    parallel_walk_t walks[2];
+    parallel_walk_start(&walks[0], the_config->source, true, pool);
+    parallel_walk_start(&walks[1], the_config->destination, true, pool);
+    thread_pool_wait(pool);
+    int source_result = parallel_walk_finish(&walks[0], src_list);
+    int destination_result = parallel_walk_finish(&walks[1], dst_list);
+    if (source_result == -1 || destination_result == -1) {
+        exit(EXIT_FAILURE); // Like make_list
     }
+    sort_files_list(src_list);
+    sort_files_list(dst_list);
 }
 
 /*!
- * @brief synchronize is the main function for synchronization
+ * @brief synchronize_streamed walks both trees in their own threads while they are compared
+ * @param the_config is a pointer to the configuration
+ * @param source_list is a pointer to the list receiving the source entries
+ * @param dest_list is a pointer to the list receiving the destination entries
+ * @param diff_list is a pointer to the list receiving the differences
+ * @param cache is the checksum cache
+ * @param pool is the pool hashing the files, NULL to hash them in the comparing thread
+ * @return 0 once the trees are compared (a directory that couldn't be read is reported), -1 if the walks couldn't
+ * start (the lists are left empty)
+ */
+static int synchronize_streamed(configuration_t *the_config, files_list_t *source_list, files_list_t *dest_list, files_list_t *diff_list, checksum_cache_t *cache, thread_pool_t *pool) {
+    entry_stream_t *streams = malloc(2 * sizeof(entry_stream_t));
+    if (!streams) {
+        return -1;
+    }
+    bool started[2] = {
+            entry_stream_start(&streams[0], source_list, the_config->source) == 0,
+            entry_stream_start(&streams[1], dest_list, the_config->destination) == 0,
+    };
+    if (started[0] && started[1]) {
+        make_differences_streamed(&streams[0], &streams[1], diff_list, the_config, cache, pool);
+    }
+    for (int i = 0; i < 2; ++i) {
+        if (started[i]) {
+            // A walk that started alone must reach its end before it is dropped
+            while (!(started[0] && started[1]) && entry_stream_next(&streams[i]) != NULL) {
+            }
+            if (entry_stream_finish(&streams[i]) == -1 && started[0] && started[1]) {
+                // As with the lists, the entries read are compared: the rest of the tree is left as is
+                fprintf(stderr, "%s couldn't be fully read, %s may be partially synchronized\n",
+                        i == 0 ? the_config->source : the_config->destination, the_config->destination);
+            }
+        }
+    }
+    free(streams);
+    if (!(started[0] && started[1])) {
+        clear_files_list(source_list);
+        clear_files_list(dest_list);
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief sort_visitor gives the entries of a walk to an external sorter (@see walk_visitor_t)
+ * @param entry is the entry
+ * @param data is the external_sorter_t
+ * @return 0 in case of success, -1 to stop the walk
+ */
+static int sort_visitor(files_list_entry_t *entry, void *data) {
+    return external_sorter_add((external_sorter_t *) data, entry);
+}
+
+/*!
+ * @brief synchronize_external sorts both trees on disk, then compares them like two lists
+ * Each tree gets half of the_config->max_memory to gather its entries.
+ * @param the_config is a pointer to the configuration
+ * @param cache is the checksum cache
+ * @param differences receives the number of differences
+ * @return 0 in case of success, -1 else
+ */
+static int synchronize_external(configuration_t *the_config, checksum_cache_t *cache, size_t *differences) {
+    external_sorter_t sorters[2];
+    external_sorter_init(&sorters[0], the_config->max_memory / 2);
+    external_sorter_init(&sorters[1], the_config->max_memory / 2);
+    int result = -1;
+    if (walk_tree_visit(the_config->source, true, sort_visitor, &sorters[0]) == 0
+        && walk_tree_visit(the_config->destination, true, sort_visitor, &sorters[1]) == 0) {
+        if (the_config->verbose) {
+            printf("External sort: %lu source entries in %zu runs, %lu destination entries in %zu runs\n",
+                   (unsigned long) sorters[0].entries_count, sorters[0].runs_count,
+                   (unsigned long) sorters[1].entries_count, sorters[1].runs_count);
+        }
+        if (external_sorter_sort(&sorters[0]) == 0 && external_sorter_sort(&sorters[1]) == 0) {
+            *differences = make_differences_external(&sorters[0], &sorters[1], the_config, cache);
+            result = (sorters[0].failed || sorters[1].failed) ? -1 : 0;
+        }
+    }
+    external_sorter_release(&sorters[0]);
+    external_sorter_release(&sorters[1]);
+    return result;
+}
+
+/*!
+ * @brief synchronize_trees compares the whole trees and applies their differences
  * It will build the lists (source and destination), then make a third list with differences, and apply differences to the destination
  * It must adapt to the parallel or not operation of the program.
+ * With the pipeline, both trees are walked while they are compared instead (@see make_differences_streamed).
+ * With a memory limit, the lists are sorted on disk and never fully loaded (@see make_differences_external).
+ * With --tree, the trees are compared directory by directory, without lists (@see make_differences_tree).
  * @param the_config is a pointer to the configuration
  * @param p_context is a pointer to the processes context
  */
-void synchronize(configuration_t *the_config, process_context_t *p_context) {
-    // Check for NULL pointers
-    if (!the_config || !p_context) {
-        fprintf(stderr, "Invalid configuration or process context pointers\n");
-        return;
-    }
-
+static void synchronize_trees(configuration_t *the_config, process_context_t *p_context) {
     // Extract source and destination paths from configuration
     char *source_path = the_config->source;
     char *dest_path = the_config->destination;
 
-    files_list_t source_list, dest_list;
-    source_list.head = source_list.tail = NULL;
-    dest_list.head = dest_list.tail = NULL;
+    files_list_t source_list, dest_list, diff_list;
+    init_files_list(&source_list);
+    init_files_list(&dest_list);
+    init_files_list(&diff_list);
+    checksum_cache_t *cache = &p_context->cache;
+    hard_links_clear();
+    dedup_reset(the_config->dedup);
 
-    // Build lists
-    make_files_list(&source_list, source_path);
-    make_files_list(&dest_list, dest_path);
+    // The walks of the pipeline, of the external sort and of the trees are charged to the comparison that drives them
+    stats_phase_t previous_phase = stats_enter(STATS_PHASE_DIFF);
+    bool external = the_config->max_memory > 0;
+    bool tree = !external && the_config->tree_diff;
+    // Files whose size and mtime can't decide are hashed on the pool or, without one, by as many threads as
+    // processes: the analyzers only get the stats, and the checksum cache belongs to this process
+    thread_pool_t hashing_pool;
+    thread_pool_t *pool = p_context->uses_threads ? &p_context->thread_pool : NULL;
+    bool owns_pool = pool == NULL && !external && !tree && the_config->uses_md5 && the_config->processes_count > 1
+                     && thread_pool_init(&hashing_pool, the_config->processes_count) == 0;
+    if (owns_pool) {
+        pool = &hashing_pool;
+    }
+    bool streamed = !external && !tree && the_config->pipelined && synchronize_streamed(the_config, &source_list, &dest_list, &diff_list, cache, pool) == 0;
+    size_t differences = 0;
+    if (external) {
+        if (synchronize_external(the_config, cache, &differences) == -1) {
+            fprintf(stderr, "The external sort failed, %s may be partially synchronized\n", dest_path);
+        }
+    } else if (tree) {
+        differences = make_differences_tree(p_context->uses_threads ? &p_context->thread_pool : NULL, the_config, cache);
+    } else if (!streamed) {
+        // Build lists (stats only, contents are read by the comparison when it needs them)
+        stats_enter(STATS_PHASE_SCAN);
+        if (p_context->uses_threads) {
+            make_files_lists_threaded(&source_list, &dest_list, the_config, &p_context->thread_pool);
+        } else if (the_config->is_parallel) {
+            make_files_lists_parallel(&source_list, &dest_list, the_config, p_context->message_queue_id);
+        } else {
+            make_files_list(&source_list, source_path);
+            make_files_list(&dest_list, dest_path);
+        }
 
-    // Compare and synchronize lists A COMPLETER  !!!!
+        // Compare lists, differences are applied as soon as they are found
+        stats_enter(STATS_PHASE_DIFF);
+        make_differences_list(&source_list, &dest_list, &diff_list, the_config, cache, pool);
+    }
+    if (owns_pool) {
+        thread_pool_destroy(&hashing_pool);
+    }
+    if (!external && !tree) {
+        differences = diff_list.count;
+    }
+    if (the_config->verbose && cache->fd != -1) {
+        printf("Checksum cache: %lu hits, %lu misses\n", (unsigned long) cache->hits, (unsigned long) cache->misses);
+    }
+
+    if (the_config->verbose) {
+        printf("%zu differences between %s and %s\n", differences, source_path, dest_path);
+    }
+
+    // Apply the differences with the copy workers, when they are not copied by the comparison
+    if (the_config->copy_workers > 0 && !streamed && !external && !tree) {
+        stats_enter(STATS_PHASE_COPY);
+        copy_stage_run(&diff_list, the_config);
+    }
+    stats_leave(previous_phase);
+    if (the_config->verbose && the_config->dedup != DEDUP_NONE) {
+        uint64_t files, bytes;
+        dedup_totals(&files, &bytes);
+        printf("Deduplication (%s): %lu files, %lu bytes not written\n", dedup_mode_name(the_config->dedup), (unsigned long) files, (unsigned long) bytes);
+    }
 
     // Free allocated memory
     clear_files_list(&source_list);
     clear_files_list(&dest_list);
+    clear_files_list(&diff_list);
 }
 
 /*!
- * @brief copy_entry_to_destination copies a file from the source to the destination
- * It keeps access modes and mtime (@see utimensat)
- * Pay attention to the path so that the prefixes are not repeated from the source to the destination
- * Use sendfile to copy the file, mkdir to create the directory
+ * @brief watch_and_synchronize applies the changes of the source tree as they happen (@see watcher_wait),
+ * until SIGINT or SIGTERM
+ * Only the touched entries are compared, except after lost events, when the whole trees are compared again.
+ * @param watcher is the watcher of the source, opened before the first comparison
+ * @param the_config is a pointer to the configuration
+ * @param p_context is a pointer to the processes context
  */
-void copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t *the_config) {
-    char dest_entry_path[PATH_SIZE]  = "";
-    concat_path(dest_entry_path, the_config->destination, source_entry->path_and_name + strlen(the_config->source));
+static void watch_and_synchronize(watcher_t *watcher, configuration_t *the_config, process_context_t *p_context) {
+    if (the_config->verbose) {
+        printf("Watching %s\n", the_config->source);
+    }
+
+    files_list_t source_list, dest_list, diff_list;
+    init_files_list(&source_list);
+    init_files_list(&dest_list);
+    init_files_list(&diff_list);
+    watch_result_t result;
+    while ((result = watcher_wait(watcher, the_config, &source_list, &dest_list)) != WATCH_STOPPED) {
+        if (result == WATCH_OVERFLOW) {
+            fprintf(stderr, "Events of %s were lost, comparing the whole trees\n", the_config->source);
+            synchronize_trees(the_config, p_context);
+        } else {
+            stats_phase_t previous_phase = stats_enter(STATS_PHASE_DIFF);
+            hard_links_clear();
+            dedup_reset(the_config->dedup);
+            size_t differences = make_differences_list(&source_list, &dest_list, &diff_list, the_config, &p_context->cache,
+                                                       p_context->uses_threads ? &p_context->thread_pool : NULL);
+            if (the_config->copy_workers > 0) {
+                stats_enter(STATS_PHASE_COPY);
+                copy_stage_run(&diff_list, the_config);
+            }
+            stats_leave(previous_phase);
+            if (the_config->verbose) {
+                printf("%zu changes of %zu touched entries applied\n", differences, source_list.count);
+            }
+        }
+        clear_files_list(&source_list);
+        clear_files_list(&dest_list);
+        clear_files_list(&diff_list);
+    }
+}
+
+/*!
+ * @brief synchronize is the main function for synchronization
+ * It compares the whole trees once, then, in watch mode, keeps applying the changes of the source.
+ * @param the_config is a pointer to the configuration
+ * @param p_context is a pointer to the processes context
+ */
+void synchronize(configuration_t *the_config, process_context_t *p_context) {
+    // Check for NULL pointers
+    if (!the_config || !p_context) {
+        fprintf(stderr, "Invalid configuration or process context pointers\n");
+        return;
+    }
+
+    // Watched before the first comparison: the changes made while it runs are queued, they are the first burst
+    watcher_t watcher;
+    bool watching = the_config->watch && watcher_open(&watcher, the_config->source) == 0;
+    synchronize_trees(the_config, p_context);
+    if (watching) {
+        watch_and_synchronize(&watcher, the_config, p_context);
+        watcher_close(&watcher);
+    }
+}
 
+/*!
+ * @brief mismatch tests if two files with the same relative path differ
+ * Size and mtime decide first: files of different sizes differ, files with the same size and mtime are
+ * the same. When only the mtime differs, the checksums (if used) decide, else the files differ.
+ * @param lhd is a pointer to the source entry
+ * @param rhd is a pointer to the destination entry
+ * @param has_md5 is true if the checksums must be compared (they must then be known, @see needs_checksums)
+ * @return true if the entries differ, false else
+ */
+bool mismatch(files_list_entry_t *lhd, files_list_entry_t *rhd, bool has_md5) {
+    if (lhd->entry_type != rhd->entry_type) {
+        return true;
+    }
+    if (lhd->entry_type == DOSSIER) {
+        return false;
+    }
+    if (lhd->size != rhd->size) {
+        return true;
+    }
+    if (lhd->mtime.tv_sec == rhd->mtime.tv_sec && lhd->mtime.tv_nsec == rhd->mtime.tv_nsec) {
+        return false;
+    }
+    return !has_md5 || lhd->checksum_type == CHECKSUM_NONE || lhd->checksum_type != rhd->checksum_type
+           || memcmp(lhd->checksum, rhd->checksum, checksum_size(lhd->checksum_type)) != 0;
+}
+
+/*!
+ * @brief needs_checksums tells if the comparison of two entries depends on their checksums
+ * @param lhd is a pointer to the source entry
+ * @param rhd is a pointer to the destination entry
+ * @return true for files with the same size but different mtimes
+ */
+static bool needs_checksums(files_list_entry_t *lhd, files_list_entry_t *rhd) {
+    return lhd->entry_type == FICHIER && rhd->entry_type == FICHIER && lhd->size == rhd->size
+           && (lhd->mtime.tv_sec != rhd->mtime.tv_sec || lhd->mtime.tv_nsec != rhd->mtime.tv_nsec);
+}
+
+/*!
+ * @brief update_destination_times gives the mtime of a source file to its destination copy, when their
+ * contents are the same, so that the next runs don't compare their contents again
+ * @param source_entry is a pointer to the source entry
+ * @param the_config is a pointer to the configuration
+ */
+static void update_destination_times(files_list_entry_t *source_entry, configuration_t *the_config) {
+    char source_entry_path[PATH_SIZE];
+    char dest_entry_path[PATH_SIZE] = "";
+    get_entry_path(source_entry, source_entry_path);
+    concat_path(dest_entry_path, the_config->destination, source_entry_path + get_root_length(the_config->source));
     if (the_config->dry_run == true) {
-        printf("%s copied to %s.\n", source_entry->path_and_name, dest_entry_path);
         return;
     }
 
+    struct timespec new_time[2] = {{0, UTIME_OMIT}, source_entry->mtime};
+    stats_syscalls(STATS_PHASE_DIFF, 1);
+    if (utimensat(AT_FDCWD, dest_entry_path, new_time, AT_SYMLINK_NOFOLLOW) != 0) {
+        fprintf(stderr, "Error updating the mtime of %s: %s\n", dest_entry_path, strerror(errno));
+    } else if (the_config->verbose == true) {
+        printf("%s has the same content, its mtime is updated.\n", dest_entry_path);
+    }
+}
+
+/*!
+ * @brief needs_hashing tells if a pair of entries can only be decided by the checksums of both files
+ * @param src_entry is a pointer to the source entry
+ * @param dst_entry is a pointer to the destination entry with the same relative path, NULL if there is none
+ * @param the_config is a pointer to the configuration
+ * @return true if both files must be hashed before the pair is decided (@see decide_entries)
+ */
+static bool needs_hashing(files_list_entry_t *src_entry, files_list_entry_t *dst_entry, configuration_t *the_config) {
+    return dst_entry != NULL && the_config->uses_md5 && needs_checksums(src_entry, dst_entry);
+}
+
+/*!
+ * @brief hash_entry gets the checksum of an entry, a file that can't be hashed is left without checksum
+ * @param entry is a pointer to the entry
+ * @param the_config is a pointer to the configuration
+ * @param cache is the checksum cache, NULL if disabled
+ */
+static void hash_entry(files_list_entry_t *entry, configuration_t *the_config, checksum_cache_t *cache) {
+    if (get_file_checksum(entry, the_config->checksum_type, cache) == -1) {
+        entry->checksum_type = CHECKSUM_NONE;
+    }
+}
+
+/*!
+ * @brief decide_entries tells if a source entry must be copied over the destination entry with its path
+ * A destination found with the same content gets the mtime of the source, unless it is a hard link made by the
+ * deduplication (@see dedup.h). An up to date destination of a file with several links is kept for its other
+ * links (@see hard-links.h).
+ * @param src_entry is a pointer to the source entry
+ * @param dst_entry is a pointer to the destination entry with the same relative path
+ * @param the_config is a pointer to the configuration
+ * @param hashed is true if the pair needs its checksums (@see needs_hashing), they must then be computed
+ * @return true if the entry must be copied
+ */
+static bool decide_entries(files_list_entry_t *src_entry, files_list_entry_t *dst_entry, configuration_t *the_config, bool hashed) {
+    bool is_different;
+    if (!hashed) {
+        is_different = mismatch(src_entry, dst_entry, false);
+    } else {
+        // A file that can't be hashed is copied again
+        is_different = src_entry->checksum_type == CHECKSUM_NONE || dst_entry->checksum_type == CHECKSUM_NONE
+                       || mismatch(src_entry, dst_entry, true);
+        // A destination linked to other paths than the links of its source (--dedup=link) shares its mtime with them
+        if (!is_different && (dst_entry->nlink <= 1 || src_entry->nlink > 1)) {
+            update_destination_times(src_entry, the_config);
+        }
+    }
+    if (!is_different && src_entry->nlink > 1) {
+        char dest_entry_path[PATH_SIZE];
+        hard_links_set_destination(src_entry, get_entry_path(dst_entry, dest_entry_path));
+    }
+    return is_different;
+}
+
+/*!
+ * @brief entry_differs tells if a source entry must be copied to the destination
+ * Contents are only compared (through their checksums, from the cache when possible) when size and mtime
+ * can't decide, they are then hashed in this thread (@see hash_queue_t to hash them on a pool).
+ * @param src_entry is a pointer to the source entry
+ * @param dst_entry is a pointer to the destination entry with the same relative path, NULL if there is none
+ * @param the_config is a pointer to the configuration
+ * @param cache is the checksum cache, NULL if disabled
+ * @return true if the entry must be copied
+ */
+static bool entry_differs(files_list_entry_t *src_entry, files_list_entry_t *dst_entry, configuration_t *the_config, checksum_cache_t *cache) {
+    if (dst_entry == NULL) {
+        return true;
+    }
+    bool hashed = needs_hashing(src_entry, dst_entry, the_config);
+    if (hashed) {
+        hash_entry(src_entry, the_config, cache);
+        hash_entry(dst_entry, the_config, cache);
+    }
+    return decide_entries(src_entry, dst_entry, the_config, hashed);
+}
+
+/*!
+ * @brief apply_list_difference records a difference found by a comparison of lists or streams and copies it
+ * @param entry is a pointer to the source entry
+ * @param diff_list is a pointer to the list receiving the differences
+ * @param stage is the copy stage, NULL to copy the difference at once unless the copy workers copy diff_list later
+ * @param the_config is a pointer to the configuration
+ */
+static void apply_list_difference(files_list_entry_t *entry, files_list_t *diff_list, copy_stage_t *stage, configuration_t *the_config) {
+    files_list_entry_t *difference = duplicate_file_entry(diff_list, entry);
+    if (stage != NULL) {
+        copy_stage_submit(stage, difference ? difference : entry);
+    } else if (the_config->copy_workers == 0) {
+        copy_entry_to_destination(difference ? difference : entry, the_config);
+    }
+}
+
+// Pairs hashed by a task of the pool
+#define HASH_SLICE_SIZE 16
+// Pairs queued before they are decided, so that the copies of their differences don't wait for the whole tree
+#define HASH_QUEUE_SIZE 1024
+
+// Slice of the pairs of a hash queue, a task of its pool (@see hash_slice_task)
+typedef struct _hash_slice {
+    struct _hash_slice *next;
+    configuration_t *the_config;
+    checksum_cache_t *cache;
+    size_t count;
+    files_list_entry_t *sources[HASH_SLICE_SIZE];
+    files_list_entry_t *destinations[HASH_SLICE_SIZE];
+} hash_slice_t;
+
+/*
+ * Pairs of files that size and mtime can't decide, while the comparison goes on: both files of each pair are
+ * hashed by the pool, a slice of pairs per task, then the pairs are decided in their order by the comparing
+ * thread (@see hash_queue_flush), which keeps the mtime updates, the hard links and the copies.
+ * Files with several links are decided at once: their destination must be known before their other links.
+ */
+typedef struct {
+    thread_pool_t *pool; // NULL to hash the pairs at once in the comparing thread (@see entry_differs)
+    configuration_t *the_config;
+    checksum_cache_t *cache;
+    hash_slice_t *head;
+    hash_slice_t *tail; // Slice being filled, submitted to the pool once full
+    size_t count;
+} hash_queue_t;
+
+/*!
+ * @brief hash_slice_task hashes both files of the pairs of a slice (thread pool task)
+ * @param parameters is the hash_slice_t
+ */
+static void hash_slice_task(void *parameters) {
+    hash_slice_t *slice = parameters;
+    for (size_t i = 0; i < slice->count; ++i) {
+        hash_entry(slice->sources[i], slice->the_config, slice->cache);
+        hash_entry(slice->destinations[i], slice->the_config, slice->cache);
+    }
+}
+
+/*!
+ * @brief hash_queue_init initializes an empty hash queue
+ * @param queue is the queue
+ * @param pool is the pool hashing the pairs, NULL to hash them in the comparing thread
+ * @param the_config is a pointer to the configuration
+ * @param cache is the checksum cache, NULL if disabled
+ */
+static void hash_queue_init(hash_queue_t *queue, thread_pool_t *pool, configuration_t *the_config, checksum_cache_t *cache) {
+    queue->pool = pool;
+    queue->the_config = the_config;
+    queue->cache = cache;
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->count = 0;
+}
+
+/*!
+ * @brief hash_queue_add queues a pair whose files must be hashed before it is decided
+ * @param queue is the queue
+ * @param src_entry is a pointer to the source entry
+ * @param dst_entry is a pointer to the destination entry with the same relative path
+ * @return 0 if the pair is queued, -1 if it must be decided at once (no pool, several links or no memory)
+ */
+static int hash_queue_add(hash_queue_t *queue, files_list_entry_t *src_entry, files_list_entry_t *dst_entry) {
+    if (queue->pool == NULL || src_entry->nlink > 1) {
+        return -1;
+    }
+    if (queue->tail == NULL || queue->tail->count == HASH_SLICE_SIZE) {
+        hash_slice_t *slice = malloc(sizeof(hash_slice_t));
+        if (!slice) {
+            return -1;
+        }
+        slice->next = NULL;
+        slice->the_config = queue->the_config;
+        slice->cache = queue->cache;
+        slice->count = 0;
+        if (queue->tail != NULL) {
+            queue->tail->next = slice;
+        } else {
+            queue->head = slice;
+        }
+        queue->tail = slice;
+    }
+    hash_slice_t *slice = queue->tail;
+    slice->sources[slice->count] = src_entry;
+    slice->destinations[slice->count] = dst_entry;
+    if (++slice->count == HASH_SLICE_SIZE) {
+        thread_pool_submit(queue->pool, hash_slice_task, slice); // Hashed at once when it can't be queued
+    }
+    ++queue->count;
+    return 0;
+}
+
+/*!
+ * @brief hash_queue_flush waits for the checksums of the queued pairs, then decides them in order and applies
+ * their differences (@see apply_list_difference)
+ * @param queue is the queue, left empty
+ * @param diff_list is a pointer to the list receiving the differences
+ * @param stage is the copy stage, NULL if there is none
+ * @return the number of differences
+ */
+static size_t hash_queue_flush(hash_queue_t *queue, files_list_t *diff_list, copy_stage_t *stage) {
+    if (queue->head == NULL) {
+        return 0;
+    }
+    if (queue->tail->count < HASH_SLICE_SIZE) {
+        thread_pool_submit(queue->pool, hash_slice_task, queue->tail);
+    }
+    thread_pool_wait(queue->pool);
+
+    size_t differences = 0;
+    while (queue->head != NULL) {
+        hash_slice_t *slice = queue->head;
+        for (size_t i = 0; i < slice->count; ++i) {
+            if (decide_entries(slice->sources[i], slice->destinations[i], queue->the_config, true)) {
+                apply_list_difference(slice->sources[i], diff_list, stage, queue->the_config);
+                ++differences;
+            }
+        }
+        queue->head = slice->next;
+        free(slice);
+    }
+    queue->tail = NULL;
+    queue->count = 0;
+    return differences;
+}
+
+/*!
+ * @brief make_differences_list compares the source and destination lists and applies their differences
+ * Both lists are sorted, so they are walked together in a single pass (merge-join) in O(N+M): the relative
+ * paths (skipping the source and destination roots) are compared, and a source entry is a difference when
+ * the destination has no entry with its path or a mismatching one.
+ * Lists only hold the stats of the entries: contents are only read (or taken from the checksum cache) for
+ * the pairs of files that size and mtime can't decide, when checksums are used. With a pool, these pairs
+ * are hashed by its threads while the comparison goes on, and decided once their checksums are known
+ * (@see hash_queue_t).
+ * Each difference is added to diff_list and, without a copy stage (@see copy_stage_run), immediately copied
+ * to the destination. Parents are always ordered before their children, so directories are created before
+ * their content is copied.
+ * @param src_list is a pointer to the sorted source list
+ * @param dst_list is a pointer to the sorted destination list
+ * @param diff_list is a pointer to the list receiving the differences
+ * @param the_config is a pointer to the configuration
+ * @param cache is the checksum cache, NULL if disabled
+ * @param pool is the pool hashing the files, NULL to hash them in this thread
+ * @return the number of differences
+ */
+size_t make_differences_list(files_list_t *src_list, files_list_t *dst_list, files_list_t *diff_list, configuration_t *the_config, checksum_cache_t *cache, thread_pool_t *pool) {
+    if (!src_list || !dst_list || !diff_list || !the_config) {
+        return 0;
+    }
+
+    size_t start_of_src = get_root_length(the_config->source);
+    size_t start_of_dest = get_root_length(the_config->destination);
+    sort_files_list(src_list);
+    sort_files_list(dst_list);
+    hash_queue_t hash_queue;
+    hash_queue_init(&hash_queue, pool, the_config, cache);
+
+    size_t differences = 0;
+    files_list_entry_t *dst_cursor = dst_list->head;
+    for (files_list_entry_t *src_cursor = src_list->head; src_cursor != NULL; src_cursor = src_cursor->next) {
+        // Skip destination entries that don't exist in the source
+        int comparison = -1;
+        while (dst_cursor != NULL && (comparison = compare_entries(src_cursor, dst_cursor, start_of_src, start_of_dest)) > 0) {
+            dst_cursor = dst_cursor->next;
+        }
+
+        files_list_entry_t *same_path = comparison == 0 ? dst_cursor : NULL;
+        if (needs_hashing(src_cursor, same_path, the_config) && hash_queue_add(&hash_queue, src_cursor, same_path) == 0) {
+            if (hash_queue.count == HASH_QUEUE_SIZE) {
+                differences += hash_queue_flush(&hash_queue, diff_list, NULL);
+            }
+        } else if (entry_differs(src_cursor, same_path, the_config, cache)) {
+            apply_list_difference(src_cursor, diff_list, NULL, the_config);
+            ++differences;
+        }
+    }
+    differences += hash_queue_flush(&hash_queue, diff_list, NULL);
+    return differences;
+}
+
+/*!
+ * @brief make_differences_streamed compares two trees while they are walked and applies their differences
+ * It is make_differences_list on two entry streams (@see entry_stream_t): entries are compared as soon as
+ * both walkers went past them, and the differences go to the copy stage (or are copied) at once, so the
+ * first copies start while the trees are still being walked.
+ * @param src_stream is the stream of the source tree
+ * @param dst_stream is the stream of the destination tree
+ * @param diff_list is a pointer to the list receiving the differences
+ * @param the_config is a pointer to the configuration
+ * @param cache is the checksum cache, NULL if disabled
+ * @param pool is the pool hashing the files, NULL to hash them in this thread
+ * @return the number of differences
+ */
+size_t make_differences_streamed(entry_stream_t *src_stream, entry_stream_t *dst_stream, files_list_t *diff_list, configuration_t *the_config, checksum_cache_t *cache, thread_pool_t *pool) {
+    size_t start_of_src = get_root_length(the_config->source);
+    size_t start_of_dest = get_root_length(the_config->destination);
+    copy_stage_t *stage = the_config->copy_workers > 0 ? copy_stage_start(the_config) : NULL;
+    // The entries of the streams stay in their lists, so the queued pairs remain valid
+    hash_queue_t hash_queue;
+    hash_queue_init(&hash_queue, pool, the_config, cache);
+
+    size_t differences = 0;
+    files_list_entry_t *dst_cursor = entry_stream_next(dst_stream);
+    files_list_entry_t *src_cursor;
+    while ((src_cursor = entry_stream_next(src_stream)) != NULL) {
+        int comparison = -1;
+        while (dst_cursor != NULL && (comparison = compare_entries(src_cursor, dst_cursor, start_of_src, start_of_dest)) > 0) {
+            dst_cursor = entry_stream_next(dst_stream);
+        }
+
+        files_list_entry_t *same_path = comparison == 0 ? dst_cursor : NULL;
+        if (needs_hashing(src_cursor, same_path, the_config) && hash_queue_add(&hash_queue, src_cursor, same_path) == 0) {
+            if (hash_queue.count == HASH_QUEUE_SIZE) {
+                differences += hash_queue_flush(&hash_queue, diff_list, stage);
+            }
+        } else if (entry_differs(src_cursor, same_path, the_config, cache)) {
+            apply_list_difference(src_cursor, diff_list, stage, the_config);
+            ++differences;
+        }
+    }
+    // The destination walker must reach its end
+    while (dst_cursor != NULL) {
+        dst_cursor = entry_stream_next(dst_stream);
+    }
+    differences += hash_queue_flush(&hash_queue, diff_list, stage);
+
+    if (stage != NULL) {
+        copy_stage_finish(stage);
+    }
+    return differences;
+}
+
+/*!
+ * @brief make_differences_external compares two trees sorted on disk and applies their differences
+ * It is make_differences_list on the merged runs of two external sorters: only the current entry of each
+ * run is in memory. Differences are copied at once, or handed to the copy stage by batches whose copies
+ * are waited for before the next batch, so that they don't pile up in memory either. For the same reason,
+ * the pairs that need checksums are hashed at once: an entry doesn't outlive the next one of its run.
+ * @param src_sorter is the sorter of the source tree
+ * @param dst_sorter is the sorter of the destination tree
+ * @param the_config is a pointer to the configuration
+ * @param cache is the checksum cache, NULL if disabled
+ * @return the number of differences
+ */
+size_t make_differences_external(external_sorter_t *src_sorter, external_sorter_t *dst_sorter, configuration_t *the_config, checksum_cache_t *cache) {
+    size_t start_of_src = get_root_length(the_config->source);
+    size_t start_of_dest = get_root_length(the_config->destination);
+    copy_stage_t *stage = the_config->copy_workers > 0 ? copy_stage_start(the_config) : NULL;
+    files_list_t diff_batch; // Differences being copied by the stage
+    init_files_list(&diff_batch);
+
+    size_t differences = 0;
+    files_list_entry_t *dst_cursor = external_sorter_next(dst_sorter);
+    files_list_entry_t *src_cursor;
+    while ((src_cursor = external_sorter_next(src_sorter)) != NULL) {
+        int comparison = -1;
+        while (dst_cursor != NULL && (comparison = compare_entries(src_cursor, dst_cursor, start_of_src, start_of_dest)) > 0) {
+            dst_cursor = external_sorter_next(dst_sorter);
+        }
+
+        if (entry_differs(src_cursor, comparison == 0 ? dst_cursor : NULL, the_config, cache)) {
+            files_list_entry_t *difference = stage != NULL ? duplicate_file_entry(&diff_batch, src_cursor) : NULL;
+            if (difference != NULL) {
+                copy_stage_submit(stage, difference);
+            } else {
+                copy_entry_to_destination(src_cursor, the_config);
+            }
+            ++differences;
+            if (stage != NULL && diff_batch.arena.allocated >= the_config->max_memory / 8) {
+                copy_stage_finish(stage);
+                clear_files_list(&diff_batch);
+                stage = copy_stage_start(the_config);
+            }
+        }
+    }
+    if (stage != NULL) {
+        copy_stage_finish(stage);
+    }
+    clear_files_list(&diff_batch);
+    return differences;
+}
+
+// Comparison of two trees directory by directory (@see make_differences_tree)
+typedef struct {
+    dir_tree_t tree;
+    configuration_t *the_config;
+    checksum_cache_t *cache;
+    copy_stage_t *stage; // NULL to copy the differences in the comparing threads
+    size_t differences;
+    size_t subtrees_copied; // Directories missing from the destination, whose entries are all copied
+} tree_diff_t;
+
+// Task comparing a source directory with the same directory of the destination
+typedef struct {
+    tree_diff_t *diff;
+    dir_node_t *source;
+    dir_node_t *destination; // NULL when the directory is missing from the destination
+} tree_diff_task_t;
+
+/*!
+ * @brief apply_tree_difference copies an entry found by the comparison of the trees
+ * Directories are always created at once, before the children they hold are handed out.
+ * @param diff is the comparison
+ * @param entry is the source entry
+ */
+static void apply_tree_difference(tree_diff_t *diff, files_list_entry_t *entry) {
+    __atomic_fetch_add(&diff->differences, 1, __ATOMIC_RELAXED);
+    if (entry->entry_type == FICHIER && diff->stage != NULL) {
+        copy_stage_submit(diff->stage, entry);
+    } else {
+        copy_entry_to_destination(entry, diff->the_config);
+    }
+}
+
+static void diff_directory_task(void *parameters);
+
+/*!
+ * @brief submit_tree_diff compares a pair of directories in a task of its own
+ * @param diff is the comparison
+ * @param source is the source directory
+ * @param destination is the same directory in the destination, NULL to copy all the entries of the source directory
+ */
+static void submit_tree_diff(tree_diff_t *diff, dir_node_t *source, dir_node_t *destination) {
+    tree_diff_task_t *task = dir_tree_alloc(&diff->tree, sizeof(tree_diff_task_t));
+    if (task == NULL) {
+        fprintf(stderr, "Out of memory comparing %s\n", source->path);
+        return;
+    }
+    task->diff = diff;
+    task->source = source;
+    task->destination = destination;
+    dir_tree_submit(&diff->tree, diff_directory_task, task);
+}
+
+/*!
+ * @brief diff_directory_task compares a source directory with the same directory of the destination (pool task)
+ * Both directories are read, then their sorted children are merged by name. The subdirectories found in
+ * both are compared in tasks of their own; the entries of a subdirectory missing from the destination are
+ * all copied, one by one like the other differences, without reading nor comparing anything in the destination.
+ * @param parameters is a pointer to the tree_diff_task_t of the pair of directories
+ */
+static void diff_directory_task(void *parameters) {
+    tree_diff_task_t *task = parameters;
+    tree_diff_t *diff = task->diff;
+    dir_node_t *source = task->source;
+    dir_node_t *destination = task->destination;
+    stats_phase_t previous_phase = stats_enter(STATS_PHASE_DIFF);
+    dir_tree_read(&diff->tree, source);
+    if (destination != NULL) {
+        dir_tree_read(&diff->tree, destination);
+    }
+
+    size_t j = 0;
+    for (size_t i = 0; i < source->count; ++i) {
+        files_list_entry_t *child = source->children[i];
+        files_list_entry_t *same = NULL;
+        dir_node_t *same_subtree = NULL;
+        int comparison = -1;
+        while (destination != NULL && j < destination->count && (comparison = strcmp(child->name, destination->children[j]->name)) > 0) {
+            ++j;
+        }
+        if (destination != NULL && j < destination->count && comparison == 0) {
+            same = destination->children[j];
+            same_subtree = destination->subtrees[j];
+        }
+
+        if (same == NULL || entry_differs(child, same, diff->the_config, diff->cache)) {
+            apply_tree_difference(diff, child);
+        }
+        if (source->subtrees[i] != NULL) {
+            if (same_subtree == NULL && destination != NULL) {
+                __atomic_fetch_add(&diff->subtrees_copied, 1, __ATOMIC_RELAXED);
+            }
+            submit_tree_diff(diff, source->subtrees[i], same_subtree);
+        }
+    }
+    stats_leave(previous_phase);
+}
+
+/*!
+ * @brief make_differences_tree compares the trees directory by directory and applies their differences
+ * Each pair of directories is a task (@see diff_directory_task): a directory is compared as soon as it is
+ * read in both trees, only the names of its own children are compared, and the subtrees missing from the
+ * destination are copied without any comparison. With a pool, independent subtrees are compared at once,
+ * else the tasks run depth first in the calling thread.
+ * Differences go to the copy stage (or are copied) as soon as they are found.
+ * @param pool is the pool running the tasks, NULL to compare in the calling thread
+ * @param the_config is a pointer to the configuration
+ * @param cache is the checksum cache, NULL if disabled
+ * @return the number of differences
+ */
+size_t make_differences_tree(thread_pool_t *pool, configuration_t *the_config, checksum_cache_t *cache) {
+    tree_diff_t diff = {.the_config = the_config, .cache = cache};
+    if (dir_tree_init(&diff.tree, pool) == -1) {
+        return 0;
+    }
+    dir_node_t *source = dir_tree_root(&diff.tree, the_config->source);
+    dir_node_t *destination = dir_tree_root(&diff.tree, the_config->destination);
+    if (source != NULL && destination != NULL) {
+        diff.stage = the_config->copy_workers > 0 ? copy_stage_start(the_config) : NULL;
+        submit_tree_diff(&diff, source, destination);
+        dir_tree_wait(&diff.tree);
+        if (diff.stage != NULL) {
+            copy_stage_finish(diff.stage);
+        }
+    }
+    if (the_config->verbose) {
+        printf("Tree comparison: %zu directories missing from the destination, copied without comparison\n", diff.subtrees_copied);
+    }
+    dir_tree_release(&diff.tree);
+    return diff.differences;
+}
+
+/*!
+ * @brief set_copy_error records why the copy of an entry failed, with the current errno
+ * @param error is the error to fill, NULL to ignore the error
+ * @param operation is the operation that failed
+ * @param path is the path of the file
+ * @return -1, to be returned by the caller
+ */
+static int set_copy_error(copy_error_t *error, const char *operation, char *path) {
+    if (error != NULL) {
+        error->operation = operation;
+        error->error_number = errno;
+        strncpy(error->path, path, sizeof(error->path) - 1);
+        error->path[sizeof(error->path) - 1] = '\0';
+    }
+    return -1;
+}
+
+/*!
+ * @brief apply_entry_attributes gives the mode and mtime of a source file to its copy
+ * @param source_entry is a pointer to the source entry
+ * @param destination_file is the open destination file
+ * @param dest_entry_path is the path of the destination, for the errors
+ * @param error receives the error
+ * @return 0 in case of success, -1 else
+ */
+static int apply_entry_attributes(files_list_entry_t *source_entry, int destination_file, char *dest_entry_path, copy_error_t *error) {
+    // The mode given to open only applies to new files, and is masked by the umask
+    if (fchmod(destination_file, source_entry->mode & 07777) == -1) {
+        return set_copy_error(error, "changing the mode of", dest_entry_path);
+    }
+    struct timespec new_time[2] = {{0, UTIME_NOW}, source_entry->mtime};
+    if (futimens(destination_file, new_time) != 0) {
+        return set_copy_error(error, "changing the mtime of", dest_entry_path);
+    }
+    return 0;
+}
+
+/*!
+ * @brief copy_file_entry copies the content, mode and mtime of a source file to the destination
+ * @param source_entry is a pointer to the source entry
+ * @param source_entry_path is the path of the source file
+ * @param dest_entry_path is the path of the destination file
+ * @param the_config is a pointer to the configuration
+ * @param error receives the reason of a failure
+ * @param bytes_copied receives the bytes written to the destination
+ * @param syscalls is increased by the system calls made
+ * @return 0 in case of success, -1 else
+ */
+static int copy_file_entry(files_list_entry_t *source_entry, char *source_entry_path, char *dest_entry_path, configuration_t *the_config,
+                           copy_error_t *error, uint64_t *bytes_copied, uint64_t *syscalls) {
     // open the source file for reading
-    int source_file = open(source_entry->path_and_name, O_RDONLY);
+    ++*syscalls;
+    int source_file = open(source_entry_path, O_RDONLY);
     if (source_file == -1) {
-        fprintf(stderr, "Error opening source file");
-        return;
+        return set_copy_error(error, "opening source file", source_entry_path);
+    }
+
+    int destination_file = -1;
+    if (the_config->delta_threshold > 0 && source_entry->size >= the_config->delta_threshold) {
+        delta_report_t delta;
+        destination_file = delta_transfer(source_file, source_entry->size, dest_entry_path, &delta);
+        *syscalls += delta.syscalls;
+        if (destination_file != -1) {
+            *bytes_copied = delta.bytes_written;
+        }
+        if (destination_file != -1 && the_config->verbose == true) {
+            printf("%s copied to %s by delta %s (%lu bytes written, %lu bytes kept, blocks of %lu bytes).\n", source_entry_path,
+                   dest_entry_path, delta.in_place ? "in place" : "in a new file", (unsigned long) delta.bytes_written,
+                   (unsigned long) delta.bytes_matched, (unsigned long) delta.block_size);
+        } else if (destination_file == -1 && errno != 0 && errno != ENOENT && the_config->verbose == true) {
+            printf("Delta transfer of %s failed (%s), it is copied.\n", source_entry_path, strerror(errno));
+        }
     }
 
-    // open the destination file
-    int destination_file = open(dest_entry_path, O_WRONLY | O_CREAT | O_TRUNC, source_entry->mode);
-    // O_WRONLY: fichier doit être ouvert en mode écriture seulement
-    // O_CREAT: crée le fichier s'il n'existe pas
-    // O_TRUNC: tronque le fichier à zéro s'il existe
+    int result = 0;
     if (destination_file == -1) {
-        fprintf(stderr, "Error opening destination file");
-        close(source_file);
-        return;
+        // open the destination file
+        ++*syscalls;
+        destination_file = open(dest_entry_path, O_WRONLY | O_CREAT | O_TRUNC, source_entry->mode & 07777);
+        // O_WRONLY: fichier doit être ouvert en mode écriture seulement
+        // O_CREAT: crée le fichier s'il n'existe pas
+        // O_TRUNC: tronque le fichier à zéro s'il existe
+        if (destination_file == -1) {
+            set_copy_error(error, "opening destination file", dest_entry_path);
+            close(source_file);
+            ++*syscalls;
+            return -1;
+        }
+
+        copy_report_t report;
+        result = copy_file_contents(source_file, destination_file, source_entry->size, &report);
+        *syscalls += report.syscalls;
+        *bytes_copied = report.bytes_copied;
+        if (result == -1) {
+            set_copy_error(error, "copying", source_entry_path);
+        } else if (the_config->verbose == true) {
+            printf("%s copied to %s (%s%s).\n", source_entry_path, dest_entry_path,
+                   copy_strategy_name(report.strategy), report.has_holes ? ", sparse" : "");
+        }
+    }
+    if (result == 0) {
+        *syscalls += 2; // fchmod and futimens
+        result = apply_entry_attributes(source_entry, destination_file, dest_entry_path, error);
     }
 
-    // copie des infos du fichier
-    off_t offset = 0;
-    ssize_t bytes_copied = sendfile(destination_file, source_file, &offset, source_entry->size);
+    close(source_file);
+    close(destination_file);
+    *syscalls += 2;
+    return result;
+}
 
-    if (bytes_copied == -1) {
-        fprintf(stderr, "Error copying file");
-    } else {
+/*!
+ * @brief link_file_entry makes a destination file a hard link to the copy of another link of its source inode
+ * An existing destination file is replaced.
+ * @param target is the destination of the other link
+ * @param dest_entry_path is the path of the destination file
+ * @param syscalls is increased by the system calls made
+ * @return 0 in case of success, -1 else
+ */
+static int link_file_entry(char *target, char *dest_entry_path, uint64_t *syscalls) {
+    ++*syscalls;
+    if (linkat(AT_FDCWD, target, AT_FDCWD, dest_entry_path, 0) == 0) {
+        return 0;
+    }
+    if (errno != EEXIST) {
+        return -1;
+    }
+    *syscalls += 2;
+    if (unlink(dest_entry_path) == -1 || linkat(AT_FDCWD, target, AT_FDCWD, dest_entry_path, 0) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief detach_destination removes a destination file whose inode is shared with files that are not links
+ * of its source (e.g. through a deduplication by hard link), so that writing it doesn't change them
+ * @param source_entry is a pointer to the source entry
+ * @param dest_entry_path is the path of the destination file
+ * @param syscalls is increased by the system calls made
+ */
+static void detach_destination(files_list_entry_t *source_entry, char *dest_entry_path, uint64_t *syscalls) {
+    struct stat sb;
+    ++*syscalls;
+    if (lstat(dest_entry_path, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_nlink > (source_entry->nlink > 1 ? source_entry->nlink : 1)) {
+        ++*syscalls;
+        unlink(dest_entry_path);
+    }
+}
+
+/*!
+ * @brief clone_file_entry makes a destination file share the blocks of another destination file with the same
+ * content (@see clone_file_contents), with the mode and mtime of its source
+ * @param source_entry is a pointer to the source entry
+ * @param target is the destination file with the same content
+ * @param dest_entry_path is the path of the destination file
+ * @param syscalls is increased by the system calls made
+ * @return 0 in case of success, -1 else (the filesystem may not support clones)
+ */
+static int clone_file_entry(files_list_entry_t *source_entry, char *target, char *dest_entry_path, uint64_t *syscalls) {
+    ++*syscalls;
+    int target_file = open(target, O_RDONLY);
+    if (target_file == -1) {
+        return -1;
+    }
+    ++*syscalls;
+    int destination_file = open(dest_entry_path, O_WRONLY | O_CREAT | O_TRUNC, source_entry->mode & 07777);
+    int result = -1;
+    if (destination_file != -1) {
+        *syscalls += 4; // FICLONE, fchmod, futimens and close
+        result = clone_file_contents(target_file, destination_file);
+        if (result == 0) {
+            result = apply_entry_attributes(source_entry, destination_file, dest_entry_path, NULL);
+        }
+        close(destination_file);
+    }
+    close(target_file);
+    ++*syscalls;
+    return result;
+}
+
+/*!
+ * @brief dedup_file_entry makes a destination file from another one with the same content, when there is one
+ * Hard links (--dedup=link) are only made between files with the same mode and mtime, that they share: they
+ * are cloned when the link fails.
+ * @param source_entry is a pointer to the source entry, its checksum is computed if needed
+ * @param dest_entry_path is the path of the destination file
+ * @param the_config is a pointer to the configuration
+ * @param first_content is set to true when the file must be copied as the first one with its content, dedup_copied
+ * must then be called after the copy
+ * @param syscalls is increased by the system calls made
+ * @return 0 if the file was made, -1 if it must be copied
+ */
+static int dedup_file_entry(files_list_entry_t *source_entry, char *dest_entry_path, configuration_t *the_config, bool *first_content,
+                            uint64_t *syscalls) {
+    dedup_match_t match;
+    if (source_entry->size == 0 || get_file_checksum(source_entry, dedup_checksum_type(), NULL) == -1) {
+        return -1;
+    }
+    if (!dedup_claim(source_entry, dest_entry_path, &match)) {
+        *first_content = true;
+        return -1;
+    }
+
+    if (the_config->dedup == DEDUP_LINK && link_file_entry(match.path, dest_entry_path, syscalls) == 0) {
         if (the_config->verbose == true) {
-            printf("%s copied to %s.\n", source_entry->path_and_name, dest_entry_path);
+            printf("%s linked to %s (same content).\n", dest_entry_path, match.path);
+        }
+    } else if (clone_file_entry(source_entry, match.path, dest_entry_path, syscalls) == 0) {
+        if (the_config->verbose == true) {
+            printf("%s cloned from %s (same content).\n", dest_entry_path, match.path);
+        }
+    } else {
+        return -1;
+    }
+    dedup_saved(source_entry->size);
+    stats_add(STATS_FILES_DEDUPLICATED, 1);
+    stats_add(STATS_BYTES_DEDUPLICATED, source_entry->size);
+    return 0;
+}
+
+/*!
+ * @brief copy_entry copies a file from the source to the destination
+ * It keeps access modes and mtime, applied through the destination descriptor (@see fchmod, futimens)
+ * Pay attention to the path so that the prefixes are not repeated from the source to the destination
+ * The content is copied by the copy engine (clone, copy_file_range or sendfile, keeping the holes, @see
+ * copy-engine.h), mkdir creates the directories
+ * Existing files above the delta threshold only get their changed blocks written (@see delta_transfer)
+ * A file with several links is only copied once: its other links are linked to the copy, keeping the link
+ * structure of the source (@see hard_links_claim)
+ * With deduplication, a file whose content was already written is cloned or linked instead (@see dedup.h)
+ * It may run in several threads at once (@see copy_stage_run).
+ * @param source_entry is a pointer to the source entry
+ * @param the_config is a pointer to the configuration
+ * @param error receives the reason of a failure, nothing is printed on errors
+ * @return 0 in case of success, -1 else
+ */
+int copy_entry(files_list_entry_t *source_entry, configuration_t *the_config, copy_error_t *error) {
+    char source_entry_path[PATH_SIZE];
+    char dest_entry_path[PATH_SIZE]  = "";
+    get_entry_path(source_entry, source_entry_path);
+    concat_path(dest_entry_path, the_config->destination, source_entry_path + get_root_length(the_config->source));
+
+    if (the_config->dry_run == true) {
+        printf("%s copied to %s.\n", source_entry_path, dest_entry_path);
+        return 0;
+    }
+
+    if (source_entry->entry_type == DOSSIER) {
+        stats_syscalls(STATS_PHASE_COPY, 1);
+        if (mkdir(dest_entry_path, source_entry->mode & 07777) == -1 && errno != EEXIST) {
+            return set_copy_error(error, "creating directory", dest_entry_path);
         }
-        struct timespec new_time[2];
-        new_time[0].tv_nsec = UTIME_NOW;
-        new_time[0].tv_sec = UTIME_NOW;
-        new_time[1].tv_nsec = source_entry->mtime.tv_nsec;
-        new_time[1].tv_sec = source_entry->mtime.tv_sec;
-        if (utimensat(AT_FDCWD, dest_entry_path, new_time, 0) != 0) {
-            fprintf(stderr, "Erreur lors de la modification de l'heure de modification");
+        if (the_config->verbose == true) {
+            printf("%s created.\n", dest_entry_path);
         }
+        return 0;
+    }
 
-        chmod(dest_entry_path, source_entry->mode);
+    stats_phase_t previous_phase = stats_enter(STATS_PHASE_COPY);
+    uint64_t syscalls = 0;
+    char target[PATH_SIZE];
+    bool first_link = false, first_content = false;
+    int result = -1;
+    if (source_entry->nlink > 1) {
+        if (!hard_links_claim(source_entry, dest_entry_path, target)) {
+            first_link = true;
+        } else if ((result = link_file_entry(target, dest_entry_path, &syscalls)) == 0) {
+            stats_add(STATS_FILES_LINKED, 1);
+            if (the_config->verbose == true) {
+                printf("%s linked to %s.\n", dest_entry_path, target);
+            }
+        } else if (the_config->verbose == true) {
+            printf("Unable to link %s to %s (%s), it is copied.\n", dest_entry_path, target, strerror(errno));
+        }
+    }
+    if (result == -1) {
+        detach_destination(source_entry, dest_entry_path, &syscalls);
+        if (the_config->dedup != DEDUP_NONE) {
+            result = dedup_file_entry(source_entry, dest_entry_path, the_config, &first_content, &syscalls);
+        }
     }
 
-    close(source_file);
-    close(destination_file);
+    if (result == -1) {
+        uint64_t span = trace_begin();
+        uint64_t bytes_copied = 0;
+        result = copy_file_entry(source_entry, source_entry_path, dest_entry_path, the_config, error, &bytes_copied, &syscalls);
+        trace_end(TRACE_COPY, span, bytes_copied, source_entry_path);
+        if (result == 0) {
+            stats_add(STATS_FILES_COPIED, 1);
+            stats_add(STATS_BYTES_COPIED, bytes_copied);
+        }
+    }
+    if (first_content) {
+        dedup_copied(source_entry, result == 0);
+    }
+    if (first_link) {
+        hard_links_copied(source_entry, result == 0);
+    }
+    stats_syscalls(STATS_PHASE_COPY, syscalls);
+    stats_leave(previous_phase);
+    return result;
+}
 
+/*!
+ * @brief copy_entry_to_destination copies a file or creates a directory in the destination, printing the
+ * errors (@see copy_entry)
+ * @param source_entry is a pointer to the source entry
+ * @param the_config is a pointer to the configuration
+ */
+void copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t *the_config) {
+    copy_error_t error;
+    if (copy_entry(source_entry, the_config, &error) == -1) {
+        print_copy_error(&error);
+    }
 }
 
 /*!
  * @brief make_files_lists_parallel makes both (src and dest) files list with parallel processing
+ * Each lister gets its directory to list, has its entries analyzed by its analyzers, then sends them by
+ * batches, in order, followed by a list end.
  * @param src_list is a pointer to the source list to build
  * @param dst_list is a pointer to the destination list to build
  * @param the_config is a pointer to the program configuration
  * @param msg_queue is the id of the MQ used for communication
  */
 void make_files_lists_parallel(files_list_t *src_list, files_list_t *dst_list, configuration_t *the_config, int msg_queue) {
-    // Implement parallel file list creation if needed
+    if (send_analyze_dir_command(msg_queue, MSG_TYPE_TO_SOURCE_LISTER, the_config->source) == -1
+        || send_analyze_dir_command(msg_queue, MSG_TYPE_TO_DESTINATION_LISTER, the_config->destination) == -1) {
+        perror("Error sending the directories to list");
+        return;
+    }
+
+    static any_message_t message;
+    int completed_lists = 0;
+    while (completed_lists < 2) {
+        ssize_t size = transport_receive(msg_queue, &message, sizeof(message) - sizeof(long), MSG_TYPE_TO_MAIN, 0);
+        if (size == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error receiving the files lists");
+            return;
+        }
+
+        if (message.simple_command.message == COMMAND_CODE_LIST_COMPLETE) {
+            ++completed_lists;
+        } else if (message.entries_batch.op_code == COMMAND_CODE_FILE_ENTRY) {
+            files_list_t *list = (message.entries_batch.reply_to == MSG_TYPE_TO_SOURCE_LISTER) ? src_list : dst_list;
+            entries_batch_reader_t reader;
+            batch_record_t record;
+            init_batch_reader(&reader, &message.entries_batch, size);
+            while (read_batch_record(&reader, &record)) {
+                add_entry_to_tail(list, batch_record_to_entry(list, &record));
+            }
+        }
+    }
 }
 
 /*!
- * @brief make_list lists files in a location (it recurses in directories)
- * It doesn't get files properties, only a list of paths
- * This function is used by make_files_list and make_files_list_parallel
+ * @brief make_list lists files in a location (it recurses in directories) and gets their stats
+ * Entries are appended unordered, call sort_files_list on the list once it is complete.
+ * This function is used by make_files_list and make_files_lists_threaded (@see walk_tree)
  * @param list is a pointer to the list that will be built
  * @param target is the target dir whose content must be listed
  */
 void make_list(files_list_t *list, char *target) {
-    DIR *dir;
-    struct dirent *entry;
-
-    if ((dir = opendir(target)) == NULL) {
-        perror("Error opening directory");
+    if (walk_tree(list, target, true) == -1) {
         exit(EXIT_FAILURE);
     }
-
-    while ((entry = readdir(dir)) != NULL) {
-        // Ignore current and parent directory entries
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
-        }
-
-        // Build the full path of the file or directory
-        char full_path[PATH_MAX];
-        concat_path(full_path, target, entry->d_name);
-
-        // Check if the entry is a directory
-        if (directory_exists(full_path)) {
-            // Recursively list files in the directory
-            make_list(list, full_path);
-        } else {
-            // Add the file path to the list
-            add_file_entry(list, entry->d_name);
-        }
-    }
-
-    closedir(dir);
 }
 
 /*!
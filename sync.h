@@ -4,11 +4,22 @@
 #include "files-list.h"
 #include "configuration.h"
 #include "processes.h"
+#include "checksum-cache.h"
+#include "copy-stage.h"
+#include "entry-stream.h"
+#include "external-sort.h"
 #include <dirent.h>
 
 void synchronize(configuration_t *the_config, process_context_t *p_context);
+bool mismatch(files_list_entry_t *lhd, files_list_entry_t *rhd, bool has_md5);
+size_t make_differences_list(files_list_t *src_list, files_list_t *dst_list, files_list_t *diff_list, configuration_t *the_config, checksum_cache_t *cache, thread_pool_t *pool);
+size_t make_differences_streamed(entry_stream_t *src_stream, entry_stream_t *dst_stream, files_list_t *diff_list, configuration_t *the_config, checksum_cache_t *cache, thread_pool_t *pool);
+size_t make_differences_tree(thread_pool_t *pool, configuration_t *the_config, checksum_cache_t *cache);
+size_t make_differences_external(external_sorter_t *src_sorter, external_sorter_t *dst_sorter, configuration_t *the_config, checksum_cache_t *cache);
 void make_files_list(files_list_t *list, char *target_path);
+void make_files_lists_threaded(files_list_t *src_list, files_list_t *dst_list, configuration_t *the_config, thread_pool_t *pool);
 void make_files_lists_parallel(files_list_t *src_list, files_list_t *dst_list, configuration_t *the_config, int msg_queue);
+int copy_entry(files_list_entry_t *source_entry, configuration_t *the_config, copy_error_t *error);
 void copy_entry_to_destination(files_list_entry_t *source_entry, configuration_t *the_config);
 void make_list(files_list_t *list, char *target);
 DIR *open_dir(char *path);
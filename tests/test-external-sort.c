@@ -0,0 +1,194 @@
+#include "../bench/tree-generator.h"
+#include "external-sort.h"
+#include "file-properties.h"
+#include "files-list.h"
+#include "walker.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Test of the external sort (--max-memory): on a small synthetic tree (@see tree-generator.h), a limit of a
+ * few hundred bytes must spill the entries to run files, and the synchronization must find and apply the same
+ * differences as with the lists in memory: same dry-run output, same destination trees.
+ * Usage: test_external_sort <program> [work directory]
+ */
+
+// Memory limit of the runs, a few entries per run (each tree gets half of it, @see synchronize_external)
+#define TEST_MAX_MEMORY "1K"
+#define TEST_MAX_MEMORY_BYTES 1024
+
+/*!
+ * @brief sort_visitor gives the entries of the walk to the sorter (@see walk_visitor_t)
+ * @param entry is the entry
+ * @param data is the external_sorter_t
+ * @return 0 in case of success, -1 to stop the walk
+ */
+static int sort_visitor(files_list_entry_t *entry, void *data) {
+    return external_sorter_add((external_sorter_t *) data, entry);
+}
+
+/*!
+ * @brief age_tree gives an old mtime to the files of a tree, so that they can't have the mtime of the files of
+ * a tree generated just after (timestamps are coarse): the comparison must then look at the contents
+ * @param root is the tree
+ * @return 0 in case of success, -1 else
+ */
+static int age_tree(const char *root) {
+    files_list_t list;
+    init_files_list(&list);
+    int result = walk_tree(&list, root, false);
+    struct timespec times[2] = {{0, UTIME_OMIT}, {978307200, 0}}; // 2001-01-01
+    char path[PATH_SIZE];
+    for (files_list_entry_t *cursor = list.head; cursor != NULL && result == 0; cursor = cursor->next) {
+        if (cursor->entry_type == FICHIER) {
+            result = utimensat(AT_FDCWD, get_entry_path(cursor, path), times, AT_SYMLINK_NOFOLLOW);
+        }
+    }
+    clear_files_list(&list);
+    return result;
+}
+
+/*!
+ * @brief run_program runs the program and keeps its standard output
+ * @param command is the command line
+ * @param output receives the output, to be freed
+ * @return 0 if the program succeeded, -1 else
+ */
+static int run_program(const char *command, char **output) {
+    FILE *pipe = popen(command, "r");
+    if (pipe == NULL) {
+        return -1;
+    }
+    size_t length = 0, capacity = 4096;
+    *output = malloc(capacity);
+    size_t read_bytes;
+    while (*output != NULL && (read_bytes = fread(*output + length, 1, capacity - length - 1, pipe)) > 0) {
+        length += read_bytes;
+        if (length + 1 == capacity) {
+            char *larger = realloc(*output, capacity *= 2);
+            if (larger == NULL) {
+                free(*output);
+            }
+            *output = larger;
+        }
+    }
+    int status = pclose(pipe);
+    if (*output == NULL) {
+        return -1;
+    }
+    (*output)[length] = '\0';
+    return status == 0 ? 0 : -1;
+}
+
+/*!
+ * @brief same_trees compares two destination trees: paths, types, sizes, modes and contents
+ * @param left is the first tree
+ * @param right is the second tree, its path must have the length of left
+ * @return true if the trees are the same
+ */
+static bool same_trees(const char *left, const char *right) {
+    files_list_t lists[2];
+    init_files_list(&lists[0]);
+    init_files_list(&lists[1]);
+    walk_tree(&lists[0], left, true);
+    walk_tree(&lists[1], right, true);
+    sort_files_list(&lists[0]);
+    sort_files_list(&lists[1]);
+    bool same = lists[0].count == lists[1].count && lists[0].count > 0;
+    size_t root_length = strlen(left);
+    char left_path[PATH_SIZE], right_path[PATH_SIZE];
+    for (files_list_entry_t *l = lists[0].head, *r = lists[1].head; same && l != NULL && r != NULL; l = l->next, r = r->next) {
+        get_entry_path(l, left_path);
+        get_entry_path(r, right_path);
+        same = strcmp(left_path + root_length, right_path + root_length) == 0 && l->entry_type == r->entry_type
+               && l->size == r->size && l->mode == r->mode;
+        if (same && l->entry_type == FICHIER) {
+            same = get_file_checksum(l, CHECKSUM_MD5, NULL) == 0 && get_file_checksum(r, CHECKSUM_MD5, NULL) == 0
+                   && memcmp(l->checksum, r->checksum, checksum_size(CHECKSUM_MD5)) == 0;
+        }
+        if (!same) {
+            fprintf(stderr, "%s and %s differ\n", left_path, right_path);
+        }
+    }
+    clear_files_list(&lists[0]);
+    clear_files_list(&lists[1]);
+    return same;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <program> [work directory]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    char work[512];
+    snprintf(work, sizeof(work), "%s/external-sort-XXXXXX", argc > 2 ? argv[2] : "/tmp");
+    if (mkdtemp(work) == NULL) {
+        perror(work);
+        return EXIT_FAILURE;
+    }
+    // Paths of the same length, compared by same_trees
+    char source[600], memory[600], external[600];
+    snprintf(source, sizeof(source), "%s/source", work);
+    snprintf(memory, sizeof(memory), "%s/dest-m", work);
+    snprintf(external, sizeof(external), "%s/dest-e", work);
+
+    // Destinations hold an older copy of the source: the differences are both new and changed files
+    tree_spec_t spec = {.depth = 2, .fanout = 3, .files_per_dir = 8, .min_file_size = 0, .max_file_size = 8192,
+                        .modified_percent = 20, .seed = 17};
+    tree_stats_t stats;
+    uint64_t modified;
+    int failures = 0;
+    if (generate_tree(memory, &spec, &stats) == -1 || generate_tree(external, &spec, &stats) == -1
+        || age_tree(memory) == -1 || age_tree(external) == -1) {
+        fprintf(stderr, "Unable to generate the destinations\n");
+        remove_tree(work);
+        return EXIT_FAILURE;
+    }
+    spec.files_per_dir = 10;
+    if (generate_tree(source, &spec, &stats) == -1 || modify_tree(source, &spec, &modified) == -1) {
+        fprintf(stderr, "Unable to generate the source\n");
+        remove_tree(work);
+        return EXIT_FAILURE;
+    }
+
+    // The limit must really spill the entries to runs
+    external_sorter_t sorter;
+    external_sorter_init(&sorter, TEST_MAX_MEMORY_BYTES / 2);
+    if (walk_tree_visit(source, true, sort_visitor, &sorter) == -1 || sorter.runs_count == 0) {
+        fprintf(stderr, "FAIL: %lu entries of %s gave no run\n", (unsigned long) sorter.entries_count, source);
+        ++failures;
+    }
+    external_sorter_release(&sorter);
+
+    char command[2048];
+    char *outputs[2] = {NULL, NULL};
+    snprintf(command, sizeof(command), "%s --no-parallel --dry-run %s %s", argv[1], source, memory);
+    int memory_result = run_program(command, &outputs[0]);
+    snprintf(command, sizeof(command), "%s --no-parallel --dry-run --max-memory " TEST_MAX_MEMORY " %s %s", argv[1], source, memory);
+    int external_result = run_program(command, &outputs[1]);
+    if (memory_result == -1 || external_result == -1 || strcmp(outputs[0], outputs[1]) != 0 || outputs[0][0] == '\0') {
+        fprintf(stderr, "FAIL: dry runs differ\n--- in memory\n%s--- external\n%s", outputs[0] ? outputs[0] : "",
+                outputs[1] ? outputs[1] : "");
+        ++failures;
+    }
+    free(outputs[0]);
+    free(outputs[1]);
+
+    snprintf(command, sizeof(command), "%s --no-parallel %s %s > /dev/null", argv[1], source, memory);
+    memory_result = system(command);
+    snprintf(command, sizeof(command), "%s --no-parallel --max-memory " TEST_MAX_MEMORY " %s %s > /dev/null", argv[1], source, external);
+    external_result = system(command);
+    if (memory_result != 0 || external_result != 0 || !same_trees(memory, external) || !same_trees(source, external)) {
+        fprintf(stderr, "FAIL: destinations differ\n");
+        ++failures;
+    }
+
+    remove_tree(work);
+    if (failures == 0) {
+        printf("External sort: spilled, same differences and destinations as in memory\n");
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
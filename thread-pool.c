@@ -0,0 +1,276 @@
+#include "thread-pool.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define DEQUE_INITIAL_CAPACITY 64
+
+typedef struct {
+    thread_pool_t *pool;
+    int index;
+} worker_parameters_t;
+
+// Index of the worker running the current thread, -1 outside of the pools
+static __thread int current_worker_index = -1;
+// Pool of the worker running the current thread
+static __thread thread_pool_t *current_pool = NULL;
+
+/*!
+ * @brief deque_push adds a task at the bottom of a deque
+ * @param deque the deque
+ * @param task the task to add
+ * @return 0 in case of success, -1 else (out of memory)
+ */
+static int deque_push(task_deque_t *deque, task_t task) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom - deque->top == deque->capacity) {
+        size_t new_capacity = deque->capacity ? deque->capacity * 2 : DEQUE_INITIAL_CAPACITY;
+        task_t *new_tasks = malloc(new_capacity * sizeof(task_t));
+        if (!new_tasks) {
+            pthread_mutex_unlock(&deque->lock);
+            return -1;
+        }
+        for (size_t i = deque->top; i != deque->bottom; ++i) {
+            new_tasks[i & (new_capacity - 1)] = deque->tasks[i & (deque->capacity - 1)];
+        }
+        free(deque->tasks);
+        deque->tasks = new_tasks;
+        deque->capacity = new_capacity;
+    }
+    deque->tasks[deque->bottom & (deque->capacity - 1)] = task;
+    ++deque->bottom;
+    pthread_mutex_unlock(&deque->lock);
+    return 0;
+}
+
+/*!
+ * @brief deque_take removes a task from a deque
+ * @param deque the deque
+ * @param task receives the removed task
+ * @param steal true to take the oldest task (top), as a thief does, false to take the newest one (bottom)
+ * @return true if a task was removed, false if the deque was empty
+ */
+static bool deque_take(task_deque_t *deque, task_t *task, bool steal) {
+    pthread_mutex_lock(&deque->lock);
+    bool found = deque->bottom != deque->top;
+    if (found && steal) {
+        *task = deque->tasks[deque->top & (deque->capacity - 1)];
+        ++deque->top;
+    } else if (found) {
+        --deque->bottom;
+        *task = deque->tasks[deque->bottom & (deque->capacity - 1)];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+/*!
+ * @brief find_task gets the next task of a worker: from its own deque first, else stolen from the others
+ * @param pool the pool
+ * @param index the index of the worker
+ * @param task receives the task
+ * @return true if a task was found
+ */
+static bool find_task(thread_pool_t *pool, int index, task_t *task) {
+    if (deque_take(&pool->deques[index], task, false)) {
+        return true;
+    }
+    for (int i = 1; i < pool->workers_count; ++i) {
+        if (deque_take(&pool->deques[(index + i) % pool->workers_count], task, true)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * @brief worker_loop is the function of the pool threads
+ * Workers run their own tasks in LIFO order (the most recently spawned ones are hot in cache) and steal the
+ * oldest tasks of the other workers (usually the biggest ones, e.g. whole directories) when they run out.
+ * @param parameters is a pointer to the worker_parameters_t of the worker
+ * @return NULL
+ */
+static void *worker_loop(void *parameters) {
+    worker_parameters_t *worker = parameters;
+    thread_pool_t *pool = worker->pool;
+    current_worker_index = worker->index;
+    current_pool = pool;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->queued_count == 0 && !pool->stopping) {
+            pthread_cond_wait(&pool->work_available, &pool->lock);
+        }
+        if (pool->queued_count == 0 && pool->stopping) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        task_t task;
+        if (!find_task(pool, worker->index, &task)) {
+            continue; // Another worker took it first
+        }
+        pthread_mutex_lock(&pool->lock);
+        --pool->queued_count;
+        pthread_mutex_unlock(&pool->lock);
+
+        task.function(task.argument);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending_count == 0) {
+            pthread_cond_broadcast(&pool->all_done);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    free(worker);
+    return NULL;
+}
+
+/*!
+ * @brief thread_pool_init starts a pool of worker threads
+ * @param pool is a pointer to the pool to initialize
+ * @param workers_count is the number of threads
+ * @return 0 in case of success, -1 else
+ */
+int thread_pool_init(thread_pool_t *pool, int workers_count) {
+    if (!pool || workers_count <= 0) {
+        return -1;
+    }
+    memset(pool, 0, sizeof(thread_pool_t));
+    pool->threads = calloc(workers_count, sizeof(pthread_t));
+    pool->deques = calloc(workers_count, sizeof(task_deque_t));
+    if (!pool->threads || !pool->deques) {
+        free(pool->threads);
+        free(pool->deques);
+        return -1;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_available, NULL);
+    pthread_cond_init(&pool->all_done, NULL);
+    for (int i = 0; i < workers_count; ++i) {
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+    }
+
+    for (int i = 0; i < workers_count; ++i) {
+        worker_parameters_t *worker = malloc(sizeof(worker_parameters_t));
+        if (worker != NULL) {
+            worker->pool = pool;
+            worker->index = i;
+        }
+        if (!worker || pthread_create(&pool->threads[i], NULL, worker_loop, worker) != 0) {
+            perror("Erreur lors de la création des threads");
+            free(worker);
+            break;
+        }
+        ++pool->workers_count;
+    }
+    if (pool->workers_count == 0) {
+        thread_pool_destroy(pool);
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief thread_pool_submit adds a task to the pool
+ * From a worker, the task goes to its own deque (other workers will steal it if they are idle), else the
+ * tasks are spread over all the deques.
+ * When the task can't be queued, it is run at once in the calling thread and the submission succeeds.
+ * @param pool is a pointer to the pool
+ * @param function is the function to run
+ * @param argument is the argument of function
+ * @return 0 once the task is queued or run, -1 if the pool or the function is invalid (nothing ran: only then
+ * may the caller run the task itself)
+ */
+int thread_pool_submit(thread_pool_t *pool, task_function_t function, void *argument) {
+    if (!pool || !function) {
+        return -1;
+    }
+
+    task_t task = {function, argument};
+    int index;
+    pthread_mutex_lock(&pool->lock);
+    if (current_pool == pool) {
+        index = current_worker_index;
+    } else {
+        index = pool->next_deque++ % pool->workers_count;
+    }
+    // Counted before the push: a worker may take the task as soon as it is in the deque
+    ++pool->pending_count;
+    ++pool->queued_count;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (deque_push(&pool->deques[index], task) == -1) {
+        pthread_mutex_lock(&pool->lock);
+        --pool->queued_count;
+        pthread_mutex_unlock(&pool->lock);
+        function(argument);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending_count == 0) {
+            pthread_cond_broadcast(&pool->all_done);
+        }
+        pthread_mutex_unlock(&pool->lock);
+        return 0;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    stats_queue_depth(STATS_QUEUE_THREAD_POOL, pool->queued_count);
+    pthread_cond_signal(&pool->work_available);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+/*!
+ * @brief thread_pool_wait waits until all the submitted tasks, and the tasks they submitted, are finished
+ * It must not be called from a worker.
+ * @param pool is a pointer to the pool
+ */
+void thread_pool_wait(thread_pool_t *pool) {
+    if (!pool) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending_count > 0) {
+        pthread_cond_wait(&pool->all_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*!
+ * @brief thread_pool_destroy finishes the queued tasks, stops the threads and frees the pool
+ * @param pool is a pointer to the pool
+ */
+void thread_pool_destroy(thread_pool_t *pool) {
+    if (!pool || !pool->threads) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->workers_count; ++i) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    for (int i = 0; i < pool->workers_count; ++i) {
+        free(pool->deques[i].tasks);
+        pthread_mutex_destroy(&pool->deques[i].lock);
+    }
+    free(pool->deques);
+    free(pool->threads);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_available);
+    pthread_cond_destroy(&pool->all_done);
+    memset(pool, 0, sizeof(thread_pool_t));
+}
+
+/*!
+ * @brief thread_pool_worker_index gives the index of the worker running the calling thread
+ * @return the index of the worker in its pool, -1 if the thread is not a worker
+ */
+int thread_pool_worker_index(void) {
+    return current_worker_index;
+}
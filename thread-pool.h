@@ -0,0 +1,40 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef void (*task_function_t)(void *);
+
+typedef struct {
+    task_function_t function;
+    void *argument;
+} task_t;
+
+// Double ended queue of a worker: the owner pushes and pops at the bottom, thieves steal at the top
+typedef struct {
+    task_t *tasks; // Ring buffer, capacity is a power of 2
+    size_t capacity;
+    size_t top;
+    size_t bottom;
+    pthread_mutex_t lock;
+} task_deque_t;
+
+typedef struct {
+    int workers_count;
+    pthread_t *threads;
+    task_deque_t *deques;
+    pthread_mutex_t lock; // Protects the counters below and the conditions
+    pthread_cond_t work_available;
+    pthread_cond_t all_done;
+    size_t queued_count; // Tasks waiting in the deques
+    size_t pending_count; // Tasks submitted and not finished yet
+    size_t next_deque; // Deque receiving the next task submitted from outside the pool
+    bool stopping;
+} thread_pool_t;
+
+int thread_pool_init(thread_pool_t *pool, int workers_count);
+int thread_pool_submit(thread_pool_t *pool, task_function_t function, void *argument);
+void thread_pool_wait(thread_pool_t *pool);
+void thread_pool_destroy(thread_pool_t *pool);
+int thread_pool_worker_index(void);
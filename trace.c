@@ -0,0 +1,278 @@
+#include "trace.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * The trace records spans (directory reads, stats, hashes, queue sends and receives, copies) of every thread
+ * of every process in one MAP_SHARED anonymous mapping, created before the fork. A thread takes a chunk of
+ * TRACE_CHUNK_EVENTS events with an atomic add, then fills it alone: writing an event takes no lock and no
+ * system call. Spans are written when they end, as complete ("X") events of the Chrome trace format, with
+ * the pid and tid of their thread, so that chrome://tracing or Perfetto show one track per thread.
+ * When the mapping is full, events are dropped and counted. The trace is written by the main process once
+ * all the others are done (@see trace_write).
+ * Off, trace_begin returns 0 after testing a NULL pointer, and trace_end returns at once.
+ */
+
+typedef struct {
+    uint64_t start_ns;
+    uint32_t chunks_used;
+    uint32_t chunks_count;
+    uint64_t dropped;
+    uint32_t names_count;
+    trace_name_t names[TRACE_MAX_NAMES];
+} trace_header_t;
+
+typedef struct {
+    trace_event_t *next; // Next free event of the chunk of the thread
+    trace_event_t *end;
+    pid_t pid;
+    pid_t tid;
+} trace_thread_t;
+
+static trace_header_t *trace_header = NULL;
+static trace_event_t *trace_events = NULL;
+static __thread trace_thread_t trace_thread;
+static bool fork_handler_set = false;
+
+static const char *kind_names[TRACE_KINDS_COUNT] = {"read directory", "stat", "hash", "send", "receive", "copy"};
+
+/*!
+ * @brief reset_thread forgets the chunk and the ids of the calling thread: a forked child must not write in
+ * the chunk of its parent (pthread_atfork handler)
+ */
+static void reset_thread(void) {
+    memset(&trace_thread, 0, sizeof(trace_thread));
+}
+
+/*!
+ * @brief now_ns reads the monotonic clock, common to all the processes
+ * @return its time in nanoseconds
+ */
+static uint64_t now_ns(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000ULL + (uint64_t) time.tv_nsec;
+}
+
+/*!
+ * @brief trace_open maps the trace buffer, to be called by the main process before any fork
+ * @return 0 in case of success, -1 else (nothing is traced then)
+ */
+int trace_open(void) {
+    size_t header_size = (sizeof(trace_header_t) + 4095) & ~(size_t) 4095;
+    void *mapping = mmap(NULL, header_size + TRACE_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED) {
+        return -1;
+    }
+    if (!fork_handler_set) {
+        fork_handler_set = pthread_atfork(NULL, NULL, reset_thread) == 0;
+    }
+    trace_header = mapping;
+    trace_events = (trace_event_t *) ((char *) mapping + header_size);
+    trace_header->start_ns = now_ns();
+    trace_header->chunks_count = TRACE_BUFFER_SIZE / (TRACE_CHUNK_EVENTS * sizeof(trace_event_t));
+    reset_thread();
+    trace_set_role("main", -1);
+    return 0;
+}
+
+/*!
+ * @brief current_thread gives the state of the calling thread, with its ids read on first use
+ * @return the state of the thread
+ */
+static trace_thread_t *current_thread(void) {
+    if (trace_thread.tid == 0) {
+        trace_thread.pid = getpid();
+        trace_thread.tid = (pid_t) syscall(SYS_gettid);
+    }
+    return &trace_thread;
+}
+
+/*!
+ * @brief trace_set_role names the calling thread in the trace; the first name of a process names it too
+ * @param group is the role, e.g. "source analyzer"
+ * @param index is the index of the thread in its role, -1 for none
+ */
+void trace_set_role(const char *group, int index) {
+    if (trace_header == NULL) {
+        return;
+    }
+    uint32_t slot = __atomic_fetch_add(&trace_header->names_count, 1, __ATOMIC_RELAXED);
+    if (slot >= TRACE_MAX_NAMES) {
+        return;
+    }
+    trace_thread_t *thread = current_thread();
+    trace_name_t *name = &trace_header->names[slot];
+    if (index >= 0) {
+        snprintf(name->name, sizeof(name->name), "%s %d", group, index);
+    } else {
+        snprintf(name->name, sizeof(name->name), "%s", group);
+    }
+    name->pid = thread->pid;
+    __atomic_store_n(&name->tid, thread->tid, __ATOMIC_RELEASE);
+}
+
+/*!
+ * @brief trace_begin starts a span
+ * @return the start of the span, 0 when tracing is off
+ */
+uint64_t trace_begin(void) {
+    return trace_header != NULL ? now_ns() : 0;
+}
+
+/*!
+ * @brief trace_end records a span started by trace_begin
+ * @param kind is the kind of the span
+ * @param start is the value returned by trace_begin
+ * @param value is the number of bytes hashed, copied, sent or received, 0 for none
+ * @param detail is the path the span is about, NULL for none (only its end is kept)
+ */
+void trace_end(trace_kind_t kind, uint64_t start, uint64_t value, const char *detail) {
+    if (start == 0 || trace_header == NULL) {
+        return;
+    }
+    uint64_t end = now_ns();
+    trace_thread_t *thread = current_thread();
+    if (thread->next == thread->end) {
+        uint32_t chunk = __atomic_fetch_add(&trace_header->chunks_used, 1, __ATOMIC_RELAXED);
+        if (chunk >= trace_header->chunks_count) {
+            __atomic_fetch_add(&trace_header->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        thread->next = trace_events + (size_t) chunk * TRACE_CHUNK_EVENTS;
+        thread->end = thread->next + TRACE_CHUNK_EVENTS;
+    }
+
+    trace_event_t *event = thread->next++;
+    event->duration_ns = end - start;
+    event->value = value;
+    event->pid = thread->pid;
+    event->tid = thread->tid;
+    event->kind = kind;
+    event->detail[0] = '\0';
+    if (detail != NULL) {
+        size_t length = strlen(detail);
+        const char *tail = length < TRACE_DETAIL_SIZE ? detail : detail + length - (TRACE_DETAIL_SIZE - 1);
+        memcpy(event->detail, tail, strlen(tail) + 1);
+    }
+    event->start_ns = start; // Last: the event is complete once it has a start
+}
+
+/*!
+ * @brief write_json_string writes a string as a JSON string, escaped
+ * @param output is the output
+ * @param text is the string
+ */
+static void write_json_string(FILE *output, const char *text) {
+    fputc('"', output);
+    for (const unsigned char *cursor = (const unsigned char *) text; *cursor != '\0'; ++cursor) {
+        if (*cursor == '"' || *cursor == '\\') {
+            fprintf(output, "\\%c", *cursor);
+        } else if (*cursor < 0x20) {
+            fprintf(output, "\\u%04x", *cursor);
+        } else {
+            fputc(*cursor, output);
+        }
+    }
+    fputc('"', output);
+}
+
+/*!
+ * @brief write_names writes the metadata events naming the processes and the threads
+ * @param output is the output
+ * @return the number of events written
+ */
+static size_t write_names(FILE *output) {
+    uint32_t count = trace_header->names_count < TRACE_MAX_NAMES ? trace_header->names_count : TRACE_MAX_NAMES;
+    size_t written = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        trace_name_t *name = &trace_header->names[i];
+        if (name->tid == 0) {
+            continue;
+        }
+        bool first_of_process = true;
+        for (uint32_t j = 0; j < i && first_of_process; ++j) {
+            first_of_process = trace_header->names[j].pid != name->pid;
+        }
+        if (first_of_process) {
+            fprintf(output, "%s{\"ph\": \"M\", \"name\": \"process_name\", \"pid\": %d, \"args\": {\"name\": ", written ? ",\n" : "", (int) name->pid);
+            write_json_string(output, name->name);
+            fprintf(output, "}}");
+            ++written;
+        }
+        fprintf(output, "%s{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": ", written ? ",\n" : "",
+                (int) name->pid, (int) name->tid);
+        write_json_string(output, name->name);
+        fprintf(output, "}}");
+        ++written;
+    }
+    return written;
+}
+
+/*!
+ * @brief trace_write merges the events of all the threads into a Chrome trace file, once they are all done
+ * @param path is the path of the file
+ * @return 0 in case of success, -1 else
+ */
+int trace_write(const char *path) {
+    if (trace_header == NULL) {
+        return -1;
+    }
+    FILE *output = fopen(path, "w");
+    if (output == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    fprintf(output, "{\"traceEvents\": [\n");
+    size_t written = write_names(output);
+    uint32_t chunks = trace_header->chunks_used < trace_header->chunks_count ? trace_header->chunks_used : trace_header->chunks_count;
+    for (size_t i = 0; i < (size_t) chunks * TRACE_CHUNK_EVENTS; ++i) {
+        trace_event_t *event = &trace_events[i];
+        if (event->start_ns == 0) {
+            continue; // End of a chunk not filled
+        }
+        fprintf(output, "%s{\"ph\": \"X\", \"name\": \"%s\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+                written ? ",\n" : "", kind_names[event->kind], (int) event->pid, (int) event->tid,
+                (double) (event->start_ns - trace_header->start_ns) / 1e3, (double) event->duration_ns / 1e3);
+        if (event->detail[0] != '\0' || event->value != 0) {
+            fprintf(output, ", \"args\": {\"bytes\": %lu", (unsigned long) event->value);
+            if (event->detail[0] != '\0') {
+                fprintf(output, ", \"path\": ");
+                write_json_string(output, event->detail);
+            }
+            fprintf(output, "}");
+        }
+        fprintf(output, "}");
+        ++written;
+    }
+    fprintf(output, "\n], \"displayTimeUnit\": \"ms\", \"otherData\": {\"dropped_events\": %lu}}\n", (unsigned long) trace_header->dropped);
+
+    if (trace_header->dropped > 0) {
+        fprintf(stderr, "The trace buffer is full, %lu events were dropped\n", (unsigned long) trace_header->dropped);
+    }
+    int result = ferror(output) ? -1 : 0;
+    if (fclose(output) != 0 || result == -1) {
+        fprintf(stderr, "Unable to write the trace %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief trace_close unmaps the trace buffer
+ */
+void trace_close(void) {
+    if (trace_header != NULL) {
+        size_t header_size = (sizeof(trace_header_t) + 4095) & ~(size_t) 4095;
+        munmap(trace_header, header_size + TRACE_BUFFER_SIZE);
+        trace_header = NULL;
+        trace_events = NULL;
+    }
+    reset_thread();
+}
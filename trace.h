@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Memory shared by all the processes for the events, pages are only used once written
+#define TRACE_BUFFER_SIZE (256 * 1024 * 1024)
+// Events taken at once by a thread from the shared buffer
+#define TRACE_CHUNK_EVENTS 1024
+// Threads and processes that can be named in the trace
+#define TRACE_MAX_NAMES 1024
+// End of the path kept with an event
+#define TRACE_DETAIL_SIZE 88
+
+typedef enum {
+    TRACE_READ_DIRECTORY,
+    TRACE_STAT,
+    TRACE_HASH,
+    TRACE_SEND,
+    TRACE_RECEIVE,
+    TRACE_COPY,
+    TRACE_KINDS_COUNT,
+} trace_kind_t;
+
+// A span, written once ended by the thread owning its chunk
+typedef struct {
+    uint64_t start_ns; // 0 for the unused events of a chunk
+    uint64_t duration_ns;
+    uint64_t value; // Bytes hashed, copied, sent or received
+    pid_t pid;
+    pid_t tid;
+    uint32_t kind;
+    char detail[TRACE_DETAIL_SIZE]; // End of the path, may be empty
+} trace_event_t;
+
+typedef struct {
+    pid_t pid;
+    pid_t tid;
+    char name[48];
+} trace_name_t;
+
+int trace_open(void);
+void trace_set_role(const char *group, int index);
+uint64_t trace_begin(void);
+void trace_end(trace_kind_t kind, uint64_t start, uint64_t value, const char *detail);
+int trace_write(const char *path);
+void trace_close(void);
@@ -0,0 +1,371 @@
+#include "transport.h"
+#include "trace.h"
+#include <sys/msg.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+
+#define MSGMAX_PATH "/proc/sys/kernel/msgmax"
+#define MSGMAX_DEFAULT 8192
+#define MSGMNB_DEFAULT 16384
+
+// Messages in a ring are framed by their size, frames are 8 bytes aligned
+#define FRAME_SIZE(size) ((sizeof(uint32_t) + (size) + 7) & ~(size_t) 7)
+
+typedef struct {
+    pthread_mutex_t lock; // Process shared and robust
+    uint32_t data_sequence; // Futex word, changed when a message is written
+    uint32_t space_sequence; // Futex word, changed when a message is read
+    uint32_t waiting_receivers;
+    uint32_t waiting_senders;
+    uint64_t head; // Bytes written since the creation of the ring
+    uint64_t tail; // Bytes read since the creation of the ring
+    uint8_t data[TRANSPORT_SHM_RING_SIZE];
+} shm_ring_t;
+
+typedef struct {
+    shm_ring_t rings[TRANSPORT_TOPICS_MAX];
+} shm_transport_t;
+
+// Both are inherited by the children on fork
+static transport_kind_t transport_kind = TRANSPORT_MQ;
+static shm_transport_t *shm_transport = NULL;
+
+/*!
+ * @brief futex_wait sleeps until the word is woken up, unless it no longer holds the expected value
+ * @param word is the shared word
+ * @param expected is the value the word had when the caller decided to wait
+ */
+static void futex_wait(uint32_t *word, uint32_t expected) {
+    syscall(SYS_futex, word, FUTEX_WAIT, expected, NULL, NULL, 0);
+}
+
+/*!
+ * @brief futex_wake wakes up all the processes waiting on a word
+ * @param word is the shared word
+ */
+static void futex_wake(uint32_t *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/*!
+ * @brief lock_ring locks a ring, recovering the lock of a process that died while holding it
+ * @param ring the ring
+ */
+static void lock_ring(shm_ring_t *ring) {
+    if (pthread_mutex_lock(&ring->lock) == EOWNERDEAD) {
+        pthread_mutex_consistent(&ring->lock);
+    }
+}
+
+/*!
+ * @brief get_ring gets the ring of a topic
+ * @param type the topic (mtype) of the messages
+ * @return the ring, NULL (with errno set) if the topic is invalid
+ */
+static shm_ring_t *get_ring(long type) {
+    if (shm_transport == NULL || type < 1 || type > TRANSPORT_TOPICS_MAX) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return &shm_transport->rings[type - 1];
+}
+
+/*!
+ * @brief ring_write copies bytes into a ring, wrapping around its end
+ * @param ring the ring
+ * @param position the position (not wrapped) of the first byte to write
+ * @param source the bytes to copy
+ * @param size the number of bytes
+ */
+static void ring_write(shm_ring_t *ring, uint64_t position, const void *source, size_t size) {
+    size_t offset = position % TRANSPORT_SHM_RING_SIZE;
+    size_t first_part = TRANSPORT_SHM_RING_SIZE - offset < size ? TRANSPORT_SHM_RING_SIZE - offset : size;
+    memcpy(ring->data + offset, source, first_part);
+    memcpy(ring->data, (const uint8_t *) source + first_part, size - first_part);
+}
+
+/*!
+ * @brief ring_read copies bytes out of a ring, wrapping around its end
+ * @param ring the ring
+ * @param position the position (not wrapped) of the first byte to read
+ * @param destination receives the bytes
+ * @param size the number of bytes
+ */
+static void ring_read(shm_ring_t *ring, uint64_t position, void *destination, size_t size) {
+    size_t offset = position % TRANSPORT_SHM_RING_SIZE;
+    size_t first_part = TRANSPORT_SHM_RING_SIZE - offset < size ? TRANSPORT_SHM_RING_SIZE - offset : size;
+    memcpy(destination, ring->data + offset, first_part);
+    memcpy((uint8_t *) destination + first_part, ring->data, size - first_part);
+}
+
+/*!
+ * @brief create_shm_transport maps a new set of rings
+ * The shared memory object is unlinked as soon as it is mapped: the children inherit the mapping, and
+ * nothing is left behind when the program ends, even on a crash.
+ * @param key is used to name the shared memory object
+ * @return 0 in case of success, -1 else (errno is EEXIST if the name is used)
+ */
+static int create_shm_transport(key_t key) {
+    char name[64];
+    snprintf(name, sizeof(name), "/lp25-transport-%d", (int) key);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1) {
+        return -1;
+    }
+    void *mapping = MAP_FAILED;
+    if (ftruncate(fd, sizeof(shm_transport_t)) == 0) {
+        mapping = mmap(NULL, sizeof(shm_transport_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    int saved_errno = errno;
+    close(fd);
+    shm_unlink(name);
+    if (mapping == MAP_FAILED) {
+        errno = saved_errno;
+        return -1;
+    }
+
+    shm_transport = mapping;
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+    for (int i = 0; i < TRANSPORT_TOPICS_MAX; ++i) {
+        // The mapping is zero filled: only the locks need an initialization
+        pthread_mutex_init(&shm_transport->rings[i].lock, &attributes);
+    }
+    pthread_mutexattr_destroy(&attributes);
+    return 0;
+}
+
+/*!
+ * @brief transport_create creates the channel used by all the processes, before they are forked
+ * @param kind is the transport to use
+ * @param key is the key of the channel
+ * @return the channel, -1 in case of error (errno is EEXIST when the key is already used, try another one)
+ */
+int transport_create(transport_kind_t kind, key_t key) {
+    transport_kind = kind;
+    if (kind == TRANSPORT_SHM) {
+        return create_shm_transport(key);
+    }
+    return msgget(key, IPC_CREAT | IPC_EXCL | 0600);
+}
+
+/*!
+ * @brief transport_open opens the channel in a child process
+ * @param key is the key of the channel
+ * @return the channel, -1 in case of error
+ */
+int transport_open(key_t key) {
+    if (transport_kind == TRANSPORT_SHM) {
+        if (shm_transport == NULL) {
+            errno = ENOENT;
+            return -1;
+        }
+        return 0;
+    }
+    return msgget(key, 0600);
+}
+
+/*!
+ * @brief shm_send writes a message in the ring of its topic (@see transport_send)
+ * @param message is the message, starting with its long mtype
+ * @param size is the size of the message, without its mtype
+ * @param flags is IPC_NOWAIT to fail with EAGAIN instead of waiting when the ring is full, 0 else
+ * @return 0 in case of success, -1 else
+ */
+static int shm_send(const void *message, size_t size, int flags) {
+    shm_ring_t *ring = get_ring(*(const long *) message);
+    if (ring == NULL) {
+        return -1;
+    }
+    size_t frame_size = FRAME_SIZE(size);
+    if (frame_size > TRANSPORT_SHM_RING_SIZE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    lock_ring(ring);
+    while (TRANSPORT_SHM_RING_SIZE - (ring->head - ring->tail) < frame_size) {
+        if (flags & IPC_NOWAIT) {
+            pthread_mutex_unlock(&ring->lock);
+            errno = EAGAIN;
+            return -1;
+        }
+        uint32_t sequence = ring->space_sequence;
+        ++ring->waiting_senders;
+        pthread_mutex_unlock(&ring->lock);
+        futex_wait(&ring->space_sequence, sequence);
+        lock_ring(ring);
+        --ring->waiting_senders;
+    }
+
+    uint32_t length = size;
+    ring_write(ring, ring->head, &length, sizeof(length));
+    ring_write(ring, ring->head + sizeof(length), (const uint8_t *) message + sizeof(long), size);
+    ring->head += frame_size;
+    ++ring->data_sequence;
+    bool wake = ring->waiting_receivers > 0;
+    pthread_mutex_unlock(&ring->lock);
+    if (wake) {
+        futex_wake(&ring->data_sequence);
+    }
+    return 0;
+}
+
+/*!
+ * @brief shm_receive reads the oldest message of the ring of a topic (@see transport_receive)
+ * @param message receives the message, starting with its long mtype
+ * @param size is the max size of the message, without its mtype
+ * @param type is the topic to receive from (> 0)
+ * @param flags is IPC_NOWAIT to fail with ENOMSG instead of waiting when the ring is empty, 0 else
+ * @return the size of the received message (without its mtype), -1 in case of error
+ */
+static ssize_t shm_receive(void *message, size_t size, long type, int flags) {
+    shm_ring_t *ring = get_ring(type);
+    if (ring == NULL) {
+        return -1;
+    }
+
+    lock_ring(ring);
+    while (ring->head == ring->tail) {
+        if (flags & IPC_NOWAIT) {
+            pthread_mutex_unlock(&ring->lock);
+            errno = ENOMSG;
+            return -1;
+        }
+        uint32_t sequence = ring->data_sequence;
+        ++ring->waiting_receivers;
+        pthread_mutex_unlock(&ring->lock);
+        futex_wait(&ring->data_sequence, sequence);
+        lock_ring(ring);
+        --ring->waiting_receivers;
+    }
+
+    uint32_t length;
+    ring_read(ring, ring->tail, &length, sizeof(length));
+    if (length > size) {
+        pthread_mutex_unlock(&ring->lock);
+        errno = E2BIG;
+        return -1;
+    }
+    *(long *) message = type;
+    ring_read(ring, ring->tail + sizeof(length), (uint8_t *) message + sizeof(long), length);
+    ring->tail += FRAME_SIZE(length);
+    ++ring->space_sequence;
+    bool wake = ring->waiting_senders > 0;
+    pthread_mutex_unlock(&ring->lock);
+    if (wake) {
+        futex_wake(&ring->space_sequence);
+    }
+    return length;
+}
+
+/*!
+ * @brief transport_send sends a message, as msgsnd does
+ * @param channel is the channel
+ * @param message is the message, starting with its long mtype
+ * @param size is the size of the message, without its mtype
+ * @param flags is IPC_NOWAIT to fail with EAGAIN instead of waiting when the channel is full, 0 else
+ * @return 0 in case of success, -1 else
+ */
+int transport_send(int channel, const void *message, size_t size, int flags) {
+    uint64_t span = trace_begin();
+    int result = transport_kind == TRANSPORT_MQ ? msgsnd(channel, message, size, flags) : shm_send(message, size, flags);
+    int saved_errno = errno;
+    trace_end(TRACE_SEND, span, result == 0 ? size : 0, NULL);
+    errno = saved_errno;
+    return result;
+}
+
+/*!
+ * @brief transport_receive receives the oldest message of a topic, as msgrcv does
+ * @param channel is the channel
+ * @param message receives the message, starting with its long mtype
+ * @param size is the max size of the message, without its mtype
+ * @param type is the topic to receive from (> 0)
+ * @param flags is IPC_NOWAIT to fail with ENOMSG instead of waiting when there is no message, 0 else
+ * @return the size of the received message (without its mtype), -1 in case of error
+ */
+ssize_t transport_receive(int channel, void *message, size_t size, long type, int flags) {
+    uint64_t span = trace_begin();
+    ssize_t result = transport_kind == TRANSPORT_MQ ? msgrcv(channel, message, size, type, flags) : shm_receive(message, size, type, flags);
+    int saved_errno = errno;
+    trace_end(TRACE_RECEIVE, span, result > 0 ? (uint64_t) result : 0, NULL);
+    errno = saved_errno;
+    return result;
+}
+
+/*!
+ * @brief transport_message_max gives the size of the largest message that can be sent
+ * @param channel is the channel
+ * @return the max size of a message, without its mtype
+ */
+size_t transport_message_max(int channel) {
+    if (transport_kind == TRANSPORT_SHM) {
+        (void) channel;
+        return TRANSPORT_SHM_RING_SIZE - FRAME_SIZE(0);
+    }
+
+    size_t message_max = MSGMAX_DEFAULT;
+    FILE *msgmax_file = fopen(MSGMAX_PATH, "r");
+    if (msgmax_file != NULL) {
+        unsigned long value;
+        if (fscanf(msgmax_file, "%lu", &value) == 1) {
+            message_max = value;
+        }
+        fclose(msgmax_file);
+    }
+    return message_max;
+}
+
+/*!
+ * @brief transport_queue_bytes gives the number of bytes a topic can hold before senders have to wait
+ * With a message queue, all the topics share this capacity.
+ * @param channel is the channel
+ * @return the capacity in bytes
+ */
+size_t transport_queue_bytes(int channel) {
+    if (transport_kind == TRANSPORT_SHM) {
+        return TRANSPORT_SHM_RING_SIZE;
+    }
+
+    struct msqid_ds queue_stats;
+    if (msgctl(channel, IPC_STAT, &queue_stats) == 0) {
+        return queue_stats.msg_qbytes;
+    }
+    return MSGMNB_DEFAULT;
+}
+
+/*!
+ * @brief transport_destroy removes the channel, once all the processes are done with it
+ * @param channel is the channel
+ */
+void transport_destroy(int channel) {
+    if (transport_kind == TRANSPORT_SHM) {
+        if (shm_transport != NULL) {
+            munmap(shm_transport, sizeof(shm_transport_t));
+            shm_transport = NULL;
+        }
+        return;
+    }
+    msgctl(channel, IPC_RMID, NULL);
+}
+
+/*!
+ * @brief transport_name gives the name of a transport, as used by the --transport option
+ * @param kind is the transport
+ * @return its name
+ */
+const char *transport_name(transport_kind_t kind) {
+    return kind == TRANSPORT_SHM ? "shm" : "mq";
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+
+/*
+ * Transports carry the messages between the main, lister and analyzer processes. Messages start with a long
+ * mtype, the topic they are sent to, as for msgsnd and msgrcv.
+ * - TRANSPORT_MQ is a SysV message queue: every message is copied to the kernel then back.
+ * - TRANSPORT_SHM is a set of rings (one per topic) in a shared memory mapping inherited by the children:
+ *   a message is copied once into the ring by the sender and once out of it by the receiver, without any
+ *   system call, futexes are only used to sleep on an empty or full ring.
+ */
+typedef enum {
+    TRANSPORT_MQ,
+    TRANSPORT_SHM,
+} transport_kind_t;
+
+// Topics are mtypes from 1 to TRANSPORT_TOPICS_MAX
+#define TRANSPORT_TOPICS_MAX 8
+#define TRANSPORT_SHM_RING_SIZE (256 * 1024)
+
+int transport_create(transport_kind_t kind, key_t key);
+int transport_open(key_t key);
+int transport_send(int channel, const void *message, size_t size, int flags);
+ssize_t transport_receive(int channel, void *message, size_t size, long type, int flags);
+size_t transport_message_max(int channel);
+size_t transport_queue_bytes(int channel);
+void transport_destroy(int channel);
+const char *transport_name(transport_kind_t kind);
@@ -0,0 +1,153 @@
+#include "uring.h"
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * The rings of the engines (@see read-engine.h, stat-engine.h) are used through the io_uring system calls:
+ * liburing is not required. A request is written in the next free entry of the submission queue
+ * (uring_get_sqe), made visible to the kernel (uring_queue), then submitted with the wait for a completion;
+ * its user_data identifies it in the completion queue (uring_reap).
+ * Callers keep fewer requests in flight than the entries of their ring.
+ */
+
+/*!
+ * @brief uring_close releases a ring
+ * @param uring the ring
+ */
+void uring_close(uring_t *uring) {
+    if (uring->sqes != NULL) {
+        munmap(uring->sqes, uring->sqes_size);
+    }
+    if (uring->cq_mapping != NULL && uring->cq_mapping != uring->sq_mapping) {
+        munmap(uring->cq_mapping, uring->cq_mapping_size);
+    }
+    if (uring->sq_mapping != NULL) {
+        munmap(uring->sq_mapping, uring->sq_mapping_size);
+    }
+    if (uring->fd != -1) {
+        close(uring->fd);
+    }
+    memset(uring, 0, sizeof(uring_t));
+    uring->fd = -1;
+}
+
+/*!
+ * @brief uring_open creates a ring and maps its queues
+ * @param uring receives the ring
+ * @param entries is the number of requests the ring can hold (rounded up by the kernel to a power of 2)
+ * @return 0 in case of success, -1 else
+ */
+int uring_open(uring_t *uring, unsigned entries) {
+    memset(uring, 0, sizeof(uring_t));
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    uring->fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if (uring->fd == -1) {
+        return -1;
+    }
+
+    uring->sq_mapping_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    uring->cq_mapping_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (uring->cq_mapping_size > uring->sq_mapping_size) {
+            uring->sq_mapping_size = uring->cq_mapping_size;
+        }
+    }
+    uring->sq_mapping = mmap(NULL, uring->sq_mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+    if (uring->sq_mapping == MAP_FAILED) {
+        uring->sq_mapping = NULL;
+        uring_close(uring);
+        return -1;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        uring->cq_mapping = uring->sq_mapping;
+    } else {
+        uring->cq_mapping = mmap(NULL, uring->cq_mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_CQ_RING);
+        if (uring->cq_mapping == MAP_FAILED) {
+            uring->cq_mapping = NULL;
+            uring_close(uring);
+            return -1;
+        }
+    }
+    uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+    if (uring->sqes == MAP_FAILED) {
+        uring->sqes = NULL;
+        uring_close(uring);
+        return -1;
+    }
+
+    uint8_t *sq = uring->sq_mapping;
+    uint8_t *cq = uring->cq_mapping;
+    uring->sq_head = (uint32_t *) (sq + params.sq_off.head);
+    uring->sq_tail = (uint32_t *) (sq + params.sq_off.tail);
+    uring->sq_mask = (uint32_t *) (sq + params.sq_off.ring_mask);
+    uring->sq_array = (uint32_t *) (sq + params.sq_off.array);
+    uring->cq_head = (uint32_t *) (cq + params.cq_off.head);
+    uring->cq_tail = (uint32_t *) (cq + params.cq_off.tail);
+    uring->cq_mask = (uint32_t *) (cq + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    return 0;
+}
+
+/*!
+ * @brief uring_get_sqe gives the next entry of the submission queue, cleared, to be filled then queued
+ * @param uring the ring
+ * @return the entry
+ */
+struct io_uring_sqe *uring_get_sqe(uring_t *uring) {
+    struct io_uring_sqe *sqe = &uring->sqes[*uring->sq_tail & *uring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/*!
+ * @brief uring_queue queues the entry given by uring_get_sqe (it is submitted by the next uring_submit_and_wait)
+ * @param uring the ring
+ */
+void uring_queue(uring_t *uring) {
+    uint32_t tail = *uring->sq_tail;
+    uint32_t index = tail & *uring->sq_mask;
+    uring->sq_array[index] = index;
+    __atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/*!
+ * @brief uring_submit_and_wait submits the queued requests and waits for at least one completion
+ * @param uring the ring
+ * @param syscalls is increased by the number of system calls made
+ * @return 0 in case of success, -1 else
+ */
+int uring_submit_and_wait(uring_t *uring, uint64_t *syscalls) {
+    for (;;) {
+        // The kernel moves the head of the submission queue when it consumes the requests
+        unsigned to_submit = *uring->sq_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+        ++*syscalls;
+        if (syscall(__NR_io_uring_enter, uring->fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0) >= 0) {
+            return 0;
+        }
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+/*!
+ * @brief uring_reap collects the available completions
+ * @param uring the ring
+ * @param results receives the result of each request, indexed by its user_data
+ * @param done is set for each completed request
+ */
+void uring_reap(uring_t *uring, int *results, bool *done) {
+    uint32_t head = *uring->cq_head;
+    uint32_t tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        struct io_uring_cqe *cqe = &uring->cqes[head & *uring->cq_mask];
+        results[cqe->user_data] = cqe->res;
+        done[cqe->user_data] = true;
+    }
+    __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+// A ring used through the io_uring system calls, by the thread that opened it
+typedef struct {
+    int fd;
+    uint32_t *sq_head, *sq_tail, *sq_mask, *sq_array;
+    uint32_t *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_mapping, *cq_mapping;
+    size_t sq_mapping_size, cq_mapping_size, sqes_size;
+} uring_t;
+
+int uring_open(uring_t *uring, unsigned entries);
+void uring_close(uring_t *uring);
+struct io_uring_sqe *uring_get_sqe(uring_t *uring);
+void uring_queue(uring_t *uring);
+int uring_submit_and_wait(uring_t *uring, uint64_t *syscalls);
+void uring_reap(uring_t *uring, int *results, bool *done);
@@ -1,4 +1,4 @@
-#include "defines.h"
+#include "utility.h"
 #include <string.h>
 
 char *concat_path(char *result, char *prefix, char *suffix) {
@@ -33,3 +33,20 @@ char *concat_path(char *result, char *prefix, char *suffix) {
         return NULL;
     }
 }
+
+/*!
+ * @brief get_root_length gives the number of chars to skip in a listed path to get its path relative to the root
+ * Listed paths are built with concat_path, so the root is always followed by exactly one '/'.
+ * @param root the root of the listed tree
+ * @return the length of the root and its separator
+ */
+size_t get_root_length(char *root) {
+    if (root == NULL) {
+        return 0;
+    }
+    size_t length = strlen(root);
+    if (length > 0 && root[length - 1] != '/') {
+        ++length;
+    }
+    return length;
+}
@@ -2,4 +2,7 @@
 
 #include "defines.h"
 
+#include <stddef.h>
+
 char *concat_path(char *result, char *prefix, char *suffix);
+size_t get_root_length(char *root);
@@ -0,0 +1,717 @@
+#include "walker.h"
+#include "defines.h"
+#include "file-properties.h"
+#include "stats.h"
+#include "trace.h"
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+/*
+ * The walker lists a tree with system calls relative to the descriptor of the parent directory: the kernel
+ * resolves one name per call instead of a full path. Directories are read with getdents64 in a large
+ * buffer, and the type given by d_type decides the recursion. The only metadata call per entry is the
+ * fstatat that fills its stats (or none when the stats are left to the analyzers, unless the filesystem
+ * doesn't give d_type). The path of the current directory is kept in a buffer: the path of an entry is only
+ * completed with its name when it is added to the list.
+ * Only regular files and directories are listed.
+ */
+
+// Layout of the records returned by getdents64
+typedef struct {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} linux_dirent64_t;
+
+typedef struct {
+    files_list_t *list;
+    walk_visitor_t visit; // Receives the entries instead of the list when set
+    void *visit_data;
+    bool with_stats;
+    char *buffer; // getdents64 buffer, reused by all the directories
+    char path[PATH_SIZE]; // Path of the current directory, with its trailing '/'
+    char *names; // Stack of the names of the directories to walk, '\0' separated
+    size_t names_length;
+    size_t names_capacity;
+    uint64_t entries; // Entries and system calls of the walk, counted once it is done
+    uint64_t syscalls;
+} walker_t;
+
+/*!
+ * @brief push_subdirectory keeps a directory to walk once its parent is read
+ * @param walker is the walker
+ * @param name is the name of the directory
+ * @param name_length is the length of name
+ * @return 0 in case of success, -1 else
+ */
+static int push_subdirectory(walker_t *walker, const char *name, size_t name_length) {
+    if (walker->names_length + name_length + 1 > walker->names_capacity) {
+        size_t new_capacity = walker->names_capacity ? 2 * walker->names_capacity : 4096;
+        while (new_capacity < walker->names_length + name_length + 1) {
+            new_capacity *= 2;
+        }
+        char *new_names = realloc(walker->names, new_capacity);
+        if (!new_names) {
+            return -1;
+        }
+        walker->names = new_names;
+        walker->names_capacity = new_capacity;
+    }
+    memcpy(walker->names + walker->names_length, name, name_length + 1);
+    walker->names_length += name_length + 1;
+    return 0;
+}
+
+/*!
+ * @brief add_dirent adds an entry of the current directory to the list, or gives it to the visitor
+ * @param walker is the walker
+ * @param dir_fd is the descriptor of the current directory
+ * @param path_length is the length of the path of the current directory
+ * @param record is the entry returned by getdents64
+ * @return 0 in case of success, -1 else
+ */
+static int add_dirent(walker_t *walker, int dir_fd, size_t path_length, linux_dirent64_t *record) {
+    const char *name = record->d_name;
+    if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+        return 0;
+    }
+    if (record->d_type != DT_UNKNOWN && record->d_type != DT_REG && record->d_type != DT_DIR) {
+        return 0;
+    }
+
+    struct stat sb;
+    bool has_stats = false;
+    if (walker->with_stats || record->d_type == DT_UNKNOWN) {
+        ++walker->syscalls;
+        if (fstatat(dir_fd, name, &sb, AT_SYMLINK_NOFOLLOW) == -1) {
+            fprintf(stderr, "%s%s: %s\n", walker->path, name, strerror(errno));
+            return 0;
+        }
+        if (!S_ISREG(sb.st_mode) && !S_ISDIR(sb.st_mode)) {
+            return 0;
+        }
+        has_stats = true;
+    }
+
+    size_t name_length = strlen(name);
+    if (path_length + name_length + 2 > PATH_SIZE) {
+        fprintf(stderr, "%s%s: %s\n", walker->path, name, strerror(ENAMETOOLONG));
+        return 0;
+    }
+    files_list_entry_t visited, *entry = &visited;
+    if (walker->visit != NULL) {
+        // The visitor only borrows the entry: it points to the path of the walker
+        memset(&visited, 0, sizeof(visited));
+        visited.dir_path = walker->path;
+        visited.dir_path_length = path_length;
+        visited.name = name;
+    } else {
+        memcpy(walker->path + path_length, name, name_length + 1);
+        entry = add_file_entry(walker->list, walker->path);
+        walker->path[path_length] = '\0';
+        if (entry == NULL) {
+            return 0;
+        }
+    }
+    if (has_stats) {
+        set_entry_stats(entry, &sb);
+    } else {
+        entry->entry_type = record->d_type == DT_DIR ? DOSSIER : FICHIER;
+    }
+    ++walker->entries;
+    if (walker->visit != NULL && walker->visit(entry, walker->visit_data) == -1) {
+        return -1;
+    }
+    return entry->entry_type == DOSSIER ? push_subdirectory(walker, name, name_length) : 0;
+}
+
+/*!
+ * @brief walk_directory lists a directory, then walks its subdirectories
+ * @param walker is the walker, whose path is the path of the directory
+ * @param dir_fd is the descriptor of the directory, closed by the function
+ * @return 0 in case of success, -1 if a directory can't be read
+ */
+static int walk_directory(walker_t *walker, int dir_fd) {
+    size_t path_length = strlen(walker->path);
+    size_t first_subdirectory = walker->names_length;
+
+    uint64_t span = trace_begin();
+    long bytes;
+    walker->syscalls += 2; // The last getdents64 and close
+    while ((bytes = syscall(SYS_getdents64, dir_fd, walker->buffer, WALKER_BUFFER_SIZE)) > 0) {
+        ++walker->syscalls;
+        for (long offset = 0; offset < bytes;) {
+            linux_dirent64_t *record = (linux_dirent64_t *) (walker->buffer + offset);
+            if (add_dirent(walker, dir_fd, path_length, record) == -1) {
+                close(dir_fd);
+                return -1;
+            }
+            offset += record->d_reclen;
+        }
+    }
+    trace_end(TRACE_READ_DIRECTORY, span, 0, walker->path);
+    if (bytes == -1) {
+        fprintf(stderr, "Error reading directory %s: %s\n", walker->path, strerror(errno));
+        close(dir_fd);
+        return -1;
+    }
+
+    // The buffer is free again: walk the subdirectories found in this one
+    int result = 0;
+    size_t last_subdirectory = walker->names_length;
+    for (size_t offset = first_subdirectory; offset < last_subdirectory && result == 0;) {
+        // The stack may move while a subdirectory is walked, only its offsets remain
+        const char *name = walker->names + offset;
+        size_t name_length = strlen(name);
+        ++walker->syscalls;
+        int subdirectory_fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (subdirectory_fd == -1) {
+            fprintf(stderr, "Error opening directory %s%s: %s\n", walker->path, name, strerror(errno));
+            result = -1;
+            break;
+        }
+        snprintf(walker->path + path_length, PATH_SIZE - path_length, "%s/", name);
+        offset += name_length + 1;
+        result = walk_directory(walker, subdirectory_fd);
+        walker->path[path_length] = '\0';
+    }
+    walker->names_length = first_subdirectory;
+    close(dir_fd);
+    return result;
+}
+
+/*!
+ * @brief run_walker lists a tree into a list or to a visitor
+ * @param list is a pointer to the list receiving the entries, when visit is NULL
+ * @param visit is the visitor receiving the entries, NULL to fill the list
+ * @param data is given to the visitor
+ * @param root is the directory to list
+ * @param with_stats is true to fill the stats of the entries
+ * @return 0 in case of success, -1 if a directory can't be read or the visitor failed
+ */
+static int run_walker(files_list_t *list, walk_visitor_t visit, void *data, const char *root, bool with_stats) {
+    walker_t *walker = calloc(1, sizeof(walker_t));
+    if (!walker || !(walker->buffer = malloc(WALKER_BUFFER_SIZE))) {
+        free(walker);
+        return -1;
+    }
+    walker->list = list;
+    walker->visit = visit;
+    walker->visit_data = data;
+    walker->with_stats = with_stats;
+
+    int result = -1;
+    int root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd == -1) {
+        fprintf(stderr, "Error opening directory %s: %s\n", root, strerror(errno));
+    } else {
+        // Same paths as concat_path: the root is followed by exactly one '/'
+        size_t root_length = strlen(root);
+        snprintf(walker->path, PATH_SIZE, (root_length > 0 && root[root_length - 1] == '/') ? "%s" : "%s/", root);
+        result = walk_directory(walker, root_fd);
+    }
+    stats_add(STATS_ENTRIES_SCANNED, walker->entries);
+    stats_syscalls(STATS_PHASE_SCAN, walker->syscalls + 1);
+
+    free(walker->names);
+    free(walker->buffer);
+    free(walker);
+    return result;
+}
+
+/*!
+ * @brief walk_tree lists all the regular files and directories of a tree
+ * Entries are appended unordered, call sort_files_list on the list once it is complete.
+ * @param list is a pointer to the list receiving the entries
+ * @param root is the directory to list
+ * @param with_stats is true to fill the stats of the entries, false to only get their types (the stats are
+ * then left to get_file_stats)
+ * @return 0 in case of success, -1 if a directory can't be read
+ */
+int walk_tree(files_list_t *list, const char *root, bool with_stats) {
+    return run_walker(list, NULL, NULL, root, with_stats);
+}
+
+/*!
+ * @brief walk_tree_visit gives all the regular files and directories of a tree to a visitor, unordered,
+ * without keeping them: the memory of the walk only depends on the depth and width of the tree
+ * @param root is the directory to list
+ * @param with_stats is true to fill the stats of the entries, false to only get their types
+ * @param visit is the visitor, it may stop the walk by returning -1
+ * @param data is given to the visitor
+ * @return 0 in case of success, -1 if a directory can't be read or the visitor failed
+ */
+int walk_tree_visit(const char *root, bool with_stats, walk_visitor_t visit, void *data) {
+    return visit != NULL ? run_walker(NULL, visit, data, root, with_stats) : -1;
+}
+
+/*
+ * The parallel walker makes each directory a task of a work-stealing pool: a worker reads a directory,
+ * builds the entries of its children in its own list (no lock, @see new_file_entry), sorts them by name into
+ * a fragment and submits a task for each subdirectory. Idle workers steal the oldest tasks, i.e. the
+ * directories closest to the root, so many directories are read at once.
+ * Once the pool is done, the fragments are merged from the root in strcmp order of the full paths, which is
+ * the order sort_files_list gives: the list is sorted whatever the scheduling was, and the arenas of the
+ * workers are handed over to the list.
+ */
+
+struct _dir_fragment {
+    parallel_walk_t *walk;
+    const char *path; // Path of the directory with its trailing '/'
+    files_list_entry_t **children; // Sorted by name
+    dir_fragment_t **subtrees; // Fragment of each child directory, NULL for files
+    size_t count;
+};
+
+struct _walk_worker {
+    files_list_t list; // Owns the entries and the fragments built by the worker, never linked
+    char *buffer; // getdents64 buffer
+};
+
+/*!
+ * @brief compare_children orders the children of a directory by name (qsort callback)
+ * @param left is a pointer to the first entry pointer
+ * @param right is a pointer to the second entry pointer
+ * @return like strcmp
+ */
+static int compare_children(const void *left, const void *right) {
+    return strcmp((*(files_list_entry_t *const *) left)->name, (*(files_list_entry_t *const *) right)->name);
+}
+
+/*!
+ * @brief read_sorted_children reads the regular files and directories of a directory, sorted by name
+ * @param dir_fd is the descriptor of the directory
+ * @param dir_path is the path of the directory, with its trailing '/'
+ * @param list is the list allocating the entries (they are not linked to it)
+ * @param with_stats is true to fill the stats of the entries, false to only get their types
+ * @param buffer is a getdents64 buffer of WALKER_BUFFER_SIZE bytes
+ * @param children receives the array of the entries, to be freed by the caller
+ * @param count receives the number of entries
+ * @return 0 in case of success, -1 if the directory couldn't be fully read (the entries read are given)
+ */
+int read_sorted_children(int dir_fd, const char *dir_path, files_list_t *list, bool with_stats, char *buffer,
+                         files_list_entry_t ***children, size_t *count) {
+    char path[PATH_SIZE];
+    size_t path_length = strlen(dir_path);
+    memcpy(path, dir_path, path_length + 1);
+    size_t capacity = 0;
+    int result = 0;
+    *children = NULL;
+    *count = 0;
+    uint64_t syscalls = 3; // open, close and the last getdents64
+    uint64_t span = trace_begin();
+    long bytes;
+    while ((bytes = syscall(SYS_getdents64, dir_fd, buffer, WALKER_BUFFER_SIZE)) > 0) {
+        ++syscalls;
+        for (long offset = 0; offset < bytes; offset += ((linux_dirent64_t *) (buffer + offset))->d_reclen) {
+            linux_dirent64_t *record = (linux_dirent64_t *) (buffer + offset);
+            const char *name = record->d_name;
+            if ((name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                || (record->d_type != DT_UNKNOWN && record->d_type != DT_REG && record->d_type != DT_DIR)) {
+                continue;
+            }
+            struct stat sb;
+            bool has_stats = with_stats || record->d_type == DT_UNKNOWN;
+            syscalls += has_stats;
+            if (has_stats && fstatat(dir_fd, name, &sb, AT_SYMLINK_NOFOLLOW) == -1) {
+                fprintf(stderr, "%s%s: %s\n", dir_path, name, strerror(errno));
+                continue;
+            }
+            if (has_stats && !S_ISREG(sb.st_mode) && !S_ISDIR(sb.st_mode)) {
+                continue;
+            }
+            size_t name_length = strlen(name);
+            if (path_length + name_length + 2 > PATH_SIZE) {
+                fprintf(stderr, "%s%s: %s\n", dir_path, name, strerror(ENAMETOOLONG));
+                continue;
+            }
+            memcpy(path + path_length, name, name_length + 1);
+
+            if (*count == capacity) {
+                size_t new_capacity = capacity ? 2 * capacity : 64;
+                files_list_entry_t **new_children = realloc(*children, new_capacity * sizeof(files_list_entry_t *));
+                if (!new_children) {
+                    result = -1;
+                    continue;
+                }
+                *children = new_children;
+                capacity = new_capacity;
+            }
+            files_list_entry_t *entry = new_file_entry(list, path);
+            if (!entry) {
+                result = -1;
+                continue;
+            }
+            if (has_stats) {
+                set_entry_stats(entry, &sb);
+            } else {
+                entry->entry_type = record->d_type == DT_DIR ? DOSSIER : FICHIER;
+            }
+            (*children)[(*count)++] = entry;
+        }
+    }
+    if (bytes == -1) {
+        fprintf(stderr, "Error reading directory %s: %s\n", dir_path, strerror(errno));
+        result = -1;
+    }
+    if (*count > 1) {
+        qsort(*children, *count, sizeof(files_list_entry_t *), compare_children);
+    }
+    stats_add(STATS_ENTRIES_SCANNED, *count);
+    stats_syscalls(STATS_PHASE_SCAN, syscalls);
+    trace_end(TRACE_READ_DIRECTORY, span, 0, dir_path);
+    return result;
+}
+
+/*!
+ * @brief new_fragment allocates the fragment of a directory in the list of a worker
+ * @param walk is the walk
+ * @param list is the list owning the fragment
+ * @param path is the path of the directory, with its trailing '/'
+ * @param length is the length of path
+ * @return the fragment, NULL if out of memory
+ */
+static dir_fragment_t *new_fragment(parallel_walk_t *walk, files_list_t *list, const char *path, size_t length) {
+    dir_fragment_t *fragment = arena_alloc(&list->arena, sizeof(dir_fragment_t), sizeof(void *));
+    if (fragment != NULL) {
+        memset(fragment, 0, sizeof(dir_fragment_t));
+        fragment->walk = walk;
+        fragment->path = arena_strndup(&list->arena, path, length);
+    }
+    return fragment && fragment->path ? fragment : NULL;
+}
+
+/*!
+ * @brief walk_fragment_task reads a directory into its fragment and submits its subdirectories (thread pool task)
+ * @param parameters is a pointer to the dir_fragment_t of the directory
+ */
+static void walk_fragment_task(void *parameters) {
+    dir_fragment_t *fragment = parameters;
+    parallel_walk_t *walk = fragment->walk;
+    int index = thread_pool_worker_index();
+    walk_worker_t *worker = &walk->workers[index >= 0 && index < walk->workers_count ? index : walk->workers_count];
+    if (worker->buffer == NULL && (worker->buffer = malloc(WALKER_BUFFER_SIZE)) == NULL) {
+        __atomic_store_n(&walk->failed, true, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // The root may be a symbolic link, given by the user
+    int dir_fd = open(fragment->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC | (fragment == walk->root ? 0 : O_NOFOLLOW));
+    if (dir_fd == -1) {
+        fprintf(stderr, "Error opening directory %s: %s\n", fragment->path, strerror(errno));
+        __atomic_store_n(&walk->failed, true, __ATOMIC_RELAXED);
+        return;
+    }
+
+    stats_phase_t previous_phase = stats_enter(STATS_PHASE_SCAN);
+    files_list_entry_t **children = NULL;
+    size_t count = 0;
+    if (read_sorted_children(dir_fd, fragment->path, &worker->list, walk->with_stats, worker->buffer, &children, &count) == -1) {
+        __atomic_store_n(&walk->failed, true, __ATOMIC_RELAXED);
+    }
+    close(dir_fd);
+
+    // The fragment keeps the children sorted, with the fragments of the subdirectories
+    char path[PATH_SIZE];
+    fragment->children = arena_alloc(&worker->list.arena, (count + 1) * sizeof(files_list_entry_t *), sizeof(void *));
+    fragment->subtrees = arena_alloc(&worker->list.arena, (count + 1) * sizeof(dir_fragment_t *), sizeof(void *));
+    if (fragment->children && fragment->subtrees) {
+        for (size_t i = 0; i < count; ++i) {
+            files_list_entry_t *child = children[i];
+            fragment->children[i] = child;
+            fragment->subtrees[i] = NULL;
+            if (child->entry_type == DOSSIER) {
+                int length = snprintf(path, PATH_SIZE, "%s%s/", fragment->path, child->name);
+                fragment->subtrees[i] = length < PATH_SIZE ? new_fragment(walk, &worker->list, path, length) : NULL;
+            }
+        }
+        fragment->count = count;
+    } else {
+        __atomic_store_n(&walk->failed, true, __ATOMIC_RELAXED);
+    }
+    free(children);
+
+    for (size_t i = 0; i < fragment->count; ++i) {
+        if (fragment->subtrees[i] != NULL) {
+            thread_pool_submit(walk->pool, walk_fragment_task, fragment->subtrees[i]);
+        }
+    }
+    stats_leave(previous_phase);
+}
+
+/*!
+ * @brief compare_subtree orders the subtree of a directory among its siblings: its paths start with the
+ * name of the directory followed by '/'
+ * @param directory is the name of the directory
+ * @param name is the name of a sibling
+ * @return like strcmp between the directory name followed by '/' and the sibling name
+ */
+static int compare_subtree(const char *directory, const char *name) {
+    size_t length = strlen(directory);
+    int comparison = strncmp(directory, name, length);
+    return comparison != 0 ? comparison : '/' - (unsigned char) name[length];
+}
+
+/*!
+ * @brief merge_fragment appends the entries of a fragment and of its subtrees to a list, in strcmp order
+ * of the full paths: the subtree of a directory comes after the siblings whose name is the directory name
+ * followed by a char lower than '/' (e.g. "a", "a.txt", "a/b").
+ * @param list is the list receiving the entries
+ * @param fragment is the fragment
+ * @return 0 in case of success, -1 else
+ */
+static int merge_fragment(files_list_t *list, dir_fragment_t *fragment) {
+    if (fragment->count == 0) {
+        return 0;
+    }
+    // Subtrees waiting for their place; the most recent one is always the first to go
+    size_t *pending = malloc(fragment->count * sizeof(size_t));
+    if (!pending) {
+        return -1;
+    }
+    size_t pending_count = 0;
+    int result = 0;
+    for (size_t i = 0; i <= fragment->count && result == 0; ++i) {
+        while (pending_count > 0 && result == 0
+               && (i == fragment->count || compare_subtree(fragment->children[pending[pending_count - 1]]->name, fragment->children[i]->name) < 0)) {
+            result = merge_fragment(list, fragment->subtrees[pending[--pending_count]]);
+        }
+        if (i == fragment->count || result == -1) {
+            break;
+        }
+        result = add_entry_to_tail(list, fragment->children[i]);
+        if (fragment->subtrees[i] != NULL) {
+            pending[pending_count++] = i;
+        }
+    }
+    free(pending);
+    return result;
+}
+
+/*!
+ * @brief parallel_walk_start starts listing a tree on a thread pool
+ * Several walks may run at once on the same pool; call thread_pool_wait, then parallel_walk_finish.
+ * @param walk is the walk to start
+ * @param root is the directory to list
+ * @param with_stats is true to fill the stats of the entries, false to only get their types
+ * @param pool is the pool running the walk
+ * @return 0 in case of success, -1 else
+ */
+int parallel_walk_start(parallel_walk_t *walk, const char *root, bool with_stats, thread_pool_t *pool) {
+    memset(walk, 0, sizeof(parallel_walk_t));
+    walk->pool = pool;
+    walk->with_stats = with_stats;
+    walk->workers_count = pool->workers_count;
+    walk->workers = calloc(walk->workers_count + 1, sizeof(walk_worker_t));
+    if (!walk->workers) {
+        return -1;
+    }
+    for (int i = 0; i <= walk->workers_count; ++i) {
+        init_files_list(&walk->workers[i].list);
+    }
+
+    // Same paths as concat_path: the root is followed by exactly one '/'
+    char path[PATH_SIZE];
+    size_t root_length = strlen(root);
+    int length = snprintf(path, PATH_SIZE, (root_length > 0 && root[root_length - 1] == '/') ? "%s" : "%s/", root);
+    walk->root = length < PATH_SIZE ? new_fragment(walk, &walk->workers[walk->workers_count].list, path, length) : NULL;
+    if (!walk->root) {
+        walk->failed = true;
+        return -1;
+    }
+    thread_pool_submit(pool, walk_fragment_task, walk->root);
+    return 0;
+}
+
+/*!
+ * @brief parallel_walk_finish merges the fragments of a finished walk into a list
+ * @param walk is the walk, whose pool is done (@see thread_pool_wait)
+ * @param list is the list receiving the entries, sorted
+ * @return 0 in case of success, -1 if a directory couldn't be read (the list holds the other entries)
+ */
+int parallel_walk_finish(parallel_walk_t *walk, files_list_t *list) {
+    if (!walk->workers) {
+        return -1;
+    }
+    int result = walk->root && merge_fragment(list, walk->root) == 0 && !walk->failed ? 0 : -1;
+    for (int i = 0; i <= walk->workers_count; ++i) {
+        arena_adopt(&list->arena, &walk->workers[i].list.arena);
+        clear_files_list(&walk->workers[i].list);
+        free(walk->workers[i].buffer);
+    }
+    free(walk->workers);
+    walk->workers = NULL;
+    return result;
+}
+
+/*!
+ * @brief walk_tree_parallel lists all the regular files and directories of a tree on a thread pool
+ * It must not be called from a worker of the pool (@see thread_pool_wait).
+ * @param list is a pointer to the list receiving the entries, they are appended sorted
+ * @param root is the directory to list
+ * @param with_stats is true to fill the stats of the entries, false to only get their types
+ * @param pool is the pool running the walk
+ * @return 0 in case of success, -1 if a directory can't be read
+ */
+int walk_tree_parallel(files_list_t *list, const char *root, bool with_stats, thread_pool_t *pool) {
+    parallel_walk_t walk;
+    int started = parallel_walk_start(&walk, root, with_stats, pool);
+    thread_pool_wait(pool);
+    return parallel_walk_finish(&walk, list) == -1 || started == -1 ? -1 : 0;
+}
+
+/*
+ * The sorted walker gives the entries of a tree one at a time, in the order of sort_files_list, while it
+ * walks the tree: a consumer can compare two trees while they are being walked. It keeps a stack of the
+ * directories being walked, each one with its children read and sorted, and the subdirectories waiting
+ * for their place among their siblings (@see merge_fragment).
+ */
+
+struct _sorted_frame {
+    int fd;
+    size_t path_length; // Length of the path of the directory in the path of the walker
+    files_list_entry_t **children;
+    size_t count;
+    size_t next;
+    size_t *pending; // Children directories whose subtree is not walked yet
+    size_t pending_count;
+};
+
+/*!
+ * @brief push_frame reads a directory and makes it the current one of a sorted walker
+ * @param walker is the walker, whose path is the path of the directory
+ * @param dir_fd is the descriptor of the directory, closed when the frame is popped
+ * @return 0 in case of success, -1 else
+ */
+static int push_frame(sorted_walker_t *walker, int dir_fd) {
+    if (walker->depth == walker->capacity) {
+        size_t new_capacity = walker->capacity ? 2 * walker->capacity : 16;
+        sorted_frame_t *new_frames = realloc(walker->frames, new_capacity * sizeof(sorted_frame_t));
+        if (!new_frames) {
+            close(dir_fd);
+            return -1;
+        }
+        walker->frames = new_frames;
+        walker->capacity = new_capacity;
+    }
+    sorted_frame_t *frame = &walker->frames[walker->depth];
+    memset(frame, 0, sizeof(sorted_frame_t));
+    frame->fd = dir_fd;
+    frame->path_length = strlen(walker->path);
+    if (read_sorted_children(dir_fd, walker->path, walker->list, walker->with_stats, walker->buffer, &frame->children, &frame->count) == -1) {
+        walker->failed = true;
+    }
+    frame->pending = malloc((frame->count + 1) * sizeof(size_t));
+    if (!frame->pending) {
+        free(frame->children);
+        close(dir_fd);
+        return -1;
+    }
+    ++walker->depth;
+    return 0;
+}
+
+/*!
+ * @brief sorted_walker_open starts walking a tree in sorted order
+ * @param walker is the walker to initialize
+ * @param list is the list allocating the entries (they are not linked to it, @see new_file_entry)
+ * @param root is the directory to walk
+ * @param with_stats is true to fill the stats of the entries, false to only get their types
+ * @return 0 in case of success, -1 else
+ */
+int sorted_walker_open(sorted_walker_t *walker, files_list_t *list, const char *root, bool with_stats) {
+    memset(walker, 0, sizeof(sorted_walker_t));
+    walker->list = list;
+    walker->with_stats = with_stats;
+    walker->buffer = malloc(WALKER_BUFFER_SIZE);
+    if (!walker->buffer) {
+        return -1;
+    }
+    int root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd == -1) {
+        fprintf(stderr, "Error opening directory %s: %s\n", root, strerror(errno));
+        return -1;
+    }
+    // Same paths as concat_path: the root is followed by exactly one '/'
+    size_t root_length = strlen(root);
+    snprintf(walker->path, PATH_SIZE, (root_length > 0 && root[root_length - 1] == '/') ? "%s" : "%s/", root);
+    return push_frame(walker, root_fd);
+}
+
+/*!
+ * @brief sorted_walker_next gives the next entry of the tree
+ * @param walker is the walker
+ * @return the next entry in the order of sort_files_list, NULL at the end of the tree
+ */
+files_list_entry_t *sorted_walker_next(sorted_walker_t *walker) {
+    while (walker->depth > 0) {
+        sorted_frame_t *frame = &walker->frames[walker->depth - 1];
+        if (frame->pending_count > 0
+            && (frame->next == frame->count
+                || compare_subtree(frame->children[frame->pending[frame->pending_count - 1]]->name, frame->children[frame->next]->name) < 0)) {
+            // Walk the subtree of a directory, the siblings ordered before it are given
+            // The path of the walker becomes the path of the subtree (push_frame may move the frames)
+            files_list_entry_t *directory = frame->children[frame->pending[--frame->pending_count]];
+            size_t path_length = frame->path_length;
+            int dir_fd = openat(frame->fd, directory->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (dir_fd == -1 || snprintf(walker->path + path_length, PATH_SIZE - path_length, "%s/", directory->name) >= (int) (PATH_SIZE - path_length)) {
+                walker->path[path_length] = '\0';
+                fprintf(stderr, "Error opening directory %s%s: %s\n", walker->path, directory->name, strerror(dir_fd == -1 ? errno : ENAMETOOLONG));
+                if (dir_fd != -1) {
+                    close(dir_fd);
+                }
+                walker->failed = true;
+            } else if (push_frame(walker, dir_fd) == -1) {
+                walker->path[path_length] = '\0';
+                walker->failed = true;
+            }
+            continue;
+        }
+        if (frame->next == frame->count) {
+            close(frame->fd);
+            free(frame->children);
+            free(frame->pending);
+            --walker->depth;
+            if (walker->depth > 0) {
+                walker->path[walker->frames[walker->depth - 1].path_length] = '\0';
+            }
+            continue;
+        }
+        files_list_entry_t *entry = frame->children[frame->next];
+        if (entry->entry_type == DOSSIER) {
+            frame->pending[frame->pending_count++] = frame->next;
+        }
+        ++frame->next;
+        return entry;
+    }
+    return NULL;
+}
+
+/*!
+ * @brief sorted_walker_close frees a walker, finished or not
+ * @param walker is the walker
+ * @return 0 if the whole tree was walked, -1 if a directory couldn't be read
+ */
+int sorted_walker_close(sorted_walker_t *walker) {
+    while (walker->depth > 0) {
+        sorted_frame_t *frame = &walker->frames[--walker->depth];
+        close(frame->fd);
+        free(frame->children);
+        free(frame->pending);
+    }
+    free(walker->frames);
+    free(walker->buffer);
+    walker->frames = NULL;
+    walker->buffer = NULL;
+    return walker->failed ? -1 : 0;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include "files-list.h"
+#include "defines.h"
+#include "thread-pool.h"
+
+// Size of the buffer given to getdents64, a directory of a few thousand entries is read in one call
+#define WALKER_BUFFER_SIZE (256 * 1024)
+
+int walk_tree(files_list_t *list, const char *root, bool with_stats);
+
+// Receives the entries of walk_tree_visit: the entry is only valid during the call, -1 stops the walk
+typedef int (*walk_visitor_t)(files_list_entry_t *entry, void *data);
+
+int walk_tree_visit(const char *root, bool with_stats, walk_visitor_t visit, void *data);
+int read_sorted_children(int dir_fd, const char *dir_path, files_list_t *list, bool with_stats, char *buffer,
+                         files_list_entry_t ***children, size_t *count);
+
+typedef struct _dir_fragment dir_fragment_t;
+typedef struct _walk_worker walk_worker_t;
+
+// Walk of a tree on a thread pool, each directory being a task (@see parallel_walk_start)
+typedef struct {
+    thread_pool_t *pool;
+    bool with_stats;
+    walk_worker_t *workers; // One per worker of the pool, plus one for the tasks run outside of the pool
+    int workers_count;
+    dir_fragment_t *root;
+    bool failed;
+} parallel_walk_t;
+
+int parallel_walk_start(parallel_walk_t *walk, const char *root, bool with_stats, thread_pool_t *pool);
+int parallel_walk_finish(parallel_walk_t *walk, files_list_t *list);
+int walk_tree_parallel(files_list_t *list, const char *root, bool with_stats, thread_pool_t *pool);
+
+typedef struct _sorted_frame sorted_frame_t;
+
+// Walk of a tree giving its entries one at a time, in sorted order (@see sorted_walker_next)
+typedef struct {
+    files_list_t *list;
+    bool with_stats;
+    char *buffer;
+    char path[PATH_SIZE]; // Path of the directory being read, with its trailing '/'
+    sorted_frame_t *frames; // Stack of the directories being walked
+    size_t depth;
+    size_t capacity;
+    bool failed;
+} sorted_walker_t;
+
+int sorted_walker_open(sorted_walker_t *walker, files_list_t *list, const char *root, bool with_stats);
+files_list_entry_t *sorted_walker_next(sorted_walker_t *walker);
+int sorted_walker_close(sorted_walker_t *walker);
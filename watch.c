@@ -0,0 +1,329 @@
+#include "watch.h"
+#include "defines.h"
+#include "walker.h"
+#include "utility.h"
+#include "file-properties.h"
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+/*
+ * The watcher follows the changes of the source tree from the start of its first synchronization (the events
+ * queued meanwhile are the first burst): each directory has an inotify watch, and the events of a burst are
+ * gathered into a list of touched paths, so that a file written many times is compared once. At the end of
+ * the burst, only the touched paths are stat'ed, in the source and in the destination, and given to
+ * make_differences_list as two small lists.
+ * A new directory (created or moved in) is walked again entirely, and watched: its content may have been
+ * written before its watch was added. When the kernel queue overflows, events are lost and the only safe
+ * answer is to compare the whole tree again.
+ * Deleted entries are ignored, like by the full synchronization which never deletes from the destination.
+ */
+
+#define WATCH_MASK (IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+static volatile sig_atomic_t watch_stopped = 0;
+
+/*!
+ * @brief stop_watching ends the watch loop (SIGINT and SIGTERM handler)
+ * @param signal_number is the signal
+ */
+static void stop_watching(int signal_number) {
+    (void) signal_number;
+    watch_stopped = 1;
+}
+
+/*!
+ * @brief add_watch watches a directory, or updates its path if it is already watched (e.g. moved)
+ * @param watcher is the watcher
+ * @param path is the path of the directory, with its trailing '/'
+ * @return 0 in case of success, -1 else
+ */
+static int add_watch(watcher_t *watcher, const char *path) {
+    int wd = inotify_add_watch(watcher->fd, path, WATCH_MASK);
+    if (wd == -1) {
+        if (errno == ENOSPC && !watcher->out_of_watches) {
+            fprintf(stderr, "Out of inotify watches, raise fs.inotify.max_user_watches to watch %s\n", path);
+            watcher->out_of_watches = true;
+        } else if (errno != ENOSPC && errno != ENOENT) {
+            fprintf(stderr, "Unable to watch %s: %s\n", path, strerror(errno));
+        }
+        return -1;
+    }
+    if ((size_t) wd >= watcher->paths_capacity) {
+        size_t new_capacity = watcher->paths_capacity ? 2 * watcher->paths_capacity : 1024;
+        while (new_capacity <= (size_t) wd) {
+            new_capacity *= 2;
+        }
+        char **new_paths = realloc(watcher->paths, new_capacity * sizeof(char *));
+        if (!new_paths) {
+            inotify_rm_watch(watcher->fd, wd);
+            return -1;
+        }
+        memset(new_paths + watcher->paths_capacity, 0, (new_capacity - watcher->paths_capacity) * sizeof(char *));
+        watcher->paths = new_paths;
+        watcher->paths_capacity = new_capacity;
+    }
+    free(watcher->paths[wd]);
+    watcher->paths[wd] = strdup(path);
+    return watcher->paths[wd] ? 0 : -1;
+}
+
+/*!
+ * @brief watch_visitor watches the directories of a walk (@see walk_visitor_t)
+ * @param entry is the entry
+ * @param data is the watcher
+ * @return 0, a directory that can't be watched doesn't stop the walk
+ */
+static int watch_visitor(files_list_entry_t *entry, void *data) {
+    if (entry->entry_type == DOSSIER) {
+        char path[PATH_SIZE];
+        snprintf(path, PATH_SIZE, "%s%s/", entry->dir_path, entry->name);
+        add_watch((watcher_t *) data, path);
+    }
+    return 0;
+}
+
+/*!
+ * @brief watch_tree watches a directory and all its subdirectories
+ * @param watcher is the watcher
+ * @param path is the path of the directory, with its trailing '/'
+ * @return 0 in case of success, -1 if the directory can't be watched
+ */
+static int watch_tree(watcher_t *watcher, const char *path) {
+    if (add_watch(watcher, path) == -1) {
+        return -1;
+    }
+    walk_tree_visit(path, false, watch_visitor, watcher);
+    return 0;
+}
+
+/*!
+ * @brief watcher_open watches a source tree, and stops on SIGINT and SIGTERM
+ * @param watcher is the watcher to initialize
+ * @param source is the source directory
+ * @return 0 in case of success, -1 else
+ */
+int watcher_open(watcher_t *watcher, char *source) {
+    memset(watcher, 0, sizeof(watcher_t));
+    init_files_list(&watcher->touched);
+    init_files_list(&watcher->new_directories);
+    watch_stopped = 0;
+    watcher->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watcher->fd == -1 || !(watcher->buffer = malloc(WATCH_BUFFER_SIZE))) {
+        perror("Unable to watch the source");
+        watcher_close(watcher);
+        return -1;
+    }
+    concat_path(watcher->root, source, "");
+    if (watch_tree(watcher, watcher->root) == -1) {
+        watcher_close(watcher);
+        return -1;
+    }
+
+    // No SA_RESTART: poll must return at once
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_watching;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    return 0;
+}
+
+/*!
+ * @brief read_events gathers the touched paths of the queued events
+ * @param watcher is the watcher
+ * @return 0 in case of success, -1 if the events can't be read
+ */
+static int read_events(watcher_t *watcher) {
+    ssize_t bytes;
+    while ((bytes = read(watcher->fd, watcher->buffer, WATCH_BUFFER_SIZE)) > 0) {
+        for (ssize_t offset = 0; offset < bytes;) {
+            struct inotify_event *event = (struct inotify_event *) (watcher->buffer + offset);
+            offset += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                watcher->overflowed = true;
+                continue;
+            }
+            if (event->wd < 0 || (size_t) event->wd >= watcher->paths_capacity || watcher->paths[event->wd] == NULL) {
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                free(watcher->paths[event->wd]);
+                watcher->paths[event->wd] = NULL;
+                continue;
+            }
+            if (event->len == 0) {
+                continue; // Event on the watched directory itself
+            }
+
+            char path[PATH_SIZE];
+            int length = snprintf(path, PATH_SIZE, "%s%s", watcher->paths[event->wd], event->name);
+            if (length >= PATH_SIZE - 1) {
+                continue;
+            }
+            bool new_directory = (event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO));
+            if ((event->mask & IN_ISDIR) && !new_directory) {
+                continue; // Directories never differ (@see mismatch)
+            }
+            // Paths touched again in the burst are only kept once
+            if (!new_directory) {
+                add_file_entry(&watcher->touched, path);
+            } else if (add_file_entry(&watcher->new_directories, path) != NULL) {
+                path[length] = '/';
+                path[length + 1] = '\0';
+                watch_tree(watcher, path);
+            }
+        }
+    }
+    if (bytes == -1 && errno != EAGAIN && errno != EINTR) {
+        perror("Unable to read the source events");
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+ * @brief elapsed_ms gives the milliseconds since a time
+ * @param start is the time
+ * @return the number of milliseconds
+ */
+static long elapsed_ms(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/*!
+ * @brief add_touched_entry adds a touched path to a list with its stats, if it still exists
+ * @param list is the list
+ * @param path is the path
+ * @param sb receives the stats
+ * @return the entry, NULL if the path is not a regular file or a directory anymore, or is already listed
+ */
+static files_list_entry_t *add_touched_entry(files_list_t *list, char *path, struct stat *sb) {
+    if (lstat(path, sb) == -1 || (!S_ISREG(sb->st_mode) && !S_ISDIR(sb->st_mode))) {
+        return NULL;
+    }
+    files_list_entry_t *entry = add_file_entry(list, path);
+    if (entry != NULL) {
+        set_entry_stats(entry, sb);
+    }
+    return entry;
+}
+
+/*!
+ * @brief list_touched_entries lists the touched entries in the source and destination lists
+ * The new directories are walked first: their entries must be listed by the walker, which only descends into
+ * the directories it adds itself.
+ * @param watcher is the watcher
+ * @param the_config is a pointer to the configuration
+ * @param src_list is the list receiving the source entries
+ * @param dst_list is the list receiving the destination entries
+ */
+static void list_touched_entries(watcher_t *watcher, configuration_t *the_config, files_list_t *src_list, files_list_t *dst_list) {
+    size_t start_of_src = get_root_length(the_config->source);
+    for (int pass = 0; pass < 2; ++pass) {
+        files_list_t *paths = pass == 0 ? &watcher->new_directories : &watcher->touched;
+        for (files_list_entry_t *cursor = paths->head; cursor != NULL; cursor = cursor->next) {
+            char source_path[PATH_SIZE], dest_path[PATH_SIZE];
+            struct stat sb;
+            get_entry_path(cursor, source_path);
+            if (!concat_path(dest_path, the_config->destination, source_path + start_of_src)) {
+                continue;
+            }
+            files_list_entry_t *src_entry = add_touched_entry(src_list, source_path, &sb);
+            files_list_entry_t *dst_entry = add_touched_entry(dst_list, dest_path, &sb);
+            if (pass == 0 && src_entry != NULL && src_entry->entry_type == DOSSIER) {
+                walk_tree(src_list, source_path, true);
+                if (dst_entry != NULL && dst_entry->entry_type == DOSSIER) {
+                    walk_tree(dst_list, dest_path, true);
+                }
+            }
+        }
+    }
+}
+
+/*!
+ * @brief watcher_wait waits for the next burst of changes of the source tree
+ * @param watcher is the watcher
+ * @param the_config is a pointer to the configuration
+ * @param src_list is the empty list receiving the touched source entries (and the content of new directories)
+ * @param dst_list is the empty list receiving their destination entries, when they exist
+ * @return WATCH_CHANGES when the lists are filled, WATCH_OVERFLOW when the whole tree must be compared (the
+ * new directories are watched already), WATCH_STOPPED at the end of the watch
+ */
+watch_result_t watcher_wait(watcher_t *watcher, configuration_t *the_config, files_list_t *src_list, files_list_t *dst_list) {
+    struct pollfd poll_fd = {.fd = watcher->fd, .events = POLLIN};
+    struct timespec burst_start;
+    int timeout = -1; // No burst yet
+    while (!watch_stopped) {
+        int ready = poll(&poll_fd, 1, timeout);
+        if (ready == -1 && errno != EINTR) {
+            perror("Unable to wait for the source events");
+            return WATCH_STOPPED;
+        }
+        if (ready == 0) {
+            break; // End of the burst
+        }
+        if (ready > 0) {
+            if (timeout == -1) {
+                clock_gettime(CLOCK_MONOTONIC, &burst_start);
+            }
+            if (read_events(watcher) == -1) {
+                return WATCH_STOPPED;
+            }
+            long remaining = WATCH_MAX_DELAY_MS - elapsed_ms(&burst_start);
+            if (remaining <= 0) {
+                break;
+            }
+            timeout = remaining < WATCH_QUIET_MS ? (int) remaining : WATCH_QUIET_MS;
+        }
+    }
+    if (watch_stopped) {
+        return WATCH_STOPPED;
+    }
+
+    watch_result_t result = WATCH_CHANGES;
+    if (watcher->overflowed) {
+        // Directories created while the events were lost must be watched too
+        watch_tree(watcher, watcher->root);
+        watcher->overflowed = false;
+        result = WATCH_OVERFLOW;
+    } else {
+        list_touched_entries(watcher, the_config, src_list, dst_list);
+    }
+    clear_files_list(&watcher->touched);
+    clear_files_list(&watcher->new_directories);
+    return result;
+}
+
+/*!
+ * @brief watcher_close stops watching and restores the default handling of SIGINT and SIGTERM
+ * @param watcher is the watcher
+ */
+void watcher_close(watcher_t *watcher) {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    if (watcher->fd != -1) {
+        close(watcher->fd);
+    }
+    for (size_t i = 0; i < watcher->paths_capacity; ++i) {
+        free(watcher->paths[i]);
+    }
+    free(watcher->paths);
+    free(watcher->buffer);
+    clear_files_list(&watcher->touched);
+    clear_files_list(&watcher->new_directories);
+    watcher->fd = -1;
+    watcher->paths = NULL;
+    watcher->paths_capacity = 0;
+    watcher->buffer = NULL;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "defines.h"
+#include "files-list.h"
+#include "configuration.h"
+
+// A burst of events ends after this quiet time...
+#define WATCH_QUIET_MS 50
+// ... or this long after its first event, so that changes are applied in well under a second
+#define WATCH_MAX_DELAY_MS 250
+// Size of the buffer of inotify events
+#define WATCH_BUFFER_SIZE (64 * 1024)
+
+typedef enum {
+    WATCH_STOPPED, // Interrupted by SIGINT or SIGTERM, or the events can't be read
+    WATCH_CHANGES, // The lists hold the touched entries
+    WATCH_OVERFLOW, // Events were lost, the whole tree must be compared again
+} watch_result_t;
+
+// Watch of the directories of the source tree with inotify
+typedef struct {
+    int fd;
+    char root[PATH_SIZE]; // Source directory, with its trailing '/'
+    char **paths; // Path of the directory of each watch descriptor, with its trailing '/'
+    size_t paths_capacity;
+    char *buffer;
+    files_list_t touched; // Paths touched by the current burst
+    files_list_t new_directories; // Directories of the current burst to be walked again
+    bool overflowed;
+    bool out_of_watches;
+} watcher_t;
+
+int watcher_open(watcher_t *watcher, char *source);
+watch_result_t watcher_wait(watcher_t *watcher, configuration_t *the_config, files_list_t *src_list, files_list_t *dst_list);
+void watcher_close(watcher_t *watcher);